@@ -5,9 +5,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <linux/input.h>
 
 #include <wayland-server.h>
@@ -24,6 +32,8 @@
 
 #define DEBUG       0
 #define MAX_FB      2
+#define MAX_DIRTY   16
+#define MAX_EVENTS  8
 
 #if defined(QX1000)
 #define LCD_W       1080
@@ -67,6 +77,30 @@ typedef struct {
     int pressure;
 } touch_data;
 
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} dirty_rect;
+
+typedef struct {
+    int cnt;
+    dirty_rect rt[MAX_DIRTY];
+} dirty_list;
+
+typedef enum {
+    SRC_RFB = 0,
+    SRC_DISPLAY,
+    SRC_KEY,
+    SRC_TP,
+    SRC_PWR,
+    SRC_REPEAT,
+    SRC_MOUSE,
+    SRC_FRAME,
+    SRC_MAX
+} event_src_t;
+
 typedef enum {
     FILTER_PIXEL = 0,
     FILTER_BLUR
@@ -107,14 +141,31 @@ typedef struct {
 
     struct {
         int running;
-        pthread_t id[2];
+        pthread_t id[1];
     } thread;
 
+    struct {
+        int back;
+        int front;
+        sem_t sem;
+        atomic_int pending;
+        atomic_int deferred;
+        dirty_list dirty;
+    } frame;
+
+    dirty_list dirty;
+
+    struct {
+        uint32_t frames;
+        uint64_t total;
+        uint32_t last;
+    } upload;
+
     int init;
-    int flip;
     int ready;
 
     uint8_t *data;
+    uint8_t *stage;
     uint32_t *pixels[MAX_FB];
 } wayland;
 
@@ -129,6 +180,28 @@ typedef struct {
         int right;
         int press;
     } mouse;
+
+    int efd;
+    int fd[SRC_MAX];
+
+    struct {
+        int id;
+        int valid;
+        float max_x;
+        float max_y;
+    } tp;
+
+    struct {
+        int val;
+        int code;
+    } key;
+
+    struct {
+        uint64_t time;
+        uint32_t cnt;
+        uint64_t total;
+        uint64_t max;
+    } latency;
 } myevent;
 
 static int running = 0;
@@ -205,15 +278,12 @@ static const char *frag_shader_code =
     "    gl_FragColor = vec4(tex, 1.0);                                 \n"
     "}                                                                  \n";
 
-static uint32_t get_tick(void)
+static uint64_t get_usec(void)
 {
     struct timespec ts = { 0 };
-    unsigned tick = 0;
 
-    clock_gettime(CLOCK_REALTIME, &ts);
-    tick = ts.tv_nsec / 1000000;
-    tick += ts.tv_sec * 1000;
-    return tick;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
 }
 
 static void cb_handle(void* dat, struct wl_registry* reg, uint32_t id, const char* intf, uint32_t ver)
@@ -235,23 +305,6 @@ static struct wl_registry_listener cb_global = {
     .global_remove = cb_remove
 };
 
-static void* display_handler(void* pParam)
-{
-    debug("%s++\n", __func__);
-
-    while (wl.thread.running) {
-        if (wl.init && wl.ready) {
-            wl_display_dispatch(wl.display);
-        }
-        else {
-            usleep(1000);
-        }
-    }
-
-    debug("%s--\n", __func__);
-    return NULL;
-}
-
 static int send_tp_event_by_offset(int addx, int addy)
 {
     tp[0].x += addx;
@@ -711,192 +764,297 @@ static rfbKeySym key2rfbKeySym(int key, int val)
     return 0;
 }
 
-static void* input_handler(void* pParam)
+static void mark_input_latency(void)
 {
-    uint32_t stime = 0;
-
-    int tp_id = 0;
-    int tp_valid = 0;
-    int key_val = 0;
-    int key_code = 0;
-    int key_stage = 0;
-    int fd[3] = { -1, -1, -1 };
-    struct input_event ev = { 0 };
-    const char *tp_path = TP_PATH;
-    const char *key_path = KEY_PATH;
-    const char *pwr_path = PWR_PATH;
+    uint64_t diff = 0;
 
-#if defined(XT894) || defined(XT897)
-    float tp_max_x = 1000.0;
-    float tp_max_y = 1000.0;
-#endif
-#if defined(QX1000)
-    float tp_max_x = 2160.0;
-    float tp_max_y = 1080.0;
-#endif
-
-    debug("%s++\n", __func__);
+    if (evt.latency.time == 0) {
+        return;
+    }
 
-    fd[0] = open(key_path, O_RDONLY);
-    if (fd[0] < 0) {
-        debug("%s, failed to open %s\n", __func__, key_path);
-        return NULL;
+    diff = get_usec() - evt.latency.time;
+    evt.latency.time = 0;
+    evt.latency.cnt += 1;
+    evt.latency.total += diff;
+    if (diff > evt.latency.max) {
+        evt.latency.max = diff;
     }
+    debug("%s, input-to-send latency %llu us\n", __func__, (unsigned long long)diff);
+}
+
+static void set_timer(int fd, int delay_ms, int interval_ms)
+{
+    struct itimerspec its = { 0 };
+
+    its.it_value.tv_sec = delay_ms / 1000;
+    its.it_value.tv_nsec = (delay_ms % 1000) * 1000000;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+static int read_timer(int fd)
+{
+    uint64_t expired = 0;
 
-    fd[1] = open(tp_path, O_RDONLY);
-    if (fd[1] < 0) {
-        debug("%s, failed to open %s\n", __func__, tp_path);
-        return NULL;
+    if (read(fd, &expired, sizeof(expired)) != sizeof(expired)) {
+        return 0;
     }
+    return (int)expired;
+}
+
+static void update_mouse_timer(void)
+{
+    const int MOUSE_DELAY = 6;
+    static int armed = 0;
+    int active = evt.mouse.up || evt.mouse.down || evt.mouse.left || evt.mouse.right;
 
-    fd[2] = open(pwr_path, O_RDONLY);
-    if (fd[2] < 0) {
-        debug("%s, failed to open %s\n", __func__, pwr_path);
-        return NULL;
+    if (active != armed) {
+        armed = active;
+        set_timer(evt.fd[SRC_MOUSE], armed ? MOUSE_DELAY : 0, armed ? MOUSE_DELAY : 0);
     }
+}
 
-    fcntl(fd[0], F_SETFL, O_NONBLOCK);
-    fcntl(fd[1], F_SETFL, O_NONBLOCK);
-    fcntl(fd[2], F_SETFL, O_NONBLOCK);
+static void handle_key_event(void)
+{
+    const int KEY_REPEAT_LONG = 500;
+    const int KEY_REPEAT_SHORT = 50;
+    struct input_event ev = { 0 };
 
-    stime = get_tick();
-    while (wl.thread.running) {
-        if (read(fd[0], &ev, sizeof(struct input_event)) > 0) {
-            debug("Key, code:%d, value:%d\n", ev.code, ev.value);
+    // modifier releases and the key itself go out in one write
+    rfbClientBeginInputBatch(cl);
+    while (read(evt.fd[SRC_KEY], &ev, sizeof(struct input_event)) > 0) {
+        debug("Key, code:%d, value:%d\n", ev.code, ev.value);
 
-            if (ev.type == EV_KEY) {
-                key_code = key2rfbKeySym(ev.code, ev.value);
-                if (key_code > 0) {
-                    key_stage = 0;
-                    key_val = !!ev.value;
-                    stime = get_tick();
+        if (ev.type == EV_KEY) {
+            if (evt.latency.time == 0) {
+                evt.latency.time = ((uint64_t)ev.time.tv_sec * 1000000) + ev.time.tv_usec;
+            }
+            evt.key.code = key2rfbKeySym(ev.code, ev.value);
+            if (evt.key.code > 0) {
+                evt.key.val = !!ev.value;
 
-                    SendKeyEvent(cl, key_code, key_val);
-                }
+                SendKeyEvent(cl, evt.key.code, evt.key.val);
+
+                set_timer(
+                    evt.fd[SRC_REPEAT],
+                    evt.key.val ? KEY_REPEAT_LONG : 0,
+                    evt.key.val ? KEY_REPEAT_SHORT : 0
+                );
+            }
+            else {
+                set_timer(evt.fd[SRC_REPEAT], 0, 0);
             }
         }
+    }
+    rfbClientFlushInputBatch(cl);
+    mark_input_latency();
+    update_mouse_timer();
+}
+
+static void handle_tp_event(void)
+{
+    struct input_event ev = { 0 };
+
+    // motion reported within one wakeup is coalesced into a single event
+    rfbClientBeginInputBatch(cl);
+    while (read(evt.fd[SRC_TP], &ev, sizeof(struct input_event)) > 0) {
+        debug("Touch, type:%d, code:%d, value:%d\n", ev.type, ev.code, ev.value);
 
-        if (read(fd[1], &ev, sizeof(struct input_event)) > 0) {
-            debug("Touch, type:%d, code:%d, value:%d\n", ev.type, ev.code, ev.value);
+        if (ev.type == EV_ABS) {
+            if (evt.latency.time == 0) {
+                evt.latency.time = ((uint64_t)ev.time.tv_sec * 1000000) + ev.time.tv_usec;
+            }
 
-            if (ev.type == EV_ABS) {
-                if (ev.code == ABS_MT_TRACKING_ID) {
+            if (ev.code == ABS_MT_TRACKING_ID) {
 #if defined(XT894) || defined(XT897)
-                    tp_valid = 1;
-                    tp_id = ev.value;
+                evt.tp.valid = 1;
+                evt.tp.id = ev.value;
 #endif
 
 #if defined(QX1000)
-                    if (ev.value >= 0) {
-                        tp_valid = 1;
-                        tp_id = 0;
-                    }
-                    else {
-                        tp_valid = 0;
-                    }
-#endif
-                }
-                else if (ev.code == ABS_MT_POSITION_X) {
-                    tp_valid = 1;
-                    tp[tp_id].y = SCREEN_H - (((float)ev.value / tp_max_y) * SCREEN_H);
-                }
-                else if (ev.code == ABS_MT_POSITION_Y) {
-                    tp_valid = 1;
-                    tp[tp_id].x = ((float)ev.value / tp_max_x) * SCREEN_W;
+                if (ev.value >= 0) {
+                    evt.tp.valid = 1;
+                    evt.tp.id = 0;
                 }
-                else if (ev.code == ABS_MT_PRESSURE) {
-                    tp_valid = 1;
-                    tp[tp_id].pressure = ev.value;
+                else {
+                    evt.tp.valid = 0;
                 }
+#endif
+            }
+            else if (ev.code == ABS_MT_POSITION_X) {
+                evt.tp.valid = 1;
+                tp[evt.tp.id].y = SCREEN_H - (((float)ev.value / evt.tp.max_y) * SCREEN_H);
+            }
+            else if (ev.code == ABS_MT_POSITION_Y) {
+                evt.tp.valid = 1;
+                tp[evt.tp.id].x = ((float)ev.value / evt.tp.max_x) * SCREEN_W;
             }
-            else if (ev.type == EV_SYN) {
+            else if (ev.code == ABS_MT_PRESSURE) {
+                evt.tp.valid = 1;
+                tp[evt.tp.id].pressure = ev.value;
+            }
+        }
+        else if (ev.type == EV_SYN) {
 #if defined(XT894) || defined(XT897)
-                if ((ev.code == ABS_Z) && (ev.value == 0)) {
+            if ((ev.code == ABS_Z) && (ev.value == 0)) {
 #endif
 #if defined(QX1000)
-                if ((ev.code == 0) && (ev.value == 0)) {
+            if ((ev.code == 0) && (ev.value == 0)) {
 #endif
-                    if (tp_valid) {
-                        tp_valid = 0;
-                        SendPointerEvent(cl, tp[0].x, tp[0].y, !evt.alt ? rfbButton1Mask : 0);
-
-                        debug(
-                            "Touch ID=%d, X=%d, Y=%d, Pressure=%d\n",
-                            tp_id,
-                            tp[tp_id].x,
-                            tp[tp_id].y,
-                            tp[tp_id].pressure
-                        );
-                    }
-                    else {
-                        evt.mouse.press = 0;
-                        SendPointerEvent(cl, tp[0].x, tp[0].y, 0);
-                    }
+                if (evt.tp.valid) {
+                    evt.tp.valid = 0;
+                    SendPointerEvent(cl, tp[0].x, tp[0].y, !evt.alt ? rfbButton1Mask : 0);
+
+                    debug(
+                        "Touch ID=%d, X=%d, Y=%d, Pressure=%d\n",
+                        evt.tp.id,
+                        tp[evt.tp.id].x,
+                        tp[evt.tp.id].y,
+                        tp[evt.tp.id].pressure
+                    );
+                }
+                else {
+                    evt.mouse.press = 0;
+                    SendPointerEvent(cl, tp[0].x, tp[0].y, 0);
                 }
             }
         }
+    }
+    rfbClientFlushInputBatch(cl);
+    mark_input_latency();
+}
 
-        if (read(fd[2], &ev, sizeof(struct input_event)) > 0) {
-            debug("Pwr, code:%d, value:%d\n", ev.code, ev.value);
+static void handle_pwr_event(void)
+{
+    struct input_event ev = { 0 };
 
-            if (ev.type == EV_KEY) {
-                if (ev.code == KEY_POWER) {
-                    debug("shutdown by power key\n");
-                    running = 0;
-                    exit(-1);
-                }
+    while (read(evt.fd[SRC_PWR], &ev, sizeof(struct input_event)) > 0) {
+        debug("Pwr, code:%d, value:%d\n", ev.code, ev.value);
+
+        if (ev.type == EV_KEY) {
+            if (ev.code == KEY_POWER) {
+                debug("shutdown by power key\n");
+                running = 0;
+                exit(-1);
             }
         }
+    }
+}
+
+static void handle_repeat_timer(void)
+{
+    if (read_timer(evt.fd[SRC_REPEAT]) && (evt.key.code > 0) && (evt.key.val > 0)) {
+        SendKeyEvent(cl, evt.key.code, evt.key.val);
+    }
+}
 
+static void handle_mouse_timer(void)
+{
+    int addx = 0;
+    int addy = 0;
+    int expired = read_timer(evt.fd[SRC_MOUSE]);
 
-        if ((key_code > 0) && (key_val > 0)) {
-            const int KEY_REPEAT_LONG = 500;
-            const int KEY_REPEAT_SHORT = 50;
+    if (expired <= 0) {
+        return;
+    }
 
-            switch (key_stage) {
-            case 0:
-                if ((get_tick() - stime) > KEY_REPEAT_LONG) {
-                    SendKeyEvent(cl, key_code, key_val);
+    // catch up on missed ticks with a single pointer event
+    if (evt.mouse.up) {
+        addy -= expired;
+    }
+    if (evt.mouse.down) {
+        addy += expired;
+    }
+    if (evt.mouse.left) {
+        addx -= expired;
+    }
+    if (evt.mouse.right) {
+        addx += expired;
+    }
+    send_tp_event_by_offset(addx, addy);
+}
 
-                    key_stage = 1;
-                    stime = get_tick();
-                }
-                break;
-            case 1:
-                if ((get_tick() - stime) > KEY_REPEAT_SHORT) {
-                    SendKeyEvent(cl, key_code, key_val);
+static int add_event_src(event_src_t src, int fd)
+{
+    struct epoll_event ee = { 0 };
 
-                    stime = get_tick();
-                }
-                break;
-            }
-        }
+    evt.fd[src] = fd;
+    if (fd < 0) {
+        return -1;
+    }
 
-        const int MOUSE_DELAY = 6000;
-        if (evt.mouse.up) {
-            send_tp_event_by_offset(0, -1);
-            usleep(MOUSE_DELAY);
-        }
-        if (evt.mouse.down) {
-            send_tp_event_by_offset(0, 1);
-            usleep(MOUSE_DELAY);
-        }
-        if (evt.mouse.left) {
-            send_tp_event_by_offset(-1, 0);
-            usleep(MOUSE_DELAY);
-        }
-        if (evt.mouse.right) {
-            send_tp_event_by_offset(1, 0);
-            usleep(MOUSE_DELAY);
-        }
+    ee.events = EPOLLIN;
+    ee.data.u32 = src;
+    return epoll_ctl(evt.efd, EPOLL_CTL_ADD, fd, &ee);
+}
 
-        usleep(1000);
+static int open_input(const char *path)
+{
+    int fd = -1;
+    int clk = CLOCK_MONOTONIC;
+
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        debug("%s, failed to open %s\n", __func__, path);
+        return -1;
     }
-    close(fd[0]);
-    close(fd[1]);
 
-    debug("%s--\n", __func__);
-    return NULL;
+    // timestamp evdev events with the same clock used for the latency stats
+    ioctl(fd, EVIOCSCLOCKID, &clk);
+    return fd;
+}
+
+static int input_create(void)
+{
+    int cc = 0;
+
+#if defined(XT894) || defined(XT897)
+    evt.tp.max_x = 1000.0;
+    evt.tp.max_y = 1000.0;
+#endif
+#if defined(QX1000)
+    evt.tp.max_x = 2160.0;
+    evt.tp.max_y = 1080.0;
+#endif
+
+    for (cc = 0; cc < SRC_MAX; cc++) {
+        evt.fd[cc] = -1;
+    }
+
+    evt.efd = epoll_create1(EPOLL_CLOEXEC);
+    if (evt.efd < 0) {
+        debug("%s, failed to create epoll instance\n", __func__);
+        return -1;
+    }
+
+    add_event_src(SRC_RFB, cl->sock);
+    add_event_src(SRC_DISPLAY, wl_display_get_fd(wl.display));
+    add_event_src(SRC_KEY, open_input(KEY_PATH));
+    add_event_src(SRC_TP, open_input(TP_PATH));
+    add_event_src(SRC_PWR, open_input(PWR_PATH));
+    add_event_src(SRC_REPEAT, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    add_event_src(SRC_MOUSE, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    add_event_src(SRC_FRAME, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    return 0;
+}
+
+static void input_free(void)
+{
+    int cc = 0;
+
+    // the rfb socket and the wayland fd are owned by their libraries
+    for (cc = SRC_KEY; cc < SRC_MAX; cc++) {
+        if (evt.fd[cc] >= 0) {
+            close(evt.fd[cc]);
+            evt.fd[cc] = -1;
+        }
+    }
+
+    if (evt.efd >= 0) {
+        close(evt.efd);
+        evt.efd = -1;
+    }
 }
 
 static void cb_ping(void* dat, struct wl_shell_surface* shell_surf, uint32_t serial)
@@ -945,6 +1103,8 @@ void wl_free(void)
 
     free(wl.data);
     wl.data = NULL;
+    free(wl.stage);
+    wl.stage = NULL;
 }
 
 void wl_create(void)
@@ -975,6 +1135,7 @@ void wl_create(void)
 
     wl.data = malloc(LCD_W * LCD_H * sizeof(uint32_t) * 2);
     memset(wl.data, 0, LCD_W * LCD_H * sizeof(uint32_t) * 2);
+    wl.stage = malloc(SCREEN_W * SCREEN_H * sizeof(uint32_t));
 }
 
 void egl_create(void)
@@ -1057,6 +1218,19 @@ void egl_create(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+    // allocate the texture storage once, damaged rects are uploaded later
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA,
+        SCREEN_W,
+        SCREEN_H,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        NULL
+    );
+
     glViewport(0, 0, LCD_W, LCD_H);
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -1073,9 +1247,197 @@ void egl_create(void)
     debug("%s, coord=0x%x\n", __func__, wl.egl.coord);
 }
 
+static int rect_touch(const dirty_rect *a, const dirty_rect *b)
+{
+    return (a->x <= (b->x + b->w)) && (b->x <= (a->x + a->w)) &&
+        (a->y <= (b->y + b->h)) && (b->y <= (a->y + a->h));
+}
+
+static void rect_merge(dirty_rect *dst, const dirty_rect *src)
+{
+    int x1 = dst->x + dst->w;
+    int y1 = dst->y + dst->h;
+
+    if (src->x < dst->x) {
+        dst->x = src->x;
+    }
+    if (src->y < dst->y) {
+        dst->y = src->y;
+    }
+    if ((src->x + src->w) > x1) {
+        x1 = src->x + src->w;
+    }
+    if ((src->y + src->h) > y1) {
+        y1 = src->y + src->h;
+    }
+    dst->w = x1 - dst->x;
+    dst->h = y1 - dst->y;
+}
+
+static void add_dirty_rect(int x, int y, int w, int h)
+{
+    int cc = 0;
+    dirty_rect rt = { 0 };
+
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if ((x + w) > SCREEN_W) {
+        w = SCREEN_W - x;
+    }
+    if ((y + h) > SCREEN_H) {
+        h = SCREEN_H - y;
+    }
+    if ((w <= 0) || (h <= 0)) {
+        return;
+    }
+
+    rt.x = x;
+    rt.y = y;
+    rt.w = w;
+    rt.h = h;
+
+    // fold into an adjacent or overlapping rect so that the list stays small,
+    // and keep folding since the grown rect may now touch other entries
+    for (cc = 0; cc < wl.dirty.cnt; cc++) {
+        if (rect_touch(&wl.dirty.rt[cc], &rt)) {
+            rect_merge(&rt, &wl.dirty.rt[cc]);
+            wl.dirty.rt[cc] = wl.dirty.rt[--wl.dirty.cnt];
+            cc = -1;
+        }
+    }
+
+    if (wl.dirty.cnt >= MAX_DIRTY) {
+        for (cc = 0; cc < wl.dirty.cnt; cc++) {
+            rect_merge(&rt, &wl.dirty.rt[cc]);
+        }
+        wl.dirty.cnt = 0;
+    }
+    wl.dirty.rt[wl.dirty.cnt++] = rt;
+}
+
+static void upload_dirty_rects(const uint32_t *pixels, dirty_list *dl)
+{
+    int cc = 0;
+    int yy = 0;
+    uint32_t bytes = 0;
+
+    for (cc = 0; cc < dl->cnt; cc++) {
+        const dirty_rect *rt = &dl->rt[cc];
+        const uint32_t *src = pixels + (rt->y * SCREEN_W) + rt->x;
+
+        // GLES2 has no GL_UNPACK_ROW_LENGTH, so partial-width rects
+        // are packed into the staging buffer before the upload
+        if (rt->w != SCREEN_W) {
+            uint32_t *dst = (uint32_t *)wl.stage;
+
+            for (yy = 0; yy < rt->h; yy++) {
+                memcpy(dst, src, rt->w * sizeof(uint32_t));
+                dst += rt->w;
+                src += SCREEN_W;
+            }
+            src = (const uint32_t *)wl.stage;
+        }
+
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            rt->x,
+            rt->y,
+            rt->w,
+            rt->h,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            src
+        );
+        bytes += rt->w * rt->h * sizeof(uint32_t);
+    }
+
+    wl.upload.last = bytes;
+    wl.upload.total += bytes;
+    wl.upload.frames += 1;
+    debug("%s, uploaded %u bytes in %d rect(s)\n", __func__, bytes, dl->cnt);
+
+    dl->cnt = 0;
+}
+
+static void copy_dirty_rects(uint32_t *dst, const uint32_t *src, const dirty_list *dl)
+{
+    int cc = 0;
+    int yy = 0;
+
+    for (cc = 0; cc < dl->cnt; cc++) {
+        const dirty_rect *rt = &dl->rt[cc];
+        int offset = (rt->y * SCREEN_W) + rt->x;
+
+        for (yy = 0; yy < rt->h; yy++) {
+            memcpy(dst + offset, src + offset, rt->w * sizeof(uint32_t));
+            offset += SCREEN_W;
+        }
+    }
+}
+
 static void* draw_handler(void* pParam)
 {
     debug("%s++\n", __func__);
+
+    egl_create();
+    wl.ready = 1;
+
+    while (wl.thread.running) {
+        if (sem_wait(&wl.frame.sem) < 0) {
+            continue;
+        }
+
+        if (!atomic_load_explicit(&wl.frame.pending, memory_order_acquire)) {
+            continue;
+        }
+
+        glVertexAttribPointer(
+            wl.egl.pos,
+            3,
+            GL_FLOAT,
+            GL_FALSE,
+            5 * sizeof(GLfloat), fb_vertices
+        );
+
+        glVertexAttribPointer(
+            wl.egl.coord,
+            2,
+            GL_FLOAT,
+            GL_FALSE,
+            5 * sizeof(GLfloat),
+            &fb_vertices[3]
+        );
+
+        upload_dirty_rects(wl.pixels[wl.frame.front], &wl.frame.dirty);
+
+        // glTexSubImage2D() has copied the pixels, hand the front buffer back
+        // to the rfb thread before blocking on vsync in eglSwapBuffers()
+        atomic_store(&wl.frame.pending, 0);
+
+        // damage that arrived while this frame was pending is still sitting
+        // in wl.dirty, wake the rfb thread so it publishes it without waiting
+        // for the next update from the server
+        if (atomic_exchange(&wl.frame.deferred, 0) && (evt.fd[SRC_FRAME] >= 0)) {
+            uint64_t one = 1;
+            if (write(evt.fd[SRC_FRAME], &one, sizeof(one)) < 0) {
+                debug("%s, failed to signal the rfb thread\n", __func__);
+            }
+        }
+
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+        eglSwapBuffers(wl.egl.display, wl.egl.surface);
+    }
+
+    egl_free();
+
+    debug("%s--\n", __func__);
     return NULL;
 }
 
@@ -1084,7 +1446,7 @@ static rfbBool vnc_resize(rfbClient *client)
     debug("%s()\n", __func__);
     client->width = SCREEN_W;
     client->height = SCREEN_H;
-    client->frameBuffer = (uint8_t *)wl.pixels[0];
+    client->frameBuffer = (uint8_t *)wl.pixels[wl.frame.back];
     client->format.bitsPerPixel = 32;
     client->format.redShift = 16;
     client->format.greenShift = 8;
@@ -1094,12 +1456,43 @@ static rfbBool vnc_resize(rfbClient *client)
     client->format.blueMax = 255;
     SetFormatAndEncodings(client);
 
+    wl.dirty.cnt = 0;
+    add_dirty_rect(0, 0, SCREEN_W, SCREEN_H);
+
     return TRUE;
 }
 
 static void vnc_update(rfbClient *cl, int x, int y, int w, int h)
 {
-    wl.flip = 1;
+    add_dirty_rect(x, y, w, h);
+}
+
+static void vnc_finished(rfbClient *cl)
+{
+    if (wl.dirty.cnt == 0) {
+        return;
+    }
+
+    // the render thread still owns the front buffer, keep decoding into
+    // the back buffer and let it call us back through SRC_FRAME once done
+    // (sequentially consistent on both sides, so one of us always sees the other)
+    atomic_store(&wl.frame.deferred, 1);
+    if (atomic_load(&wl.frame.pending)) {
+        return;
+    }
+    atomic_store(&wl.frame.deferred, 0);
+
+    wl.frame.front = wl.frame.back;
+    wl.frame.back = (wl.frame.back + 1) % MAX_FB;
+    wl.frame.dirty = wl.dirty;
+    wl.dirty.cnt = 0;
+    cl->frameBuffer = (uint8_t *)wl.pixels[wl.frame.back];
+
+    atomic_store_explicit(&wl.frame.pending, 1, memory_order_release);
+    sem_post(&wl.frame.sem);
+
+    // bring the new back buffer up to date, both threads only read the front one
+    copy_dirty_rects(wl.pixels[wl.frame.back], wl.pixels[wl.frame.front], &wl.frame.dirty);
 }
 
 static void vnc_cleanup(rfbClient *cl)
@@ -1118,8 +1511,6 @@ char* vnc_password(rfbClient *client)
 
 int main(int argc, char *argv[])
 {
-    int r = 0;
-
     debug("%s\n", __func__);
 
     if (argc != 2) {
@@ -1128,26 +1519,25 @@ int main(int argc, char *argv[])
     }
 
     wl_create();
-    egl_create();
 
     filter = FILTER_PIXEL;
-    memset(wl.data, 0, wl.info.size * sizeof(uint32_t));
-    wl.pixels[0] = (uint32_t *)wl.data;
-    wl.pixels[1] = (uint32_t *)(wl.data + wl.info.size);
-
-    wl.flip = 0;
     wl.info.w = SCREEN_W;
     wl.info.h = SCREEN_H;
     wl.info.bpp = 32;
     wl.info.size = wl.info.w * wl.info.h * (wl.info.bpp / 8);
+    wl.pixels[0] = (uint32_t *)wl.data;
+    wl.pixels[1] = (uint32_t *)(wl.data + wl.info.size);
+
+    wl.frame.back = 0;
+    wl.frame.front = 1;
+    atomic_init(&wl.frame.pending, 0);
+    sem_init(&wl.frame.sem, 0, 0);
 
     wl.init = 1;
-    wl.ready = 1;
     wl.thread.running = 1;
-    pthread_create(&wl.thread.id[0], NULL, display_handler, NULL);
-    pthread_create(&wl.thread.id[1], NULL, input_handler, NULL);
+    pthread_create(&wl.thread.id[0], NULL, draw_handler, NULL);
 
-    while (wl.init == 0) {
+    while (wl.ready == 0) {
         usleep(100000);
     }
 
@@ -1155,6 +1545,7 @@ int main(int argc, char *argv[])
     cl->MallocFrameBuffer = vnc_resize;
     cl->canHandleNewFBSize = TRUE;
     cl->GotFrameBufferUpdate = vnc_update;
+    cl->FinishedFrameBufferUpdate = vnc_finished;
     cl->GetPassword = vnc_password;
     cl->listenPort = LISTEN_PORT_OFFSET;
     cl->listen6Port = LISTEN_PORT_OFFSET;
@@ -1163,64 +1554,108 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (input_create() < 0) {
+        vnc_cleanup(cl);
+        return -1;
+    }
+
     running = 1;
     debug("running...\n");
     while (running) {
-        r = WaitForMessage(cl, 1000);
-        if (r < 0) {
+        int cc = 0;
+        int cnt = 0;
+        int display_ready = 0;
+        struct epoll_event ee[MAX_EVENTS] = { 0 };
+
+        // flush our requests and announce the intention to read, so that
+        // the render thread's eglSwapBuffers() can share the display fd
+        while (wl_display_prepare_read(wl.display) != 0) {
+            wl_display_dispatch_pending(wl.display);
+        }
+        wl_display_flush(wl.display);
+
+        cnt = epoll_wait(evt.efd, ee, MAX_EVENTS, -1);
+        if (cnt < 0) {
+            wl_display_cancel_read(wl.display);
+            if (errno == EINTR) {
+                continue;
+            }
             break;
         }
 
-        if (r) {
-            if (!HandleRFBServerMessage(cl)) {
-                break;
+        for (cc = 0; cc < cnt; cc++) {
+            if (ee[cc].data.u32 == SRC_DISPLAY) {
+                display_ready = 1;
             }
         }
 
-        if (wl.ready && wl.flip) {
-            wl.flip = 0;
-            glVertexAttribPointer(
-                wl.egl.pos,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                5 * sizeof(GLfloat), fb_vertices
-            );
-
-            glVertexAttribPointer(
-                wl.egl.coord,
-                2,
-                GL_FLOAT,
-                GL_FALSE,
-                5 * sizeof(GLfloat),
-                &fb_vertices[3]
-            );
-
-            glTexImage2D(
-                GL_TEXTURE_2D,
-                0,
-                GL_RGBA,
-                SCREEN_W,
-                SCREEN_H,
-                0,
-                GL_RGBA,
-                GL_UNSIGNED_BYTE,
-                wl.pixels[0]
-            );
-
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
-            eglSwapBuffers(wl.egl.display, wl.egl.surface);
+        if (display_ready) {
+            wl_display_read_events(wl.display);
+        }
+        else {
+            wl_display_cancel_read(wl.display);
+        }
+        wl_display_dispatch_pending(wl.display);
+
+        for (cc = 0; (cc < cnt) && running; cc++) {
+            switch (ee[cc].data.u32) {
+            case SRC_RFB:
+                // messages already sitting in client->buf won't wake epoll again
+                do {
+                    if (!HandleRFBServerMessage(cl)) {
+                        running = 0;
+                    }
+                } while (running && (cl->buffered > 0));
+                break;
+            case SRC_KEY:
+                handle_key_event();
+                break;
+            case SRC_TP:
+                handle_tp_event();
+                break;
+            case SRC_PWR:
+                handle_pwr_event();
+                break;
+            case SRC_REPEAT:
+                handle_repeat_timer();
+                break;
+            case SRC_MOUSE:
+                handle_mouse_timer();
+                break;
+            case SRC_FRAME:
+                if (read_timer(evt.fd[SRC_FRAME])) {
+                    vnc_finished(cl);
+                }
+                break;
+            }
         }
     }
+    input_free();
     vnc_cleanup(cl);
 
     debug("exit...\n");
     wl.thread.running = 0;
+    sem_post(&wl.frame.sem);
     pthread_join(wl.thread.id[0], NULL);
-    pthread_join(wl.thread.id[1], NULL);
-    egl_free();
+    sem_destroy(&wl.frame.sem);
     wl_free();
 
+    if (wl.upload.frames) {
+        printf(
+            "uploaded %u frames, %llu bytes/frame on average\n",
+            wl.upload.frames,
+            (unsigned long long)(wl.upload.total / wl.upload.frames)
+        );
+    }
+
+    if (evt.latency.cnt) {
+        printf(
+            "input-to-send latency %llu us on average, %llu us max\n",
+            (unsigned long long)(evt.latency.total / evt.latency.cnt),
+            (unsigned long long)evt.latency.max
+        );
+    }
+
     return 0;
 }
 
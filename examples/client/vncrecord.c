@@ -0,0 +1,99 @@
+/**
+ * @example vncrecord.c
+ * Records what a server sends into a file in vncrec format, to be played
+ * back with the -play option or replayed through the decoders by
+ * test/bench_client_decode.
+ *
+ * Usage: vncrecord [-frames n] [-incremental] [-nojpeg] -record file [options] host:display
+ *
+ * By default every update is followed by a request for the whole screen,
+ * so that servers which change little, like most in examples/server, still
+ * produce full frames in the chosen encoding; -incremental records only
+ * what changed. Only updates carrying pixels count towards -frames.
+ * -nojpeg keeps Tight lossless, as test/vncrec's corpus needs it. Pick
+ * the encoding with -encodings, e.g.
+ *
+ *   examples/server/camera &
+ *   vncrecord -frames 200 -encodings zrle -record zrle.vncrec localhost:0
+ *
+ * The client uses the default 32 bpp pixel format, which is what the
+ * benchmark replays with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rfb/rfbclient.h>
+
+static int frames = 0, rects = 0;
+
+static void GotUpdate(rfbClient* client, int x, int y, int w, int h)
+{
+	rects++;
+}
+
+/* only count updates with pixels in them, not pseudo-encodings alone */
+static void FinishedUpdate(rfbClient* client)
+{
+	if (rects > 0)
+		frames++;
+	rects = 0;
+}
+
+static void usage(const char* program)
+{
+	fprintf(stderr, "Usage: %s [-frames n] [-incremental] [-nojpeg] -record file [options] host:display\n", program);
+}
+
+int main(int argc, char **argv)
+{
+	rfbClient* client;
+	int maxFrames = 100, incremental = FALSE, jpeg = TRUE, recording = FALSE;
+	int i, j;
+
+	for (i = j = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			maxFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-incremental") == 0)
+			incremental = TRUE;
+		else if (strcmp(argv[i], "-nojpeg") == 0)
+			jpeg = FALSE;
+		else {
+			if (strcmp(argv[i], "-record") == 0)
+				recording = TRUE;
+			argv[j++] = argv[i];
+		}
+	}
+	argc = j;
+
+	if (!recording) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	client = rfbGetClient(8,3,4);
+	client->appData.enableJPEG = jpeg;
+	client->GotFrameBufferUpdate = GotUpdate;
+	client->FinishedFrameBufferUpdate = FinishedUpdate;
+	if (!rfbInitClient(client, &argc, argv))
+		return 1;
+
+	while (frames < maxFrames) {
+		int done = frames;
+
+		i = WaitForMessage(client, 500000);
+		if (i < 0)
+			break;
+		if (i == 0)
+			continue;
+		if (!HandleRFBServerMessage(client))
+			break;
+		if (!incremental && frames > done &&
+		    !SendFramebufferUpdateRequest(client, 0, 0, client->width, client->height, FALSE))
+			break;
+	}
+
+	printf("Recorded %d updates to %s\n", frames, client->recordFile);
+	rfbClientCleanup(client);
+	return 0;
+}
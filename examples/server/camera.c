@@ -148,6 +148,7 @@ int TakePicture(unsigned char *buffer)
 int main(int argc,char** argv)
 {                                       
   long usec;
+  rfbDamageDetectorPtr damage;
   
   rfbScreenInfoPtr server=rfbGetScreen(&argc,argv,WIDTH,HEIGHT,8,3,BPP);
   if(!server)
@@ -159,14 +160,18 @@ int main(int argc,char** argv)
   /* Initialize the server */
   rfbInitServer(server);           
 
+  /* only what changed from one picture to the next is sent */
+  damage=rfbNewDamageDetector(server,1);
+
   /* Loop, processing clients and taking pictures */
   while (rfbIsActive(server)) {
     if (TimeToTakePicture())
       if (TakePicture((unsigned char *)server->frameBuffer))
-        rfbMarkRectAsModified(server,0,0,WIDTH,HEIGHT);
+        rfbFindDamage(damage);
           
     usec = server->deferUpdateTime*1000;
     rfbProcessEvents(server,usec);
   }
+  rfbFreeDamageDetector(damage);
   return(0);
 }
@@ -1,18 +1,71 @@
-// Compile with LIBS := -lvncserver -lxcb -lxcb-xtest -lxcb-keysyms
+// Compile with LIBS := -lvncserver -lxcb -lxcb-xtest -lxcb-keysyms, and -lxcb-shm -DHAVE_XCB_SHM
+// and -lxcb-damage -DHAVE_XCB_DAMAGE for the faster capture described below.
 // Need CMake 3.24.0 to find these libraries. see https://cmake.org/cmake/help/v3.24/module/FindX11.html
 // XWayland not support to read screen, because wayland not allow it.
 // Read screen in wayland need use XDG desktop portals' interface `org.freedesktop.portal.Screenshot` and `org.freedesktop.portal.ScreenCast`
 // Under some environment, this code not work well, see https://github.com/LibVNC/libvncserver/pull/503#issuecomment-1064472566
+//
+// The framebuffer keeps the root window's pixels as the X server has them,
+// BGRX with the usual 24 bit visuals, so nothing is converted. With MIT-SHM
+// the X server writes them straight into the framebuffer, a shared memory
+// segment, and with XDamage only the rows it reports changed are grabbed, at
+// most -capturefps times a second, so an idle desktop costs no CPU at all.
+// Without XDamage the screen is grabbed -capturefps times a second and
+// rfbCopyDamage() finds what changed; without MIT-SHM, as with a display on
+// another machine, the pixels come through the X connection.
+//
+// Options, besides libvncserver's:
+//   -capturefps n   grab the screen at most n times a second, 60 by default
+//   -stats          every 5 seconds, print the grabs per second, the share of
+//                   the screen grabbed and the CPU time the whole server took
+//
+// To measure it at 1080p, with something drawing all the time:
+//   Xvfb :1 -screen 0 1920x1080x24 &
+//   DISPLAY=:1 x11perf -repeat 100000 -copywinwin500 &
+//   DISPLAY=:1 ./x11 -stats
+// and connect a viewer, as updates are only encoded for clients.
 
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/resource.h>
 #include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
 #include <xcb/xcb.h>
 #include <xcb/xtest.h>
 #include <xcb/xcb_keysyms.h>
+#ifdef HAVE_XCB_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+#endif
+#ifdef HAVE_XCB_DAMAGE
+#include <xcb/damage.h>
+#endif
+
+typedef struct {
+    xcb_connection_t* conn;
+    xcb_window_t root;
+    uint16_t width;
+    uint16_t height;
+    // where the X server puts images, NULL to have them sent
+    uint8_t* shm;
+#ifdef HAVE_XCB_SHM
+    xcb_shm_seg_t seg;
+#endif
+    // reports what changed, 0 to poll
+    uint32_t damage;
+    uint8_t damage_event;
+} Capture;
 
-void dirty_copy(rfbScreenInfoPtr rfbScreen, const uint8_t* data, int width, int height, int nbytes);
-void convert_bgrx_to_rgb(const uint8_t* in, uint16_t width, uint16_t height, uint8_t* buff);
 void get_window_size(xcb_connection_t* conn, xcb_window_t window, uint16_t* width, uint16_t* height);
-void get_window_image(xcb_connection_t* conn, xcb_window_t window, uint8_t* buff);
+rfbBool use_root_format(rfbPixelFormat* format, const xcb_setup_t* setup, xcb_screen_t* screen);
+uint8_t* attach_shm(Capture* cap, size_t size);
+void start_damage(Capture* cap);
+void read_damage(Capture* cap, sraRegionPtr damaged);
+rfbBool grab_rows(Capture* cap, uint8_t* buffer, int y, int h);
+int grab_region(Capture* cap, uint8_t* buffer, sraRegionPtr region);
 void send_keycode(xcb_connection_t *conn, xcb_keycode_t keycode, int press);
 void send_keysym(xcb_connection_t *conn, xcb_keysym_t keysym, int press);
 void send_button(xcb_connection_t *conn, xcb_button_t button, int press);
@@ -52,102 +105,371 @@ static void mouseCallback(int buttonMask, int x, int y, rfbClientPtr client)
     send_motion(conn, (int16_t)x, (int16_t)y);
 }
 
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
 int main(int argc, char* argv[])
 {
     conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(conn))
+    {
+        fprintf(stderr, "cannot connect to the X server\n");
+        return EXIT_FAILURE;
+    }
     const xcb_setup_t* setup = xcb_get_setup(conn);
     xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
     xcb_screen_t* screen = iter.data;
-    xcb_window_t root = screen->root;
 
-    int16_t width;
-    int16_t height;
-    get_window_size(conn, root, &width, &height);
-    void* frameBuffer = malloc(4UL * width * height);
+    Capture cap;
+    memset(&cap, 0, sizeof(cap));
+    cap.conn = conn;
+    cap.root = screen->root;
+    get_window_size(conn, cap.root, &cap.width, &cap.height);
+    size_t stride = 4UL * cap.width;
+    size_t size = stride * cap.height;
+
+    rfbScreenInfoPtr rfbScreen = rfbGetScreen(&argc, argv, (int)cap.width, (int)cap.height, 8, 3, 4);
+    if (rfbScreen == NULL)
+        return EXIT_FAILURE;
+    if (!use_root_format(&rfbScreen->serverFormat, setup, screen))
+    {
+        fprintf(stderr, "the root window does not have 32 bit true colour pixels\n");
+        return EXIT_FAILURE;
+    }
+
+    int fps = 60;
+    rfbBool stats = FALSE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-capturefps") == 0 && i + 1 < argc)
+            fps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-stats") == 0)
+            stats = TRUE;
+    }
+    if (fps < 1)
+        fps = 1;
+
+    start_damage(&cap);
+    uint8_t* shm = attach_shm(&cap, size);
+
+    // with XDamage, the X server is told what to grab, into the framebuffer;
+    // polling, everything is grabbed into a buffer of its own and compared
+    uint8_t* buffer = shm != NULL ? shm : (uint8_t*)malloc(size);
+    rfbDamageDetectorPtr detector = NULL;
+    if (cap.damage != 0)
+        rfbScreen->frameBuffer = (char*)buffer;
+    else
+    {
+        rfbScreen->frameBuffer = (char*)malloc(size);
+        // copies only the tiles that changed since the last grab, and marks them
+        detector = rfbNewDamageDetector(rfbScreen, 4);
+    }
+    // the first grab takes everything
+    sraRegionPtr damaged = sraRgnCreateRect(0, 0, cap.width, cap.height);
+    rfbLog("capturing %dx%d with%s MIT-SHM, %s\n", cap.width, cap.height, shm != NULL ? "" : "out",
+           cap.damage != 0 ? "where XDamage reports changes" : "polling");
 
-    rfbScreenInfoPtr rfbScreen = rfbGetScreen(&argc, argv, (int)width, (int)height, 8, 3, 4);
     rfbScreen->desktopName = "LibVNCServer X11 Example";
-    rfbScreen->frameBuffer = (char*)malloc(4UL * width * height);
     rfbScreen->alwaysShared = TRUE;
     rfbScreen->kbdAddEvent = keyCallback;
     rfbScreen->ptrAddEvent = mouseCallback;
     rfbInitServer(rfbScreen);
     rfbRunEventLoop(rfbScreen, 10000, TRUE);
-    
-    while (TRUE)
+
+    struct pollfd pfd;
+    pfd.fd = xcb_get_file_descriptor(conn);
+    pfd.events = POLLIN;
+    long next = 0, statsTime = now_ms();
+    double statsCpu = cpu_seconds(), grabbed = 0;
+    int grabs = 0;
+
+    while (!xcb_connection_has_error(conn))
     {
-        get_window_image(conn, root, (uint8_t*)frameBuffer);
-        dirty_copy(rfbScreen, (uint8_t*)frameBuffer, (int)width, (int)height, 4);
+        read_damage(&cap, damaged);
+
+        // with nothing damaged, sleep until the X server says otherwise
+        int timeout = -1;
+        if (cap.damage == 0 || !sraRgnEmpty(damaged))
+        {
+            long left = next - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        if (stats)
+        {
+            long left = statsTime + 5000 - now_ms();
+            if (timeout < 0 || timeout > left)
+                timeout = left > 0 ? (int)left : 0;
+        }
+        if (timeout != 0)
+        {
+            poll(&pfd, 1, timeout);
+            continue;
+        }
+
+        if ((cap.damage == 0 || !sraRgnEmpty(damaged)) && now_ms() >= next)
+        {
+            next = now_ms() + 1000 / fps;
+            if (cap.damage != 0)
+            {
+                grabbed += grab_region(&cap, buffer, damaged);
+                rfbMarkRegionAsModified(rfbScreen, damaged);
+                sraRgnMakeEmpty(damaged);
+            }
+            else if (grab_rows(&cap, buffer, 0, cap.height))
+            {
+                rfbCopyDamage(detector, (const char*)buffer, (int)stride);
+                grabbed += cap.height;
+            }
+            grabs++;
+        }
+
+        if (stats && now_ms() >= statsTime + 5000)
+        {
+            long now = now_ms();
+            double cpu = cpu_seconds();
+            printf("%.1f grabs/s, %.1f%% of the screen grabbed, %.1f%% CPU\n",
+                   grabs * 1000.0 / (now - statsTime), 100.0 * grabbed / ((double)cap.height * (grabs > 0 ? grabs : 1)),
+                   100.0 * (cpu - statsCpu) * 1000.0 / (now - statsTime));
+            fflush(stdout);
+            statsTime = now;
+            statsCpu = cpu;
+            grabs = 0;
+            grabbed = 0;
+        }
     }
 
-    free(rfbScreen->frameBuffer);
-    free(frameBuffer);
+    rfbShutdownServer(rfbScreen, TRUE);
+    rfbFreeDamageDetector(detector);
+    sraRgnDestroy(damaged);
+#ifdef HAVE_XCB_SHM
+    if (shm != NULL)
+        shmdt(shm);
+#endif
+    if (cap.damage == 0)
+        free(rfbScreen->frameBuffer);
+    if (shm == NULL)
+        free(buffer);
+    rfbScreenCleanup(rfbScreen);
     xcb_disconnect(conn);
     return EXIT_SUCCESS;
 }
 
-void dirty_copy(rfbScreenInfoPtr rfbScreen, const uint8_t* data, int width, int height, int nbytes)
+void get_window_size(xcb_connection_t* conn, xcb_window_t window, uint16_t* width, uint16_t* height)
 {
-    // check dirty by line, because it is convenient to copy
-    for (int y = 0; y < height; y++)
-    {
-        rfbBool dirty = FALSE;
-        for (int x = 0; x < width; x++)
-        {
-            const void* s1 = &rfbScreen->frameBuffer[(y*width+x)*nbytes];
-            const void* s2 = &data[(y*width+x)*nbytes];
-            if (memcmp(s1, s2, nbytes) != 0)
+    xcb_get_geometry_cookie_t cookie = xcb_get_geometry(conn, window);
+    xcb_get_geometry_reply_t* reply = xcb_get_geometry_reply(conn, cookie, NULL);
+
+    *width = reply->width;
+    *height = reply->height;
+    free(reply);
+}
+
+static void set_channel(uint16_t* max, uint8_t* shift, uint32_t mask)
+{
+    for (*shift = 0; mask != 0 && !(mask & 1); mask >>= 1)
+        (*shift)++;
+    *max = (uint16_t)mask;
+}
+
+// takes the root window's pixel format as it is, FALSE if it is not 32 bit true colour
+rfbBool use_root_format(rfbPixelFormat* format, const xcb_setup_t* setup, xcb_screen_t* screen)
+{
+    xcb_visualtype_t* visual = NULL;
+    for (xcb_depth_iterator_t d = xcb_screen_allowed_depths_iterator(screen); d.rem && visual == NULL; xcb_depth_next(&d))
+        for (xcb_visualtype_iterator_t v = xcb_depth_visuals_iterator(d.data); v.rem; xcb_visualtype_next(&v))
+            if (v.data->visual_id == screen->root_visual)
             {
-                dirty = TRUE;
+                visual = v.data;
                 break;
             }
-        }
 
-        if (dirty)
-        {
-            memcpy(&rfbScreen->frameBuffer[y*width*nbytes], &data[y*width*nbytes], width*nbytes);
-            rfbMarkRectAsModified(rfbScreen, 0, y, width, y+1);
-        }
+    int bpp = 0;
+    for (xcb_format_iterator_t f = xcb_setup_pixmap_formats_iterator(setup); f.rem; xcb_format_next(&f))
+        if (f.data->depth == screen->root_depth)
+            bpp = f.data->bits_per_pixel;
+
+    if (visual == NULL || bpp != 32 ||
+        (visual->_class != XCB_VISUAL_CLASS_TRUE_COLOR && visual->_class != XCB_VISUAL_CLASS_DIRECT_COLOR))
+        return FALSE;
+
+    uint32_t red = visual->red_mask, green = visual->green_mask, blue = visual->blue_mask;
+    // pixels in the other byte order are read here as if the masks were swapped
+    if ((setup->image_byte_order == XCB_IMAGE_ORDER_MSB_FIRST) == (rfbEndianTest != 0))
+    {
+        red = Swap32(red);
+        green = Swap32(green);
+        blue = Swap32(blue);
     }
+    set_channel(&format->redMax, &format->redShift, red);
+    set_channel(&format->greenMax, &format->greenShift, green);
+    set_channel(&format->blueMax, &format->blueShift, blue);
+    format->depth = screen->root_depth;
+    return TRUE;
 }
 
-void convert_bgrx_to_rgb(const uint8_t* in, uint16_t width, uint16_t height, uint8_t* buff)
+// returns a shared memory segment of size bytes the X server can put images into, or NULL
+uint8_t* attach_shm(Capture* cap, size_t size)
 {
-    for (uint16_t y = 0; y < height; y++)
+#ifdef HAVE_XCB_SHM
+    const xcb_query_extension_reply_t* ext = xcb_get_extension_data(cap->conn, &xcb_shm_id);
+    if (ext == NULL || !ext->present)
+        return NULL;
+
+    int id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (id < 0)
+        return NULL;
+    void* addr = shmat(id, NULL, 0);
+    if (addr == (void*)-1)
     {
-        for(uint16_t x = 0; x < width; x++)
-        {
-            buff[(y*width+x)*4] = in[(y*width+x)*4 + 2];
-            buff[(y*width+x)*4 + 1] = in[(y*width+x)*4 + 1];
-            buff[(y*width+x)*4 + 2] = in[(y*width+x)*4];
-        }
+        shmctl(id, IPC_RMID, NULL);
+        return NULL;
     }
+
+    // fails if the X server is on another machine
+    cap->seg = xcb_generate_id(cap->conn);
+    xcb_generic_error_t* error = xcb_request_check(cap->conn, xcb_shm_attach_checked(cap->conn, cap->seg, (uint32_t)id, 0));
+    // gone once both sides have detached
+    shmctl(id, IPC_RMID, NULL);
+    if (error != NULL)
+    {
+        free(error);
+        shmdt(addr);
+        return NULL;
+    }
+    cap->shm = (uint8_t*)addr;
+    return cap->shm;
+#else
+    (void)cap;
+    (void)size;
+    return NULL;
+#endif
 }
 
+// has the X server report what changes on the root window, if it can
+void start_damage(Capture* cap)
+{
+#ifdef HAVE_XCB_DAMAGE
+    const xcb_query_extension_reply_t* ext = xcb_get_extension_data(cap->conn, &xcb_damage_id);
+    if (ext == NULL || !ext->present)
+        return;
+    xcb_damage_query_version_reply_t* version = xcb_damage_query_version_reply(cap->conn,
+        xcb_damage_query_version(cap->conn, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION), NULL);
+    if (version == NULL)
+        return;
+    free(version);
 
-void get_window_size(xcb_connection_t* conn, xcb_window_t window, uint16_t* width, uint16_t* height)
+    cap->damage = xcb_generate_id(cap->conn);
+    cap->damage_event = ext->first_event + XCB_DAMAGE_NOTIFY;
+    xcb_damage_create(cap->conn, cap->damage, cap->root, XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+    xcb_flush(cap->conn);
+#else
+    (void)cap;
+#endif
+}
+
+// adds the rectangles XDamage reported since the last call to damaged
+void read_damage(Capture* cap, sraRegionPtr damaged)
 {
-    xcb_get_geometry_cookie_t cookie = xcb_get_geometry(conn, window);
-    xcb_get_geometry_reply_t* reply = xcb_get_geometry_reply(conn, cookie, NULL);
+    xcb_generic_event_t* event;
+    int reported = 0;
 
-    *width = reply->width;
-    *height = reply->height;
-    free(reply);
+    while ((event = xcb_poll_for_event(cap->conn)) != NULL)
+    {
+#ifdef HAVE_XCB_DAMAGE
+        if (cap->damage != 0 && (event->response_type & 0x7f) == cap->damage_event)
+        {
+            xcb_damage_notify_event_t* notify = (xcb_damage_notify_event_t*)event;
+            sraRegionPtr rect = sraRgnCreateRect(notify->area.x, notify->area.y,
+                                                 notify->area.x + notify->area.width,
+                                                 notify->area.y + notify->area.height);
+            sraRgnOr(damaged, rect);
+            sraRgnDestroy(rect);
+            reported = 1;
+        }
+#endif
+        free(event);
+    }
+
+#ifdef HAVE_XCB_DAMAGE
+    // the damage object's own region is not used, keep it from growing
+    if (reported)
+    {
+        xcb_damage_subtract(cap->conn, cap->damage, XCB_NONE, XCB_NONE);
+        xcb_flush(cap->conn);
+    }
+#else
+    (void)reported;
+    (void)damaged;
+#endif
 }
 
-void get_window_image(xcb_connection_t* conn, xcb_window_t window, uint8_t* buff)
+// puts rows y to y + h - 1 of the screen into the same rows of buffer, which is cap->shm if there is one
+rfbBool grab_rows(Capture* cap, uint8_t* buffer, int y, int h)
 {
-    uint16_t width = 0;
-    uint16_t height = 0;
-    get_window_size(conn, window, &width, &height);
+    size_t stride = 4UL * cap->width;
+
+#ifdef HAVE_XCB_SHM
+    if (cap->shm != NULL)
+    {
+        xcb_shm_get_image_cookie_t cookie = xcb_shm_get_image(cap->conn, cap->root, 0, (int16_t)y, cap->width, (uint16_t)h,
+                                                              UINT32_MAX, XCB_IMAGE_FORMAT_Z_PIXMAP, cap->seg,
+                                                              (uint32_t)(y * stride));
+        xcb_shm_get_image_reply_t* reply = xcb_shm_get_image_reply(cap->conn, cookie, NULL);
+        if (reply == NULL)
+            return FALSE;
+        free(reply);
+        return TRUE;
+    }
+#endif
 
-    // will failed in wayland, xcb_get_image_data will return NULL, convert_bgrx_to_rgb will abort
-    xcb_get_image_cookie_t cookie = xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, window, 0, 0, width, height, UINT32_MAX);
-    xcb_get_image_reply_t* reply = xcb_get_image_reply(conn, cookie, NULL);
-    convert_bgrx_to_rgb(xcb_get_image_data(reply), width, height, buff);
+    // will fail in wayland, xcb_get_image_reply will return NULL
+    xcb_get_image_cookie_t cookie = xcb_get_image(cap->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, cap->root, 0, (int16_t)y, cap->width, (uint16_t)h, UINT32_MAX);
+    xcb_get_image_reply_t* reply = xcb_get_image_reply(cap->conn, cookie, NULL);
+    if (reply == NULL)
+        return FALSE;
+    if ((size_t)xcb_get_image_data_length(reply) >= stride * h)
+        memcpy(buffer + y * stride, xcb_get_image_data(reply), stride * h);
     free(reply);
+    return TRUE;
 }
 
+// grabs the whole rows region touches, returns how many
+int grab_region(Capture* cap, uint8_t* buffer, sraRegionPtr region)
+{
+    sraRegionPtr rows = sraRgnCreate();
+    sraRectangleIterator* i = sraRgnGetIterator(region);
+    sraRect rect;
+    int n = 0;
+
+    while (sraRgnIteratorNext(i, &rect))
+    {
+        sraRegionPtr band = sraRgnCreateRect(0, rect.y1 < 0 ? 0 : rect.y1, cap->width,
+                                             rect.y2 > cap->height ? cap->height : rect.y2);
+        sraRgnOr(rows, band);
+        sraRgnDestroy(band);
+    }
+    sraRgnReleaseIterator(i);
+
+    i = sraRgnGetIterator(rows);
+    while (sraRgnIteratorNext(i, &rect))
+        if (grab_rows(cap, buffer, rect.y1, rect.y2 - rect.y1))
+            n += rect.y2 - rect.y1;
+    sraRgnReleaseIterator(i);
+    sraRgnDestroy(rows);
+    return n;
+}
 
 void send_keycode(xcb_connection_t *conn, xcb_keycode_t keycode, int press) 
 {
@@ -376,6 +376,53 @@ typedef struct _rfbScreenInfo
 #endif
     /* Timeout value for select() calls, mainly used for multithreaded servers. */
     int select_timeout_usec;
+    /** Bytes of encoded rectangles kept for reuse by clients that ask for
+     * the same region in the same pixel format, encoding and quality, so that
+     * identical viewers don't encode an update over and over. Only
+     * encodings without per-client compression state are shared. 0, the
+     * default, disables the cache. Set it before rfbInitServer(). */
+    int encodeCacheSize;
+    void *encodeCache;
+    /** Wait for socket events with select() even where epoll is available.
+     * select() cannot watch sockets numbered FD_SETSIZE or above, so such
+     * clients are turned away. Set it before rfbInitServer(). */
+    rfbBool useSelect;
+    void *pollSet;
+    /** With rfbRunEventLoop() in the background, serve the clients from a
+     * pool of this many threads instead of two threads per client. -1
+     * means one per CPU core. Needs epoll, without it clients get their
+     * own threads as with the default of 0. Set it before rfbRunEventLoop(). */
+    int workerThreads;
+    void *workerPool;
+    /** Pace updates instead of deferring each one by deferUpdateTime: an
+     * update goes out at once while the client's connection is idle, waits
+     * for it to drain while it is not, and no client gets more than this
+     * many updates per second. 0, the default, keeps deferUpdateTime. */
+    int maxFrameRate;
+    /** No new update is encoded for a client while more than this many
+     * bytes wait in its output queue, see rfbClientRec::outputQueued.
+     * Defaults to 1 MB. */
+    int outputHighWater;
+    /** Encode updates of a large area on this many threads at once, in
+     * strips that go to the client in order, rather than on the thread
+     * sending the update only. -1 means one per CPU core. Only clients
+     * that take LastRect markers and use Raw, RRE, CoRRE, Hextile, Ultra,
+     * Tight or TightPng qualify. 0, the default, and 1 keep it to one
+     * thread. Set it before rfbInitServer(). */
+    int encodeThreads;
+    void *encodeThreadPool;
+    /** Rather than keeping ZRLE and ZYWRLE to the zlib level each client
+     * asks for, start there and move it up while the client's connection
+     * can't take the data as fast as it is compressed, and down while it
+     * could take more. Off by default. */
+    rfbBool adaptiveZlibLevel;
+    /** Bring large changes into the scaled copies of the framebuffer,
+     * which clients get with SetScale or PalmVNC's SetScaleFactor, on this
+     * many threads at once rather than on the thread marking the change
+     * only. -1 means one per CPU core; 0, the default, and 1 keep it to
+     * one thread. Set it before rfbInitServer(). */
+    int scaleThreads;
+    void *scaleThreadPool;
 } rfbScreenInfo, *rfbScreenInfoPtr;
 
 
@@ -645,6 +692,9 @@ typedef struct _rfbClientRec {
 
 #ifdef LIBVNCSERVER_HAVE_LIBZ
     void* zrleData;
+    /** the zlib level ZRLE compresses at, see
+        rfbScreenInfo::adaptiveZlibLevel */
+    int zrleZlibLevel;
     int zywrleLevel;
     int zywrleBuf[rfbZRLETileWidth * rfbZRLETileHeight];
 #endif
@@ -709,8 +759,50 @@ typedef struct _rfbClientRec {
     rfbBool tightUsePixelFormat24;
     void *tightTJ;
     int tightPngDstDataLen;
+    /** bits 0-3: Tight zlib streams to restart, along with the client's
+        inflaters, the next time they are used */
+    int tightStreamsToReset;
 #endif
 #endif
+
+    /** the rectangle being encoded for rfbScreenInfo::encodeCache */
+    void *encodeCapture;
+    /** the strip of an update that this copy of a client encodes, see
+        rfbScreenInfo::encodeThreads */
+    void *encodeStrip;
+    /** the client's place in rfbScreenInfo::workerPool */
+    void *poolTask;
+    /** How fast the client's connection took the data lately, in bytes per
+     * second, and how much of what was written to it is still on its way.
+     * Measured as updates are paced, see rfbScreenInfo::maxFrameRate, or
+     * ZRLE levels adapted, and only where the system tells, 0 otherwise. */
+    uint32_t sendRate;
+    uint32_t queuedBytes;
+    /* frame pacer state, in ms and bytes; bytesWritten counts what
+       rfbWriteExact() gave the socket or queued for it, never what was read */
+    unsigned long bytesWritten;
+    unsigned long rateSampleBytes;
+    long rateSampleTime;
+    long lastUpdateTime;
+    int rtt;
+    int updateDelay;
+    /** The client announced the Fence and ContinuousUpdates
+     * pseudo-encodings. With both, it may ask to have continuousRegion
+     * updated as it changes, without FramebufferUpdateRequests, and
+     * continuousUpdates is set while it does. Those updates are paced by
+     * how fast the client answers the fences sent after them. */
+    rfbBool enableFence;
+    rfbBool enableContinuousUpdates;
+    rfbBool continuousUpdates;
+    sraRegionPtr continuousRegion;
+    /** fences on their way to the client and back, for internal use only */
+    void *fencePings;
+    /** Bytes written to the client that its socket did not take yet. They
+     * wait in the output queue, which is drained as the socket becomes
+     * writable, so that a slow client never blocks the thread sending to
+     * it. Clients on an encrypted connection write synchronously. */
+    unsigned long outputQueued;
+    void *outputQueue;
 } rfbClientRec, *rfbClientPtr;
 
 /**
@@ -817,6 +909,7 @@ extern rfbBool rfbSendCopyRegion(rfbClientPtr cl,sraRegionPtr reg,int dx,int dy)
 extern rfbBool rfbSendLastRectMarker(rfbClientPtr cl);
 extern rfbBool rfbSendNewFBSize(rfbClientPtr cl, int w, int h);
 extern rfbBool rfbSendExtDesktopSize(rfbClientPtr cl, int w, int h);
+extern rfbBool rfbSendFence(rfbClientPtr cl, uint32_t flags, int length, const char *data);
 extern rfbBool rfbSendSetColourMapEntries(rfbClientPtr cl, int firstColour, int nColours);
 extern void rfbSendBell(rfbScreenInfoPtr rfbScreen);
 
@@ -1017,6 +1110,27 @@ extern void rfbPurgeArguments(int* argc,int* position,int count,char *argv[]);
 extern rfbBool rfbProcessArguments(rfbScreenInfoPtr rfbScreen,int* argc, char *argv[]);
 extern rfbBool rfbProcessSizeArguments(int* width,int* height,int* bpp,int* argc, char *argv[]);
 
+/* damage.c */
+
+/**
+ * Finds the tiles of the framebuffer that a polled source changed and marks
+ * only those as modified. Use rfbCopyDamage() with a frame captured
+ * elsewhere, which is compared with rfbScreenInfo::frameBuffer and copied
+ * into it where it differs, or rfbFindDamage() after drawing into the
+ * framebuffer directly, which compares per-tile hashes with those of the
+ * previous call; the first call finds everything changed. Both return the
+ * number of changed tiles, or -1 if out of memory. With threads > 1, that
+ * many threads share the work, the calling one included. A detector
+ * follows changes of the framebuffer size and is not meant to be used
+ * from more than one thread at a time.
+ */
+typedef struct _rfbDamageDetector *rfbDamageDetectorPtr;
+
+extern rfbDamageDetectorPtr rfbNewDamageDetector(rfbScreenInfoPtr rfbScreen, int threads);
+extern void rfbFreeDamageDetector(rfbDamageDetectorPtr detector);
+extern int rfbCopyDamage(rfbDamageDetectorPtr detector, const char *frame, int stride);
+extern int rfbFindDamage(rfbDamageDetectorPtr detector);
+
 /* main.c */
 
 extern void rfbLogEnable(int enabled);
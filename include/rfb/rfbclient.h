@@ -108,6 +108,16 @@ typedef struct {
   rfbBool doNotSleep;
 } rfbVNCRec;
 
+/** Rects of one encoding received so far, see rfbClient::decodeStats */
+
+typedef struct _rfbClientDecodeStats {
+  struct _rfbClientDecodeStats* next;
+  int32_t encoding;
+  unsigned int rects;
+  uint64_t pixels;
+  double seconds; /**< reading and decoding them */
+} rfbClientDecodeStats;
+
 /** client data */
 
 typedef struct rfbClientData {
@@ -257,13 +267,15 @@ typedef struct _rfbClient {
 		int x, y, w, h;
 	} updateRect;
 
-	/** Note that the CoRRE encoding uses this buffer and assumes it is big enough
-	   to hold 255 * 255 * 32 bits -> 260100 bytes.  640*480 = 307200 bytes.
-	   Hextile also assumes it is big enough to hold 16 * 16 * 32 bits.
-	   Tight encoding assumes BUFFER_SIZE is at least 16384 bytes. */
+	/** Decoder scratch buffer. It is allocated on first use and grows to
+	   what the largest rectangle seen so far needed, see bufferSize.
+	   RFB_BUFFER_SIZE caps how much a decoder stages in it at once: Raw
+	   and ZRLE read in chunks of at most that size, CoRRE and uncompressed
+	   Tight data larger than that are rejected. */
 
 #define RFB_BUFFER_SIZE (640*480)
-	char buffer[RFB_BUFFER_SIZE];
+	char *buffer;
+	int bufferSize;
 
 	/* rfbproto.c */
 
@@ -305,9 +317,11 @@ typedef struct _rfbClient {
 	 * Variables for the ``tight'' encoding implementation.
 	 */
 
-	/** Separate buffer for compressed data. */
+	/** Separate buffer for compressed data, allocated on first use.
+	   ZRLE borrows it as ZYWRLE work space. */
 #define ZLIB_BUFFER_SIZE 30000
-	char zlib_buffer[ZLIB_BUFFER_SIZE];
+	char *zlib_buffer;
+	int zlibBufferSize;
 
 	/* Four independent compression streams for zlib library. */
 	z_stream zlibStream[4];
@@ -317,7 +331,9 @@ typedef struct _rfbClient {
 	rfbBool cutZeros;
 	int rectWidth, rectColors;
 	char tightPalette[256*4];
-	uint8_t tightPrevRow[2048*3*sizeof(uint16_t)];
+	/** Previous row for the gradient filter, sized to the widest rect seen. */
+	uint8_t *tightPrevRow;
+	int tightPrevRowSize;
 
 #ifdef LIBVNCSERVER_HAVE_LIBJPEG
 	/** JPEG decoder state (obsolete-- do not use). */
@@ -489,6 +505,89 @@ typedef struct _rfbClient {
 
         /* flag to indicate wheter updateRect is managed by lib or user */
         rfbBool isUpdateRectManagedByLib;
+
+        /**
+         * Input event batching state, see rfbClientBeginInputBatch().
+         * For internal use only.
+         */
+        rfbBool inputBatching;
+#define RFB_INPUT_BATCH_SIZE 1024
+        char *inputBatchBuf;
+        unsigned int inputBatchLen;
+        int inputBatchLastPointer;
+        /* the button mask of the last pointer event sent or queued */
+        int inputBatchButtons;
+
+        /**
+         * Size in bytes of the buffer ReadFromRFBServer() reads ahead into.
+         * Set this before connecting; values up to RFB_BUF_SIZE use the
+         * inline client->buf. A larger buffer means fewer read() calls and
+         * longer spans for PeekFromRFBServer().
+         */
+        unsigned int readBufferSize;
+        /** Heap receive buffer, for internal use only. */
+        char *readBuffer;
+        unsigned int readBufferAllocated;
+
+        /**
+         * Number of worker threads decoding Tight JPEG rects and ZRLE
+         * tiles. With the default of 0 every rect is decoded on the thread
+         * that calls HandleRFBServerMessage(). Otherwise JPEG rects are
+         * handed to the workers and GotFrameBufferUpdate() fires for them
+         * once they are done, at the latest before
+         * FinishedFrameBufferUpdate(). The tiles of a ZRLE rect are decoded
+         * by the workers and the calling thread together, so GotBitmap and
+         * GotFillRect must cope with being called from several threads at
+         * once for disjoint areas, as the default ones do. Set this before
+         * connecting. Not for use with a GotJpeg handler or a soft cursor
+         * that draws into the framebuffer.
+         */
+        int decodeThreads;
+        /** Decode worker pool, for internal use only. */
+        void *decodePool;
+        /** ZRLE tile index, for internal use only. */
+        void *zrleTiles;
+        int zrleTilesSize;
+
+        /**
+         * If set before connecting, everything the server sends is also
+         * written to this file in vncrec format, for replaying with -play.
+         * Set by the -record option of rfbInitClient().
+         */
+        const char* recordFile;
+        /**
+         * Rects received so far and the time spent reading and decoding
+         * them, one entry per encoding. Maintained by the library. With
+         * decodeThreads set, rects decoded by the workers only count the
+         * time spent reading them.
+         */
+        rfbClientDecodeStats* decodeStats;
+
+        /**
+         * If set before connecting, the server is asked to send updates
+         * as the framebuffer changes rather than one per request, where it
+         * supports the ContinuousUpdates extension. This saves a round trip
+         * per update on slow links. Set by the -continuous option of
+         * rfbInitClient().
+         */
+        rfbBool continuousUpdates;
+        /** The server supports the Fence and ContinuousUpdates extensions. */
+        rfbBool supportsFence;
+        rfbBool supportsContinuousUpdates;
+        /** The server sends continuous updates right now. */
+        rfbBool continuousUpdatesActive;
+        /**
+         * The round trip time in ms to the server and the bytes per second
+         * its data arrives at, measured with a fence after each update
+         * where the server supports them, 0 until then. Maintained by the
+         * library.
+         */
+        int latency;
+        uint32_t bandwidth;
+        /** Bytes received from the server so far. */
+        uint64_t bytesReceived;
+        /** A fence of ours is on its way, for internal use only. */
+        rfbBool fencePending;
 } rfbClient;
 
 /* cursor.c */
@@ -607,6 +706,25 @@ extern rfbBool SendKeyEvent(rfbClient* client,uint32_t key, rfbBool down);
  * successfully, false otherwise
  */
 extern rfbBool SendExtendedKeyEvent(rfbClient* client, uint32_t keysym, uint32_t keycode, rfbBool down);
+/**
+ * Starts batching input events. Until rfbClientFlushInputBatch() is called,
+ * SendPointerEvent(), SendKeyEvent() and SendExtendedKeyEvent() only queue
+ * their messages, which are then sent to the server with a single write.
+ * Consecutive motion events with the same button mask are coalesced into
+ * the last one, so a burst of motion costs one message; an event that presses
+ * or releases a button is always sent where it happened. Use this around
+ * gestures that emit several events at once.
+ * @param client The client on which to start batching
+ * @return true if batching was started, false if the queue couldn't be allocated
+ */
+extern rfbBool rfbClientBeginInputBatch(rfbClient* client);
+/**
+ * Sends all input events queued since rfbClientBeginInputBatch() and stops
+ * batching. Does nothing if no batch was started.
+ * @param client The client whose queued input events to send
+ * @return true if the queued events were sent successfully, false otherwise
+ */
+extern rfbBool rfbClientFlushInputBatch(rfbClient* client);
 /**
  * Places a Latin-1-encoded string on the server's clipboard. Use this function if you want to
  * be able to copy and paste between the server and your application. For
@@ -669,6 +787,27 @@ extern rfbBool TextChatClose(rfbClient* client);
 extern rfbBool TextChatFinish(rfbClient* client);
 extern rfbBool PermitServerInput(rfbClient* client, int enabled);
 extern rfbBool SendXvpMsg(rfbClient* client, uint8_t version, uint8_t code);
+/**
+ * Sends a fence, see rfbFenceMsg. The server answers a request with the
+ * same payload once it has handled everything sent before it. Does
+ * nothing if the server doesn't support fences.
+ * @param client The client through which to send the fence
+ * @param flags rfbFenceFlag* values
+ * @param length The payload's length, at most rfbFenceMaxLength
+ * @param data The payload
+ * @return true if the fence was sent successfully, false otherwise
+ */
+extern rfbBool SendFence(rfbClient* client, uint32_t flags, unsigned int length, const char* data);
+/**
+ * Asks the server to send updates of the given area as it changes, or to
+ * stop doing so. Does nothing if the server doesn't support continuous
+ * updates. See rfbClient::continuousUpdates to have them enabled on
+ * connecting.
+ * @param client The client through which to send the request
+ * @param enable Whether to start or stop continuous updates
+ * @return true if the request was sent successfully, false otherwise
+ */
+extern rfbBool SendEnableContinuousUpdates(rfbClient* client, rfbBool enable, int x, int y, int w, int h);
 
 extern void PrintPixelFormat(rfbPixelFormat *format);
 
@@ -744,6 +883,25 @@ void rfbClientRegisterExtension(rfbClientProtocolExtension* e);
 extern rfbBool errorMessageOnReadFailure;
 
 extern rfbBool ReadFromRFBServer(rfbClient* client, char *out, unsigned int n);
+/**
+ * Gives in-place access to data received from the server, so decoders can
+ * consume it without copying it out of the receive buffer first. Blocks
+ * until at least n bytes are available.
+ * @param client The client to read from
+ * @param n The minimum number of contiguous bytes wanted, at most the size of
+ * the receive buffer (see rfbClient::readBufferSize)
+ * @param avail If not NULL, receives the number of bytes available at the
+ * returned pointer, which may be more than n
+ * @return a pointer to the data, or NULL on error. It stays valid until the
+ * next call that reads from the server.
+ */
+extern const char* PeekFromRFBServer(rfbClient* client, unsigned int n, unsigned int *avail);
+/**
+ * Releases n bytes previously returned by PeekFromRFBServer().
+ * @param client The client the data was peeked from
+ * @param n The number of bytes to release
+ */
+extern void ConsumeFromRFBServer(rfbClient* client, unsigned int n);
 extern rfbBool WriteToRFBServer(rfbClient* client, const char *buf, unsigned int n);
 extern int FindFreeTcpPort(void);
 extern rfbSocket ListenAtTcpPort(int port);
@@ -806,7 +964,8 @@ extern rfbBool SameMachine(rfbSocket sock);
  * will return.
  * @param client The client to cause to wait until a message is received
  * @param usecs The timeout in microseconds
- * @return the return value of the underlying select() call
+ * @return the return value of the underlying select() call, or 1 at once if
+ * data already read from the socket is waiting to be handled
  */
 extern int WaitForMessage(rfbClient* client,unsigned int usecs);
 
@@ -847,6 +1006,8 @@ rfbClient* rfbGetClient(int bitsPerSample,int samplesPerPixel,int bytesPerPixel)
  * <tr><td>-listennofork</td><td>Listen for incoming connections without forking.
  * </td></tr>
  * <tr><td>-play</td><td>Set this client to replay a previously recorded session.</td></tr>
+ * <tr><td>-record</td><td>Record the session for replaying with -play. The next item
+ * in the argv array is the file to write.</td></tr>
  * <tr><td>-encodings</td><td>Set the encodings to use. The next item in the
  * argv array is the encodings string, consisting of comma separated encodings like 'tight,ultra,raw'.</td></tr>
  * <tr><td>-compress</td><td>Set the compression level. The next item in the
@@ -885,6 +1046,16 @@ rfbBool rfbClientInitialise(rfbClient* client);
  * @param client The client to clean up
  */
 void rfbClientCleanup(rfbClient* client);
+/**
+ * Returns the approximate number of heap bytes held by this client: the
+ * rfbClient structure itself, its receive, decode and input batch buffers,
+ * an estimate for each active zlib stream and the framebuffer if it was
+ * allocated by the default MallocFrameBuffer handler. Memory held by TLS,
+ * SASL or JPEG libraries is not included.
+ * @param client The client to inspect
+ * @return The number of bytes
+ */
+size_t rfbClientGetMemoryUsage(rfbClient* client);
 
 #if(defined __cplusplus)
 }
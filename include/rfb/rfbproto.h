@@ -408,6 +408,7 @@ typedef struct {
 /* Modif sf@2002 */
 #define rfbResizeFrameBuffer 4
 #define rfbPalmVNCReSizeFrameBuffer 0xF
+#define rfbEndOfContinuousUpdates 150
 
 /* client -> server */
 
@@ -436,6 +437,9 @@ typedef struct {
 /* SetDesktopSize client -> server message */
 #define rfbSetDesktopSize 251
 #define rfbQemuEvent 255
+#define rfbEnableContinuousUpdates 150
+/* Fence message - bidirectional */
+#define rfbFence 248
 
 
 
@@ -516,6 +520,8 @@ typedef struct {
 #define rfbEncodingLastRect           0xFFFFFF20
 #define rfbEncodingNewFBSize          0xFFFFFF21
 #define rfbEncodingExtDesktopSize     0xFFFFFECC
+#define rfbEncodingFence              0xFFFFFEC8 /* -312 */
+#define rfbEncodingContinuousUpdates  0xFFFFFEC7 /* -313 */
 
 #define rfbEncodingQualityLevel0   0xFFFFFFE0
 #define rfbEncodingQualityLevel1   0xFFFFFFE1
@@ -1212,6 +1218,49 @@ typedef struct rfbSetDesktopSizeMsg {
 #define sz_rfbSetDesktopSizeMsg (8)
 
 
+/*-----------------------------------------------------------------------------
+ * Fence - bidirectional
+ *
+ * A client announces support with the Fence pseudo-encoding, a server
+ * confirms it by sending a Fence request. The receiver of a request
+ * answers it with the same payload and those of the flags it honours,
+ * with rfbFenceFlagRequest cleared. Since messages are answered in order,
+ * a fence marks how far the peer has got through everything sent before.
+ */
+
+typedef struct {
+    uint8_t type;			/* always rfbFence */
+    uint8_t pad[3];
+    uint32_t flags;
+    uint8_t length;			/* at most 64 */
+    /* followed by char data[length] */
+} rfbFenceMsg;
+
+#define sz_rfbFenceMsg 9
+
+#define rfbFenceFlagBlockBefore 0x00000001
+#define rfbFenceFlagBlockAfter  0x00000002
+#define rfbFenceFlagSyncNext    0x00000004
+#define rfbFenceFlagRequest     0x80000000
+#define rfbFenceFlagsSupported  (rfbFenceFlagBlockBefore | rfbFenceFlagBlockAfter | \
+                                 rfbFenceFlagSyncNext | rfbFenceFlagRequest)
+#define rfbFenceMaxLength 64
+
+/*-----------------------------------------------------------------------------
+ * EndOfContinuousUpdates server -> client message
+ *
+ * Sent once when the client announces the ContinuousUpdates
+ * pseudo-encoding, to say the server supports it, and then whenever
+ * continuous updates have been switched off.
+ */
+
+typedef struct {
+    uint8_t type;			/* always rfbEndOfContinuousUpdates */
+} rfbEndOfContinuousUpdatesMsg;
+
+#define sz_rfbEndOfContinuousUpdatesMsg 1
+
+
 /*-----------------------------------------------------------------------------
  * Modif sf@2002
  * ResizeFrameBuffer - The Client must change the size of its framebuffer  
@@ -1267,6 +1316,8 @@ typedef union {
 	rfbTextChatMsg tc;
 	rfbXvpMsg xvp;
 	rfbExtDesktopSizeMsg eds;
+	rfbFenceMsg f;
+	rfbEndOfContinuousUpdatesMsg ecu;
 } rfbServerToClientMsg;
 
 
@@ -1524,6 +1575,25 @@ typedef struct _rfbSetSWMsg {
 
 
 
+/*-----------------------------------------------------------------------------
+ * EnableContinuousUpdates - the server sends updates of the given area as
+ * the framebuffer changes, without waiting for FramebufferUpdateRequests,
+ * until the client disables them again. Only for servers that announced
+ * support with an EndOfContinuousUpdates message.
+ */
+
+typedef struct {
+    uint8_t type;			/* always rfbEnableContinuousUpdates */
+    uint8_t enable;
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} rfbEnableContinuousUpdatesMsg;
+
+#define sz_rfbEnableContinuousUpdatesMsg 10
+
+
 /*-----------------------------------------------------------------------------
  * Union of all client->server messages.
  */
@@ -1545,6 +1615,8 @@ typedef union {
 	rfbTextChatMsg tc;
 	rfbXvpMsg xvp;
 	rfbSetDesktopSizeMsg sdm;
+	rfbFenceMsg f;
+	rfbEnableContinuousUpdatesMsg ecu;
 } rfbClientToServerMsg;
 
 /* 
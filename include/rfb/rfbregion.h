@@ -28,6 +28,8 @@ extern void sraRgnMakeEmpty(sraRegion *rgn);
 extern rfbBool sraRgnAnd(sraRegion *dst, const sraRegion *src);
 extern void sraRgnOr(sraRegion *dst, const sraRegion *src);
 extern rfbBool sraRgnSubtract(sraRegion *dst, const sraRegion *src);
+/* what sraRgnAnd() would return, without changing or copying anything */
+extern rfbBool sraRgnIntersects(const sraRegion *rgn1, const sraRegion *rgn2);
 
 extern void sraRgnOffset(sraRegion *dst, int dx, int dy);
 
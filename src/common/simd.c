@@ -0,0 +1,1085 @@
+/*
+ * common/simd.c - CPU feature detection and vectorised framebuffer
+ * kernels used by both libvncclient and libvncserver.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <string.h>
+
+#include "simd.h"
+
+/*
+ * SSE2 and NEON are part of the x86-64 and AArch64 baselines, so they are
+ * used whenever the compiler targets them. SSSE3 and AVX2 are compiled in
+ * through function attributes and only picked when the CPU reports them.
+ */
+#if defined(__SSE2__) || defined(_M_X64)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define HAVE_AVX2 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define HAVE_SSSE3 1
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+static int detected = -1;
+static int allowed = -1;
+
+static int detect(void)
+{
+  int features = 0;
+
+#ifdef HAVE_SSE2
+  features |= SIMD_SSE2;
+#endif
+#ifdef HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))
+    features |= SIMD_SSSE3;
+  if (__builtin_cpu_supports("avx2"))
+    features |= SIMD_AVX2;
+#endif
+#ifdef HAVE_NEON
+  features |= SIMD_NEON;
+#endif
+
+  return features;
+}
+
+int simd_features(void)
+{
+  if (detected < 0)
+    detected = detect();
+  return allowed < 0 ? detected : detected & allowed;
+}
+
+void simd_set_features(int mask)
+{
+  allowed = mask;
+}
+
+/*
+ * Fill kernels. A 16 bpp colour is widened to a 32 bit pattern first, so
+ * every kernel only has to repeat 4 bytes over n bytes, n being a multiple
+ * of 2. Stores are unaligned, the framebuffer row start decides where the
+ * pattern begins.
+ */
+
+static void fill_c(uint8_t *p, size_t n, uint32_t pattern)
+{
+  if (((uintptr_t)p & 3) == 0) {
+    uint32_t *p32 = (uint32_t *)p;
+    size_t i;
+
+    for (i = 0; i < n / 4; i++)
+      p32[i] = pattern;
+    p += n & ~(size_t)3;
+    n &= 3;
+  }
+  for (; n >= 4; n -= 4, p += 4)
+    memcpy(p, &pattern, 4);
+  if (n >= 2)
+    memcpy(p, &pattern, 2);
+}
+
+#ifdef HAVE_SSE2
+static void fill_sse2(uint8_t *p, size_t n, uint32_t pattern)
+{
+  __m128i v = _mm_set1_epi32((int)pattern);
+
+  for (; n >= 64; n -= 64, p += 64) {
+    _mm_storeu_si128((__m128i *)p, v);
+    _mm_storeu_si128((__m128i *)(p + 16), v);
+    _mm_storeu_si128((__m128i *)(p + 32), v);
+    _mm_storeu_si128((__m128i *)(p + 48), v);
+  }
+  for (; n >= 16; n -= 16, p += 16)
+    _mm_storeu_si128((__m128i *)p, v);
+  fill_c(p, n, pattern);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void fill_avx2(uint8_t *p, size_t n, uint32_t pattern)
+{
+  __m256i v = _mm256_set1_epi32((int)pattern);
+
+  for (; n >= 128; n -= 128, p += 128) {
+    _mm256_storeu_si256((__m256i *)p, v);
+    _mm256_storeu_si256((__m256i *)(p + 32), v);
+    _mm256_storeu_si256((__m256i *)(p + 64), v);
+    _mm256_storeu_si256((__m256i *)(p + 96), v);
+  }
+  for (; n >= 32; n -= 32, p += 32)
+    _mm256_storeu_si256((__m256i *)p, v);
+  fill_c(p, n, pattern);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void fill_neon(uint8_t *p, size_t n, uint32_t pattern)
+{
+  uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+
+  for (; n >= 64; n -= 64, p += 64) {
+    vst1q_u8(p, v);
+    vst1q_u8(p + 16, v);
+    vst1q_u8(p + 32, v);
+    vst1q_u8(p + 48, v);
+  }
+  for (; n >= 16; n -= 16, p += 16)
+    vst1q_u8(p, v);
+  fill_c(p, n, pattern);
+}
+#endif
+
+void simd_fill_rect(uint8_t *dst, int stride, int bpp, int w, int h, uint32_t colour)
+{
+  void (*fill)(uint8_t *, size_t, uint32_t) = fill_c;
+  int features = simd_features();
+  size_t n;
+  uint32_t pattern;
+
+  if (w <= 0 || h <= 0)
+    return;
+
+  if (bpp == 8) {
+    for (; h > 0; h--, dst += stride)
+      memset(dst, (uint8_t)colour, w);
+    return;
+  }
+
+  if (bpp == 16)
+    pattern = (colour & 0xffff) | (colour << 16);
+  else
+    pattern = colour;
+  n = (size_t)w * (bpp / 8);
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    fill = fill_sse2;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    fill = fill_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    fill = fill_neon;
+#endif
+  (void)features;
+
+  for (; h > 0; h--, dst += stride)
+    fill(dst, n, pattern);
+}
+
+/*
+ * Rectangle moves go row by row through memmove(), which the C library
+ * already dispatches to its best vector implementation. All that is left
+ * to do here is walking the rows in the direction that keeps overlapping
+ * source rows intact, and moving contiguous full-width rows in one go.
+ */
+void simd_move_rect(uint8_t *dst, const uint8_t *src, int stride, int row_bytes, int h)
+{
+  if (row_bytes <= 0 || h <= 0 || dst == src)
+    return;
+
+  if (row_bytes == stride) {
+    memmove(dst, src, (size_t)row_bytes * h);
+    return;
+  }
+
+  if (dst < src) {
+    for (; h > 0; h--, dst += stride, src += stride)
+      memmove(dst, src, row_bytes);
+  } else {
+    dst += (size_t)(h - 1) * stride;
+    src += (size_t)(h - 1) * stride;
+    for (; h > 0; h--, dst -= stride, src -= stride)
+      memmove(dst, src, row_bytes);
+  }
+}
+
+/*
+ * Difference search. The vector kernels only find the block a difference
+ * is in, 64 bytes at a time while there are no differences, and leave the
+ * exact offset and the tail to the plain C one, which goes a word at a
+ * time.
+ */
+
+static size_t find_difference_c(const uint8_t *a, const uint8_t *b, size_t n)
+{
+  size_t i = 0;
+  uint64_t wa, wb;
+
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&wa, a + i, 8);
+    memcpy(&wb, b + i, 8);
+    if (wa != wb)
+      break;
+  }
+  for (; i < n; i++)
+    if (a[i] != b[i])
+      break;
+  return i;
+}
+
+#ifdef HAVE_SSE2
+static size_t find_difference_sse2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+  size_t i = 0;
+  __m128i eq;
+
+  for (; i + 64 <= n; i += 64) {
+    eq = _mm_and_si128(
+      _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                   _mm_loadu_si128((const __m128i *)(b + i))),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                                   _mm_loadu_si128((const __m128i *)(b + i + 16)))),
+      _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                                   _mm_loadu_si128((const __m128i *)(b + i + 32))),
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                                   _mm_loadu_si128((const __m128i *)(b + i + 48)))));
+    if (_mm_movemask_epi8(eq) != 0xffff)
+      break;
+  }
+  for (; i + 16 <= n; i += 16) {
+    eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                        _mm_loadu_si128((const __m128i *)(b + i)));
+    if (_mm_movemask_epi8(eq) != 0xffff)
+      break;
+  }
+  return i + find_difference_c(a + i, b + i, n - i);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static size_t find_difference_avx2(const uint8_t *a, const uint8_t *b, size_t n)
+{
+  size_t i = 0;
+  __m256i eq;
+
+  for (; i + 64 <= n; i += 64) {
+    eq = _mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                        _mm256_loadu_si256((const __m256i *)(b + i))),
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+                        _mm256_loadu_si256((const __m256i *)(b + i + 32))));
+    if ((uint32_t)_mm256_movemask_epi8(eq) != 0xffffffffU)
+      break;
+  }
+  for (; i + 32 <= n; i += 32) {
+    eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                           _mm256_loadu_si256((const __m256i *)(b + i)));
+    if ((uint32_t)_mm256_movemask_epi8(eq) != 0xffffffffU)
+      break;
+  }
+  return i + find_difference_c(a + i, b + i, n - i);
+}
+#endif
+
+#ifdef HAVE_NEON
+static size_t find_difference_neon(const uint8_t *a, const uint8_t *b, size_t n)
+{
+  size_t i = 0;
+  uint8x16_t eq;
+  uint64x2_t lanes;
+
+  for (; i + 64 <= n; i += 64) {
+    eq = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i)),
+                           vceqq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16))),
+                  vandq_u8(vceqq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32)),
+                           vceqq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48))));
+    lanes = vreinterpretq_u64_u8(eq);
+    if ((vgetq_lane_u64(lanes, 0) & vgetq_lane_u64(lanes, 1)) != ~(uint64_t)0)
+      break;
+  }
+  return i + find_difference_c(a + i, b + i, n - i);
+}
+#endif
+
+size_t simd_find_difference(const uint8_t *a, const uint8_t *b, size_t n)
+{
+  size_t (*find)(const uint8_t *, const uint8_t *, size_t) = find_difference_c;
+  int features = simd_features();
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    find = find_difference_sse2;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    find = find_difference_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    find = find_difference_neon;
+#endif
+  (void)features;
+
+  return find(a, b, n);
+}
+
+/*
+ * Byte shuffles, for 32 bit pixel translation between formats that only
+ * differ in where red, green and blue are. The vector kernels look each
+ * byte up in the pixel with a table instruction, whose index is the map
+ * repeated for every pixel in the register; indices past the register
+ * come out as 0. What doesn't fill a register is left to the C one.
+ */
+
+static void shuffle32_c(uint8_t *dst, const uint8_t *src, int w, const uint8_t map[4])
+{
+  uint8_t px[5];
+  int idx[4], k;
+
+  /* byte 4 stays 0 for what the map leaves empty */
+  px[4] = 0;
+  for (k = 0; k < 4; k++)
+    idx[k] = map[k] < 4 ? map[k] : 4;
+  for (; w > 0; w--, dst += 4, src += 4) {
+    memcpy(px, src, 4);
+    dst[0] = px[idx[0]];
+    dst[1] = px[idx[1]];
+    dst[2] = px[idx[2]];
+    dst[3] = px[idx[3]];
+  }
+}
+
+/* the map repeated over n bytes, within a register lane of lane bytes */
+static void shuffle_index(uint8_t *idx, int n, int lane, const uint8_t map[4])
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    idx[i] = map[i & 3] < 4 ? (uint8_t)((i & (lane - 4)) + map[i & 3]) : 0x80;
+}
+
+#ifdef HAVE_SSSE3
+TARGET_SSSE3 static void shuffle32_ssse3(uint8_t *dst, const uint8_t *src, int w, const uint8_t map[4])
+{
+  uint8_t idx[16];
+  __m128i m;
+
+  shuffle_index(idx, 16, 16, map);
+  m = _mm_loadu_si128((const __m128i *)idx);
+  for (; w >= 8; w -= 8, dst += 32, src += 32) {
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), m));
+    _mm_storeu_si128((__m128i *)(dst + 16),
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 16)), m));
+  }
+  for (; w >= 4; w -= 4, dst += 16, src += 16)
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), m));
+  shuffle32_c(dst, src, w, map);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void shuffle32_avx2(uint8_t *dst, const uint8_t *src, int w, const uint8_t map[4])
+{
+  uint8_t idx[32];
+  __m256i m;
+
+  /* vpshufb looks up within each 128 bit half */
+  shuffle_index(idx, 32, 16, map);
+  m = _mm256_loadu_si256((const __m256i *)idx);
+  for (; w >= 16; w -= 16, dst += 64, src += 64) {
+    _mm256_storeu_si256((__m256i *)dst,
+                        _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), m));
+    _mm256_storeu_si256((__m256i *)(dst + 32),
+                        _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + 32)), m));
+  }
+  for (; w >= 8; w -= 8, dst += 32, src += 32)
+    _mm256_storeu_si256((__m256i *)dst,
+                        _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), m));
+  shuffle32_c(dst, src, w, map);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void shuffle32_neon(uint8_t *dst, const uint8_t *src, int w, const uint8_t map[4])
+{
+#ifdef __aarch64__
+  uint8_t idx[16];
+  uint8x16_t m;
+
+  shuffle_index(idx, 16, 16, map);
+  m = vld1q_u8(idx);
+  for (; w >= 4; w -= 4, dst += 16, src += 16)
+    vst1q_u8(dst, vqtbl1q_u8(vld1q_u8(src), m));
+#else
+  uint8_t idx[8];
+  uint8x8_t m;
+
+  shuffle_index(idx, 8, 8, map);
+  m = vld1_u8(idx);
+  for (; w >= 2; w -= 2, dst += 8, src += 8)
+    vst1_u8(dst, vtbl1_u8(vld1_u8(src), m));
+#endif
+  shuffle32_c(dst, src, w, map);
+}
+#endif
+
+void simd_shuffle32(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+                    int w, int h, const uint8_t map[4])
+{
+  void (*shuffle)(uint8_t *, const uint8_t *, int, const uint8_t *) = shuffle32_c;
+  int features = simd_features();
+
+  if (w <= 0 || h <= 0)
+    return;
+
+#ifdef HAVE_SSSE3
+  if (features & SIMD_SSSE3)
+    shuffle = shuffle32_ssse3;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    shuffle = shuffle32_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    shuffle = shuffle32_neon;
+#endif
+  (void)features;
+
+  /* whole rows back to back go in one */
+  if (dst_stride == w * 4 && src_stride == w * 4 && (size_t)w * h <= 0x7fffffff) {
+    w *= h;
+    h = 1;
+  }
+  for (; h > 0; h--, dst += dst_stride, src += src_stride)
+    shuffle(dst, src, w, map);
+}
+
+/*
+ * Packing 32 bit pixels into 16 bits. Each channel is scaled as
+ * (value * max + 127) / 255, where the division is done as
+ * (x + 1 + (x >> 8)) >> 8, exact for the x that come up here. The
+ * vector kernels work on 32 bit lanes, the product fitting the low half
+ * of each, and narrow the results to 16 bits at the end.
+ */
+
+static void pack32to16_c(uint8_t *dst, const uint8_t *src, int w, const simd_pack_format *fmt)
+{
+  uint32_t p, x;
+  uint16_t v;
+  int c;
+
+  for (; w > 0; w--, dst += 2, src += 4) {
+    memcpy(&p, src, 4);
+    v = 0;
+    for (c = 0; c < 3; c++) {
+      x = ((p >> fmt->in_shift[c]) & 0xff) * fmt->max[c] + 127;
+      v |= (uint16_t)(x / 255 << fmt->out_shift[c]);
+    }
+    if (fmt->swap)
+      v = (uint16_t)(v << 8 | v >> 8);
+    memcpy(dst, &v, 2);
+  }
+}
+
+#ifdef HAVE_SSE2
+typedef struct {
+  __m128i in_shift[3], max[3], out_shift[3];
+} pack_sse2_consts;
+
+static __m128i pack_sse2(__m128i p, const pack_sse2_consts *k)
+{
+  __m128i x, v = _mm_setzero_si128();
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    x = _mm_and_si128(_mm_srl_epi32(p, k->in_shift[c]), _mm_set1_epi32(0xff));
+    x = _mm_add_epi32(_mm_mullo_epi16(x, k->max[c]), _mm_set1_epi32(127));
+    x = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, _mm_set1_epi32(1)),
+                                     _mm_srli_epi32(x, 8)), 8);
+    v = _mm_or_si128(v, _mm_sll_epi32(x, k->out_shift[c]));
+  }
+  /* biased, so the signed saturating pack keeps all 16 bits */
+  return _mm_sub_epi32(v, _mm_set1_epi32(0x8000));
+}
+
+static void pack32to16_sse2(uint8_t *dst, const uint8_t *src, int w, const simd_pack_format *fmt)
+{
+  pack_sse2_consts k;
+  __m128i r;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    k.in_shift[c] = _mm_cvtsi32_si128(fmt->in_shift[c]);
+    k.max[c] = _mm_set1_epi32(fmt->max[c]);
+    k.out_shift[c] = _mm_cvtsi32_si128(fmt->out_shift[c]);
+  }
+  for (; w >= 8; w -= 8, dst += 16, src += 32) {
+    r = _mm_packs_epi32(pack_sse2(_mm_loadu_si128((const __m128i *)src), &k),
+                        pack_sse2(_mm_loadu_si128((const __m128i *)(src + 16)), &k));
+    r = _mm_xor_si128(r, _mm_set1_epi16((short)0x8000));
+    if (fmt->swap)
+      r = _mm_or_si128(_mm_slli_epi16(r, 8), _mm_srli_epi16(r, 8));
+    _mm_storeu_si128((__m128i *)dst, r);
+  }
+  pack32to16_c(dst, src, w, fmt);
+}
+#endif
+
+#ifdef HAVE_AVX2
+typedef struct {
+  __m128i in_shift[3], out_shift[3];
+  __m256i max[3];
+} pack_avx2_consts;
+
+TARGET_AVX2 static __m256i pack_avx2(__m256i p, const pack_avx2_consts *k)
+{
+  __m256i x, v = _mm256_setzero_si256();
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    x = _mm256_and_si256(_mm256_srl_epi32(p, k->in_shift[c]), _mm256_set1_epi32(0xff));
+    x = _mm256_add_epi32(_mm256_mullo_epi16(x, k->max[c]), _mm256_set1_epi32(127));
+    x = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(1)),
+                                           _mm256_srli_epi32(x, 8)), 8);
+    v = _mm256_or_si256(v, _mm256_sll_epi32(x, k->out_shift[c]));
+  }
+  return v;
+}
+
+TARGET_AVX2 static void pack32to16_avx2(uint8_t *dst, const uint8_t *src, int w, const simd_pack_format *fmt)
+{
+  pack_avx2_consts k;
+  __m256i r;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    k.in_shift[c] = _mm_cvtsi32_si128(fmt->in_shift[c]);
+    k.max[c] = _mm256_set1_epi32(fmt->max[c]);
+    k.out_shift[c] = _mm_cvtsi32_si128(fmt->out_shift[c]);
+  }
+  for (; w >= 16; w -= 16, dst += 32, src += 64) {
+    /* packs within each 128 bit half, the permute puts the pixels back in order */
+    r = _mm256_packus_epi32(pack_avx2(_mm256_loadu_si256((const __m256i *)src), &k),
+                            pack_avx2(_mm256_loadu_si256((const __m256i *)(src + 32)), &k));
+    r = _mm256_permute4x64_epi64(r, 0xd8);
+    if (fmt->swap)
+      r = _mm256_or_si256(_mm256_slli_epi16(r, 8), _mm256_srli_epi16(r, 8));
+    _mm256_storeu_si256((__m256i *)dst, r);
+  }
+  pack32to16_c(dst, src, w, fmt);
+}
+#endif
+
+#ifdef HAVE_NEON
+typedef struct {
+  int32x4_t in_shift[3], out_shift[3];
+  uint32x4_t max[3];
+} pack_neon_consts;
+
+static uint16x4_t pack_neon(uint32x4_t p, const pack_neon_consts *k)
+{
+  uint32x4_t x, v = vdupq_n_u32(0);
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    x = vandq_u32(vshlq_u32(p, k->in_shift[c]), vdupq_n_u32(0xff));
+    x = vmlaq_u32(vdupq_n_u32(127), x, k->max[c]);
+    x = vshrq_n_u32(vaddq_u32(vaddq_u32(x, vdupq_n_u32(1)), vshrq_n_u32(x, 8)), 8);
+    v = vorrq_u32(v, vshlq_u32(x, k->out_shift[c]));
+  }
+  return vmovn_u32(v);
+}
+
+static void pack32to16_neon(uint8_t *dst, const uint8_t *src, int w, const simd_pack_format *fmt)
+{
+  pack_neon_consts k;
+  uint8x16_t r;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    /* vshlq shifts right by negative counts */
+    k.in_shift[c] = vdupq_n_s32(-fmt->in_shift[c]);
+    k.max[c] = vdupq_n_u32(fmt->max[c]);
+    k.out_shift[c] = vdupq_n_s32(fmt->out_shift[c]);
+  }
+  for (; w >= 8; w -= 8, dst += 16, src += 32) {
+    r = vreinterpretq_u8_u16(vcombine_u16(
+          pack_neon(vreinterpretq_u32_u8(vld1q_u8(src)), &k),
+          pack_neon(vreinterpretq_u32_u8(vld1q_u8(src + 16)), &k)));
+    if (fmt->swap)
+      r = vrev16q_u8(r);
+    vst1q_u8(dst, r);
+  }
+  pack32to16_c(dst, src, w, fmt);
+}
+#endif
+
+void simd_pack32to16(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+                     int w, int h, const simd_pack_format *fmt)
+{
+  void (*pack)(uint8_t *, const uint8_t *, int, const simd_pack_format *) = pack32to16_c;
+  int features = simd_features();
+
+  if (w <= 0 || h <= 0)
+    return;
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    pack = pack32to16_sse2;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    pack = pack32to16_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    pack = pack32to16_neon;
+#endif
+  (void)features;
+
+  if (dst_stride == w * 2 && src_stride == w * 4 && (size_t)w * h <= 0x7fffffff) {
+    w *= h;
+    h = 1;
+  }
+  for (; h > 0; h--, dst += dst_stride, src += src_stride)
+    pack(dst, src, w, fmt);
+}
+
+/*
+ * 16 bit pixels taken apart into a byte per channel, the other way from
+ * simd_pack32to16() but without scaling, so that the byte kernels can
+ * work on them.
+ */
+
+static void unpack16_c(uint8_t *dst, const uint8_t *src, int n, const int shift[3], const int max[3])
+{
+  uint16_t p;
+  int i;
+
+  for (i = 0; i < n; i++, src += 2, dst += 4) {
+    memcpy(&p, src, 2);
+    dst[0] = (uint8_t)((p >> shift[0]) & max[0]);
+    dst[1] = (uint8_t)((p >> shift[1]) & max[1]);
+    dst[2] = (uint8_t)((p >> shift[2]) & max[2]);
+    dst[3] = 0;
+  }
+}
+
+#ifdef HAVE_SSE2
+static void unpack16_sse2(uint8_t *dst, const uint8_t *src, int n, const int shift[3], const int max[3])
+{
+  const __m128i s0 = _mm_cvtsi32_si128(shift[0]), m0 = _mm_set1_epi16((short)max[0]);
+  const __m128i s1 = _mm_cvtsi32_si128(shift[1]), m1 = _mm_set1_epi16((short)max[1]);
+  const __m128i s2 = _mm_cvtsi32_si128(shift[2]), m2 = _mm_set1_epi16((short)max[2]);
+  __m128i p, c01, c2;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8, src += 16, dst += 32) {
+    p = _mm_loadu_si128((const __m128i *)src);
+    c01 = _mm_or_si128(_mm_and_si128(_mm_srl_epi16(p, s0), m0),
+                       _mm_slli_epi16(_mm_and_si128(_mm_srl_epi16(p, s1), m1), 8));
+    c2 = _mm_and_si128(_mm_srl_epi16(p, s2), m2);
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(c01, c2));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(c01, c2));
+  }
+  unpack16_c(dst, src, n - i, shift, max);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void unpack16_neon(uint8_t *dst, const uint8_t *src, int n, const int shift[3], const int max[3])
+{
+  const int16x8_t s0 = vdupq_n_s16((int16_t)-shift[0]), s1 = vdupq_n_s16((int16_t)-shift[1]);
+  const int16x8_t s2 = vdupq_n_s16((int16_t)-shift[2]);
+  const uint16x8_t m0 = vdupq_n_u16((uint16_t)max[0]), m1 = vdupq_n_u16((uint16_t)max[1]);
+  const uint16x8_t m2 = vdupq_n_u16((uint16_t)max[2]);
+  uint16x8_t p;
+  uint8x8x4_t out;
+  int i = 0;
+
+  out.val[3] = vdup_n_u8(0);
+  for (; i + 8 <= n; i += 8, src += 16, dst += 32) {
+    p = vreinterpretq_u16_u8(vld1q_u8(src));
+    out.val[0] = vmovn_u16(vandq_u16(vshlq_u16(p, s0), m0));
+    out.val[1] = vmovn_u16(vandq_u16(vshlq_u16(p, s1), m1));
+    out.val[2] = vmovn_u16(vandq_u16(vshlq_u16(p, s2), m2));
+    vst4_u8(dst, out);
+  }
+  unpack16_c(dst, src, n - i, shift, max);
+}
+#endif
+
+void simd_unpack16(uint8_t *dst, const uint8_t *src, int n, const int shift[3], const int max[3])
+{
+  void (*unpack)(uint8_t *, const uint8_t *, int, const int *, const int *) = unpack16_c;
+  int features = simd_features();
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    unpack = unpack16_sse2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    unpack = unpack16_neon;
+#endif
+  (void)features;
+
+  unpack(dst, src, n, shift, max);
+}
+
+/*
+ * Weighted sums of rows of bytes, for the area averaging of server side
+ * scaling. The vector kernels widen the bytes to 32 bit lanes; as weights
+ * are below 65536, SSE2 puts each product together from the low and high
+ * halves of 16 bit multiplies.
+ */
+
+static void accumulate_u8_c(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight)
+{
+  size_t i;
+
+  if (weight == 1)
+    for (i = 0; i < n; i++)
+      acc[i] += src[i];
+  else
+    for (i = 0; i < n; i++)
+      acc[i] += src[i] * weight;
+}
+
+#ifdef HAVE_SSE2
+static void accumulate_u8_sse2(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w = _mm_set1_epi16((short)weight);
+  __m128i p, x, lo, hi;
+  size_t i = 0;
+  int k;
+
+  for (; i + 16 <= n; i += 16) {
+    p = _mm_loadu_si128((const __m128i *)(src + i));
+    for (k = 0; k < 2; k++) {
+      x = k ? _mm_unpackhi_epi8(p, zero) : _mm_unpacklo_epi8(p, zero);
+      lo = _mm_mullo_epi16(x, w);
+      hi = _mm_mulhi_epu16(x, w);
+      _mm_storeu_si128((__m128i *)(acc + i + 8 * k),
+                       _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i + 8 * k)),
+                                     _mm_unpacklo_epi16(lo, hi)));
+      _mm_storeu_si128((__m128i *)(acc + i + 8 * k + 4),
+                       _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i + 8 * k + 4)),
+                                     _mm_unpackhi_epi16(lo, hi)));
+    }
+  }
+  accumulate_u8_c(acc + i, src + i, n - i, weight);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void accumulate_u8_avx2(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight)
+{
+  const __m256i w = _mm256_set1_epi32((int)weight);
+  __m256i x;
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+    if (weight != 1)
+      x = _mm256_mullo_epi32(x, w);
+    _mm256_storeu_si256((__m256i *)(acc + i),
+                        _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(acc + i)), x));
+  }
+  accumulate_u8_c(acc + i, src + i, n - i, weight);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void accumulate_u8_neon(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight)
+{
+  const uint16x4_t w = vdup_n_u16((uint16_t)weight);
+  uint16x8_t x;
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    x = vmovl_u8(vld1_u8(src + i));
+    vst1q_u32(acc + i, vmlal_u16(vld1q_u32(acc + i), vget_low_u16(x), w));
+    vst1q_u32(acc + i + 4, vmlal_u16(vld1q_u32(acc + i + 4), vget_high_u16(x), w));
+  }
+  accumulate_u8_c(acc + i, src + i, n - i, weight);
+}
+#endif
+
+void simd_accumulate_u8(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight)
+{
+  void (*accumulate)(uint32_t *, const uint8_t *, size_t, uint32_t) = accumulate_u8_c;
+  int features = simd_features();
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    accumulate = accumulate_u8_sse2;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    accumulate = accumulate_u8_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    accumulate = accumulate_u8_neon;
+#endif
+  (void)features;
+
+  accumulate(acc, src, n, weight);
+}
+
+/*
+ * The other half of the area averaging: runs of accumulators added up
+ * and divided by a multiplication with a fixed point reciprocal. The
+ * vector kernels add whole pixels at a time and multiply lanes 0 and 2
+ * and lanes 1 and 3 of four sums into 64 bit products.
+ */
+
+static void average_u32_c(uint8_t *dst, const uint32_t *acc, int n, int count,
+                          uint32_t m, int shift, const uint8_t mask[4])
+{
+  uint32_t sum[4];
+  int i, j, k;
+
+  for (i = 0; i < n; i++, dst += 4) {
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+    for (j = 0; j < count; j++, acc += 4)
+      for (k = 0; k < 4; k++)
+        sum[k] += acc[k];
+    for (k = 0; k < 4; k++)
+      dst[k] = (uint8_t)(((uint64_t)sum[k] * m) >> shift) & mask[k];
+  }
+}
+
+#ifdef HAVE_SSE2
+static __m128i average_sse2(const uint32_t *acc, int count, __m128i m, __m128i shift)
+{
+  __m128i sum = _mm_loadu_si128((const __m128i *)acc), even, odd;
+  int j;
+
+  for (j = 1; j < count; j++)
+    sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(acc + 4 * j)));
+  even = _mm_srl_epi64(_mm_mul_epu32(sum, m), shift);
+  odd = _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(sum, 32), m), shift);
+  return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+static void average_u32_sse2(uint8_t *dst, const uint32_t *acc, int n, int count,
+                             uint32_t m, int shift, const uint8_t mask[4])
+{
+  const __m128i mv = _mm_set1_epi32((int)m);
+  const __m128i sv = _mm_cvtsi32_si128(shift);
+  __m128i a, b, c, d, maskv;
+  uint32_t mask32;
+  int i = 0;
+
+  memcpy(&mask32, mask, 4);
+  maskv = _mm_set1_epi32((int)mask32);
+  for (; i + 4 <= n; i += 4, dst += 16, acc += 16 * count) {
+    a = average_sse2(acc, count, mv, sv);
+    b = average_sse2(acc + 4 * count, count, mv, sv);
+    c = average_sse2(acc + 8 * count, count, mv, sv);
+    d = average_sse2(acc + 12 * count, count, mv, sv);
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_and_si128(_mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)),
+                                   maskv));
+  }
+  average_u32_c(dst, acc, n - i, count, m, shift, mask);
+}
+#endif
+
+#ifdef HAVE_NEON
+static uint32x4_t average_neon(const uint32_t *acc, int count, uint32x2_t m, int64x2_t shift)
+{
+  uint32x4_t sum = vld1q_u32(acc);
+  uint64x2_t lo, hi;
+  int j;
+
+  for (j = 1; j < count; j++)
+    sum = vaddq_u32(sum, vld1q_u32(acc + 4 * j));
+  lo = vshlq_u64(vmull_u32(vget_low_u32(sum), m), shift);
+  hi = vshlq_u64(vmull_u32(vget_high_u32(sum), m), shift);
+  return vcombine_u32(vmovn_u64(lo), vmovn_u64(hi));
+}
+
+static void average_u32_neon(uint8_t *dst, const uint32_t *acc, int n, int count,
+                             uint32_t m, int shift, const uint8_t mask[4])
+{
+  const uint32x2_t mv = vdup_n_u32(m);
+  const int64x2_t sv = vdupq_n_s64(-shift);
+  uint32_t mask32;
+  uint8x8_t maskv;
+  uint16x4_t a, b;
+  int i = 0;
+
+  memcpy(&mask32, mask, 4);
+  maskv = vreinterpret_u8_u32(vdup_n_u32(mask32));
+  for (; i + 2 <= n; i += 2, dst += 8, acc += 8 * count) {
+    a = vmovn_u32(average_neon(acc, count, mv, sv));
+    b = vmovn_u32(average_neon(acc + 4 * count, count, mv, sv));
+    vst1_u8(dst, vand_u8(vmovn_u16(vcombine_u16(a, b)), maskv));
+  }
+  average_u32_c(dst, acc, n - i, count, m, shift, mask);
+}
+#endif
+
+void simd_average_u32(uint8_t *dst, const uint32_t *acc, int n, int count,
+                      uint32_t m, int shift, const uint8_t mask[4])
+{
+  void (*average)(uint8_t *, const uint32_t *, int, int, uint32_t, int, const uint8_t *) =
+    average_u32_c;
+  int features = simd_features();
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    average = average_u32_sse2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    average = average_u32_neon;
+#endif
+  (void)features;
+
+  if (n > 0 && count > 0)
+    average(dst, acc, n, count, m, shift, mask);
+}
+
+/*
+ * WebSocket masking. The mask repeats every four bytes, so it is XORed in
+ * a word or a register at a time; what is left is done a byte at a time
+ * with the mask where it has got to.
+ */
+
+static void xor_mask_c(uint8_t *data, size_t n, const uint8_t mask[4])
+{
+  size_t i = 0;
+  uint64_t pattern, w;
+
+  memcpy(&pattern, mask, 4);
+  memcpy((uint8_t *)&pattern + 4, mask, 4);
+  for (; i + 8 <= n; i += 8) {
+    memcpy(&w, data + i, 8);
+    w ^= pattern;
+    memcpy(data + i, &w, 8);
+  }
+  for (; i < n; i++)
+    data[i] ^= mask[i % 4];
+}
+
+#ifdef HAVE_SSE2
+static void xor_mask_sse2(uint8_t *data, size_t n, const uint8_t mask[4])
+{
+  size_t i = 0;
+  uint32_t m;
+  __m128i pattern;
+
+  memcpy(&m, mask, 4);
+  pattern = _mm_set1_epi32((int)m);
+  for (; i + 64 <= n; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(data + i + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(data + i + 48));
+    _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(a, pattern));
+    _mm_storeu_si128((__m128i *)(data + i + 16), _mm_xor_si128(b, pattern));
+    _mm_storeu_si128((__m128i *)(data + i + 32), _mm_xor_si128(c, pattern));
+    _mm_storeu_si128((__m128i *)(data + i + 48), _mm_xor_si128(d, pattern));
+  }
+  for (; i + 16 <= n; i += 16)
+    _mm_storeu_si128((__m128i *)(data + i),
+                     _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i)), pattern));
+  xor_mask_c(data + i, n - i, mask);
+}
+#endif
+
+#ifdef HAVE_AVX2
+TARGET_AVX2 static void xor_mask_avx2(uint8_t *data, size_t n, const uint8_t mask[4])
+{
+  size_t i = 0;
+  uint32_t m;
+  __m256i pattern;
+
+  memcpy(&m, mask, 4);
+  pattern = _mm256_set1_epi32((int)m);
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+    _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(a, pattern));
+    _mm256_storeu_si256((__m256i *)(data + i + 32), _mm256_xor_si256(b, pattern));
+  }
+  for (; i + 32 <= n; i += 32)
+    _mm256_storeu_si256((__m256i *)(data + i),
+                        _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(data + i)), pattern));
+  xor_mask_c(data + i, n - i, mask);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void xor_mask_neon(uint8_t *data, size_t n, const uint8_t mask[4])
+{
+  size_t i = 0;
+  uint32_t m;
+  uint8x16_t pattern;
+
+  memcpy(&m, mask, 4);
+  pattern = vreinterpretq_u8_u32(vdupq_n_u32(m));
+  for (; i + 64 <= n; i += 64) {
+    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), pattern));
+    vst1q_u8(data + i + 16, veorq_u8(vld1q_u8(data + i + 16), pattern));
+    vst1q_u8(data + i + 32, veorq_u8(vld1q_u8(data + i + 32), pattern));
+    vst1q_u8(data + i + 48, veorq_u8(vld1q_u8(data + i + 48), pattern));
+  }
+  for (; i + 16 <= n; i += 16)
+    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), pattern));
+  xor_mask_c(data + i, n - i, mask);
+}
+#endif
+
+void simd_xor_mask(uint8_t *data, size_t n, const uint8_t mask[4])
+{
+  void (*xor_mask)(uint8_t *, size_t, const uint8_t *) = xor_mask_c;
+  int features = simd_features();
+
+#ifdef HAVE_SSE2
+  if (features & SIMD_SSE2)
+    xor_mask = xor_mask_sse2;
+#endif
+#ifdef HAVE_AVX2
+  if (features & SIMD_AVX2)
+    xor_mask = xor_mask_avx2;
+#endif
+#ifdef HAVE_NEON
+  if (features & SIMD_NEON)
+    xor_mask = xor_mask_neon;
+#endif
+  (void)features;
+
+  xor_mask(data, n, mask);
+}
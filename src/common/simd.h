@@ -0,0 +1,119 @@
+/*
+ *  LibVNCServer/LibVNCClient common SIMD helpers: CPU feature detection
+ *  and the framebuffer kernels built on it.
+ *
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#ifndef _RFB_COMMON_SIMD_H
+#define _RFB_COMMON_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIMD_SSE2 0x01
+#define SIMD_AVX2 0x02
+#define SIMD_NEON 0x04
+#define SIMD_SSSE3 0x08
+
+/*
+   Returns the SIMD_* instruction sets that were compiled in and that the
+   CPU supports. Detection runs once; the result is cached.
+ */
+int simd_features(void);
+
+/*
+   Restricts the kernels below to the given SIMD_* sets, 0 meaning plain C.
+   Pass -1 to go back to everything detected. Meant for tests and
+   benchmarks that compare the code paths.
+ */
+void simd_set_features(int mask);
+
+/*
+   Fills a w x h rectangle of bpp bit pixels (8, 16 or 32) starting at dst,
+   whose rows are stride bytes apart, with colour.
+ */
+void simd_fill_rect(uint8_t *dst, int stride, int bpp, int w, int h, uint32_t colour);
+
+/*
+   Moves h rows of row_bytes bytes each from src to dst inside a buffer whose
+   rows are stride bytes apart. Source and destination may overlap.
+ */
+void simd_move_rect(uint8_t *dst, const uint8_t *src, int stride, int row_bytes, int h);
+
+/*
+   Returns the offset of the first byte in which the n bytes at a and b
+   differ, or n if they are all the same.
+ */
+size_t simd_find_difference(const uint8_t *a, const uint8_t *b, size_t n);
+
+/*
+   Rearranges the bytes of w x h 32 bit pixels: byte i of each pixel at dst
+   is byte map[i] of the one at src, or 0 if map[i] is not 0 to 3. Rows are
+   src_stride and dst_stride bytes apart.
+ */
+void simd_shuffle32(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+                    int w, int h, const uint8_t map[4]);
+
+/*
+   How simd_pack32to16() turns each of red, green and blue of a 32 bit
+   pixel into its part of a 16 bit one: the 8 bit value at in_shift is
+   scaled to 0..max, rounding like libvncserver's translation tables, and
+   moved to out_shift. max is one less than a power of two, 255 at most.
+ */
+typedef struct {
+  int in_shift[3];
+  int max[3];
+  int out_shift[3];
+  int swap;  /* byte swap the 16 bit results */
+} simd_pack_format;
+
+/*
+   Converts w x h 32 bit pixels at src into 16 bit ones at dst, as fmt
+   says. Rows are src_stride and dst_stride bytes apart.
+ */
+void simd_pack32to16(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+                     int w, int h, const simd_pack_format *fmt);
+
+/*
+   Takes n 16 bit pixels at src apart: bytes 0, 1 and 2 of each 32 bit
+   pixel at dst are its channels k, (pixel >> shift[k]) & max[k], and byte
+   3 is 0. max is 255 at most.
+ */
+void simd_unpack16(uint8_t *dst, const uint8_t *src, int n, const int shift[3], const int max[3]);
+
+/*
+   Adds src[i] * weight to acc[i] for the n bytes at src. weight is less
+   than 65536.
+ */
+void simd_accumulate_u8(uint32_t *acc, const uint8_t *src, size_t n, uint32_t weight);
+
+/*
+   Averages runs of count groups of four 32 bit sums: byte k of pixel i at
+   dst is the sum of acc[4 * (i * count + j) + k] over j < count, times m,
+   shifted right by shift and ANDed with mask[k], for n pixels. The sums
+   and results have to fit 32 and 8 bits, and shift is 32 or more.
+ */
+void simd_average_u32(uint8_t *dst, const uint32_t *acc, int n, int count,
+                      uint32_t m, int shift, const uint8_t mask[4]);
+
+/*
+   XORs the n bytes at data with the four at mask over and over, byte i
+   with mask[i % 4], as WebSocket payloads are masked and unmasked.
+ */
+void simd_xor_mask(uint8_t *data, size_t n, const uint8_t mask[4]);
+
+#endif /* _RFB_COMMON_SIMD_H */
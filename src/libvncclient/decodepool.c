@@ -0,0 +1,404 @@
+/*
+ * decodepool.c - decodes rects on worker threads.
+ *
+ * The thread calling HandleRFBServerMessage() keeps reading the socket and
+ * inflating zlib data in stream order; only self-contained JPEG payloads
+ * are passed on. Each worker owns a TurboJPEG handle and writes straight
+ * into its rect of the framebuffer. Decoders whose payload has already
+ * been inflated, like the tiles of a ZRLE rect, can also split it up and
+ * run the parts on the pool together with the reading thread.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <stdlib.h>
+#include <rfb/rfbclient.h>
+#include "decodepool.h"
+
+#if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) || defined(LIBVNCSERVER_HAVE_WIN32THREADS)
+
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+#include "turbojpeg.h"
+#endif
+
+#define MAX_DECODE_THREADS 64
+
+typedef struct {
+  DecodeJobProc proc;
+  uint8_t *data;
+  int len;
+  int x, y, w, h;
+} DecodeJob;
+
+typedef struct {
+  rfbClient* client;
+  int nThreads;
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+  pthread_t threads[MAX_DECODE_THREADS];
+#else
+  uintptr_t threads[MAX_DECODE_THREADS];
+#endif
+  MUTEX(mutex);
+  COND(workAvailable);
+  COND(workDone);
+  /* jobs[next..count) are waiting, finished counts those done */
+  DecodeJob *jobs;
+  int allocated, count, next, finished;
+  rfbBool failed, quit, queuedLast;
+  /* the tasks of RunDecodeTasks(), taskNext..taskCount still to start */
+  COND(tasksDone);
+  DecodeTaskProc taskProc;
+  void *taskArg;
+  int taskCount, taskNext, taskDone;
+  rfbBool taskFailed;
+} DecodePool;
+
+static THREAD_ROUTINE_RETURN_TYPE
+DecodeWorker(void *arg)
+{
+  DecodePool *pool = (DecodePool *)arg;
+  char *scratch = NULL;
+  int scratchSize = 0;
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+  tjhandle tjhnd = tjInitDecompress();
+
+  if (tjhnd == NULL)
+    rfbClientLog("TurboJPEG error: %s\n", tjGetErrorStr());
+#else
+  void *tjhnd = NULL;
+#endif
+
+  LOCK(pool->mutex);
+  for (;;) {
+    DecodeJob job;
+    rfbBool ok;
+
+    while (pool->next == pool->count && pool->taskNext == pool->taskCount &&
+           !pool->quit)
+      WAIT(pool->workAvailable, pool->mutex);
+    if (pool->quit)
+      break;
+
+    if (pool->taskNext < pool->taskCount) {
+      DecodeTaskProc proc = pool->taskProc;
+      void *taskArg = pool->taskArg;
+      int task = pool->taskNext++;
+
+      UNLOCK(pool->mutex);
+      ok = proc(pool->client, taskArg, task, &scratch, &scratchSize);
+      LOCK(pool->mutex);
+      if (!ok)
+        pool->taskFailed = TRUE;
+      if (++pool->taskDone == pool->taskCount)
+        TSIGNAL(pool->tasksDone);
+      continue;
+    }
+
+    job = pool->jobs[pool->next++];
+    UNLOCK(pool->mutex);
+
+    ok = tjhnd != NULL &&
+      job.proc(pool->client, tjhnd, job.data, job.len, job.x, job.y, job.w, job.h,
+               &scratch, &scratchSize);
+
+    LOCK(pool->mutex);
+    if (!ok)
+      pool->failed = TRUE;
+    if (++pool->finished == pool->count)
+      TSIGNAL(pool->workDone);
+  }
+  UNLOCK(pool->mutex);
+  /* pass the wakeup on to the next worker */
+  TSIGNAL(pool->workAvailable);
+
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+  if (tjhnd)
+    tjDestroy(tjhnd);
+#endif
+  free(scratch);
+  return THREAD_ROUTINE_RETURN_VALUE;
+}
+
+static DecodePool *
+StartDecodePool(rfbClient* client)
+{
+  DecodePool *pool;
+  int i;
+
+  pool = calloc(1, sizeof(DecodePool));
+  if (pool == NULL)
+    return NULL;
+
+  pool->client = client;
+  INIT_MUTEX(pool->mutex);
+  INIT_COND(pool->workAvailable);
+  INIT_COND(pool->workDone);
+  INIT_COND(pool->tasksDone);
+
+  for (i = 0; i < client->decodeThreads && i < MAX_DECODE_THREADS; i++) {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    if (pthread_create(&pool->threads[i], NULL, DecodeWorker, pool) != 0)
+      break;
+#else
+    pool->threads[i] = _beginthread(DecodeWorker, 0, pool);
+    if (pool->threads[i] == (uintptr_t)-1L)
+      break;
+#endif
+  }
+  pool->nThreads = i;
+
+  if (pool->nThreads == 0) {
+    rfbClientLog("Could not start decode threads, decoding inline\n");
+    client->decodePool = pool;
+    FreeDecodePool(client);
+    client->decodeThreads = 0;
+    return NULL;
+  }
+
+  client->decodePool = pool;
+  return pool;
+}
+
+rfbBool
+QueueDecodeJob(rfbClient* client, DecodeJobProc proc,
+               uint8_t *data, int len, int x, int y, int w, int h)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+  DecodeJob *job;
+
+  if (pool == NULL) {
+    if (client->decodeThreads <= 0 || (pool = StartDecodePool(client)) == NULL)
+      return FALSE;
+  }
+
+  LOCK(pool->mutex);
+  if (pool->count == pool->allocated) {
+    int allocated = pool->allocated ? pool->allocated * 2 : 16;
+    DecodeJob *jobs = realloc(pool->jobs, allocated * sizeof(DecodeJob));
+    if (jobs == NULL) {
+      UNLOCK(pool->mutex);
+      return FALSE;
+    }
+    pool->jobs = jobs;
+    pool->allocated = allocated;
+  }
+  job = &pool->jobs[pool->count++];
+  job->proc = proc;
+  job->data = data;
+  job->len = len;
+  job->x = x;
+  job->y = y;
+  job->w = w;
+  job->h = h;
+  TSIGNAL(pool->workAvailable);
+  UNLOCK(pool->mutex);
+
+  pool->queuedLast = TRUE;
+  return TRUE;
+}
+
+rfbBool
+DecodeJobQueued(rfbClient* client)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+  rfbBool queued;
+
+  if (pool == NULL)
+    return FALSE;
+  queued = pool->queuedLast;
+  pool->queuedLast = FALSE;
+  return queued;
+}
+
+static rfbBool
+DrainDecodeJobs(DecodePool *pool, rfbBool report)
+{
+  rfbClient* client = pool->client;
+  rfbBool failed;
+  int i, n;
+
+  LOCK(pool->mutex);
+  while (pool->finished < pool->count)
+    WAIT(pool->workDone, pool->mutex);
+  failed = pool->failed;
+  n = pool->count;
+  pool->failed = FALSE;
+  pool->count = pool->next = pool->finished = 0;
+  UNLOCK(pool->mutex);
+
+  /* Only this thread queues jobs, so the array stays put from here on. */
+  for (i = 0; i < n; i++) {
+    DecodeJob *job = &pool->jobs[i];
+    free(job->data);
+    if (report && !failed)
+      client->GotFrameBufferUpdate(client, job->x, job->y, job->w, job->h);
+  }
+
+  return !failed;
+}
+
+rfbBool
+WaitForDecodeJobs(rfbClient* client)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+
+  if (pool == NULL)
+    return TRUE;
+  return DrainDecodeJobs(pool, TRUE);
+}
+
+rfbBool
+WaitForOverlappingDecodeJobs(rfbClient* client, int x, int y, int w, int h)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+  int i;
+
+  if (pool == NULL)
+    return TRUE;
+
+  for (i = 0; i < pool->count; i++) {
+    DecodeJob *job = &pool->jobs[i];
+    if (x < job->x + job->w && job->x < x + w &&
+        y < job->y + job->h && job->y < y + h)
+      return WaitForDecodeJobs(client);
+  }
+  return TRUE;
+}
+
+rfbBool
+RunDecodeTasks(rfbClient* client, DecodeTaskProc proc, void *arg, int nTasks,
+               char **scratch, int *scratchSize)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+  rfbBool failed = FALSE;
+  int i;
+
+  if (pool == NULL && client->decodeThreads > 0 && nTasks > 1)
+    pool = StartDecodePool(client);
+
+  if (pool == NULL || nTasks <= 1) {
+    for (i = 0; i < nTasks; i++)
+      if (!proc(client, arg, i, scratch, scratchSize))
+        failed = TRUE;
+    return !failed;
+  }
+
+  LOCK(pool->mutex);
+  pool->taskProc = proc;
+  pool->taskArg = arg;
+  pool->taskCount = nTasks;
+  pool->taskNext = pool->taskDone = 0;
+  pool->taskFailed = FALSE;
+  for (i = 0; i < pool->nThreads && i < nTasks - 1; i++)
+    TSIGNAL(pool->workAvailable);
+
+  /* this thread does its share instead of sleeping */
+  while (pool->taskNext < pool->taskCount) {
+    int task = pool->taskNext++;
+    rfbBool ok;
+
+    UNLOCK(pool->mutex);
+    ok = proc(client, arg, task, scratch, scratchSize);
+    LOCK(pool->mutex);
+    if (!ok)
+      pool->taskFailed = TRUE;
+    pool->taskDone++;
+  }
+  while (pool->taskDone < pool->taskCount)
+    WAIT(pool->tasksDone, pool->mutex);
+
+  failed = pool->taskFailed;
+  pool->taskCount = pool->taskNext = pool->taskDone = 0;
+  UNLOCK(pool->mutex);
+
+  return !failed;
+}
+
+void
+FreeDecodePool(rfbClient* client)
+{
+  DecodePool *pool = (DecodePool *)client->decodePool;
+  int i;
+
+  if (pool == NULL)
+    return;
+
+  DrainDecodeJobs(pool, FALSE);
+
+  LOCK(pool->mutex);
+  pool->quit = TRUE;
+  TSIGNAL(pool->workAvailable);
+  UNLOCK(pool->mutex);
+  for (i = 0; i < pool->nThreads; i++)
+    THREAD_JOIN(pool->threads[i]);
+
+  TINI_COND(pool->tasksDone);
+  TINI_COND(pool->workDone);
+  TINI_COND(pool->workAvailable);
+  TINI_MUTEX(pool->mutex);
+  free(pool->jobs);
+  free(pool);
+  client->decodePool = NULL;
+}
+
+#else
+
+rfbBool
+QueueDecodeJob(rfbClient* client, DecodeJobProc proc,
+               uint8_t *data, int len, int x, int y, int w, int h)
+{
+  return FALSE;
+}
+
+rfbBool
+DecodeJobQueued(rfbClient* client)
+{
+  return FALSE;
+}
+
+rfbBool
+WaitForDecodeJobs(rfbClient* client)
+{
+  return TRUE;
+}
+
+rfbBool
+WaitForOverlappingDecodeJobs(rfbClient* client, int x, int y, int w, int h)
+{
+  return TRUE;
+}
+
+rfbBool
+RunDecodeTasks(rfbClient* client, DecodeTaskProc proc, void *arg, int nTasks,
+               char **scratch, int *scratchSize)
+{
+  rfbBool failed = FALSE;
+  int i;
+
+  for (i = 0; i < nTasks; i++)
+    if (!proc(client, arg, i, scratch, scratchSize))
+      failed = TRUE;
+  return !failed;
+}
+
+void
+FreeDecodePool(rfbClient* client)
+{
+}
+
+#endif
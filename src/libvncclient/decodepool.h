@@ -0,0 +1,63 @@
+#ifndef DECODEPOOL_H
+#define DECODEPOOL_H
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+/* Decodes one rect from data into the framebuffer, using the worker's own
+ * TurboJPEG handle and scratch buffer. Returns FALSE on error.
+ */
+typedef rfbBool (*DecodeJobProc)(rfbClient* client, void *tjhnd,
+                                 uint8_t *data, int len, int x, int y, int w, int h,
+                                 char **scratch, int *scratchSize);
+
+/* Hands a rect to the worker pool, starting it if client->decodeThreads
+ * asks for one. On success the pool owns data and TRUE is returned. FALSE
+ * means there is no pool and the caller has to decode the rect itself.
+ */
+rfbBool QueueDecodeJob(rfbClient* client, DecodeJobProc proc,
+                       uint8_t *data, int len, int x, int y, int w, int h);
+
+/* Returns TRUE once if the last rect was queued rather than decoded. */
+rfbBool DecodeJobQueued(rfbClient* client);
+
+/* Waits for all queued rects and calls GotFrameBufferUpdate() for them.
+ * Returns FALSE if any of them failed to decode.
+ */
+rfbBool WaitForDecodeJobs(rfbClient* client);
+
+/* Like WaitForDecodeJobs(), but only if a queued rect overlaps the given one. */
+rfbBool WaitForOverlappingDecodeJobs(rfbClient* client, int x, int y, int w, int h);
+
+/* Decodes part number task of a rect the caller has split up, using the
+ * worker's own scratch buffer. Returns FALSE on error.
+ */
+typedef rfbBool (*DecodeTaskProc)(rfbClient* client, void *arg, int task,
+                                  char **scratch, int *scratchSize);
+
+/* Runs proc for tasks 0..nTasks-1 on the worker pool and the calling
+ * thread, which passes scratch and scratchSize on, and returns once all of
+ * them are done. Without a pool the tasks run one after the other. Returns
+ * FALSE if any of them failed.
+ */
+rfbBool RunDecodeTasks(rfbClient* client, DecodeTaskProc proc, void *arg, int nTasks,
+                       char **scratch, int *scratchSize);
+
+/* Stops the workers. */
+void FreeDecodePool(rfbClient* client);
+
+#endif /* DECODEPOOL_H */
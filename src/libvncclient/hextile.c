@@ -40,6 +40,10 @@ HandleHextileBPP (rfbClient* client, int rx, int ry, int rw, int rh)
   uint8_t subencoding;
   uint8_t nSubrects;
 
+  /* large enough for a raw tile and for 255 coloured subrects */
+  if (!ReserveBuffer(client, 255 * (2 + (BPP / 8))))
+    return FALSE;
+
   for (y = ry; y < ry+rh; y += 16) {
     for (x = rx; x < rx+rw; x += 16) {
       w = h = 16;
@@ -64,9 +64,52 @@
 #include "minilzo.h"
 #endif
 #include "tls.h"
+#include "decodepool.h"
 
 #define MAX_TEXTCHAT_SIZE 10485760 /* 10MB */
 
+/* vncviewer.c */
+rfbBool rfbClientHasDefaultGotBitmap(rfbClient* client);
+
+/*
+ * Decoder scratch buffers are allocated on first use and only ever grow,
+ * so they end up sized to the largest rectangle seen. Growing them does
+ * not preserve their contents.
+ */
+
+static rfbBool
+GrowBuffer(void **buf, int *allocated, int size)
+{
+  if (size <= *allocated)
+    return TRUE;
+
+  free(*buf);
+  *buf = malloc(size);
+  if (*buf == NULL) {
+    *allocated = 0;
+    rfbClientErr("Could not allocate %d bytes of decoder buffer\n", size);
+    return FALSE;
+  }
+  *allocated = size;
+  return TRUE;
+}
+
+static rfbBool
+ReserveBuffer(rfbClient* client, int size)
+{
+  return GrowBuffer((void **)&client->buffer, &client->bufferSize, size);
+}
+
+#if !defined LIBVNCSERVER_HAVE_GETTIMEOFDAY && defined WIN32
+static void gettimeofday(struct timeval* tv,char* dummy)
+{
+   SYSTEMTIME t;
+   GetSystemTime(&t);
+   tv->tv_sec=t.wHour*3600+t.wMinute*60+t.wSecond;
+   tv->tv_usec=t.wMilliseconds*1000;
+}
+#endif
+
 /*
  * rfbClientLog prints a time-stamped message to the log file (stderr).
  */
@@ -313,11 +356,11 @@ ConnectToRFBServer(rfbClient* client,const char *hostname, int port)
       rfbClientLog("Could not open %s.\n",client->serverHost);
       return FALSE;
     }
-    setbuf(rec->file,NULL);
 
     if (fread(buffer,1,strlen(magic),rec->file) != strlen(magic) || strncmp(buffer,magic,strlen(magic))) {
       rfbClientLog("File %s was not recorded by vncrec.\n",client->serverHost);
       fclose(rec->file);
+      rec->file = NULL;
       return FALSE;
     }
     client->sock = RFB_INVALID_SOCKET;
@@ -353,6 +396,23 @@ ConnectToRFBServer(rfbClient* client,const char *hostname, int port)
   if(client->QoS_DSCP && !SetDSCP(client->sock, client->QoS_DSCP))
      return FALSE;
 
+  if (client->recordFile) {
+    /* the same format as played back above */
+    rfbVNCRec* rec = (rfbVNCRec*)calloc(1, sizeof(rfbVNCRec));
+    if(!rec) {
+        rfbClientLog("Could not allocate rfbVNCRec memory\n");
+        return FALSE;
+    }
+    client->vncRec = rec;
+
+    rec->file = fopen(client->recordFile,"wb");
+    if (!rec->file) {
+      rfbClientLog("Could not open %s for recording.\n",client->recordFile);
+      return FALSE;
+    }
+    fputs("vncLog0.0",rec->file);
+  }
+
   return TRUE;
 }
 
@@ -1323,8 +1383,12 @@ SetFormatAndEncodings(rfbClient* client)
 	encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingTRLE);
       } else if (strncasecmp(encStr,"zrle",encStrLen) == 0) {
 	encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingZRLE);
+	if (client->appData.compressLevel >= 0 && client->appData.compressLevel <= 9)
+	  requestCompressLevel = TRUE;
       } else if (strncasecmp(encStr,"zywrle",encStrLen) == 0) {
 	encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingZYWRLE);
+	if (client->appData.compressLevel >= 0 && client->appData.compressLevel <= 9)
+	  requestCompressLevel = TRUE;
 	requestQualityLevel = TRUE;
 #endif
       } else if ((strncasecmp(encStr,"ultra",encStrLen) == 0) || (strncasecmp(encStr,"ultrazip",encStrLen) == 0)) {
@@ -1443,6 +1507,12 @@ SetFormatAndEncodings(rfbClient* client)
   if (se->nEncodings < MAX_ENCODINGS)
     encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingXvp);
 
+  /* fences, and continuous updates if wanted */
+  if (se->nEncodings < MAX_ENCODINGS)
+    encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingFence);
+  if (se->nEncodings < MAX_ENCODINGS && client->continuousUpdates)
+    encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingContinuousUpdates);
+
   if (se->nEncodings < MAX_ENCODINGS)
     encs[se->nEncodings++] = rfbClientSwap32IfLE(rfbEncodingQemuExtendedKeyEvent);
 
@@ -1653,6 +1723,186 @@ rfbBool SendXvpMsg(rfbClient* client, uint8_t version, uint8_t code)
 }
 
 
+/*
+ * Fences and continuous updates.
+ */
+
+/* the payload of the fences measuring the round trip */
+typedef struct {
+  char tag[4];
+  uint32_t pad;
+  uint64_t sent; /* in us */
+  uint64_t bytesReceived;
+} rfbClientPing;
+
+static const char clientPingTag[4] = { 'p', 'i', 'n', 'g' };
+
+static uint64_t
+PingClock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+rfbBool
+SendFence(rfbClient* client, uint32_t flags, unsigned int length, const char* data)
+{
+  char buf[sz_rfbFenceMsg + rfbFenceMaxLength];
+  rfbFenceMsg f;
+
+  if (!SupportsClient2Server(client, rfbFence)) return TRUE;
+  if (length > rfbFenceMaxLength) return FALSE;
+
+  f.type = rfbFence;
+  f.pad[0] = f.pad[1] = f.pad[2] = 0;
+  f.flags = rfbClientSwap32IfLE(flags);
+  f.length = length;
+  memcpy(buf, &f, sz_rfbFenceMsg);
+  if (length > 0)
+    memcpy(buf + sz_rfbFenceMsg, data, length);
+
+  return WriteToRFBServer(client, buf, sz_rfbFenceMsg + length);
+}
+
+rfbBool
+SendEnableContinuousUpdates(rfbClient* client, rfbBool enable, int x, int y, int w, int h)
+{
+  rfbEnableContinuousUpdatesMsg ecu;
+
+  if (!SupportsClient2Server(client, rfbEnableContinuousUpdates)) return TRUE;
+
+  ecu.type = rfbEnableContinuousUpdates;
+  ecu.enable = enable ? 1 : 0;
+  ecu.x = rfbClientSwap16IfLE(x);
+  ecu.y = rfbClientSwap16IfLE(y);
+  ecu.w = rfbClientSwap16IfLE(w);
+  ecu.h = rfbClientSwap16IfLE(h);
+
+  if (!WriteToRFBServer(client, (char *)&ecu, sz_rfbEnableContinuousUpdatesMsg))
+    return FALSE;
+
+  /* it stays active until the server says it has ended */
+  if (enable)
+    client->continuousUpdatesActive = TRUE;
+  return TRUE;
+}
+
+/* follows an update with a fence, unless the last one is still out */
+static rfbBool
+SendPing(rfbClient* client)
+{
+  rfbClientPing ping;
+
+  if (!client->supportsFence || client->fencePending || client->serverPort == -1)
+    return TRUE;
+
+  memset(&ping, 0, sizeof(ping));
+  memcpy(ping.tag, clientPingTag, sizeof(ping.tag));
+  ping.sent = PingClock();
+  ping.bytesReceived = client->bytesReceived;
+  if (!SendFence(client, rfbFenceFlagRequest | rfbFenceFlagBlockBefore, sizeof(ping), (char *)&ping))
+    return FALSE;
+  client->fencePending = TRUE;
+  return TRUE;
+}
+
+/*
+ * Everything received between sending a fence and getting its answer
+ * took one round trip; if the server had that much to send, it tells how
+ * fast the link is. Otherwise it only counts if it is faster than
+ * thought.
+ */
+#define RFB_PING_MIN_BYTES 65536
+
+static void
+HandlePong(rfbClient* client, const char* data, unsigned int length)
+{
+  rfbClientPing ping;
+  uint64_t rtt, bytes;
+  uint32_t rate;
+
+  if (!client->fencePending || length != sizeof(ping))
+    return;
+  memcpy(&ping, data, sizeof(ping));
+  if (memcmp(ping.tag, clientPingTag, sizeof(ping.tag)) != 0)
+    return;
+  client->fencePending = FALSE;
+
+  rtt = PingClock() - ping.sent;
+  if (rtt == 0)
+    rtt = 1;
+  if (client->latency == 0)
+    client->latency = (int)((rtt + 999) / 1000);
+  else
+    client->latency += ((int)((rtt + 999) / 1000) - client->latency) / 8;
+
+  bytes = client->bytesReceived - ping.bytesReceived;
+  rate = (uint32_t)(bytes * 1000000 / rtt);
+  if (client->bandwidth == 0)
+    client->bandwidth = rate;
+  else if (bytes >= RFB_PING_MIN_BYTES || rate > client->bandwidth)
+    client->bandwidth = (client->bandwidth * 3 + rate) / 4;
+}
+
+
+/*
+ * Input event batching.
+ */
+
+rfbBool
+rfbClientBeginInputBatch(rfbClient* client)
+{
+  if (!client->inputBatchBuf) {
+    client->inputBatchBuf = malloc(RFB_INPUT_BATCH_SIZE);
+    if (!client->inputBatchBuf)
+      return FALSE;
+  }
+  client->inputBatching = TRUE;
+  client->inputBatchLen = 0;
+  client->inputBatchLastPointer = -1;
+  return TRUE;
+}
+
+static rfbBool
+WriteInputBatch(rfbClient* client)
+{
+  unsigned int len = client->inputBatchLen;
+
+  client->inputBatchLen = 0;
+  client->inputBatchLastPointer = -1;
+  if (len == 0)
+    return TRUE;
+  return WriteToRFBServer(client, client->inputBatchBuf, len);
+}
+
+rfbBool
+rfbClientFlushInputBatch(rfbClient* client)
+{
+  if (!client->inputBatching)
+    return TRUE;
+  client->inputBatching = FALSE;
+  return WriteInputBatch(client);
+}
+
+static rfbBool
+WriteInputEvent(rfbClient* client, const char *buf, unsigned int n)
+{
+  if (!client->inputBatching)
+    return WriteToRFBServer(client, buf, n);
+
+  /* queue full: send what we have and keep batching */
+  if (client->inputBatchLen + n > RFB_INPUT_BATCH_SIZE && !WriteInputBatch(client))
+    return FALSE;
+
+  memcpy(client->inputBatchBuf + client->inputBatchLen, buf, n);
+  client->inputBatchLen += n;
+  client->inputBatchLastPointer = -1;
+  return TRUE;
+}
+
+
 /*
  * SendPointerEvent.
  */
@@ -1671,6 +1921,27 @@ SendPointerEvent(rfbClient* client,int x, int y, int buttonMask)
 
   pe.x = rfbClientSwap16IfLE(x);
   pe.y = rfbClientSwap16IfLE(y);
+
+  if (client->inputBatching) {
+    /* motion after queued motion with the same buttons only moves the
+       pointer further, so overwrite the queued position. An event that
+       changes the buttons is never overwritten, or clicks and drags
+       would land where the pointer went next. */
+    rfbBool motion = buttonMask == client->inputBatchButtons;
+
+    if (motion && client->inputBatchLastPointer >= 0) {
+      memcpy(client->inputBatchBuf + client->inputBatchLastPointer, (char *)&pe, sz_rfbPointerEventMsg);
+      return TRUE;
+    }
+    if (!WriteInputEvent(client, (char *)&pe, sz_rfbPointerEventMsg))
+      return FALSE;
+    client->inputBatchButtons = buttonMask;
+    if (motion)
+      client->inputBatchLastPointer = client->inputBatchLen - sz_rfbPointerEventMsg;
+    return TRUE;
+  }
+
+  client->inputBatchButtons = buttonMask;
   return WriteToRFBServer(client, (char *)&pe, sz_rfbPointerEventMsg);
 }
 
@@ -1690,7 +1961,12 @@ ResizeClientBuffer(rfbClient* client, int width, int height)
       client->updateRect.w = client->width;
       client->updateRect.h = client->height;
   }
-  return client->MallocFrameBuffer(client);
+  if (!client->MallocFrameBuffer(client))
+    return FALSE;
+  /* continuous updates still cover the old size */
+  if (client->continuousUpdatesActive && client->isUpdateRectManagedByLib)
+    return SendEnableContinuousUpdates(client, TRUE, 0, 0, width, height);
+  return TRUE;
 }
 
 
@@ -1750,7 +2026,7 @@ SendKeyEvent(rfbClient* client, uint32_t key, rfbBool down)
   ke.type = rfbKeyEvent;
   ke.down = down ? 1 : 0;
   ke.key = rfbClientSwap32IfLE(key);
-  return WriteToRFBServer(client, (char *)&ke, sz_rfbKeyEventMsg);
+  return WriteInputEvent(client, (char *)&ke, sz_rfbKeyEventMsg);
 }
 
 
@@ -1775,7 +2051,7 @@ SendExtendedKeyEvent(rfbClient* client, uint32_t keysym, uint32_t keycode, rfbBo
   ke.down = rfbClientSwap16IfLE(!!down);
   ke.keysym = rfbClientSwap32IfLE(keysym);
   ke.keycode = rfbClientSwap32IfLE(keycode);
-  return WriteToRFBServer(client, (char *)&ke, sz_rfbQemuExtendedKeyEventMsg);
+  return WriteInputEvent(client, (char *)&ke, sz_rfbQemuExtendedKeyEventMsg);
 }
 
 
@@ -2041,6 +2317,57 @@ void rfbClientGetUpdateRect(rfbClient *client, rfbRectangle *rect, rfbBool *isMa
  * HandleRFBServerMessage.
  */
 
+/*
+ * Encodings that only write pixels inside their own rect.
+ */
+
+static rfbBool
+IsPixelEncoding(uint32_t encoding)
+{
+  switch (encoding) {
+  case rfbEncodingRaw:
+  case rfbEncodingRRE:
+  case rfbEncodingCoRRE:
+  case rfbEncodingHextile:
+  case rfbEncodingUltra:
+  case rfbEncodingZlib:
+  case rfbEncodingTight:
+  case rfbEncodingTRLE:
+  case rfbEncodingZRLE:
+  case rfbEncodingZYWRLE:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+static void
+RecordDecodeStats(rfbClient* client, rfbFramebufferUpdateRectHeader* rect,
+                  struct timeval* start)
+{
+  rfbClientDecodeStats* stats;
+  struct timeval end;
+
+  gettimeofday(&end, NULL);
+
+  for (stats = client->decodeStats; stats; stats = stats->next)
+    if (stats->encoding == (int32_t)rect->encoding)
+      break;
+  if (stats == NULL) {
+    stats = (rfbClientDecodeStats*)calloc(1, sizeof(rfbClientDecodeStats));
+    if (stats == NULL)
+      return;
+    stats->encoding = rect->encoding;
+    stats->next = client->decodeStats;
+    client->decodeStats = stats;
+  }
+
+  stats->rects++;
+  stats->pixels += (uint64_t)rect->r.w * rect->r.h;
+  stats->seconds += (end.tv_sec - start->tv_sec) +
+    (end.tv_usec - start->tv_usec) / 1000000.0;
+}
+
 rfbBool
 HandleRFBServerMessage(rfbClient* client)
 {
@@ -2048,6 +2375,14 @@ HandleRFBServerMessage(rfbClient* client)
 
   if (client->serverPort==-1)
     client->vncRec->readTimestamp = TRUE;
+  else if (client->vncRec) {
+    /* recording: every message is preceded by the time it arrived */
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    tv.tv_sec = rfbClientSwap32IfLE (tv.tv_sec);
+    tv.tv_usec = rfbClientSwap32IfLE (tv.tv_usec);
+    fwrite(&tv,sizeof(struct timeval),1,client->vncRec->file);
+  }
   if (!ReadFromRFBServer(client, (char *)&msg, 1))
     return FALSE;
 
@@ -2085,6 +2420,7 @@ HandleRFBServerMessage(rfbClient* client)
   case rfbFramebufferUpdate:
   {
     rfbFramebufferUpdateRectHeader rect;
+    struct timeval rectStart;
     int linesToRead;
     int bytesPerLine;
     int i;
@@ -2108,6 +2444,15 @@ HandleRFBServerMessage(rfbClient* client)
       rect.r.w = rfbClientSwap16IfLE(rect.r.w);
       rect.r.h = rfbClientSwap16IfLE(rect.r.h);
 
+      /* Rects still being decoded on worker threads have to land before
+	 anything draws over them, reads them or resizes the framebuffer. */
+      if (client->decodePool) {
+	if (IsPixelEncoding(rect.encoding)) {
+	  if (!WaitForOverlappingDecodeJobs(client, rect.r.x, rect.r.y, rect.r.w, rect.r.h))
+	    return FALSE;
+	} else if (!WaitForDecodeJobs(client))
+	  return FALSE;
+      }
 
       if (rect.encoding == rfbEncodingXCursor ||
 	  rect.encoding == rfbEncodingRichCursor) {
@@ -2264,16 +2609,41 @@ HandleRFBServerMessage(rfbClient* client)
         client->SoftCursorLockArea(client, rect.r.x, rect.r.y, rect.r.w, rect.r.h);
       }
 
+      gettimeofday(&rectStart, NULL);
+
       switch (rect.encoding) {
 
       case rfbEncodingRaw: {
 	int y=rect.r.y, h=rect.r.h;
 
 	bytesPerLine = rect.r.w * client->format.bitsPerPixel / 8;
+
+	/* With the default bitmap handler the wire format is the framebuffer
+	   format, so read the rows in place instead of staging them. */
+	if (rfbClientHasDefaultGotBitmap(client) && client->frameBuffer && bytesPerLine) {
+	  int stride = client->width * client->format.bitsPerPixel / 8;
+	  char *dst = (char *)client->frameBuffer + y * stride + rect.r.x * client->format.bitsPerPixel / 8;
+
+	  if (bytesPerLine == stride) {
+	    if (!ReadFromRFBServer(client, dst, bytesPerLine * h))
+	      return FALSE;
+	  } else {
+	    for (; h > 0; h--, dst += stride)
+	      if (!ReadFromRFBServer(client, dst, bytesPerLine))
+	        return FALSE;
+	  }
+	  break;
+	}
+
 	/* RealVNC 4.x-5.x on OSX can induce bytesPerLine==0, 
 	   usually during GPU accel. */
 	/* Regardless of cause, do not divide by zero. */
 	linesToRead = bytesPerLine ? (RFB_BUFFER_SIZE / bytesPerLine) : 0;
+	if (linesToRead > h)
+	  linesToRead = h;
+
+	if (linesToRead && !ReserveBuffer(client, bytesPerLine * linesToRead))
+	  return FALSE;
 
 	while (linesToRead && h > 0) {
 	  if (linesToRead > h)
@@ -2555,13 +2925,25 @@ HandleRFBServerMessage(rfbClient* client)
 	 }
       }
 
+      RecordDecodeStats(client, &rect, &rectStart);
+
       /* Now we may discard "soft cursor locks". */
       client->SoftCursorUnlockScreen(client);
 
-      client->GotFrameBufferUpdate(client, rect.r.x, rect.r.y, rect.r.w, rect.r.h);
+      /* queued rects are reported by WaitForDecodeJobs() */
+      if (!DecodeJobQueued(client))
+	client->GotFrameBufferUpdate(client, rect.r.x, rect.r.y, rect.r.w, rect.r.h);
+    }
+
+    /* Ask for the next update first so the server can get going while the
+       workers finish this one. Continuous updates come unasked. */
+    if ((!client->continuousUpdatesActive && !SendIncrementalFramebufferUpdateRequest(client)) ||
+        !SendPing(client)) {
+      WaitForDecodeJobs(client);
+      return FALSE;
     }
 
-    if (!SendIncrementalFramebufferUpdateRequest(client))
+    if (!WaitForDecodeJobs(client))
       return FALSE;
 
     if (client->FinishedFrameBufferUpdate)
@@ -2688,6 +3070,62 @@ HandleRFBServerMessage(rfbClient* client)
     break;
   }
 
+  case rfbFence:
+  {
+    char data[rfbFenceMaxLength];
+
+    if (!ReadFromRFBServer(client, ((char *)&msg) + 1,
+                           sz_rfbFenceMsg -1))
+      return FALSE;
+    if (msg.f.length > rfbFenceMaxLength) {
+      rfbClientLog("Fence payload of %d bytes is too long\n", msg.f.length);
+      return FALSE;
+    }
+    if (!ReadFromRFBServer(client, data, msg.f.length))
+      return FALSE;
+
+    if (!client->supportsFence) {
+      client->supportsFence = TRUE;
+      SetClient2Server(client, rfbFence);
+      SetServer2Client(client, rfbFence);
+    }
+
+    msg.f.flags = rfbClientSwap32IfLE(msg.f.flags);
+    if (msg.f.flags & rfbFenceFlagRequest) {
+      /* messages are handled one after another, so all three hold */
+      if (!SendFence(client, msg.f.flags & (rfbFenceFlagBlockBefore |
+                                            rfbFenceFlagBlockAfter |
+                                            rfbFenceFlagSyncNext),
+                     msg.f.length, data))
+        return FALSE;
+    } else
+      HandlePong(client, data, msg.f.length);
+
+    break;
+  }
+
+  case rfbEndOfContinuousUpdates:
+  {
+    if (!client->supportsContinuousUpdates) {
+      /* the first one just says the server supports them */
+      client->supportsContinuousUpdates = TRUE;
+      SetClient2Server(client, rfbEnableContinuousUpdates);
+      SetServer2Client(client, rfbEndOfContinuousUpdates);
+      if (client->continuousUpdates &&
+          !SendEnableContinuousUpdates(client, TRUE,
+                                       client->updateRect.x, client->updateRect.y,
+                                       client->updateRect.w, client->updateRect.h))
+        return FALSE;
+    } else if (client->continuousUpdatesActive) {
+      /* back to asking for each update */
+      client->continuousUpdatesActive = FALSE;
+      if (!SendIncrementalFramebufferUpdateRequest(client))
+        return FALSE;
+    }
+
+    break;
+  }
+
   case rfbResizeFrameBuffer:
   {
     if (!ReadFromRFBServer(client, ((char *)&msg) + 1,
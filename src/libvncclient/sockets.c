@@ -45,6 +45,128 @@ void PrintInHex(char *buf, int len);
 
 rfbBool errorMessageOnReadFailure = TRUE;
 
+/*
+ * Returns the buffer small reads are staged in. This is the inline
+ * client->buf unless a larger client->readBufferSize was requested, in which
+ * case a heap buffer of that size is allocated on first use.
+ */
+
+static char*
+GetReadBuffer(rfbClient* client, unsigned int *size)
+{
+  if (client->readBufferSize > RFB_BUF_SIZE && !client->readBuffer) {
+    client->readBuffer = malloc(client->readBufferSize);
+    if (client->readBuffer) {
+      client->readBufferAllocated = client->readBufferSize;
+      /* carry over whatever is still pending in the inline buffer */
+      memcpy(client->readBuffer, client->bufoutptr, client->buffered);
+      client->bufoutptr = client->readBuffer;
+    } else {
+      rfbClientErr("could not allocate %u byte receive buffer, using %d bytes\n",
+		   client->readBufferSize, RFB_BUF_SIZE);
+      client->readBufferSize = 0;
+    }
+  }
+
+  if (client->readBuffer) {
+    *size = client->readBufferAllocated;
+    return client->readBuffer;
+  }
+
+  *size = RFB_BUF_SIZE;
+  return client->buf;
+}
+
+/*
+ * Does one read from the transport. Returns FALSE on error or EOF, otherwise
+ * the number of bytes read is stored in nread, which may be 0 if the read
+ * would block and should be retried.
+ */
+
+static rfbBool
+ReadFromTransport(rfbClient* client, char *out, unsigned int n, int *nread, int *retries)
+{
+  const int USECS_WAIT_PER_RETRY = 100000;
+  int i;
+
+  if (client->tlsSession)
+    i = ReadFromTLS(client, out, n);
+  else
+#ifdef LIBVNCSERVER_HAVE_SASL
+  if (client->saslconn)
+    i = ReadFromSASL(client, out, n);
+  else
+#endif /* LIBVNCSERVER_HAVE_SASL */
+    i = read(client->sock, out, n);
+
+  if (i <= 0) {
+    if (i < 0) {
+#ifdef WIN32
+      errno=WSAGetLastError();
+#endif
+      if (errno == EWOULDBLOCK || errno == EAGAIN) {
+	if (client->readTimeout > 0 &&
+	    ++(*retries) > (client->readTimeout * 1000 * 1000 / USECS_WAIT_PER_RETRY))
+	{
+	  rfbClientLog("Connection timed out\n");
+	  return FALSE;
+	}
+	/* TODO:
+	   ProcessXtEvents();
+	*/
+	WaitForMessage(client, USECS_WAIT_PER_RETRY);
+	i = 0;
+      } else {
+	rfbClientErr("read (%d: %s)\n",errno,strerror(errno));
+	return FALSE;
+      }
+    } else {
+      if (errorMessageOnReadFailure) {
+	rfbClientLog("VNC server closed connection\n");
+      }
+      return FALSE;
+    }
+  }
+
+  *nread = i;
+  return TRUE;
+}
+
+/*
+ * Makes sure at least n bytes are buffered contiguously at client->bufoutptr.
+ * n must not exceed the size of the receive buffer. Every read asks for as
+ * much as fits into the buffer, so a large buffer means fewer syscalls.
+ */
+
+static rfbBool
+FillReadBuffer(rfbClient* client, unsigned int n)
+{
+  unsigned int size;
+  char *buf = GetReadBuffer(client, &size);
+  int retries = 0;
+  int i;
+
+  if (client->buffered >= n)
+    return TRUE;
+
+  /* wrap around: move the leftover to the front so the span stays contiguous */
+  if (client->buffered == 0)
+    client->bufoutptr = buf;
+  else if (client->bufoutptr + n > buf + size) {
+    memmove(buf, client->bufoutptr, client->buffered);
+    client->bufoutptr = buf;
+  }
+
+  while (client->buffered < n) {
+    char *end = client->bufoutptr + client->buffered;
+    if (!ReadFromTransport(client, end, buf + size - end, &i, &retries))
+      return FALSE;
+    client->buffered += i;
+  }
+
+  return TRUE;
+}
+
 /*
  * ReadFromRFBServer is called whenever we want to read some data from the RFB
  * server.  It is non-trivial for two reasons:
@@ -59,10 +181,22 @@ rfbBool errorMessageOnReadFailure = TRUE;
  *    events are processed, as there is no XtAppMainLoop in the program.
  */
 
+/* counts everything handed out and, recording vncrec, keeps a copy */
+static rfbBool
+RecordFromRFBServer(rfbClient* client, const char *buf, unsigned int n)
+{
+  client->bytesReceived += n;
+  if (client->vncRec == NULL || client->serverPort == -1)
+    return TRUE;
+  return fwrite(buf, 1, n, client->vncRec->file) == n;
+}
+
 rfbBool
 ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 {
-  const int USECS_WAIT_PER_RETRY = 100000;
+  const char *start = out;
+  unsigned int total = n;
+  unsigned int size;
   int retries = 0;
 #undef DEBUG_READ_EXACT
 #ifdef DEBUG_READ_EXACT
@@ -71,6 +205,11 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 	rfbClientLog("ReadFromRFBServer %d bytes\n",n);
 #endif
 
+  /* Nothing to read, like the subrects of a solid CoRRE rect. The
+     decoder's scratch buffer may not even be allocated yet. */
+  if (n == 0)
+    return TRUE;
+
   /* Handle attempts to write to NULL out buffer that might occur
      when an outside malloc() fails. For instance, memcpy() to NULL
      results in undefined behaviour and probably memory corruption.*/
@@ -82,6 +221,18 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
     rfbVNCRec* rec = client->vncRec;
     struct timeval tv;
 
+    /* bytes left over from PeekFromRFBServer() come first */
+    if (client->buffered > 0) {
+      unsigned int k = n < client->buffered ? n : client->buffered;
+      memcpy(out, client->bufoutptr, k);
+      client->bufoutptr += k;
+      client->buffered -= k;
+      out += k;
+      n -= k;
+      if (n == 0)
+        return TRUE;
+    }
+
     if (rec->readTimestamp) {
       rec->readTimestamp = FALSE;
       if (!fread(&tv,sizeof(struct timeval),1,rec->file))
@@ -119,7 +270,7 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 #ifdef DEBUG_READ_EXACT
     goto hexdump;
 #endif
-    return TRUE;
+    return RecordFromRFBServer(client, start, total);
   }
 
   memcpy(out, client->bufoutptr, client->buffered);
@@ -127,56 +278,13 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
   out += client->buffered;
   n -= client->buffered;
 
-  client->bufoutptr = client->buf;
   client->buffered = 0;
+  GetReadBuffer(client, &size);
 
-  if (n <= RFB_BUF_SIZE) {
+  if (n <= size) {
 
-    while (client->buffered < n) {
-      int i;
-      if (client->tlsSession)
-        i = ReadFromTLS(client, client->buf + client->buffered, RFB_BUF_SIZE - client->buffered);
-      else
-#ifdef LIBVNCSERVER_HAVE_SASL
-      if (client->saslconn)
-        i = ReadFromSASL(client, client->buf + client->buffered, RFB_BUF_SIZE - client->buffered);
-      else {
-#endif /* LIBVNCSERVER_HAVE_SASL */
-        i = read(client->sock, client->buf + client->buffered, RFB_BUF_SIZE - client->buffered);
-#ifdef WIN32
-	if (i < 0) errno=WSAGetLastError();
-#endif
-#ifdef LIBVNCSERVER_HAVE_SASL
-      }
-#endif
-  
-      if (i <= 0) {
-	if (i < 0) {
-	  if (errno == EWOULDBLOCK || errno == EAGAIN) {
-	    if (client->readTimeout > 0 &&
-		++retries > (client->readTimeout * 1000 * 1000 / USECS_WAIT_PER_RETRY))
-	    {
-	      rfbClientLog("Connection timed out\n");
-	      return FALSE;
-	    }
-	    /* TODO:
-	       ProcessXtEvents();
-	    */
-	    WaitForMessage(client, USECS_WAIT_PER_RETRY);
-	    i = 0;
-	  } else {
-	    rfbClientErr("read (%d: %s)\n",errno,strerror(errno));
-	    return FALSE;
-	  }
-	} else {
-	  if (errorMessageOnReadFailure) {
-	    rfbClientLog("VNC server closed connection\n");
-	  }
-	  return FALSE;
-	}
-      }
-      client->buffered += i;
-    }
+    if (!FillReadBuffer(client, n))
+      return FALSE;
 
     memcpy(out, client->bufoutptr, n);
     client->bufoutptr += n;
@@ -186,44 +294,8 @@ ReadFromRFBServer(rfbClient* client, char *out, unsigned int n)
 
     while (n > 0) {
       int i;
-      if (client->tlsSession)
-        i = ReadFromTLS(client, out, n);
-      else
-#ifdef LIBVNCSERVER_HAVE_SASL
-      if (client->saslconn)
-        i = ReadFromSASL(client, out, n);
-      else
-#endif
-        i = read(client->sock, out, n);
-
-      if (i <= 0) {
-	if (i < 0) {
-#ifdef WIN32
-	  errno=WSAGetLastError();
-#endif
-	  if (errno == EWOULDBLOCK || errno == EAGAIN) {
-	    if (client->readTimeout > 0 &&
-		++retries > (client->readTimeout * 1000 * 1000 / USECS_WAIT_PER_RETRY))
-	    {
-		rfbClientLog("Connection timed out\n");
-		return FALSE;
-	    }
-	    /* TODO:
-	       ProcessXtEvents();
-	    */
-	    WaitForMessage(client, USECS_WAIT_PER_RETRY);
-	    i = 0;
-	  } else {
-	    rfbClientErr("read (%s)\n",strerror(errno));
-	    return FALSE;
-	  }
-	} else {
-	  if (errorMessageOnReadFailure) {
-	    rfbClientLog("VNC server closed connection\n");
-	  }
-	  return FALSE;
-	}
-      }
+      if (!ReadFromTransport(client, out, n, &i, &retries))
+        return FALSE;
       out += i;
       n -= i;
     }
@@ -238,7 +310,52 @@ hexdump:
   }
 #endif
 
-  return TRUE;
+  return RecordFromRFBServer(client, start, total);
+}
+
+
+/*
+ * Returns a pointer to at least n contiguous bytes from the server without
+ * copying them out of the receive buffer. The number of bytes that are
+ * available at the pointer is stored in avail if that is not NULL. The bytes
+ * stay buffered until they are released with ConsumeFromRFBServer().
+ */
+
+const char*
+PeekFromRFBServer(rfbClient* client, unsigned int n, unsigned int *avail)
+{
+  unsigned int size;
+  char *buf = GetReadBuffer(client, &size);
+
+  if (n > size)
+    return NULL;
+
+  if (client->serverPort==-1) {
+    /* vncrec playing, there is no socket to read ahead from */
+    if (client->buffered < n) {
+      if (client->buffered > 0)
+        memmove(buf, client->bufoutptr, client->buffered);
+      client->bufoutptr = buf;
+      if (fread(buf + client->buffered, 1, n - client->buffered, client->vncRec->file) != n - client->buffered)
+        return NULL;
+      client->buffered = n;
+    }
+  } else if (!FillReadBuffer(client, n))
+    return NULL;
+
+  if (avail)
+    *avail = client->buffered;
+  return client->bufoutptr;
+}
+
+void
+ConsumeFromRFBServer(rfbClient* client, unsigned int n)
+{
+  if (n > client->buffered)
+    n = client->buffered;
+  RecordFromRFBServer(client, client->bufoutptr, n);
+  client->bufoutptr += n;
+  client->buffered -= n;
 }
 
 
@@ -860,7 +977,11 @@ int WaitForMessage(rfbClient* client,unsigned int usecs)
   if (client->serverPort==-1)
     /* playing back vncrec file */
     return 1;
-  
+
+  if (client->buffered > 0)
+    /* read ahead with a fence reply or the like, the socket may stay quiet */
+    return 1;
+
   timeout.tv_sec=(usecs/1000000);
   timeout.tv_usec=(usecs%1000000);
 
@@ -50,6 +50,7 @@
 
 #if BPP != 8
 #define DecompressJpegRectBPP CONCAT2E(DecompressJpegRect,BPP)
+#define DecodeJpegBPP CONCAT2E(DecodeJpeg,BPP)
 #endif
 
 #ifndef RGB_TO_PIXEL
@@ -175,9 +176,10 @@ HandleTightBPP (rfbClient* client, int rx, int ry, int rw, int rh)
 #if BPP == 32
     if (client->format.depth == 24 && client->format.redMax == 0xFF &&
 	client->format.greenMax == 0xFF && client->format.blueMax == 0xFF) {
-      if (!ReadFromRFBServer(client, client->buffer, 3))
+      uint8_t rgb[3];
+      if (!ReadFromRFBServer(client, (char *)rgb, 3))
 	return FALSE;
-      fill_colour = RGB24_TO_PIXEL32(client->buffer[0], client->buffer[1], client->buffer[2]);
+      fill_colour = RGB24_TO_PIXEL32(rgb[0], rgb[1], rgb[2]);
     } else {
       if (!ReadFromRFBServer(client, (char*)&fill_colour, sizeof(fill_colour)))
 	return FALSE;
@@ -248,6 +250,8 @@ HandleTightBPP (rfbClient* client, int rx, int ry, int rw, int rh)
   /* Determine if the data should be decompressed or just copied. */
   rowSize = (rw * bitsPixel + 7) / 8;
   if (rh * rowSize < TIGHT_MIN_TO_COMPRESS) {
+    if (!ReserveBuffer(client, rh * rowSize))
+      return FALSE;
     if (!ReadFromRFBServer(client, (char*)client->buffer, rh * rowSize))
       return FALSE;
 
@@ -268,6 +272,8 @@ HandleTightBPP (rfbClient* client, int rx, int ry, int rw, int rh)
 	return FALSE;
     }
 
+    if (!ReserveBuffer(client, compressedLen))
+      return FALSE;
     if (!ReadFromRFBServer(client, (char*)client->buffer, compressedLen))
       return FALSE;
 
@@ -300,6 +306,15 @@ HandleTightBPP (rfbClient* client, int rx, int ry, int rw, int rh)
     rfbClientLog("Internal error: incorrect buffer size.\n");
     return FALSE;
   }
+  /* Small rects don't need the whole staging area. */
+  if (bufferSize > rh * rowSize)
+    bufferSize = (rh * rowSize + 3) & 0xFFFFFFFC;
+
+  if (!ReserveBuffer(client, bufferSize))
+    return FALSE;
+  if (!GrowBuffer((void **)&client->zlib_buffer, &client->zlibBufferSize,
+                  compressedLen < ZLIB_BUFFER_SIZE ? compressedLen : ZLIB_BUFFER_SIZE))
+    return FALSE;
 
   rowsProcessed = 0;
   extraBytes = 0;
@@ -414,6 +429,9 @@ InitFilterGradientBPP (rfbClient* client, int rw, int rh)
   int bits;
 
   bits = InitFilterCopyBPP(client, rw, rh);
+  if (!GrowBuffer((void **)&client->tightPrevRow, &client->tightPrevRowSize,
+                  rw * 3 * sizeof(uint16_t)))
+    return 0;
   if (client->cutZeros)
     memset(client->tightPrevRow, 0, rw * 3);
   else
@@ -594,46 +612,27 @@ FilterPaletteBPP (rfbClient* client, int srcx, int srcy, int numRows)
  *
  */
 
+/*
+ * Decodes a JPEG payload straight into the framebuffer. This runs on the
+ * decode workers as well, so it must only touch the handle and scratch
+ * buffer it is given, never client->tjhnd or client->buffer.
+ */
+
 static rfbBool
-DecompressJpegRectBPP(rfbClient* client, int x, int y, int w, int h)
+DecodeJpegBPP(rfbClient* client, void *tjhnd, uint8_t *compressedData,
+              int compressedLen, int x, int y, int w, int h,
+              char **scratch, int *scratchSize)
 {
-  int compressedLen;
-  uint8_t *compressedData, *dst;
+  uint8_t *dst;
   int pixelSize, pitch, flags = 0;
 
-  compressedLen = (int)ReadCompactLen(client);
-  if (compressedLen <= 0) {
-    rfbClientLog("Incorrect data received from the server.\n");
-    return FALSE;
-  }
-
-  compressedData = malloc(compressedLen);
-  if (compressedData == NULL) {
-    rfbClientLog("Memory allocation error.\n");
-    return FALSE;
-  }
-
-  if (!ReadFromRFBServer(client, (char*)compressedData, compressedLen)) {
-    free(compressedData);
-    return FALSE;
-  }
-
-  if(client->GotJpeg != NULL)
-    return client->GotJpeg(client, compressedData, compressedLen, x, y, w, h);
-  
-  if (!client->tjhnd) {
-    if ((client->tjhnd = tjInitDecompress()) == NULL) {
-      rfbClientLog("TurboJPEG error: %s\n", tjGetErrorStr());
-      free(compressedData);
-      return FALSE;
-    }
-  }
-
 #if BPP == 16
   flags = 0;
   pixelSize = 3;
   pitch = w * pixelSize;
-  dst = (uint8_t *)client->buffer;
+  if (!GrowBuffer((void **)scratch, scratchSize, h * pitch))
+    return FALSE;
+  dst = (uint8_t *)*scratch;
 #else
   if (client->format.bigEndian) flags |= TJ_ALPHAFIRST;
   if (client->format.redShift == 16 && client->format.blueShift == 0)
@@ -644,22 +643,19 @@ DecompressJpegRectBPP(rfbClient* client, int x, int y, int w, int h)
   dst = &client->frameBuffer[y * pitch + x * pixelSize];
 #endif
 
-  if (tjDecompress(client->tjhnd, compressedData, (unsigned long)compressedLen,
+  if (tjDecompress(tjhnd, compressedData, (unsigned long)compressedLen,
                    dst, w, pitch, h, pixelSize, flags)==-1) {
     rfbClientLog("TurboJPEG error: %s\n", tjGetErrorStr());
-    free(compressedData);
     return FALSE;
   }
 
-  free(compressedData);
-
 #if BPP == 16
   pixelSize = BPP / 8;
   pitch = client->width * pixelSize;
   dst = &client->frameBuffer[y * pitch + x * pixelSize];
   {
     CARDBPP *dst16=(CARDBPP *)dst, *dst2;
-    char *src = client->buffer;
+    char *src = *scratch;
     int i, j;
 
     for (j = 0; j < h; j++) {
@@ -674,6 +670,51 @@ DecompressJpegRectBPP(rfbClient* client, int x, int y, int w, int h)
   return TRUE;
 }
 
+static rfbBool
+DecompressJpegRectBPP(rfbClient* client, int x, int y, int w, int h)
+{
+  int compressedLen;
+  uint8_t *compressedData;
+  rfbBool ok;
+
+  compressedLen = (int)ReadCompactLen(client);
+  if (compressedLen <= 0) {
+    rfbClientLog("Incorrect data received from the server.\n");
+    return FALSE;
+  }
+
+  compressedData = malloc(compressedLen);
+  if (compressedData == NULL) {
+    rfbClientLog("Memory allocation error.\n");
+    return FALSE;
+  }
+
+  if (!ReadFromRFBServer(client, (char*)compressedData, compressedLen)) {
+    free(compressedData);
+    return FALSE;
+  }
+
+  if(client->GotJpeg != NULL)
+    return client->GotJpeg(client, compressedData, compressedLen, x, y, w, h);
+
+  /* The pool takes over compressedData if there is one. */
+  if (QueueDecodeJob(client, DecodeJpegBPP, compressedData, compressedLen, x, y, w, h))
+    return TRUE;
+
+  if (!client->tjhnd) {
+    if ((client->tjhnd = tjInitDecompress()) == NULL) {
+      rfbClientLog("TurboJPEG error: %s\n", tjGetErrorStr());
+      free(compressedData);
+      return FALSE;
+    }
+  }
+
+  ok = DecodeJpegBPP(client, client->tjhnd, compressedData, compressedLen,
+                     x, y, w, h, &client->buffer, &client->bufferSize);
+  free(compressedData);
+  return ok;
+}
+
 #else
 
 static long
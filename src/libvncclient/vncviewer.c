@@ -39,6 +39,8 @@
 #include <time.h>
 #include <rfb/rfbclient.h>
 #include "tls.h"
+#include "simd.h"
+#include "decodepool.h"
 #if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
 #include "turbojpeg.h"
 #endif
@@ -117,8 +119,6 @@ static rfbBool CheckRect(rfbClient* client, int x, int y, int w, int h) {
 }
 
 static void FillRectangle(rfbClient* client, int x, int y, int w, int h, uint32_t colour) {
-  int i,j;
-
   if (client->frameBuffer == NULL) {
       return;
   }
@@ -128,15 +128,14 @@ static void FillRectangle(rfbClient* client, int x, int y, int w, int h, uint32_
     return;
   }
 
-#define FILL_RECT(BPP) \
-    for(j=y*client->width;j<(y+h)*client->width;j+=client->width) \
-      for(i=x;i<x+w;i++) \
-	((uint##BPP##_t*)client->frameBuffer)[j+i]=colour;
-
   switch(client->format.bitsPerPixel) {
-  case  8: FILL_RECT(8);  break;
-  case 16: FILL_RECT(16); break;
-  case 32: FILL_RECT(32); break;
+  case  8:
+  case 16:
+  case 32:
+    simd_fill_rect(client->frameBuffer + (y * client->width + x) * client->format.bitsPerPixel / 8,
+                   client->width * client->format.bitsPerPixel / 8,
+                   client->format.bitsPerPixel, w, h, colour);
+    break;
   default:
     rfbClientLog("Unsupported bitsPerPixel: %d\n",client->format.bitsPerPixel);
   }
@@ -157,10 +156,13 @@ static void CopyRectangle(rfbClient* client, const uint8_t* buffer, int x, int y
 #define COPY_RECT(BPP) \
   { \
     int rs = w * BPP / 8, rs2 = client->width * BPP / 8; \
-    for (j = ((x * (BPP / 8)) + (y * rs2)); j < (y + h) * rs2; j += rs2) { \
-      memcpy(client->frameBuffer + j, buffer, rs); \
-      buffer += rs; \
-    } \
+    if (rs == rs2) \
+      memcpy(client->frameBuffer + y * rs2, buffer, (size_t)rs * h); \
+    else \
+      for (j = ((x * (BPP / 8)) + (y * rs2)); j < (y + h) * rs2; j += rs2) { \
+        memcpy(client->frameBuffer + j, buffer, rs); \
+        buffer += rs; \
+      } \
   }
 
   switch(client->format.bitsPerPixel) {
@@ -172,9 +174,14 @@ static void CopyRectangle(rfbClient* client, const uint8_t* buffer, int x, int y
   }
 }
 
-/* TODO: test */
+/* for rfbclient.c, which reads raw rects in place while nobody else
+   wants to see their pixels */
+rfbBool rfbClientHasDefaultGotBitmap(rfbClient* client) {
+  return client->GotBitmap == CopyRectangle;
+}
+
 static void CopyRectangleFromRectangle(rfbClient* client, int src_x, int src_y, int w, int h, int dest_x, int dest_y) {
-  int i,j;
+  int bpp = client->format.bitsPerPixel / 8, stride = client->width * bpp;
 
   if (client->frameBuffer == NULL) {
       return;
@@ -190,40 +197,14 @@ static void CopyRectangleFromRectangle(rfbClient* client, int src_x, int src_y,
     return;
   }
 
-#define COPY_RECT_FROM_RECT(BPP) \
-  { \
-    uint##BPP##_t* _buffer=((uint##BPP##_t*)client->frameBuffer)+(src_y-dest_y)*client->width+src_x-dest_x; \
-    if (dest_y < src_y) { \
-      for(j = dest_y*client->width; j < (dest_y+h)*client->width; j += client->width) { \
-        if (dest_x < src_x) { \
-          for(i = dest_x; i < dest_x+w; i++) { \
-            ((uint##BPP##_t*)client->frameBuffer)[j+i]=_buffer[j+i]; \
-          } \
-        } else { \
-          for(i = dest_x+w-1; i >= dest_x; i--) { \
-            ((uint##BPP##_t*)client->frameBuffer)[j+i]=_buffer[j+i]; \
-          } \
-        } \
-      } \
-    } else { \
-      for(j = (dest_y+h-1)*client->width; j >= dest_y*client->width; j-=client->width) { \
-        if (dest_x < src_x) { \
-          for(i = dest_x; i < dest_x+w; i++) { \
-            ((uint##BPP##_t*)client->frameBuffer)[j+i]=_buffer[j+i]; \
-          } \
-        } else { \
-          for(i = dest_x+w-1; i >= dest_x; i--) { \
-            ((uint##BPP##_t*)client->frameBuffer)[j+i]=_buffer[j+i]; \
-          } \
-        } \
-      } \
-    } \
-  }
-
   switch(client->format.bitsPerPixel) {
-  case  8: COPY_RECT_FROM_RECT(8);  break;
-  case 16: COPY_RECT_FROM_RECT(16); break;
-  case 32: COPY_RECT_FROM_RECT(32); break;
+  case  8:
+  case 16:
+  case 32:
+    simd_move_rect(client->frameBuffer + dest_y * stride + dest_x * bpp,
+                   client->frameBuffer + src_y * stride + src_x * bpp,
+                   stride, w * bpp, h);
+    break;
   default:
     rfbClientLog("Unsupported bitsPerPixel: %d\n",client->format.bitsPerPixel);
   }
@@ -451,6 +432,12 @@ rfbBool rfbInitClient(rfbClient* client,int* argc,char** argv) {
       } else if (strcmp(argv[i], "-play") == 0) {
 	client->serverPort = -1;
 	j++;
+      } else if (strcmp(argv[i], "-continuous") == 0) {
+	client->continuousUpdates = TRUE;
+	j++;
+      } else if (i+1<*argc && strcmp(argv[i], "-record") == 0) {
+	client->recordFile = argv[i+1];
+	j+=2;
       } else if (i+1<*argc && strcmp(argv[i], "-encodings") == 0) {
 	client->appData.encodingsString = argv[i+1];
 	j+=2;
@@ -515,6 +502,11 @@ rfbBool rfbInitClient(rfbClient* client,int* argc,char** argv) {
 void rfbClientCleanup(rfbClient* client) {
 #ifdef LIBVNCSERVER_HAVE_LIBZ
   int i;
+#endif
+
+  FreeDecodePool(client);
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
 
   for ( i = 0; i < 4; i++ ) {
     if (client->zlibStreamActive[i] == TRUE ) {
@@ -538,8 +530,16 @@ void rfbClientCleanup(rfbClient* client) {
 #endif /* LIBVNCSERVER_HAVE_LIBJPEG */
 #endif
 
+  free(client->buffer);
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+  free(client->zlib_buffer);
+  free(client->tightPrevRow);
+  free(client->zrleTiles);
+#endif
   free(client->ultra_buffer);
   free(client->raw_buffer);
+  free(client->inputBatchBuf);
+  free(client->readBuffer);
 
   FreeTLS(client);
 
@@ -549,8 +549,16 @@ void rfbClientCleanup(rfbClient* client) {
     client->clientData = next;
   }
 
+  if (client->vncRec && client->vncRec->file)
+    fclose(client->vncRec->file);
   free(client->vncRec);
 
+  while (client->decodeStats) {
+    rfbClientDecodeStats* next = client->decodeStats->next;
+    free(client->decodeStats);
+    client->decodeStats = next;
+  }
+
   if (client->sock != RFB_INVALID_SOCKET)
     rfbCloseSocket(client->sock);
   if (client->listenSock != RFB_INVALID_SOCKET)
@@ -579,3 +587,38 @@ void rfbClientCleanup(rfbClient* client) {
 
   free(client);
 }
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+/* zconf.h: inflate needs the window plus about 7 KB for small objects */
+#define INFLATE_MEMORY ((1 << MAX_WBITS) + 7 * 1024)
+#endif
+
+size_t rfbClientGetMemoryUsage(rfbClient* client) {
+  size_t total = sizeof(rfbClient);
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (client->zlibStreamActive[i])
+      total += INFLATE_MEMORY;
+  if (client->decompStreamInited)
+    total += INFLATE_MEMORY;
+  total += client->zlibBufferSize;
+  total += client->tightPrevRowSize;
+  total += client->zrleTilesSize;
+#endif
+
+  total += client->bufferSize;
+  if (client->raw_buffer_size > 0)
+    total += client->raw_buffer_size;
+  total += client->ultra_buffer_size;
+  total += client->readBufferAllocated;
+  if (client->inputBatchBuf)
+    total += RFB_INPUT_BATCH_SIZE;
+  if (client->desktopName)
+    total += strlen(client->desktopName) + 1;
+  if (client->frameBuffer && client->MallocFrameBuffer == MallocFrameBuffer)
+    total += (size_t)client->width * client->height * client->format.bitsPerPixel / 8;
+
+  return total;
+}
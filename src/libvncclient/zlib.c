@@ -95,19 +95,19 @@ HandleZlibBPP (rfbClient* client, int rx, int ry, int rw, int rh)
    */
   while (( remaining > 0 ) &&
          ( inflateResult == Z_OK )) {
-  
-    if ( remaining > RFB_BUFFER_SIZE ) {
-      toRead = RFB_BUFFER_SIZE;
-    }
-    else {
-      toRead = remaining;
-    }
 
-    /* Fill the buffer, obtaining data from the server. */
-    if (!ReadFromRFBServer(client, client->buffer,toRead))
+    const char *in;
+    unsigned int avail;
+
+    /* Inflate straight out of the receive buffer, taking whatever is
+     * already buffered and only reading when it runs dry.
+     */
+    if (!(in = PeekFromRFBServer(client, 1, &avail)))
       return FALSE;
 
-    client->decompStream.next_in  = ( Bytef * )client->buffer;
+    toRead = avail < (unsigned int)remaining ? (int)avail : remaining;
+
+    client->decompStream.next_in  = ( Bytef * )in;
     client->decompStream.avail_in = toRead;
 
     /* Need to uncompress buffer full. */
@@ -135,6 +135,7 @@ HandleZlibBPP (rfbClient* client, int rx, int ry, int rw, int rh)
       return FALSE;
     }
 
+    ConsumeFromRFBServer(client, toRead);
     remaining -= toRead;
 
   } /* while ( remaining > 0 ) */
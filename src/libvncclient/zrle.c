@@ -35,12 +35,36 @@
 #if !defined(UNCOMP) || UNCOMP==0
 #define HandleZRLE CONCAT2E(HandleZRLE,REALBPP)
 #define HandleZRLETile CONCAT2E(HandleZRLETile,REALBPP)
+#define ZRLETileLength CONCAT2E(ZRLETileLength,REALBPP)
+#define ZRLETileTask CONCAT2E(ZRLETileTask,REALBPP)
 #elif UNCOMP>0
 #define HandleZRLE CONCAT3E(HandleZRLE,REALBPP,Down)
 #define HandleZRLETile CONCAT3E(HandleZRLETile,REALBPP,Down)
+#define ZRLETileLength CONCAT3E(ZRLETileLength,REALBPP,Down)
+#define ZRLETileTask CONCAT3E(ZRLETileTask,REALBPP,Down)
 #else
 #define HandleZRLE CONCAT3E(HandleZRLE,REALBPP,Up)
 #define HandleZRLETile CONCAT3E(HandleZRLETile,REALBPP,Up)
+#define ZRLETileLength CONCAT3E(ZRLETileLength,REALBPP,Up)
+#define ZRLETileTask CONCAT3E(ZRLETileTask,REALBPP,Up)
+#endif
+
+#ifndef ZRLE_TILE_INDEX
+#define ZRLE_TILE_INDEX
+/* Where a tile's data starts in the inflated rect, found by the serial
+ * pass over the rect so that the tiles can be decoded in parallel.
+ */
+typedef struct {
+	int offset, length;
+	int x, y, w, h;
+} ZRLETile;
+
+typedef struct {
+	uint8_t *data;
+	ZRLETile *tiles;
+	int nTiles, tilesPerTask;
+	int zywrle_level;
+} ZRLETileJob;
 #endif
 #define CARDBPP CONCAT3E(uint,BPP,_t)
 #define CARDREALBPP CONCAT3E(uint,REALBPP,_t)
@@ -78,7 +102,34 @@
 
 static int HandleZRLETile(rfbClient* client,
 	uint8_t* buffer,size_t buffer_length,
-	int x,int y,int w,int h);
+	int x,int y,int w,int h,
+	int zywrle_level,char** scratch,int* scratchSize);
+static int ZRLETileLength(uint8_t* buffer,size_t buffer_length,
+	int w,int h,int zywrle_level);
+
+/* Decodes one share of the tiles indexed by HandleZRLE. */
+static rfbBool
+ZRLETileTask(rfbClient* client, void *arg, int task, char **scratch, int *scratchSize)
+{
+	ZRLETileJob* job = (ZRLETileJob*)arg;
+	int i = task * job->tilesPerTask;
+	int end = i + job->tilesPerTask;
+
+	if (end > job->nTiles)
+		end = job->nTiles;
+	for (; i < end; i++) {
+		ZRLETile* tile = &job->tiles[i];
+		int result = HandleZRLETile(client, job->data + tile->offset, tile->length,
+				tile->x, tile->y, tile->w, tile->h,
+				job->zywrle_level, scratch, scratchSize);
+
+		if (result < 0) {
+			rfbClientLog("ZRLE decoding failed (%d)\n", result);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
 
 static rfbBool
 HandleZRLE (rfbClient* client, int rx, int ry, int rw, int rh)
@@ -139,6 +190,9 @@ HandleZRLE (rfbClient* client, int rx, int ry, int rw, int rh)
 
 	inflateResult = Z_OK;
 
+	if (!ReserveBuffer(client, remaining < RFB_BUFFER_SIZE ? remaining : RFB_BUFFER_SIZE))
+		return FALSE;
+
 	/* Process buffer full of data until no more to process, or
 	 * some type of inflater error, or Z_STREAM_END.
 	 */
@@ -190,15 +244,74 @@ HandleZRLE (rfbClient* client, int rx, int ry, int rw, int rh)
 
 	if ( inflateResult == Z_OK ) {
 		char* buf=client->raw_buffer;
+		int zywrle_level=0;
 		int i,j;
 
+#if BPP!=8
+		zywrle_level = (client->appData.qualityLevel & 0x80) ?
+			0 : (3 - client->appData.qualityLevel / 3);
+#endif
 		remaining = client->raw_buffer_size-client->decompStream.avail_out;
 
+		if (client->decodeThreads > 0 && rw * rh > rfbZRLETileWidth * rfbZRLETileHeight) {
+			/* Only the tile boundaries are found here; the tiles themselves
+			 * are decoded on the worker pool, which the inflate above
+			 * could not be split across.
+			 */
+			int maxTiles = ((rw + rfbZRLETileWidth - 1) / rfbZRLETileWidth) *
+				((rh + rfbZRLETileHeight - 1) / rfbZRLETileHeight);
+			int nTasks, result = 0;
+			ZRLETileJob job;
+
+			if (!GrowBuffer(&client->zrleTiles, &client->zrleTilesSize,
+			                maxTiles * sizeof(ZRLETile)))
+				return FALSE;
+
+			job.data = (uint8_t *)client->raw_buffer;
+			job.tiles = (ZRLETile *)client->zrleTiles;
+			job.nTiles = 0;
+			job.zywrle_level = zywrle_level;
+
+			for(j=0; j<rh && result>=0; j+=rfbZRLETileHeight)
+				for(i=0; i<rw; i+=rfbZRLETileWidth) {
+					ZRLETile* tile = &job.tiles[job.nTiles];
+
+					tile->w=(i+rfbZRLETileWidth>rw)?rw-i:rfbZRLETileWidth;
+					tile->h=(j+rfbZRLETileHeight>rh)?rh-j:rfbZRLETileHeight;
+					result=ZRLETileLength((uint8_t *)buf,remaining,tile->w,tile->h,zywrle_level);
+					if(result<0)
+						break;
+					tile->offset=buf-client->raw_buffer;
+					tile->length=result;
+					tile->x=rx+i;
+					tile->y=ry+j;
+					job.nTiles++;
+
+					buf+=result;
+					remaining-=result;
+				}
+
+			/* a few shares per thread evens out tiles of differing cost */
+			nTasks = (client->decodeThreads + 1) * 4;
+			job.tilesPerTask = (job.nTiles + nTasks - 1) / nTasks;
+			if (job.tilesPerTask < 1)
+				job.tilesPerTask = 1;
+			nTasks = (job.nTiles + job.tilesPerTask - 1) / job.tilesPerTask;
+
+			/* as below, a broken tile only cuts the rect short */
+			RunDecodeTasks(client, ZRLETileTask, &job, nTasks,
+			               &client->zlib_buffer, &client->zlibBufferSize);
+			if(result<0)
+				rfbClientLog("ZRLE decoding failed (%d)\n",result);
+			return TRUE;
+		}
+
 		for(j=0; j<rh; j+=rfbZRLETileHeight)
 			for(i=0; i<rw; i+=rfbZRLETileWidth) {
 				int subWidth=(i+rfbZRLETileWidth>rw)?rw-i:rfbZRLETileWidth;
 				int subHeight=(j+rfbZRLETileHeight>rh)?rh-j:rfbZRLETileHeight;
-				int result=HandleZRLETile(client,(uint8_t *)buf,remaining,rx+i,ry+j,subWidth,subHeight);
+				int result=HandleZRLETile(client,(uint8_t *)buf,remaining,rx+i,ry+j,subWidth,subHeight,
+				                          zywrle_level,&client->zlib_buffer,&client->zlibBufferSize);
 
 				if(result<0) {
 					rfbClientLog("ZRLE decoding failed (%d)\n",result);
@@ -235,14 +348,11 @@ return TRUE;
 
 static int HandleZRLETile(rfbClient* client,
 		uint8_t* buffer,size_t buffer_length,
-		int x,int y,int w,int h) {
+		int x,int y,int w,int h,
+		int zywrle_level,char** scratch,int* scratchSize) {
 	uint8_t* buffer_copy = buffer;
 	uint8_t* buffer_end = buffer+buffer_length;
 	uint8_t type;
-#if BPP!=8
-	uint8_t zywrle_level = (client->appData.qualityLevel & 0x80) ?
-		0 : (3 - client->appData.qualityLevel / 3);
-#endif
 
 	if(buffer_length<1)
 		return -2;
@@ -255,13 +365,16 @@ static int HandleZRLETile(rfbClient* client,
           if( zywrle_level > 0 ){
 			CARDBPP* pFrame = (CARDBPP*)client->frameBuffer + y*client->width+x;
 			int ret;
-			client->appData.qualityLevel |= 0x80;
-			ret = HandleZRLETile(client, buffer, buffer_end-buffer, x, y, w, h);
-		    client->appData.qualityLevel &= 0x7F;
+			ret = HandleZRLETile(client, buffer, buffer_end-buffer, x, y, w, h,
+			                     0, scratch, scratchSize);
 			if( ret < 0 ){
 				return ret;
 			}
-			ZYWRLE_SYNTHESIZE( pFrame, pFrame, w, h, client->width, zywrle_level, (int*)client->zlib_buffer );
+			if( !GrowBuffer((void **)scratch, scratchSize,
+			                rfbZRLETileWidth * rfbZRLETileHeight * sizeof(int)) ){
+				return -12;
+			}
+			ZYWRLE_SYNTHESIZE( pFrame, pFrame, w, h, client->width, zywrle_level, (int*)*scratch );
 			buffer += ret;
 		  }else
 #endif
@@ -415,10 +528,106 @@ static int HandleZRLETile(rfbClient* client,
 	return buffer-buffer_copy;	
 }
 
+/* Returns how many bytes HandleZRLETile() would consume for a w x h tile,
+ * with the same negative result for data it would reject, without
+ * decoding it.
+ */
+static int ZRLETileLength(uint8_t* buffer,size_t buffer_length,
+		int w,int h,int zywrle_level) {
+	uint8_t* buffer_copy = buffer;
+	uint8_t* buffer_end = buffer+buffer_length;
+	int pixels = w*h;
+	uint8_t type;
+
+	if(buffer_length<1)
+		return -2;
+
+	type = *buffer;
+	buffer++;
+	if( type == 0 ) /* raw */
+	{
+#if BPP!=8
+		if( zywrle_level > 0 ){
+			int ret = ZRLETileLength(buffer, buffer_end-buffer, w, h, 0);
+			return ret < 0 ? ret : 1+ret;
+		}
+#endif
+		if(1+w*h*REALBPP/8>buffer_length)
+			return -3;
+		buffer+=w*h*REALBPP/8;
+	}
+	else if( type == 1 ) /* solid */
+	{
+		if(1+REALBPP/8>buffer_length)
+			return -4;
+		buffer+=REALBPP/8;
+	}
+	else if( type <= 127 ) /* packed Palette */
+	{
+		int bpp=(type>4?(type>16?8:4):(type>2?2:1)),
+			divider=(8/bpp);
+
+		if(1+type*REALBPP/8+((w+divider-1)/divider)*h>buffer_length)
+			return -5;
+		buffer+=type*REALBPP/8+((w+divider-1)/divider)*h;
+	}
+	else if( type == 128 ) /* plain RLE */
+	{
+		while(pixels>0) {
+			int length=1;
+			if(buffer+REALBPP/8+1>buffer_end)
+				return -7;
+			buffer+=REALBPP/8;
+			while(*buffer==0xff) {
+				if(buffer+1>=buffer_end)
+					return -8;
+				length+=*buffer;
+				buffer++;
+			}
+			length+=*buffer;
+			buffer++;
+			pixels-=length;
+		}
+	}
+	else if( type == 129 ) /* unused */
+	{
+		return -8;
+	}
+	else /* palette RLE */
+	{
+		if(2+(type-128)*REALBPP/8>buffer_length)
+			return -9;
+		buffer+=(type-128)*REALBPP/8;
+		while(pixels>0) {
+			int length=1;
+			if(buffer>=buffer_end)
+				return -10;
+			if(*buffer&0x80) {
+				if(buffer+1>=buffer_end)
+					return -11;
+				buffer++;
+				while(*buffer==0xff) {
+					if(buffer+1>=buffer_end)
+						return -8;
+					length+=*buffer;
+					buffer++;
+				}
+				length+=*buffer;
+			}
+			buffer++;
+			pixels-=length;
+		}
+	}
+
+	return buffer-buffer_copy;
+}
+
 #undef CARDBPP
 #undef CARDREALBPP
 #undef HandleZRLE
 #undef HandleZRLETile
+#undef ZRLETileLength
+#undef ZRLETileTask
 #undef UncompressCPixel
 
 #endif
@@ -54,6 +54,19 @@ rfbUsage(void)
 #endif
     fprintf(stderr, "-enablehttpproxy       enable http proxy support\n");
     fprintf(stderr, "-progressive height    enable progressive updating for slow links\n");
+    fprintf(stderr, "-encodecache kbytes    share up to kbytes of encoded rectangles between\n"
+                    "                       clients with the same format and encoding\n");
+    fprintf(stderr, "-select                wait for input with select() rather than epoll\n");
+    fprintf(stderr, "-workers n             in the background, serve clients from n threads\n"
+                    "                       instead of two per client (-1: one per core)\n");
+    fprintf(stderr, "-maxfps n              pace updates to the clients' connections, at most\n"
+                    "                       n per second, instead of deferring them\n");
+    fprintf(stderr, "-encodethreads n       encode large updates on n threads at once\n"
+                    "                       (-1: one per core)\n");
+    fprintf(stderr, "-scalethreads n        scale large changes for scaled clients on n\n"
+                    "                       threads at once (-1: one per core)\n");
+    fprintf(stderr, "-adaptivezlib          move ZRLE's zlib level to suit each client's\n"
+                    "                       connection and the CPU\n");
     fprintf(stderr, "-listen ipaddr         listen for connections only on network interface with\n");
     fprintf(stderr, "                       addr ipaddr. '-listen localhost' and hostname work too.\n");
 #ifdef LIBVNCSERVER_IPv6
@@ -186,6 +199,40 @@ rfbProcessArguments(rfbScreenInfoPtr rfbScreen,int* argc, char *argv[])
 		return FALSE;
 	    }
             rfbScreen->progressiveSliceHeight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-encodecache") == 0) {  /* -encodecache kbytes */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->encodeCacheSize = atoi(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "-select") == 0) {
+            rfbScreen->useSelect = TRUE;
+        } else if (strcmp(argv[i], "-workers") == 0) {  /* -workers n */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->workerThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-maxfps") == 0) {  /* -maxfps n */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->maxFrameRate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-encodethreads") == 0) {  /* -encodethreads n */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->encodeThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-scalethreads") == 0) {  /* -scalethreads n */
+            if (i + 1 >= *argc) {
+		rfbUsage();
+		return FALSE;
+	    }
+            rfbScreen->scaleThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-adaptivezlib") == 0) {
+            rfbScreen->adaptiveZlibLevel = TRUE;
         } else if (strcmp(argv[i], "-listen") == 0) {  /* -listen ipaddr */
             if (i + 1 >= *argc) {
 		rfbUsage();
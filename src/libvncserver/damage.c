@@ -0,0 +1,368 @@
+/*
+ * damage.c - finds what changed in the framebuffer of a source that can
+ * only be polled, like a screen grabber or a camera, so that only that is
+ * marked as modified instead of the whole screen.
+ *
+ * The screen is cut into TILE_SIZE x TILE_SIZE tiles and the result is
+ * the region of the tiles that changed, merged into runs along each row
+ * of tiles. rfbCopyDamage() compares a captured frame with the
+ * framebuffer, which keeps the previous one, and copies what changed
+ * over; rows are searched for differences with simd_find_difference()
+ * across all tiles not yet known to have changed, so an unchanged row
+ * costs one vector compare pass. rfbFindDamage() is for sources that
+ * draw straight into the framebuffer and compares a hash of each tile
+ * with the one it had the last time.
+ *
+ * With more than one thread, the calling thread and threads-1 helpers
+ * take rows of tiles off a shared counter until all are done.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <string.h>
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+#include "simd.h"
+
+#define TILE_SIZE 32
+#define MAX_DAMAGE_THREADS 64
+
+struct _rfbDamageDetector {
+    rfbScreenInfoPtr screen;
+    /* what the tiles are laid out for */
+    int width, height, bytesPerPixel;
+    int tilesX, tilesY;
+    unsigned char *changed;     /* per tile, for the current frame */
+    uint64_t *hashes;           /* per tile, for rfbFindDamage() */
+    rfbBool hashed;             /* hashes are those of the last frame */
+
+    /* the job the threads share: a frame to copy from, or NULL to hash */
+    const char *frame;
+    int stride;
+    int nextBand, bandsDone;
+    MUTEX(mutex);
+    COND(jobDone);
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    int nThreads;
+    pthread_t threads[MAX_DAMAGE_THREADS];
+    COND(jobPosted);
+    unsigned long job;
+    rfbBool quit;
+#endif
+};
+
+/* (re)sizes the tile arrays to the screen, FALSE if out of memory */
+static rfbBool
+layOut(rfbDamageDetectorPtr d)
+{
+    rfbScreenInfoPtr screen = d->screen;
+    int bytesPerPixel = screen->serverFormat.bitsPerPixel / 8;
+    size_t tiles;
+
+    if (d->changed && d->width == screen->width && d->height == screen->height
+	&& d->bytesPerPixel == bytesPerPixel)
+	return TRUE;
+
+    d->width = screen->width;
+    d->height = screen->height;
+    d->bytesPerPixel = bytesPerPixel;
+    d->tilesX = (d->width + TILE_SIZE - 1) / TILE_SIZE;
+    d->tilesY = (d->height + TILE_SIZE - 1) / TILE_SIZE;
+    tiles = (size_t)d->tilesX * d->tilesY;
+
+    free(d->changed);
+    free(d->hashes);
+    d->changed = malloc(tiles);
+    d->hashes = malloc(tiles * sizeof(uint64_t));
+    d->hashed = FALSE;
+    if (d->changed == NULL || d->hashes == NULL) {
+	free(d->changed);
+	free(d->hashes);
+	d->changed = NULL;
+	d->hashes = NULL;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/* marks the tiles of a band whose rows differ in frame and copies them */
+static void
+compareBand(rfbDamageDetectorPtr d, int band)
+{
+    rfbScreenInfoPtr screen = d->screen;
+    unsigned char *changed = d->changed + (size_t)band * d->tilesX;
+    size_t tileBytes = (size_t)TILE_SIZE * d->bytesPerPixel;
+    size_t rowBytes = (size_t)d->width * d->bytesPerPixel;
+    size_t start, end, offset;
+    int y0 = band * TILE_SIZE, rows = d->height - y0, y, t, u;
+    char *fb;
+    const char *src;
+
+    if (rows > TILE_SIZE)
+	rows = TILE_SIZE;
+    memset(changed, 0, d->tilesX);
+
+    for (y = y0; y < y0 + rows; y++) {
+	fb = screen->frameBuffer + (size_t)y * screen->paddedWidthInBytes;
+	src = d->frame + (size_t)y * d->stride;
+	/* one search over each run of tiles that have not changed yet */
+	for (t = 0; t < d->tilesX; ) {
+	    if (changed[t]) {
+		t++;
+		continue;
+	    }
+	    for (u = t; u < d->tilesX && !changed[u]; u++)
+		;
+	    start = t * tileBytes;
+	    end = u * tileBytes < rowBytes ? u * tileBytes : rowBytes;
+	    offset = simd_find_difference((const uint8_t *)fb + start,
+					  (const uint8_t *)src + start, end - start);
+	    if (offset == end - start) {
+		t = u;
+		continue;
+	    }
+	    t = (start + offset) / tileBytes;
+	    changed[t] = TRUE;
+	    t++;
+	}
+    }
+
+    /* runs of changed tiles are copied a row at a time */
+    for (t = 0; t < d->tilesX; t = u) {
+	for (; t < d->tilesX && !changed[t]; t++)
+	    ;
+	for (u = t; u < d->tilesX && changed[u]; u++)
+	    ;
+	if (t == u)
+	    break;
+	start = t * tileBytes;
+	end = u * tileBytes < rowBytes ? u * tileBytes : rowBytes;
+	for (y = y0; y < y0 + rows; y++)
+	    memcpy(screen->frameBuffer + (size_t)y * screen->paddedWidthInBytes + start,
+		   d->frame + (size_t)y * d->stride + start, end - start);
+    }
+}
+
+#define HASH_PRIME 0x9e3779b97f4a7c15ULL
+/* each step maps one h to one h for a given w and the other way round,
+   so a tile that differs in a single word always hashes differently */
+#define HASH_STEP(h, w) \
+    ((h) = ((h) ^ (w)) * HASH_PRIME, (h) = (h) << 31 | (h) >> 33)
+
+/* over four lanes, which do not wait on each other */
+static uint64_t
+hashTile(const char *p, int stride, size_t bytes, int rows)
+{
+    uint64_t h0 = 1, h1 = 2, h2 = 3, h3 = 4, w;
+    size_t i;
+    int y;
+
+    for (y = 0; y < rows; y++, p += stride) {
+	for (i = 0; i + 32 <= bytes; i += 32) {
+	    memcpy(&w, p + i, 8);
+	    HASH_STEP(h0, w);
+	    memcpy(&w, p + i + 8, 8);
+	    HASH_STEP(h1, w);
+	    memcpy(&w, p + i + 16, 8);
+	    HASH_STEP(h2, w);
+	    memcpy(&w, p + i + 24, 8);
+	    HASH_STEP(h3, w);
+	}
+	for (; i < bytes; i += 8) {
+	    w = 0;
+	    memcpy(&w, p + i, bytes - i < 8 ? bytes - i : 8);
+	    HASH_STEP(h0, w);
+	}
+    }
+    return ((h0 * HASH_PRIME ^ h1) * HASH_PRIME ^ h2) * HASH_PRIME ^ h3;
+}
+
+/* marks the tiles of a band whose hashes changed and keeps the new ones */
+static void
+hashBand(rfbDamageDetectorPtr d, int band)
+{
+    rfbScreenInfoPtr screen = d->screen;
+    size_t first = (size_t)band * d->tilesX;
+    size_t tileBytes = (size_t)TILE_SIZE * d->bytesPerPixel;
+    size_t rowBytes = (size_t)d->width * d->bytesPerPixel, start;
+    int y0 = band * TILE_SIZE, rows = d->height - y0, t;
+    uint64_t hash;
+
+    if (rows > TILE_SIZE)
+	rows = TILE_SIZE;
+
+    for (t = 0; t < d->tilesX; t++) {
+	start = t * tileBytes;
+	hash = hashTile(screen->frameBuffer + (size_t)y0 * screen->paddedWidthInBytes + start,
+			screen->paddedWidthInBytes,
+			start + tileBytes < rowBytes ? tileBytes : rowBytes - start, rows);
+	d->changed[first + t] = !d->hashed || hash != d->hashes[first + t];
+	d->hashes[first + t] = hash;
+    }
+}
+
+/* takes bands until there are none left; d->mutex is held, if any */
+static void
+runBands(rfbDamageDetectorPtr d)
+{
+    int band;
+
+    while (d->nextBand < d->tilesY) {
+	band = d->nextBand++;
+	UNLOCK(d->mutex);
+	if (d->frame)
+	    compareBand(d, band);
+	else
+	    hashBand(d, band);
+	LOCK(d->mutex);
+	if (++d->bandsDone == d->tilesY)
+	    TSIGNAL(d->jobDone);
+    }
+}
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+static THREAD_ROUTINE_RETURN_TYPE
+helperRun(void *data)
+{
+    rfbDamageDetectorPtr d = (rfbDamageDetectorPtr)data;
+    unsigned long job = 0;
+
+    LOCK(d->mutex);
+    for (;;) {
+	while (d->job == job && !d->quit)
+	    WAIT(d->jobPosted, d->mutex);
+	if (d->quit)
+	    break;
+	job = d->job;
+	runBands(d);
+    }
+    UNLOCK(d->mutex);
+    return THREAD_ROUTINE_RETURN_VALUE;
+}
+#endif
+
+/* runs a job over all bands and marks what changed; see rfbCopyDamage() */
+static int
+detect(rfbDamageDetectorPtr d, const char *frame, int stride)
+{
+    sraRegionPtr region, rect;
+    int x, y, t, u, tiles = 0;
+    unsigned char *changed;
+
+    if (!layOut(d))
+	return -1;
+
+    LOCK(d->mutex);
+    d->frame = frame;
+    d->stride = stride;
+    d->nextBand = 0;
+    d->bandsDone = 0;
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    d->job++;
+    if (d->nThreads > 0)
+	pthread_cond_broadcast(&d->jobPosted);
+#endif
+    runBands(d);
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    /* for the bands the helpers are still on */
+    while (d->bandsDone < d->tilesY)
+	WAIT(d->jobDone, d->mutex);
+#endif
+    UNLOCK(d->mutex);
+    if (!frame)
+	d->hashed = TRUE;
+
+    region = sraRgnCreate();
+    for (y = 0; y < d->tilesY; y++) {
+	changed = d->changed + (size_t)y * d->tilesX;
+	for (t = 0; t < d->tilesX; t = u) {
+	    for (; t < d->tilesX && !changed[t]; t++)
+		;
+	    for (u = t; u < d->tilesX && changed[u]; u++)
+		;
+	    if (t == u)
+		break;
+	    tiles += u - t;
+	    x = u * TILE_SIZE < d->width ? u * TILE_SIZE : d->width;
+	    rect = sraRgnCreateRect(t * TILE_SIZE, y * TILE_SIZE, x,
+				    (y + 1) * TILE_SIZE < d->height ? (y + 1) * TILE_SIZE : d->height);
+	    sraRgnOr(region, rect);
+	    sraRgnDestroy(rect);
+	}
+    }
+    if (tiles > 0)
+	rfbMarkRegionAsModified(d->screen, region);
+    sraRgnDestroy(region);
+    return tiles;
+}
+
+rfbDamageDetectorPtr
+rfbNewDamageDetector(rfbScreenInfoPtr screen, int threads)
+{
+    rfbDamageDetectorPtr d = calloc(1, sizeof(struct _rfbDamageDetector));
+
+    if (d == NULL)
+	return NULL;
+    d->screen = screen;
+    INIT_MUTEX(d->mutex);
+    INIT_COND(d->jobDone);
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    INIT_COND(d->jobPosted);
+    if (threads > MAX_DAMAGE_THREADS)
+	threads = MAX_DAMAGE_THREADS;
+    for (d->nThreads = 0; d->nThreads < threads - 1; d->nThreads++)
+	if (pthread_create(&d->threads[d->nThreads], NULL, helperRun, d) != 0)
+	    break;
+#else
+    (void)threads;
+#endif
+    return d;
+}
+
+void
+rfbFreeDamageDetector(rfbDamageDetectorPtr d)
+{
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+    int i;
+
+    LOCK(d->mutex);
+    d->quit = TRUE;
+    pthread_cond_broadcast(&d->jobPosted);
+    UNLOCK(d->mutex);
+    for (i = 0; i < d->nThreads; i++)
+	THREAD_JOIN(d->threads[i]);
+    TINI_COND(d->jobPosted);
+#endif
+    TINI_COND(d->jobDone);
+    TINI_MUTEX(d->mutex);
+    free(d->changed);
+    free(d->hashes);
+    free(d);
+}
+
+int
+rfbCopyDamage(rfbDamageDetectorPtr d, const char *frame, int stride)
+{
+    return detect(d, frame, stride);
+}
+
+int
+rfbFindDamage(rfbDamageDetectorPtr d)
+{
+    return detect(d, NULL, 0);
+}
@@ -0,0 +1,441 @@
+/*
+ * encodecache.c - lets clients share encoded rectangles.
+ *
+ * When several viewers ask for the same update in the same pixel format,
+ * encoding and quality, only the first one has to encode it: the bytes it
+ * produces, from the rectangle header on, are kept in a per-screen cache
+ * and copied into the update buffers of the others. Entries are keyed by
+ * the rectangle, the client's pixel format, the encoding and its levels,
+ * and belong to a framebuffer generation, which goes up whenever a region
+ * is marked as modified or copied and whenever the framebuffer is
+ * replaced. A new generation drops the whole cache.
+ *
+ * Only the output of encodings without state across rectangles can be
+ * shared. Raw, RRE, CoRRE, Hextile and Ultra always qualify. Zlib, ZRLE and
+ * ZYWRLE compress into a zlib stream per client, and what they send only
+ * decodes against the dictionary that client's inflater has built up, so
+ * they are never cached: sharing would need every client's stream in
+ * lockstep, and resetting the streams for every rectangle would throw
+ * away the compression ratio those encodings are chosen for. Tight sits in
+ * between; its solid, JPEG and uncompressed subrectangles are shared,
+ * but a rectangle with any data deflated through one of the client's four
+ * zlib streams is not (see rfbEncodeCacheUnshareable()).
+ *
+ * Clients that get the cursor drawn into the framebuffer, scaled clients
+ * and colour map pixel formats neither use nor fill the cache.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <rfb/rfb.h>
+#include "private.h"
+
+#define ENCODE_CACHE_BUCKETS 1024
+
+typedef struct {
+    int x, y, w, h;
+    int encoding;
+    int level[4];
+    rfbBool lastRect;
+    rfbPixelFormat format;
+} EncodeKey;
+
+typedef struct EncodedRect {
+    struct EncodedRect *next;   /* in the hash bucket */
+    struct EncodedRect *older, *newer;
+    EncodeKey key;
+    unsigned int hash;
+    int refs;                   /* 1 for the cache, 1 per client sending it */
+    int len;
+} EncodedRect;
+
+#define ENCODED_DATA(e) ((char *)((e) + 1))
+
+typedef struct {
+#if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) || defined(LIBVNCSERVER_HAVE_WIN32THREADS)
+    MUTEX(mutex);
+#endif
+    unsigned long generation;
+    /* the generation all entries belong to */
+    unsigned long entriesGeneration;
+    EncodedRect *buckets[ENCODE_CACHE_BUCKETS];
+    EncodedRect *oldest, *newest;
+    size_t size;
+} EncodeCache;
+
+typedef struct {
+    EncodeKey key;
+    unsigned int hash;
+    unsigned long generation;
+    rfbBool active;
+    /* where the bytes not yet captured start in cl->updateBuf */
+    int start;
+    char *buf;
+    int len, allocated;
+} EncodeCapture;
+
+void
+rfbEncodeCacheInit(rfbScreenInfoPtr screen)
+{
+    EncodeCache *cache;
+
+    if (screen->encodeCacheSize <= 0 || screen->encodeCache != NULL)
+        return;
+
+    cache = calloc(1, sizeof(EncodeCache));
+    if (cache == NULL) {
+        rfbErr("rfbEncodeCacheInit: out of memory\n");
+        return;
+    }
+    INIT_MUTEX(cache->mutex);
+    screen->encodeCache = cache;
+}
+
+static void
+ReleaseEncodedRect(EncodedRect *e)
+{
+    if (--e->refs == 0)
+        free(e);
+}
+
+static void
+Unlink(EncodeCache *cache, EncodedRect *e)
+{
+    EncodedRect **p = &cache->buckets[e->hash % ENCODE_CACHE_BUCKETS];
+
+    while (*p != e)
+        p = &(*p)->next;
+    *p = e->next;
+
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        cache->oldest = e->newer;
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        cache->newest = e->older;
+
+    cache->size -= sizeof(EncodedRect) + e->len;
+    ReleaseEncodedRect(e);
+}
+
+static void
+Flush(EncodeCache *cache)
+{
+    while (cache->oldest)
+        Unlink(cache, cache->oldest);
+    cache->entriesGeneration = cache->generation;
+}
+
+void
+rfbEncodeCacheFree(rfbScreenInfoPtr screen)
+{
+    EncodeCache *cache = (EncodeCache *)screen->encodeCache;
+
+    if (cache == NULL)
+        return;
+
+    Flush(cache);
+    TINI_MUTEX(cache->mutex);
+    free(cache);
+    screen->encodeCache = NULL;
+}
+
+void
+rfbEncodeCacheFreeClient(rfbClientPtr cl)
+{
+    EncodeCapture *cap = (EncodeCapture *)cl->encodeCapture;
+
+    if (cap == NULL)
+        return;
+
+    free(cap->buf);
+    free(cap);
+    cl->encodeCapture = NULL;
+}
+
+void
+rfbEncodeCacheInvalidate(rfbScreenInfoPtr screen)
+{
+    EncodeCache *cache = (EncodeCache *)screen->encodeCache;
+
+    if (cache == NULL)
+        return;
+
+    LOCK(cache->mutex);
+    cache->generation++;
+    UNLOCK(cache->mutex);
+}
+
+static rfbBool
+Shareable(rfbClientPtr cl)
+{
+    if (cl->scaledScreen != cl->screen)
+        return FALSE;
+    if (!cl->screen->serverFormat.trueColour || !cl->format.trueColour)
+        return FALSE;
+    /* the soft cursor is drawn into the framebuffer while encoding */
+    if (!cl->enableCursorShapeUpdates && cl->screen->cursor != NULL)
+        return FALSE;
+
+    switch (cl->preferredEncoding) {
+    case -1:
+    case rfbEncodingRaw:
+    case rfbEncodingRRE:
+    case rfbEncodingCoRRE:
+    case rfbEncodingHextile:
+    case rfbEncodingUltra:
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    case rfbEncodingTight:
+#ifdef LIBVNCSERVER_HAVE_LIBPNG
+    case rfbEncodingTightPng:
+#endif
+#endif
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static unsigned int
+MakeKey(rfbClientPtr cl, EncodeKey *key, int x, int y, int w, int h)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    unsigned int hash = 2166136261U;
+    size_t i;
+
+    /* the key is hashed and compared as bytes, padding included */
+    memset(key, 0, sizeof(EncodeKey));
+    key->x = x;
+    key->y = y;
+    key->w = w;
+    key->h = h;
+    key->encoding = cl->preferredEncoding == -1 ? rfbEncodingRaw : cl->preferredEncoding;
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    if (key->encoding == rfbEncodingTight || key->encoding == rfbEncodingTightPng) {
+        key->level[0] = cl->tightCompressLevel;
+        key->level[1] = cl->tightQualityLevel;
+        key->level[2] = cl->turboSubsampLevel;
+        key->level[3] = cl->turboQualityLevel;
+        key->lastRect = cl->enableLastRectEncoding;
+    }
+#endif
+    key->format = cl->format;
+    key->format.pad1 = 0;
+    key->format.pad2 = 0;
+
+    for (i = 0; i < sizeof(EncodeKey); i++)
+        hash = (hash ^ p[i]) * 16777619U;
+    return hash;
+}
+
+static rfbBool
+SendEncodedRect(rfbClientPtr cl, EncodedRect *e)
+{
+    const char *data = ENCODED_DATA(e);
+    int left = e->len;
+
+    while (left > 0) {
+        int n = UPDATE_BUF_SIZE - cl->ublen;
+
+        if (n == 0) {
+            if (!rfbSendUpdateBuf(cl))
+                return FALSE;
+            continue;
+        }
+        if (n > left)
+            n = left;
+        memcpy(&cl->updateBuf[cl->ublen], data, n);
+        cl->ublen += n;
+        data += n;
+        left -= n;
+    }
+
+    rfbStatRecordEncodingSent(cl, e->key.encoding, e->len,
+                              sz_rfbFramebufferUpdateRectHeader +
+                              e->key.w * e->key.h * (cl->format.bitsPerPixel / 8));
+    return TRUE;
+}
+
+int
+rfbEncodeCacheBegin(rfbClientPtr cl, int x, int y, int w, int h)
+{
+    EncodeCache *cache = (EncodeCache *)cl->screen->encodeCache;
+    EncodeCapture *cap = (EncodeCapture *)cl->encodeCapture;
+    EncodedRect *e;
+    EncodeKey key;
+    unsigned int hash;
+    unsigned long generation;
+    rfbBool ok;
+
+    if (cap)
+        cap->active = FALSE;
+    if (cache == NULL || !Shareable(cl))
+        return 0;
+
+    hash = MakeKey(cl, &key, x, y, w, h);
+
+    LOCK(cache->mutex);
+    if (cache->entriesGeneration != cache->generation)
+        Flush(cache);
+    for (e = cache->buckets[hash % ENCODE_CACHE_BUCKETS]; e; e = e->next)
+        if (e->hash == hash && memcmp(&e->key, &key, sizeof(EncodeKey)) == 0)
+            break;
+    if (e) {
+        /* most recently used goes to the end */
+        if (e->newer) {
+            if (e->older)
+                e->older->newer = e->newer;
+            else
+                cache->oldest = e->newer;
+            e->newer->older = e->older;
+            e->older = cache->newest;
+            e->newer = NULL;
+            cache->newest->newer = e;
+            cache->newest = e;
+        }
+        e->refs++;
+    }
+    generation = cache->generation;
+    UNLOCK(cache->mutex);
+
+    if (e) {
+        ok = SendEncodedRect(cl, e);
+        LOCK(cache->mutex);
+        ReleaseEncodedRect(e);
+        UNLOCK(cache->mutex);
+        return ok ? 1 : -1;
+    }
+
+    if (cap == NULL) {
+        cap = calloc(1, sizeof(EncodeCapture));
+        if (cap == NULL)
+            return 0;
+        cl->encodeCapture = cap;
+    }
+    cap->key = key;
+    cap->hash = hash;
+    cap->generation = generation;
+    cap->start = cl->ublen;
+    cap->len = 0;
+    cap->active = TRUE;
+    return 0;
+}
+
+static void
+Append(EncodeCapture *cap, const char *data, int len)
+{
+    if (cap->len + len > cap->allocated) {
+        int allocated = cap->allocated ? cap->allocated : UPDATE_BUF_SIZE;
+        char *buf;
+
+        while (allocated < cap->len + len)
+            allocated *= 2;
+        buf = realloc(cap->buf, allocated);
+        if (buf == NULL) {
+            cap->active = FALSE;
+            return;
+        }
+        cap->buf = buf;
+        cap->allocated = allocated;
+    }
+    memcpy(cap->buf + cap->len, data, len);
+    cap->len += len;
+}
+
+void
+rfbEncodeCacheCapture(rfbClientPtr cl)
+{
+    EncodeCapture *cap = (EncodeCapture *)cl->encodeCapture;
+
+    if (cap == NULL || !cap->active)
+        return;
+
+    Append(cap, cl->updateBuf + cap->start, cl->ublen - cap->start);
+    cap->start = 0;
+}
+
+void
+rfbEncodeCacheUnshareable(rfbClientPtr cl)
+{
+    EncodeCapture *cap = (EncodeCapture *)cl->encodeCapture;
+
+    if (cap)
+        cap->active = FALSE;
+}
+
+void
+rfbEncodeCacheEnd(rfbClientPtr cl)
+{
+    EncodeCache *cache = (EncodeCache *)cl->screen->encodeCache;
+    EncodeCapture *cap = (EncodeCapture *)cl->encodeCapture;
+    EncodedRect *e, *old;
+    size_t size;
+
+    if (cap == NULL || !cap->active)
+        return;
+
+    rfbEncodeCacheCapture(cl);
+    if (!cap->active)
+        return;
+    cap->active = FALSE;
+
+    size = sizeof(EncodedRect) + cap->len;
+    if (size > (size_t)cl->screen->encodeCacheSize)
+        return;
+    e = malloc(size);
+    if (e == NULL)
+        return;
+    e->key = cap->key;
+    e->hash = cap->hash;
+    e->refs = 1;
+    e->len = cap->len;
+    memcpy(ENCODED_DATA(e), cap->buf, cap->len);
+
+    LOCK(cache->mutex);
+    if (cache->entriesGeneration != cache->generation)
+        Flush(cache);
+    /* the framebuffer may have changed while this rect was encoded */
+    if (cap->generation != cache->generation) {
+        UNLOCK(cache->mutex);
+        free(e);
+        return;
+    }
+    /* and another client may have been quicker */
+    for (old = cache->buckets[e->hash % ENCODE_CACHE_BUCKETS]; old; old = old->next)
+        if (old->hash == e->hash && memcmp(&old->key, &e->key, sizeof(EncodeKey)) == 0) {
+            UNLOCK(cache->mutex);
+            free(e);
+            return;
+        }
+
+    while (cache->oldest && cache->size + size > (size_t)cl->screen->encodeCacheSize)
+        Unlink(cache, cache->oldest);
+
+    e->next = cache->buckets[e->hash % ENCODE_CACHE_BUCKETS];
+    cache->buckets[e->hash % ENCODE_CACHE_BUCKETS] = e;
+    e->older = cache->newest;
+    e->newer = NULL;
+    if (cache->newest)
+        cache->newest->newer = e;
+    else
+        cache->oldest = e;
+    cache->newest = e;
+    cache->size += size;
+    UNLOCK(cache->mutex);
+}
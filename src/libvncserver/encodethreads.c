@@ -0,0 +1,499 @@
+/*
+ * encodethreads.c - encodes a large framebuffer update on several threads.
+ *
+ * With rfbScreenInfo::encodeThreads set, an update of MIN_PARALLEL_AREA
+ * pixels or more is cut into strips of whole rows, which the sending
+ * thread and encodeThreads-1 helpers take off a shared counter, as with
+ * the bands of damage.c. Each thread encodes through a shadow of the
+ * client: a client record of its own that takes the client's pixel format
+ * and encoding settings, with encoder buffers, zlib streams and a JPEG
+ * compressor of its own, whose rfbSendUpdateBuf() appends to the output
+ * of its strip instead of writing to the socket. The strips then go to
+ * the client in order. How many rectangles the encoders make of a strip
+ * is only known afterwards, so such an update ends with a LastRect marker
+ * and clients that don't take one are always encoded on one thread.
+ *
+ * Raw, RRE, CoRRE, Hextile and Ultra keep nothing from one rectangle to
+ * the next. Tight deflates through four zlib streams whose dictionaries
+ * the client's inflaters have to follow, so a shadow restarts the streams
+ * it uses in every strip and has the client restart its own along with
+ * them, and the client's own streams are restarted the next time it uses
+ * them itself; see rfbClientRec::tightStreamsToReset. Zlib, ZRLE and
+ * ZYWRLE compress a whole update through one stream and stay on one
+ * thread.
+ *
+ * One update at a time is spread over the threads; one that comes along
+ * while they are busy is encoded by the thread sending it, strip by strip.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+#include "private.h"
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+
+#include <unistd.h>
+
+#define MAX_ENCODE_THREADS 64
+/* smaller updates are not worth waking the helpers for */
+#define MIN_PARALLEL_AREA (512 * 256)
+/* so that a thread that gets the easy strips gets more of them */
+#define STRIPS_PER_THREAD 4
+/* strips start on the tile rows of Hextile and Tight */
+#define STRIP_ROWS 16
+
+typedef struct {
+    int x, y, w, h;
+    /* what the encoder sent for the strip */
+    char *out;
+    int len, allocated;
+    rfbBool failed;
+} EncodeStrip;
+
+typedef struct {
+    int nThreads;
+    pthread_t threads[MAX_ENCODE_THREADS];
+    /* [0] is the sending thread's, [i + 1] threads[i]'s */
+    rfbClientPtr shadows[MAX_ENCODE_THREADS + 1];
+
+    MUTEX(mutex);
+    COND(jobPosted);
+    COND(jobDone);
+    rfbBool busy;
+    unsigned long job;
+    rfbBool quit;
+
+    /* the job: the client whose update the strips are */
+    rfbClientPtr cl;
+    EncodeStrip *strips;
+    int nStrips, allocatedStrips;
+    int nextStrip, stripsDone;
+} EncodeThreads;
+
+/*
+ * gives shadow what the encoders read of cl: the framebuffer, the pixel
+ * format and its translation, and the encoding with its settings. The
+ * encoders' buffers, zlib streams and JPEG compressor stay the shadow's,
+ * and nothing else of cl, its socket, locks and regions least of all,
+ * ever gets there
+ */
+static void
+adopt(rfbClientPtr shadow, rfbClientPtr cl)
+{
+    shadow->screen = cl->screen;
+    shadow->scaledScreen = cl->scaledScreen;
+    shadow->format = cl->format;
+    shadow->translateFn = cl->translateFn;
+    shadow->translateLookupTable = cl->translateLookupTable;
+    shadow->preferredEncoding = cl->preferredEncoding;
+    shadow->correMaxWidth = cl->correMaxWidth;
+    shadow->correMaxHeight = cl->correMaxHeight;
+    shadow->enableLastRectEncoding = cl->enableLastRectEncoding;
+    shadow->enableCursorShapeUpdates = cl->enableCursorShapeUpdates;
+#if defined(LIBVNCSERVER_HAVE_LIBZ) || defined(LIBVNCSERVER_HAVE_LIBPNG)
+    shadow->tightQualityLevel = cl->tightQualityLevel;
+#ifdef LIBVNCSERVER_HAVE_LIBJPEG
+    shadow->tightCompressLevel = cl->tightCompressLevel;
+    shadow->turboSubsampLevel = cl->turboSubsampLevel;
+    shadow->turboQualityLevel = cl->turboQualityLevel;
+#endif
+#endif
+    shadow->ublen = 0;
+}
+
+/* what the shadow counted goes to the client it is a copy of */
+static void
+foldStats(rfbClientPtr shadow, rfbClientPtr cl)
+{
+    rfbStatList *from, *to;
+
+    for (from = shadow->statEncList; from != NULL; from = from->Next) {
+        to = rfbStatLookupEncoding(cl, from->type);
+        if (to == NULL)
+            continue;
+        to->sentCount += from->sentCount;
+        to->bytesSent += from->bytesSent;
+        to->bytesSentIfRaw += from->bytesSentIfRaw;
+    }
+    rfbResetStats(shadow);
+}
+
+static void
+encodeStrip(rfbClientPtr shadow, EncodeStrip *strip)
+{
+    strip->len = 0;
+    shadow->encodeStrip = strip;
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    shadow->tightStreamsToReset = 0x0F;
+#endif
+    strip->failed = !rfbSendUpdateRect(shadow, strip->x, strip->y, strip->w, strip->h) ||
+                    (shadow->ublen > 0 && !rfbSendUpdateBuf(shadow));
+    shadow->encodeStrip = NULL;
+}
+
+/* takes strips until there are none left; t->mutex is held */
+static void
+runStrips(EncodeThreads *t, rfbClientPtr shadow)
+{
+    rfbBool adopted = FALSE;
+    EncodeStrip *strip;
+
+    while (t->nextStrip < t->nStrips) {
+        strip = &t->strips[t->nextStrip++];
+        UNLOCK(t->mutex);
+        /* t->cl is there until the last strip is done */
+        if (!adopted) {
+            adopt(shadow, t->cl);
+            adopted = TRUE;
+        }
+        encodeStrip(shadow, strip);
+        LOCK(t->mutex);
+        if (++t->stripsDone == t->nStrips)
+            TSIGNAL(t->jobDone);
+    }
+}
+
+static THREAD_ROUTINE_RETURN_TYPE
+helperRun(void *data)
+{
+    EncodeThreads *t = (EncodeThreads *)data;
+    rfbClientPtr shadow;
+    unsigned long job = 0;
+    int i;
+
+    LOCK(t->mutex);
+    for (i = 0; !pthread_equal(t->threads[i], pthread_self()); i++)
+        ;
+    shadow = t->shadows[i + 1];
+    for (;;) {
+        while (t->job == job && !t->quit)
+            WAIT(t->jobPosted, t->mutex);
+        if (t->quit)
+            break;
+        job = t->job;
+        runStrips(t, shadow);
+    }
+    UNLOCK(t->mutex);
+    return THREAD_ROUTINE_RETURN_VALUE;
+}
+
+/* cuts the update into strips of about area pixels, FALSE if out of memory */
+static rfbBool
+cutStrips(EncodeThreads *t, sraRegionPtr updateRegion, int area)
+{
+    sraRectangleIterator *i;
+    sraRect rect;
+    EncodeStrip *strip;
+    int y, rows;
+
+    t->nStrips = 0;
+    i = sraRgnGetIterator(updateRegion);
+    while (sraRgnIteratorNext(i, &rect)) {
+        rows = (area / (rect.x2 - rect.x1) + STRIP_ROWS - 1) / STRIP_ROWS * STRIP_ROWS;
+        if (rows < STRIP_ROWS)
+            rows = STRIP_ROWS;
+        for (y = rect.y1; y < rect.y2; y += rows) {
+            if (t->nStrips == t->allocatedStrips) {
+                int allocated = t->allocatedStrips ? 2 * t->allocatedStrips : 64;
+
+                strip = realloc(t->strips, allocated * sizeof(EncodeStrip));
+                if (strip == NULL) {
+                    sraRgnReleaseIterator(i);
+                    return FALSE;
+                }
+                memset(strip + t->allocatedStrips, 0,
+                       (allocated - t->allocatedStrips) * sizeof(EncodeStrip));
+                t->strips = strip;
+                t->allocatedStrips = allocated;
+            }
+            strip = &t->strips[t->nStrips++];
+            strip->x = rect.x1;
+            strip->y = y;
+            strip->w = rect.x2 - rect.x1;
+            strip->h = y + rows < rect.y2 ? rows : rect.y2 - y;
+        }
+    }
+    sraRgnReleaseIterator(i);
+    return TRUE;
+}
+
+void
+rfbEncodeThreadsInit(rfbScreenInfoPtr screen)
+{
+    EncodeThreads *t;
+    int n = screen->encodeThreads, i;
+
+    if (screen->encodeThreadPool)
+        return;
+    if (n < 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > MAX_ENCODE_THREADS)
+        n = MAX_ENCODE_THREADS;
+    if (n < 2)
+        return;
+
+    t = calloc(1, sizeof(EncodeThreads));
+    if (t == NULL)
+        return;
+    INIT_MUTEX(t->mutex);
+    INIT_COND(t->jobPosted);
+    INIT_COND(t->jobDone);
+    for (i = 0; i < n; i++) {
+        t->shadows[i] = calloc(1, sizeof(rfbClientRec));
+        if (t->shadows[i] == NULL)
+            break;
+        /* its output goes to the strips, never to a socket */
+        t->shadows[i]->sock = RFB_INVALID_SOCKET;
+    }
+    t->nThreads = i > 0 ? i - 1 : 0;
+
+    /* the helpers look for their place in t->threads */
+    LOCK(t->mutex);
+    for (i = 0; i < t->nThreads; i++)
+        if (pthread_create(&t->threads[i], NULL, helperRun, t) != 0)
+            break;
+    t->nThreads = i;
+    UNLOCK(t->mutex);
+    screen->encodeThreadPool = t;
+}
+
+static void
+freeShadow(rfbClientPtr shadow)
+{
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (shadow->zsActive[i])
+            deflateEnd(&shadow->zsStruct[i]);
+    rfbFreeTightData(shadow);
+#endif
+    rfbFreeUltraData(shadow);
+    rfbEncodeCacheFreeClient(shadow);
+    free(shadow->beforeEncBuf);
+    free(shadow->afterEncBuf);
+    free(shadow);
+}
+
+void
+rfbEncodeThreadsFree(rfbScreenInfoPtr screen)
+{
+    EncodeThreads *t = (EncodeThreads *)screen->encodeThreadPool;
+    int i;
+
+    if (t == NULL)
+        return;
+    LOCK(t->mutex);
+    t->quit = TRUE;
+    pthread_cond_broadcast(&t->jobPosted);
+    UNLOCK(t->mutex);
+    for (i = 0; i < t->nThreads; i++)
+        THREAD_JOIN(t->threads[i]);
+    for (i = 0; i <= MAX_ENCODE_THREADS; i++)
+        if (t->shadows[i])
+            freeShadow(t->shadows[i]);
+    for (i = 0; i < t->allocatedStrips; i++)
+        free(t->strips[i].out);
+    free(t->strips);
+    TINI_COND(t->jobPosted);
+    TINI_COND(t->jobDone);
+    TINI_MUTEX(t->mutex);
+    free(t);
+    screen->encodeThreadPool = NULL;
+}
+
+rfbBool
+rfbEncodeThreadsWanted(rfbClientPtr cl, sraRegionPtr updateRegion)
+{
+    EncodeThreads *t = (EncodeThreads *)cl->screen->encodeThreadPool;
+    sraRectangleIterator *i;
+    sraRect rect;
+    long area = 0;
+
+    if (t == NULL || t->nThreads == 0 || !cl->enableLastRectEncoding)
+        return FALSE;
+
+    switch (cl->preferredEncoding) {
+    case -1:
+    case rfbEncodingRaw:
+    case rfbEncodingRRE:
+    case rfbEncodingCoRRE:
+    case rfbEncodingHextile:
+    case rfbEncodingUltra:
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    case rfbEncodingTight:
+#ifdef LIBVNCSERVER_HAVE_LIBPNG
+    case rfbEncodingTightPng:
+#endif
+#endif
+        break;
+    default:
+        return FALSE;
+    }
+
+    i = sraRgnGetIterator(updateRegion);
+    while (area < MIN_PARALLEL_AREA && sraRgnIteratorNext(i, &rect))
+        area += (long)(rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+    sraRgnReleaseIterator(i);
+    return area >= MIN_PARALLEL_AREA;
+}
+
+rfbBool
+rfbEncodeThreadsSend(rfbClientPtr cl, sraRegionPtr updateRegion)
+{
+    EncodeThreads *t = (EncodeThreads *)cl->screen->encodeThreadPool;
+    sraRectangleIterator *i;
+    sraRect rect;
+    EncodeStrip *strip;
+    long area = 0;
+    int s, n, chunk;
+    rfbBool ok = TRUE;
+
+    LOCK(t->mutex);
+    if (t->busy) {
+        /* another client's update has the threads */
+        UNLOCK(t->mutex);
+        i = sraRgnGetIterator(updateRegion);
+        while (ok && sraRgnIteratorNext(i, &rect))
+            ok = rfbSendUpdateRect(cl, rect.x1, rect.y1,
+                                   rect.x2 - rect.x1, rect.y2 - rect.y1);
+        sraRgnReleaseIterator(i);
+        return ok;
+    }
+    t->busy = TRUE;
+    UNLOCK(t->mutex);
+
+    i = sraRgnGetIterator(updateRegion);
+    while (sraRgnIteratorNext(i, &rect))
+        area += (long)(rect.x2 - rect.x1) * (rect.y2 - rect.y1);
+    sraRgnReleaseIterator(i);
+    if (!cutStrips(t, updateRegion,
+                   (int)(area / ((t->nThreads + 1) * STRIPS_PER_THREAD)))) {
+        LOCK(t->mutex);
+        t->busy = FALSE;
+        UNLOCK(t->mutex);
+        return FALSE;
+    }
+
+    LOCK(t->mutex);
+    t->cl = cl;
+    t->nextStrip = 0;
+    t->stripsDone = 0;
+    t->job++;
+    pthread_cond_broadcast(&t->jobPosted);
+    runStrips(t, t->shadows[0]);
+    /* for the strips the helpers are still on */
+    while (t->stripsDone < t->nStrips)
+        WAIT(t->jobDone, t->mutex);
+    t->cl = NULL;
+    UNLOCK(t->mutex);
+
+    for (s = 0; s <= t->nThreads; s++)
+        foldStats(t->shadows[s], cl);
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+    /* the shadows had the client restart the streams they used */
+    if (cl->preferredEncoding == rfbEncodingTight ||
+        cl->preferredEncoding == rfbEncodingTightPng)
+        cl->tightStreamsToReset = 0x0F;
+#endif
+
+    /* the strips in order, through the client's own update buffer */
+    rfbEncodeCacheUnshareable(cl);
+    for (s = 0; ok && s < t->nStrips; s++) {
+        strip = &t->strips[s];
+        if (strip->failed) {
+            ok = FALSE;
+            break;
+        }
+        for (n = 0; n < strip->len; n += chunk) {
+            if (cl->ublen == UPDATE_BUF_SIZE && !rfbSendUpdateBuf(cl)) {
+                ok = FALSE;
+                break;
+            }
+            chunk = UPDATE_BUF_SIZE - cl->ublen;
+            if (chunk > strip->len - n)
+                chunk = strip->len - n;
+            memcpy(&cl->updateBuf[cl->ublen], strip->out + n, chunk);
+            cl->ublen += chunk;
+        }
+    }
+
+    LOCK(t->mutex);
+    t->busy = FALSE;
+    UNLOCK(t->mutex);
+    return ok;
+}
+
+rfbBool
+rfbEncodeThreadsCapture(rfbClientPtr shadow)
+{
+    EncodeStrip *strip = (EncodeStrip *)shadow->encodeStrip;
+
+    rfbEncodeCacheCapture(shadow);
+
+    if (strip->len + shadow->ublen > strip->allocated) {
+        int allocated = strip->allocated ? strip->allocated : UPDATE_BUF_SIZE;
+        char *out;
+
+        while (allocated < strip->len + shadow->ublen)
+            allocated *= 2;
+        out = realloc(strip->out, allocated);
+        if (out == NULL)
+            return FALSE;
+        strip->out = out;
+        strip->allocated = allocated;
+    }
+    memcpy(strip->out + strip->len, shadow->updateBuf, shadow->ublen);
+    strip->len += shadow->ublen;
+    shadow->ublen = 0;
+    return TRUE;
+}
+
+#else
+
+void
+rfbEncodeThreadsInit(rfbScreenInfoPtr screen)
+{
+}
+
+void
+rfbEncodeThreadsFree(rfbScreenInfoPtr screen)
+{
+}
+
+rfbBool
+rfbEncodeThreadsWanted(rfbClientPtr cl, sraRegionPtr updateRegion)
+{
+    return FALSE;
+}
+
+rfbBool
+rfbEncodeThreadsSend(rfbClientPtr cl, sraRegionPtr updateRegion)
+{
+    return FALSE;
+}
+
+rfbBool
+rfbEncodeThreadsCapture(rfbClientPtr shadow)
+{
+    return FALSE;
+}
+
+#endif
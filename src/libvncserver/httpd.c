@@ -58,6 +58,7 @@
 #endif
 
 #include "sockets.h"
+#include "private.h"
 
 #ifdef USE_LIBWRAP
 #include <tcpd.h>
@@ -113,6 +114,7 @@ rfbHttpInitSockets(rfbScreenInfoPtr rfbScreen)
     }
     rfbLog("Listening for HTTP connections on TCP port %d\n", rfbScreen->httpPort);
     rfbLog("  URL http://%s:%d\n",rfbScreen->thisHost,rfbScreen->httpPort);
+    rfbWatchSocket(rfbScreen, rfbScreen->httpListenSock, &rfbScreen->httpListenSock);
 
 #ifdef LIBVNCSERVER_IPv6
     if (rfbScreen->http6Port == 0) {
@@ -126,6 +128,7 @@ rfbHttpInitSockets(rfbScreenInfoPtr rfbScreen)
     }
     rfbLog("Listening for HTTP connections on TCP6 port %d\n", rfbScreen->http6Port);
     rfbLog("  URL http://%s:%d\n",rfbScreen->thisHost,rfbScreen->http6Port);
+    rfbWatchSocket(rfbScreen, rfbScreen->httpListen6Sock, &rfbScreen->httpListen6Sock);
 #endif
     INIT_MUTEX(cl.outputMutex);
     INIT_MUTEX(cl.refCountMutex);
@@ -134,19 +137,19 @@ rfbHttpInitSockets(rfbScreenInfoPtr rfbScreen)
 
 void rfbHttpShutdownSockets(rfbScreenInfoPtr rfbScreen) {
     if(rfbScreen->httpSock>-1) {
-	FD_CLR(rfbScreen->httpSock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->httpSock);
 	rfbCloseSocket(rfbScreen->httpSock);
 	rfbScreen->httpSock=RFB_INVALID_SOCKET;
     }
 
     if(rfbScreen->httpListenSock>-1) {
-	FD_CLR(rfbScreen->httpListenSock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->httpListenSock);
 	rfbCloseSocket(rfbScreen->httpListenSock);
 	rfbScreen->httpListenSock=RFB_INVALID_SOCKET;
     }
 
     if(rfbScreen->httpListen6Sock>-1) {
-	FD_CLR(rfbScreen->httpListen6Sock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->httpListen6Sock);
 	rfbCloseSocket(rfbScreen->httpListen6Sock);
 	rfbScreen->httpListen6Sock=RFB_INVALID_SOCKET;
     }
@@ -176,15 +179,10 @@ void rfbHttpShutdownSockets(rfbScreenInfoPtr rfbScreen) {
 void
 rfbHttpCheckFds(rfbScreenInfoPtr rfbScreen)
 {
-    int nfds;
+    int nfds, maxFd;
     fd_set fds;
     struct timeval tv;
-#ifdef LIBVNCSERVER_IPv6
-    struct sockaddr_storage addr;
-#else
-    struct sockaddr_in addr;
-#endif
-    socklen_t addrlen = sizeof(addr);
+    rfbBool watchSock;
 
     if (!rfbScreen->httpDir)
 	return;
@@ -194,15 +192,23 @@ rfbHttpCheckFds(rfbScreenInfoPtr rfbScreen)
 
     FD_ZERO(&fds);
     FD_SET(rfbScreen->httpListenSock, &fds);
+    maxFd = rfbScreen->httpListenSock;
     if (rfbScreen->httpListen6Sock != RFB_INVALID_SOCKET) {
 	FD_SET(rfbScreen->httpListen6Sock, &fds);
+	maxFd = rfbMax(rfbScreen->httpListen6Sock, maxFd);
     }
-    if (rfbScreen->httpSock != RFB_INVALID_SOCKET) {
+    /* sockets beyond FD_SETSIZE only come with epoll, and rfbCheckFds serves them */
+    watchSock = rfbScreen->httpSock != RFB_INVALID_SOCKET;
+#ifndef WIN32
+    watchSock = watchSock && rfbScreen->httpSock < FD_SETSIZE;
+#endif
+    if (watchSock) {
 	FD_SET(rfbScreen->httpSock, &fds);
+	maxFd = rfbMax(rfbScreen->httpSock, maxFd);
     }
     tv.tv_sec = 0;
     tv.tv_usec = 0;
-    nfds = select(rfbMax(rfbScreen->httpListen6Sock, rfbMax(rfbScreen->httpSock,rfbScreen->httpListenSock)) + 1, &fds, NULL, NULL, &tv);
+    nfds = select(maxFd + 1, &fds, NULL, NULL, &tv);
     if (nfds == 0) {
 	return;
     }
@@ -215,21 +221,45 @@ rfbHttpCheckFds(rfbScreenInfoPtr rfbScreen)
 	return;
     }
 
-    if ((rfbScreen->httpSock != RFB_INVALID_SOCKET) && FD_ISSET(rfbScreen->httpSock, &fds)) {
+    rfbHttpProcessFds(rfbScreen, FD_ISSET(rfbScreen->httpListenSock, &fds),
+		      rfbScreen->httpListen6Sock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpListen6Sock, &fds),
+		      watchSock && FD_ISSET(rfbScreen->httpSock, &fds));
+}
+
+/*
+ * rfbHttpProcessFds serves the HTTP sockets that rfbHttpCheckFds or
+ * rfbCheckFds found readable.
+ */
+
+void
+rfbHttpProcessFds(rfbScreenInfoPtr rfbScreen, rfbBool listenReady,
+		  rfbBool listen6Ready, rfbBool sockReady)
+{
+#ifdef LIBVNCSERVER_IPv6
+    struct sockaddr_storage addr;
+#else
+    struct sockaddr_in addr;
+#endif
+    socklen_t addrlen = sizeof(addr);
+
+    if (sockReady && rfbScreen->httpSock != RFB_INVALID_SOCKET) {
 	httpProcessInput(rfbScreen);
     }
 
-    if ((rfbScreen->httpListenSock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpListenSock, &fds))
-        || (rfbScreen->httpListen6Sock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpListen6Sock, &fds))) {
-	if (rfbScreen->httpSock != RFB_INVALID_SOCKET) rfbCloseSocket(rfbScreen->httpSock);
+    if (listenReady || listen6Ready) {
+	if (rfbScreen->httpSock != RFB_INVALID_SOCKET) {
+	    rfbUnwatchSocket(rfbScreen, rfbScreen->httpSock);
+	    rfbCloseSocket(rfbScreen->httpSock);
+	    rfbScreen->httpSock = RFB_INVALID_SOCKET;
+	}
 
-	if(FD_ISSET(rfbScreen->httpListenSock, &fds)) {
+	if(listenReady) {
 	    if ((rfbScreen->httpSock = accept(rfbScreen->httpListenSock, (struct sockaddr *)&addr, &addrlen)) == RFB_INVALID_SOCKET) {
 	      rfbLogPerror("httpCheckFds: accept");
 	      return;
 	    }
 	}
-	else if(FD_ISSET(rfbScreen->httpListen6Sock, &fds)) {
+	else if(listen6Ready) {
 	    if ((rfbScreen->httpSock = accept(rfbScreen->httpListen6Sock, (struct sockaddr *)&addr, &addrlen)) == RFB_INVALID_SOCKET) {
 	      rfbLogPerror("httpCheckFds: accept");
 	      return;
@@ -255,12 +285,12 @@ rfbHttpCheckFds(rfbScreenInfoPtr rfbScreen)
 	  return;
 	}
 #endif
-        if(!rfbSetNonBlocking(rfbScreen->httpSock)) {
+        if(!rfbSetNonBlocking(rfbScreen->httpSock)
+	   || !rfbWatchSocket(rfbScreen, rfbScreen->httpSock, &rfbScreen->httpSock)) {
 	    rfbCloseSocket(rfbScreen->httpSock);
 	    rfbScreen->httpSock=RFB_INVALID_SOCKET;
 	    return;
 	}
-	/*AddEnabledDevice(httpSock);*/
     }
 }
 
@@ -268,6 +298,7 @@ rfbHttpCheckFds(rfbScreenInfoPtr rfbScreen)
 static void
 httpCloseSock(rfbScreenInfoPtr rfbScreen)
 {
+    rfbUnwatchSocket(rfbScreen, rfbScreen->httpSock);
     rfbCloseSocket(rfbScreen->httpSock);
     rfbScreen->httpSock = RFB_INVALID_SOCKET;
     buf_filled = 0;
@@ -282,6 +282,8 @@ void rfbScheduleCopyRegion(rfbScreenInfoPtr rfbScreen,sraRegionPtr copyRegion,in
    rfbClientIteratorPtr iterator;
    rfbClientPtr cl;
 
+   rfbEncodeCacheInvalidate(rfbScreen);
+
    iterator=rfbGetClientIterator(rfbScreen);
    while((cl=rfbClientIteratorNext(iterator))) {
      LOCK(cl->updateMutex);
@@ -361,6 +363,7 @@ void rfbScheduleCopyRegion(rfbScreenInfoPtr rfbScreen,sraRegionPtr copyRegion,in
      }
      TSIGNAL(cl->updateCond);
      UNLOCK(cl->updateMutex);
+     rfbWorkerPoolUpdate(cl);
    }
 
    rfbReleaseClientIterator(iterator);
@@ -414,18 +417,25 @@ void rfbMarkRegionAsModified(rfbScreenInfoPtr screen,sraRegionPtr modRegion)
    rfbClientIteratorPtr iterator;
    rfbClientPtr cl;
 
+   /* before the clients see the region, so none of them can pick up
+      rects encoded from the old contents */
+   rfbEncodeCacheInvalidate(screen);
+
+   /* update scaled copies for this region */
+   rfbScaledScreenUpdateRegion(screen,modRegion);
+
    iterator=rfbGetClientIterator(screen);
    while((cl=rfbClientIteratorNext(iterator))) {
      LOCK(cl->updateMutex);
      sraRgnOr(cl->modifiedRegion,modRegion);
      TSIGNAL(cl->updateCond);
      UNLOCK(cl->updateMutex);
+     rfbWorkerPoolUpdate(cl);
    }
 
    rfbReleaseClientIterator(iterator);
 }
 
-void rfbScaledScreenUpdate(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2);
 void rfbMarkRectAsModified(rfbScreenInfoPtr screen,int x1,int y1,int x2,int y2)
 {
    sraRegionPtr region;
@@ -441,9 +451,6 @@ void rfbMarkRectAsModified(rfbScreenInfoPtr screen,int x1,int y1,int x2,int y2)
    if(y2>screen->height) y2=screen->height;
    if(y1==y2) return;
 
-   /* update scaled copies for this rectangle */
-   rfbScaledScreenUpdate(screen,x1,y1,x2,y2);
-
    region = sraRgnCreateRect(x1,y1,x2,y2);
    rfbMarkRegionAsModified(screen,region);
    sraRgnDestroy(region);
@@ -457,6 +464,7 @@ clientOutput(void *data)
     rfbClientPtr cl = (rfbClientPtr)data;
     rfbBool haveUpdate;
     sraRegion* updateRegion;
+    int delay;
 
     while (1) {
         haveUpdate = false;
@@ -475,13 +483,12 @@ clientOutput(void *data)
 
 		if (sraRgnEmpty(cl->requestedRegion)) {
 			; /* always require a FB Update Request (otherwise can crash.) */
+		} else if (rfbOutputFull(cl)) {
+			; /* clientInput() signals once the socket took enough */
 		} else {
 			haveUpdate = FB_UPDATE_PENDING(cl);
-			if(!haveUpdate) {
-				updateRegion = sraRgnCreateRgn(cl->modifiedRegion);
-				haveUpdate   = sraRgnAnd(updateRegion,cl->requestedRegion);
-				sraRgnDestroy(updateRegion);
-			}
+			if(!haveUpdate)
+				haveUpdate = sraRgnIntersects(cl->modifiedRegion,cl->requestedRegion);
 		}
 
 		if (!haveUpdate) {
@@ -492,8 +499,10 @@ clientOutput(void *data)
         }
         
         /* OK, now, to save bandwidth, wait a little while for more
-           updates to come along. */
-	THREAD_SLEEP_MS(cl->screen->deferUpdateTime);
+           updates to come along, as long as the pacer says. */
+	delay = rfbUpdateDelay(cl);
+	if (delay > 0)
+	    THREAD_SLEEP_MS(delay);
 
         /* Now, get the region we're going to update, and remove
            it from cl->modifiedRegion _before_ we send the update.
@@ -546,9 +555,10 @@ clientInput(void *data)
 	FD_ZERO(&efds);
 	FD_SET(cl->sock, &efds);
 
-	/* Are we transferring a file in the background? */
+	/* Are we transferring a file in the background, or is output queued? */
 	FD_ZERO(&wfds);
-	if ((cl->fileTransfer.fd!=-1) && (cl->fileTransfer.sending==1))
+	if (((cl->fileTransfer.fd!=-1) && (cl->fileTransfer.sending==1))
+	    || cl->outputQueued > 0)
 	    FD_SET(cl->sock, &wfds);
 
 #ifndef WIN32
@@ -583,8 +593,13 @@ clientInput(void *data)
 #endif
 
         /* We have some space on the transmit queue, send some data */
-        if (FD_ISSET(cl->sock, &wfds))
+        if (FD_ISSET(cl->sock, &wfds)) {
+            if (!rfbFlushOutput(cl)) {
+                rfbCloseClient(cl);
+                continue;
+            }
             rfbSendFileTransferChunk(cl);
+        }
 
         if (FD_ISSET(cl->sock, &rfds) || FD_ISSET(cl->sock, &efds))
         {
@@ -691,7 +706,10 @@ rfbStartOnHoldClient(rfbClientPtr cl)
 {
     cl->onHold = FALSE;
 #ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
-    if(cl->screen->backgroundLoop) {
+    if(cl->screen->workerPool) {
+        /* its socket was left unarmed while it was on hold */
+        rfbWatchClient(cl);
+    } else if(cl->screen->backgroundLoop) {
 #ifndef WIN32
         if (pipe(cl->pipe_notify_client_thread) == -1) {
             cl->pipe_notify_client_thread[0] = -1;
@@ -994,6 +1012,7 @@ rfbScreenInfoPtr rfbGetScreen(int* argc,char** argv,
 
    screen->deferUpdateTime=5;
    screen->maxRectsPerUpdate=50;
+   screen->outputHighWater=1024*1024;
 
    screen->handleEventsEagerly = FALSE;
 
@@ -1108,6 +1127,7 @@ void rfbNewFramebuffer(rfbScreenInfoPtr screen, char *framebuffer,
   }
 
   screen->frameBuffer = framebuffer;
+  rfbEncodeCacheInvalidate(screen);
 
   /* Adjust pointer position if necessary */
 
@@ -1140,6 +1160,7 @@ void rfbNewFramebuffer(rfbScreenInfoPtr screen, char *framebuffer,
 
     TSIGNAL(cl->updateCond);
     UNLOCK(cl->updateMutex);
+    rfbWorkerPoolUpdate(cl);
 
     /* Swapping frame buffers finished, re-enable client reads. */
     UNLOCK(cl->sendMutex);
@@ -1167,6 +1188,9 @@ void rfbScreenCleanup(rfbScreenInfoPtr screen)
   FREE_SCREEN_MEMBER(colourMap.data.bytes);
   FREE_SCREEN_MEMBER(underCursorBuffer);
   TINI_MUTEX(screen->cursorMutex);
+  rfbEncodeCacheFree(screen);
+  rfbEncodeThreadsFree(screen);
+  rfbScaleThreadsFree(screen);
 
   if(screen->cursor != &myCursor)
       rfbFreeCursor(screen->cursor);
@@ -1189,6 +1213,9 @@ void rfbScreenCleanup(rfbScreenInfoPtr screen)
 
 void rfbInitServer(rfbScreenInfoPtr screen)
 {
+  rfbEncodeCacheInit(screen);
+  rfbEncodeThreadsInit(screen);
+  rfbScaleThreadsInit(screen);
   rfbInitSockets(screen);
   rfbHttpInitSockets(screen);
 #ifndef WIN32
@@ -1198,11 +1225,17 @@ void rfbInitServer(rfbScreenInfoPtr screen)
 }
 
 void rfbShutdownServer(rfbScreenInfoPtr screen,rfbBool disconnectClients) {
+  rfbBool pooled = screen->workerPool != NULL;
+
   if(disconnectClients) {
     rfbClientIteratorPtr iter = rfbGetClientIterator(screen);
     rfbClientPtr nextCl, currentCl = rfbClientIteratorNext(iter);
 
     while(currentCl) {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+      /* once closed, the client may be freed by its thread at any time */
+      pthread_t client_thread = currentCl->client_thread;
+#endif
       nextCl = rfbClientIteratorNext(iter);
       if (currentCl->sock != RFB_INVALID_SOCKET) {
         /* we don't care about maxfd here, because the server goes away */
@@ -1210,9 +1243,11 @@ void rfbShutdownServer(rfbScreenInfoPtr screen,rfbBool disconnectClients) {
       }
 
 #ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
-    if(currentCl->screen->backgroundLoop) {
+    if(pooled) {
+      /* A worker finishes it off, rfbStopWorkerPool() below waits for that. */
+    } else if(screen->backgroundLoop) {
       /* Wait for threads to finish. The thread has already been pipe-notified by rfbCloseClient() */
-      pthread_join(currentCl->client_thread, NULL);
+      pthread_join(client_thread, NULL);
     } else {
       /*
 	In threaded mode, rfbClientConnectionGone() is called by the client-to-server thread.
@@ -1230,11 +1265,15 @@ void rfbShutdownServer(rfbScreenInfoPtr screen,rfbBool disconnectClients) {
     rfbReleaseClientIterator(iter);
   }
 
+  /* The pool takes its clients with it, and needs the sockets until then. */
+  if (pooled)
+      rfbStopWorkerPool(screen);
+
   rfbHttpShutdownSockets(screen);
   rfbShutdownSockets(screen);
 
 #ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
-  if (screen->backgroundLoop) {
+  if (screen->backgroundLoop && !pooled) {
       /*
 	Notify the listener thread. This simply writes a NULL byte to the notify pipe in order to get past the select()
 	in listenerRun, the loop in there will then break because the rfbShutdownSockets() above has set screen->socketState.
@@ -1242,6 +1281,8 @@ void rfbShutdownServer(rfbScreenInfoPtr screen,rfbBool disconnectClients) {
       write(screen->pipe_notify_listener_thread[1], "\x00", 1);
       /* And wait for it to finish. */
       pthread_join(screen->listener_thread, NULL);
+  }
+  if (screen->backgroundLoop) {
       /* Now we can close the pipe */
       close(screen->pipe_notify_listener_thread[0]);
       close(screen->pipe_notify_listener_thread[1]);
@@ -1276,7 +1317,6 @@ rfbProcessEvents(rfbScreenInfoPtr screen,long usec)
     usec=screen->deferUpdateTime*1000;
 
   rfbCheckFds(screen,usec);
-  rfbHttpCheckFds(screen);
 
   i = rfbGetClientIteratorWithClosed(screen);
   cl=rfbClientIteratorHead(i);
@@ -1299,12 +1339,13 @@ rfbUpdateClient(rfbClientPtr cl)
 {
   struct timeval tv;
   rfbBool result=FALSE;
-  rfbScreenInfoPtr screen = cl->screen;
 
+  /* a client whose output queue is full gets its update once it drained */
   if (cl->sock != RFB_INVALID_SOCKET && !cl->onHold && FB_UPDATE_PENDING(cl) &&
-        !sraRgnEmpty(cl->requestedRegion)) {
+        !sraRgnEmpty(cl->requestedRegion) && !rfbOutputFull(cl)) {
       result=TRUE;
-      if(screen->deferUpdateTime == 0) {
+      if(cl->startDeferring.tv_usec == 0
+         && (cl->updateDelay = rfbUpdateDelay(cl)) <= 0) {
           rfbSendFramebufferUpdate(cl,cl->modifiedRegion);
       } else if(cl->startDeferring.tv_usec == 0) {
         gettimeofday(&cl->startDeferring,NULL);
@@ -1315,7 +1356,7 @@ rfbUpdateClient(rfbClientPtr cl)
         if(tv.tv_sec < cl->startDeferring.tv_sec /* at midnight */
            || ((tv.tv_sec-cl->startDeferring.tv_sec)*1000
                +(tv.tv_usec-cl->startDeferring.tv_usec)/1000)
-             > screen->deferUpdateTime) {
+             > cl->updateDelay) {
           cl->startDeferring.tv_usec = 0;
           rfbSendFramebufferUpdate(cl,cl->modifiedRegion);
         }
@@ -1367,6 +1408,8 @@ void rfbRunEventLoop(rfbScreenInfoPtr screen, long usec, rfbBool runInBackground
         }
         fcntl(screen->pipe_notify_listener_thread[0], F_SETFL, O_NONBLOCK);
 #endif
+       if (rfbStartWorkerPool(screen))
+           return;
        pthread_create(&screen->listener_thread, NULL, listenerRun, screen);
     return;
 #elif defined(LIBVNCSERVER_HAVE_WIN32THREADS)
@@ -0,0 +1,366 @@
+/*
+ * pacer.c - decides when a client's next update goes out.
+ *
+ * With rfbScreenInfo::maxFrameRate unset every update simply waits
+ * deferUpdateTime. Otherwise an update goes out as soon as the client's
+ * connection is idle, so a single key press is echoed without delay. While
+ * earlier updates are still on their way, new changes pile up in the
+ * client's modifiedRegion until the connection has taken what it holds
+ * beyond one round trip's worth, and no client gets updates more often
+ * than maxFrameRate a second.
+ *
+ * What the connection holds and how fast it takes it comes from the
+ * kernel's count of unacknowledged bytes and its round trip time estimate,
+ * where the system has them. Elsewhere the frame rate is the only limit.
+ *
+ * Clients getting continuous updates never ask for the next one, so each
+ * of their updates is followed by a fence. Its answer tells what reached
+ * the client and how fast, and how much is allowed on its way follows the
+ * round trip: it grows while the answers come back about as fast as they
+ * ever did and shrinks once they queue behind earlier updates, whatever
+ * maxFrameRate says.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <rfb/rfb.h>
+#include "private.h"
+
+#ifdef LIBVNCSERVER_HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#endif
+
+#if defined(__linux__) && defined(SIOCOUTQ) && defined(TCP_INFO)
+#define HAVE_LINK_INFO
+#endif
+
+/* the longest an update waits for the connection to drain, in ms */
+#define MAX_UPDATE_DELAY 1000
+/* the shortest interval a send rate is measured over, in ms */
+#define MIN_RATE_SAMPLE 10
+/* fences on their way at once, further updates go without one */
+#define MAX_PINGS 16
+/* updates sent before the first fence comes back */
+#define FIRST_PINGS 2
+/* what is always allowed on its way, in bytes */
+#define MIN_WINDOW 16384
+/* a round trip this much over the lowest one means updates queue, in ms */
+#define QUEUE_DELAY 50
+
+/* the payload that tells our fences from the ones the client asked for */
+static const char pingTag[4] = { 'p', 'a', 'c', 'e' };
+
+typedef struct {
+    unsigned long start;	/* when the update began */
+    unsigned long sent;
+    unsigned long bytes;	/* bytesWritten once it is out */
+} Ping;
+
+typedef struct {
+    Ping pings[MAX_PINGS];
+    int first, count;
+    /* all written up to ackedBytes has reached the client at ackTime */
+    unsigned long ackedBytes;
+    unsigned long ackTime;
+    uint32_t rate;		/* bytes per second */
+    int rtt;			/* the lowest round trip so far, in ms */
+    long window;		/* bytes allowed on their way, 0 until measured */
+} FencePings;
+
+/* the clock the pacer, ZRLE and the worker pool time things by, in us;
+   it doesn't jump where the system has a monotonic clock */
+unsigned long long
+rfbClockUsecs(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+unsigned long
+rfbPacerClock(void)
+{
+    return (unsigned long)(rfbClockUsecs() / 1000);
+}
+
+/*
+ * Updates the client's queuedBytes, rtt and sendRate. The rate is what
+ * was acknowledged over an interval the connection had data queued
+ * throughout; if it ran dry meanwhile the sample may only raise it.
+ */
+static void
+measureLink(rfbClientPtr cl, unsigned long now)
+{
+#ifdef HAVE_LINK_INFO
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    unsigned long acked, rate;
+    long elapsed;
+    int queued;
+
+    if (cl->sock == RFB_INVALID_SOCKET || ioctl(cl->sock, SIOCOUTQ, &queued) < 0)
+	return;
+    /* and what waits in front of the socket */
+    queued += (int)cl->outputQueued;
+    if (getsockopt(cl->sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && info.tcpi_rtt > 0)
+	cl->rtt = (info.tcpi_rtt + 999) / 1000;
+
+    acked = cl->bytesWritten - queued;
+    elapsed = (long)(now - cl->rateSampleTime);
+    if (cl->queuedBytes > 0 && elapsed >= MIN_RATE_SAMPLE) {
+	rate = (acked - cl->rateSampleBytes) * 1000 / elapsed;
+	if (cl->sendRate == 0)
+	    cl->sendRate = rate;
+	else if (queued > 0)
+	    cl->sendRate = (cl->sendRate * 3 + rate) / 4;
+	else if (rate > cl->sendRate)
+	    cl->sendRate = rate;
+    }
+    if (cl->queuedBytes == 0 || elapsed >= MIN_RATE_SAMPLE) {
+	cl->rateSampleTime = now;
+	cl->rateSampleBytes = acked;
+    }
+    cl->queuedBytes = queued;
+#endif
+}
+
+/* for when something other than the pacer wants to know the connection */
+void
+rfbPacerMeasure(rfbClientPtr cl)
+{
+    measureLink(cl, rfbPacerClock());
+}
+
+/*
+ * Appends a fence to the update in cl->updateBuf, for the client to answer
+ * once it has read the update. The fences are kept under cl->updateMutex,
+ * only the thread sending updates adds to them.
+ */
+rfbBool
+rfbPacerPing(rfbClientPtr cl)
+{
+    FencePings *fp;
+    rfbBool full;
+    rfbFenceMsg f;
+    Ping *p;
+
+    LOCK(cl->updateMutex);
+    fp = (FencePings *)cl->fencePings;
+    if (fp == NULL) {
+	fp = cl->fencePings = calloc(1, sizeof(FencePings));
+	if (fp != NULL) {
+	    fp->ackTime = rfbPacerClock();
+	    fp->ackedBytes = cl->bytesWritten;
+	}
+    }
+    full = fp == NULL || fp->count == MAX_PINGS;
+    UNLOCK(cl->updateMutex);
+    if (full)
+	return TRUE;
+
+    if (cl->ublen + sz_rfbFenceMsg + sizeof(pingTag) > UPDATE_BUF_SIZE) {
+	if (!rfbSendUpdateBuf(cl))
+	    return FALSE;
+    }
+
+    f.type = rfbFence;
+    f.pad[0] = f.pad[1] = f.pad[2] = 0;
+    f.flags = Swap32IfLE(rfbFenceFlagRequest | rfbFenceFlagBlockBefore);
+    f.length = sizeof(pingTag);
+    memcpy(&cl->updateBuf[cl->ublen], (char *)&f, sz_rfbFenceMsg);
+    cl->ublen += sz_rfbFenceMsg;
+    memcpy(&cl->updateBuf[cl->ublen], pingTag, sizeof(pingTag));
+    cl->ublen += sizeof(pingTag);
+    rfbStatRecordMessageSent(cl, rfbFence, sz_rfbFenceMsg + sizeof(pingTag),
+			     sz_rfbFenceMsg + sizeof(pingTag));
+
+    LOCK(cl->updateMutex);
+    p = &fp->pings[(fp->first + fp->count++) % MAX_PINGS];
+    p->start = cl->lastUpdateTime;
+    p->sent = rfbPacerClock();
+    p->bytes = cl->bytesWritten + cl->ublen;
+    UNLOCK(cl->updateMutex);
+    return TRUE;
+}
+
+/*
+ * Takes the answer to a fence. Returns FALSE if it was not one of ours.
+ * The rate is measured like the one in measureLink(), over the interval
+ * between two answers, with the connection busy throughout if the fence
+ * went out before the previous one came back. Otherwise the interval
+ * starts with the update, the connection was idle before.
+ */
+rfbBool
+rfbPacerPong(rfbClientPtr cl, const char *data, int length)
+{
+    FencePings *fp;
+    unsigned long now;
+    uint32_t rate;
+    rfbBool busy;
+    long elapsed;
+    Ping *p;
+    int rtt;
+
+    if (length != sizeof(pingTag) || memcmp(data, pingTag, sizeof(pingTag)) != 0)
+	return FALSE;
+
+    LOCK(cl->updateMutex);
+    fp = (FencePings *)cl->fencePings;
+    if (fp == NULL || fp->count == 0) {
+	UNLOCK(cl->updateMutex);
+	return FALSE;
+    }
+
+    now = rfbPacerClock();
+    p = &fp->pings[fp->first];
+    fp->first = (fp->first + 1) % MAX_PINGS;
+    fp->count--;
+
+    rtt = (int)(now - p->sent);
+    if (rtt < 1)
+	rtt = 1;
+    if (fp->rtt == 0 || rtt < fp->rtt)
+	fp->rtt = rtt;
+
+    busy = (long)(p->sent - fp->ackTime) < 0;
+    elapsed = (long)(now - (busy ? fp->ackTime : p->start));
+    if (elapsed >= MIN_RATE_SAMPLE && p->bytes > fp->ackedBytes) {
+	rate = (uint32_t)((p->bytes - fp->ackedBytes) * 1000 / elapsed);
+	if (fp->rate == 0)
+	    fp->rate = rate;
+	else if (busy)
+	    fp->rate = (fp->rate * 3 + rate) / 4;
+	else if (rate > fp->rate)
+	    fp->rate = rate;
+    }
+    if (elapsed >= MIN_RATE_SAMPLE || p->bytes <= fp->ackedBytes) {
+	fp->ackTime = now;
+	fp->ackedBytes = p->bytes;
+    }
+
+    /* a little more while nothing queues, a lot less once it does */
+    if (fp->rate > 0 && fp->window == 0)
+	fp->window = (long)((double)fp->rate * fp->rtt * 2 / 1000);
+    else if (rtt > fp->rtt + fp->rtt / 2 + QUEUE_DELAY)
+	fp->window -= fp->window / 4;
+    else if (busy)
+	fp->window += fp->window / 8;
+    if (fp->window > 0 && fp->window < MIN_WINDOW)
+	fp->window = MIN_WINDOW;
+    UNLOCK(cl->updateMutex);
+    return TRUE;
+}
+
+void
+rfbPacerFreeClient(rfbClientPtr cl)
+{
+    free(cl->fencePings);
+    cl->fencePings = NULL;
+}
+
+/*
+ * How many ms a continuous update has to wait until no more than the
+ * window of the earlier ones is still on its way to the client.
+ */
+static long
+fenceDelay(rfbClientPtr cl, unsigned long now)
+{
+    FencePings *fp;
+    long inFlight, wait = 0;
+
+    LOCK(cl->updateMutex);
+    fp = (FencePings *)cl->fencePings;
+    if (!cl->continuousUpdates || fp == NULL || fp->count == 0)
+	; /* everything has arrived */
+    else if (fp->window == 0) {
+	/* nothing measured yet, a couple of updates until the first answer */
+	if (fp->count >= FIRST_PINGS)
+	    wait = (long)(fp->pings[fp->first].sent - now) + MAX_UPDATE_DELAY;
+    } else {
+	/* assume it kept arriving at the measured rate since the last answer */
+	inFlight = (long)(cl->bytesWritten - fp->ackedBytes) -
+	    (long)((double)fp->rate * (long)(now - fp->ackTime) / 1000);
+	wait = inFlight > fp->window
+	    ? (long)((double)(inFlight - fp->window) * 1000 / fp->rate) : 0;
+    }
+    UNLOCK(cl->updateMutex);
+
+    if (wait > MAX_UPDATE_DELAY)
+	wait = MAX_UPDATE_DELAY;
+    return wait > 0 ? wait : 0;
+}
+
+/*
+ * Returns how many ms the client's pending update should wait, 0 if it
+ * can go out now. Call it from the thread that sends the client's updates.
+ */
+int
+rfbUpdateDelay(rfbClientPtr cl)
+{
+    rfbScreenInfoPtr screen = cl->screen;
+    unsigned long now;
+    long delay, sinceUpdate, wait, inFlight;
+
+    if (screen->maxFrameRate <= 0) {
+	delay = cl->continuousUpdates ? fenceDelay(cl, rfbPacerClock()) : 0;
+	return delay > screen->deferUpdateTime ? (int)delay : screen->deferUpdateTime;
+    }
+
+    now = rfbPacerClock();
+    measureLink(cl, now);
+
+    sinceUpdate = (long)(now - cl->lastUpdateTime);
+    delay = 1000 / screen->maxFrameRate - sinceUpdate;
+
+    if (cl->queuedBytes > 0) {
+	if (cl->sendRate > 0) {
+	    /* a round trip's worth is in flight anyway, more only waits */
+	    inFlight = (long)((double)cl->sendRate * cl->rtt / 1000);
+	    wait = cl->queuedBytes > inFlight
+		? (long)((double)(cl->queuedBytes - inFlight) * 1000 / cl->sendRate) : 0;
+	} else {
+	    /* no idea of the rate yet, one update per round trip */
+	    wait = cl->rtt - sinceUpdate;
+	}
+	if (wait > MAX_UPDATE_DELAY)
+	    wait = MAX_UPDATE_DELAY;
+	if (wait > delay)
+	    delay = wait;
+    }
+    wait = fenceDelay(cl, now);
+    if (wait > delay)
+	delay = wait;
+
+    return delay > 0 ? (int)delay : 0;
+}
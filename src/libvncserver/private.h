@@ -7,10 +7,80 @@ void rfbShowCursor(rfbClientPtr cl);
 void rfbHideCursor(rfbClientPtr cl);
 void rfbRedrawAfterHideCursor(rfbClientPtr cl,sraRegionPtr updateRegion);
 
+/* from encodecache.c */
+
+void rfbEncodeCacheInit(rfbScreenInfoPtr screen);
+void rfbEncodeCacheFree(rfbScreenInfoPtr screen);
+void rfbEncodeCacheFreeClient(rfbClientPtr cl);
+/* starts a new framebuffer generation */
+void rfbEncodeCacheInvalidate(rfbScreenInfoPtr screen);
+/* Sends the rect from the cache and returns 1, or returns 0 to have the
+   caller encode it and call rfbEncodeCacheEnd(). -1 means a write failed. */
+int rfbEncodeCacheBegin(rfbClientPtr cl, int x, int y, int w, int h);
+void rfbEncodeCacheEnd(rfbClientPtr cl);
+/* called by rfbSendUpdateBuf() before cl->updateBuf is flushed */
+void rfbEncodeCacheCapture(rfbClientPtr cl);
+/* for encoders whose output for this rect depends on client state */
+void rfbEncodeCacheUnshareable(rfbClientPtr cl);
+
+/* from encodethreads.c */
+
+void rfbEncodeThreadsInit(rfbScreenInfoPtr screen);
+void rfbEncodeThreadsFree(rfbScreenInfoPtr screen);
+/* TRUE if the update is to be encoded by rfbEncodeThreadsSend() */
+rfbBool rfbEncodeThreadsWanted(rfbClientPtr cl, sraRegionPtr updateRegion);
+rfbBool rfbEncodeThreadsSend(rfbClientPtr cl, sraRegionPtr updateRegion);
+/* called by rfbSendUpdateBuf() for a client with an encodeStrip */
+rfbBool rfbEncodeThreadsCapture(rfbClientPtr shadow);
+
+/* from httpd.c */
+
+void rfbHttpProcessFds(rfbScreenInfoPtr rfbScreen, rfbBool listenReady,
+		       rfbBool listen6Ready, rfbBool sockReady);
+
 /* from main.c */
 
 rfbClientPtr rfbClientIteratorHead(rfbClientIteratorPtr i);
 
+/* from pacer.c */
+
+unsigned long long rfbClockUsecs(void);
+/* rfbClockUsecs() in ms */
+unsigned long rfbPacerClock(void);
+int rfbUpdateDelay(rfbClientPtr cl);
+/* updates cl->sendRate, cl->queuedBytes and cl->rtt */
+void rfbPacerMeasure(rfbClientPtr cl);
+/* follows a continuous update in cl->updateBuf with a fence */
+rfbBool rfbPacerPing(rfbClientPtr cl);
+/* takes the answer to a fence, FALSE if it wasn't rfbPacerPing()'s */
+rfbBool rfbPacerPong(rfbClientPtr cl, const char *data, int length);
+void rfbPacerFreeClient(rfbClientPtr cl);
+
+/* from rfbserver.c */
+
+/* sends a rect of the screen in the client's preferred encoding */
+rfbBool rfbSendUpdateRect(rfbClientPtr cl, int x, int y, int w, int h);
+
+/* from scale.c */
+
+void rfbScaleThreadsInit(rfbScreenInfoPtr screen);
+void rfbScaleThreadsFree(rfbScreenInfoPtr screen);
+/* brings the scaled copies of the framebuffer in use up to date */
+void rfbScaledScreenUpdateRegion(rfbScreenInfoPtr screen, sraRegionPtr region);
+
+/* from sockets.c */
+
+rfbBool rfbWatchSocket(rfbScreenInfoPtr rfbScreen, rfbSocket sock, void *data);
+rfbBool rfbWatchClient(rfbClientPtr cl);
+void rfbUnwatchSocket(rfbScreenInfoPtr rfbScreen, rfbSocket sock);
+int rfbWaitForSocket(rfbSocket sock, rfbBool forWriting, int timeout);
+void rfbProcessClientSocket(rfbClientPtr cl);
+/* the output queue behind rfbWriteExact(), see rfbClientRec::outputQueued */
+rfbBool rfbInitOutputQueue(rfbClientPtr cl);
+void rfbFreeOutputQueue(rfbClientPtr cl);
+rfbBool rfbOutputFull(rfbClientPtr cl);
+rfbBool rfbFlushOutput(rfbClientPtr cl);
+
 /* from tight.c */
 
 #ifdef LIBVNCSERVER_HAVE_LIBZ
@@ -28,5 +98,20 @@ void rfbFreeZrleData(rfbClientPtr cl);
 
 extern void rfbFreeUltraData(rfbClientPtr cl);
 
+/* from websockets.c */
+
+/* longest frame header webSocketsFrameHeader() writes */
+#define WS_FRAME_HEADER_MAX 10
+int webSocketsFrameHeader(rfbClientPtr cl, int len, char *header);
+
+/* from workerpool.c */
+
+rfbBool rfbStartWorkerPool(rfbScreenInfoPtr screen);
+void rfbStopWorkerPool(rfbScreenInfoPtr screen);
+void rfbWorkerPoolInput(rfbClientPtr cl);
+void rfbWorkerPoolWritable(rfbClientPtr cl);
+void rfbWorkerPoolClose(rfbClientPtr cl);
+void rfbWorkerPoolUpdate(rfbClientPtr cl);
+
 #endif
 
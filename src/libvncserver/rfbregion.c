@@ -8,6 +8,9 @@
 #include <rfb/rfb.h>
 #include <rfb/rfbregion.h>
 
+/* rfbregion_bands.c has the regions instead, only the clippers are here */
+#ifndef LIBVNCSERVER_BANDED_REGIONS
+
 /* -=- Internal Span structure */
 
 struct sraRegion;
@@ -25,6 +28,131 @@ typedef struct sraRegion {
   sraSpan back;
 } sraSpanList;
 
+/* -=- Span pool
+ *
+ * Regions are copied and combined several times per update and client,
+ * and each span and span list in them is an allocation of its own. Freed
+ * ones are kept on a free list per thread, up to SRA_POOL_SPANS spans and
+ * SRA_POOL_LISTS lists, enough for damage of a few thousand rectangles,
+ * and handed out again before malloc() is asked. A thread's lists are
+ * freed when it exits. Without thread-local storage there is no pool.
+ */
+
+#define SRA_POOL_SPANS 16384
+#define SRA_POOL_LISTS 4096
+
+#if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) && defined(__GNUC__)
+#define SRA_POOL
+#define SRA_THREAD_LOCAL __thread
+#elif !defined(LIBVNCSERVER_HAVE_LIBPTHREAD) && !defined(LIBVNCSERVER_HAVE_WIN32THREADS)
+#define SRA_POOL
+#define SRA_THREAD_LOCAL
+#endif
+
+#ifdef SRA_POOL
+typedef struct sraPool {
+  sraSpan *spans;         /* chained through _next */
+  sraSpanList *lists;     /* chained through front._next */
+  int nSpans, nLists;
+  rfbBool registered;     /* to be freed when the thread exits */
+} sraPool;
+
+static SRA_THREAD_LOCAL sraPool pool;
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+sraPoolFree(void *data) {
+  sraPool *p = (sraPool*)data;
+  sraSpan *span;
+  sraSpanList *list;
+
+  while ((span = p->spans)) {
+    p->spans = span->_next;
+    free(span);
+  }
+  while ((list = p->lists)) {
+    p->lists = (sraSpanList*)list->front._next;
+    free(list);
+  }
+  p->nSpans = p->nLists = 0;
+  p->registered = FALSE;
+}
+
+static void
+sraPoolMakeKey(void) {
+  pthread_key_create(&poolKey, sraPoolFree);
+}
+#endif
+
+static void
+sraPoolRegister(void) {
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+  pthread_once(&poolKeyOnce, sraPoolMakeKey);
+  pthread_setspecific(poolKey, &pool);
+#endif
+  pool.registered = TRUE;
+}
+#endif
+
+static sraSpan *
+sraSpanAlloc(void) {
+#ifdef SRA_POOL
+  sraSpan *span = pool.spans;
+  if (span) {
+    pool.spans = span->_next;
+    pool.nSpans--;
+    return span;
+  }
+#endif
+  return (sraSpan*)malloc(sizeof(sraSpan));
+}
+
+static void
+sraSpanFree(sraSpan *span) {
+#ifdef SRA_POOL
+  if (pool.nSpans < SRA_POOL_SPANS) {
+    if (!pool.registered)
+      sraPoolRegister();
+    span->_next = pool.spans;
+    pool.spans = span;
+    pool.nSpans++;
+    return;
+  }
+#endif
+  free(span);
+}
+
+static sraSpanList *
+sraSpanListAlloc(void) {
+#ifdef SRA_POOL
+  sraSpanList *list = pool.lists;
+  if (list) {
+    pool.lists = (sraSpanList*)list->front._next;
+    pool.nLists--;
+    return list;
+  }
+#endif
+  return (sraSpanList*)malloc(sizeof(sraSpanList));
+}
+
+static void
+sraSpanListFree(sraSpanList *list) {
+#ifdef SRA_POOL
+  if (pool.nLists < SRA_POOL_LISTS) {
+    if (!pool.registered)
+      sraPoolRegister();
+    list->front._next = (sraSpan*)pool.lists;
+    pool.lists = list;
+    pool.nLists++;
+    return;
+  }
+#endif
+  free(list);
+}
+
 /* -=- Span routines */
 
 sraSpanList *sraSpanListDup(const sraSpanList *src);
@@ -32,7 +160,7 @@ void sraSpanListDestroy(sraSpanList *list);
 
 static sraSpan *
 sraSpanCreate(int start, int end, const sraSpanList *subspan) {
-  sraSpan *item = (sraSpan*)malloc(sizeof(sraSpan));
+  sraSpan *item = sraSpanAlloc();
   if (!item) return NULL;
   item->_next = item->_prev = NULL;
   item->start = start;
@@ -80,7 +208,7 @@ sraSpanRemove(sraSpan *span) {
 static void
 sraSpanDestroy(sraSpan *span) {
   if (span->subspan) sraSpanListDestroy(span->subspan);
-  free(span);
+  sraSpanFree(span);
 }
 
 #ifdef DEBUG
@@ -123,7 +251,7 @@ sraSpanPrint(const sraSpan *s) {
 
 static sraSpanList *
 sraSpanListCreate(void) {
-  sraSpanList *item = (sraSpanList*)malloc(sizeof(sraSpanList));
+  sraSpanList *item = sraSpanListAlloc();
   if (!item) return NULL;
   item->front._next = &(item->back);
   item->front._prev = NULL;
@@ -157,7 +285,7 @@ sraSpanListDestroy(sraSpanList *list) {
     sraSpanRemove(curr);
     sraSpanDestroy(curr);
   }
-  free(list);
+  sraSpanListFree(list);
 }
 
 static void
@@ -509,6 +637,28 @@ sraSpanListSubtract(sraSpanList *dest, const sraSpanList *src) {
   return !sraSpanListEmpty(dest);
 }
 
+/* like sraSpanListAnd(), but only tells whether anything would be left */
+static rfbBool
+sraSpanListIntersects(const sraSpanList *s1, const sraSpanList *s2) {
+  const sraSpan *sp1, *sp2;
+
+  if (!s1 || !s2)
+    return s1 == s2;
+
+  sp1 = s1->front._next;
+  sp2 = s2->front._next;
+  while ((sp1 != &(s1->back)) && (sp2 != &(s2->back))) {
+    if ((sp1->start < sp2->end) && (sp2->start < sp1->end) &&
+	sraSpanListIntersects(sp1->subspan, sp2->subspan))
+      return TRUE;
+    if (sp1->end < sp2->end)
+      sp1 = sp1->_next;
+    else
+      sp2 = sp2->_next;
+  }
+  return FALSE;
+}
+
 /* -=- Region routines */
 
 sraRegion *
@@ -526,13 +676,12 @@ sraRgnCreateRect(int x1, int y1, int x2, int y2) {
   hspan = sraSpanCreate(x1, x2, NULL);
   sraSpanInsertAfter(hspan, &(hlist->front));
 
-  /* - Build the vertical portion of the span */
+  /* - Build the vertical portion of the span, which takes hlist over */
   vlist = sraSpanListCreate();
-  vspan = sraSpanCreate(y1, y2, hlist);
+  vspan = sraSpanCreate(y1, y2, NULL);
+  vspan->subspan = hlist;
   sraSpanInsertAfter(vspan, &(vlist->front));
 
-  sraSpanListDestroy(hlist);
-
   return (sraRegion*)vlist;
 }
 
@@ -568,6 +717,11 @@ sraRgnSubtract(sraRegion *dst, const sraRegion *src) {
   return sraSpanListSubtract((sraSpanList*)dst, (sraSpanList*)src);
 }
 
+rfbBool
+sraRgnIntersects(const sraRegion *rgn1, const sraRegion *rgn2) {
+  return sraSpanListIntersects((sraSpanList*)rgn1, (sraSpanList*)rgn2);
+}
+
 void
 sraRgnOffset(sraRegion *dst, int dx, int dy) {
   sraSpan *vcurr, *hcurr;
@@ -789,6 +943,8 @@ sraRgnPrint(const sraRegion *rgn) {
 	sraSpanListPrint((sraSpanList*)rgn);
 }
 
+#endif
+
 rfbBool
 sraClipRect(int *x, int *y, int *w, int *h,
 	    int cx, int cy, int cw, int ch) {
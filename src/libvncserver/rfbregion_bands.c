@@ -0,0 +1,688 @@
+/* -=- sraRegion.c, banded rectangles
+ *
+ * The same region API as rfbregion.c, with a region kept the way X11 and
+ * pixman keep theirs: one array of rectangles, sorted into bands that
+ * share their top and bottom edge, top to bottom, and left to right
+ * within a band. Bands do not overlap, the rectangles of a band neither
+ * overlap nor touch, and two touching bands with the same rectangles are
+ * always merged into one. Union, intersection and difference are single
+ * merges over both arrays, the rectangle count is known, and iterating
+ * is a walk along the array instead of a chase through nested lists.
+ *
+ * Built instead of the span lists with -DWITH_BANDED_REGIONS=ON.
+ */
+
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+
+struct sraRegion {
+  sraRect *rects;  /* the bands, or one when there are less than two */
+  int count;
+  int size;
+  sraRect extents; /* the bounding box, all 0 while empty */
+  sraRect one;
+};
+
+enum { SRA_OR, SRA_AND, SRA_SUBTRACT };
+
+/* -=- Rectangle array routines */
+
+static rfbBool
+sraBandsGrow(sraRegion *rgn, int more) {
+  sraRect *rects;
+  int size = rgn->size;
+
+  if (rgn->count + more <= size)
+    return TRUE;
+  while (size < rgn->count + more)
+    size = size < 8 ? 16 : size * 2;
+  if (rgn->rects == &rgn->one || !rgn->rects) {
+    rects = (sraRect*)malloc(size * sizeof(sraRect));
+    if (rects && rgn->count)
+      memcpy(rects, rgn->rects, rgn->count * sizeof(sraRect));
+  } else
+    rects = (sraRect*)realloc(rgn->rects, size * sizeof(sraRect));
+  if (!rects)
+    return FALSE;
+  rgn->rects = rects;
+  rgn->size = size;
+  return TRUE;
+}
+
+static void
+sraBandsRelease(sraRegion *rgn) {
+  if (rgn->rects != &rgn->one)
+    free(rgn->rects);
+  rgn->rects = &rgn->one;
+  rgn->count = 0;
+  rgn->size = 1;
+}
+
+static void
+sraBandsExtents(sraRegion *rgn) {
+  const sraRect *r = rgn->rects, *end = r + rgn->count;
+
+  if (!rgn->count) {
+    memset(&rgn->extents, 0, sizeof(rgn->extents));
+    return;
+  }
+  rgn->extents = *r;
+  rgn->extents.y2 = end[-1].y2;
+  for (; r < end; r++) {
+    if (r->x1 < rgn->extents.x1)
+      rgn->extents.x1 = r->x1;
+    if (r->x2 > rgn->extents.x2)
+      rgn->extents.x2 = r->x2;
+  }
+}
+
+/* replaces the rectangles of dst with those of src, which is left empty */
+static void
+sraBandsAdopt(sraRegion *dst, sraRegion *src) {
+  sraBandsRelease(dst);
+  if (src->count <= 1) {
+    if (src->count)
+      dst->one = src->rects[0];
+    dst->count = src->count;
+    sraBandsRelease(src);
+  } else {
+    dst->rects = src->rects;
+    dst->count = src->count;
+    dst->size = src->size;
+    src->rects = &src->one;
+    src->count = 0;
+    src->size = 1;
+  }
+}
+
+static rfbBool
+sraBandsCopy(sraRegion *dst, const sraRegion *src) {
+  if (dst == src)
+    return TRUE;
+  dst->count = 0;
+  if (!sraBandsGrow(dst, src->count))
+    return FALSE;
+  memcpy(dst->rects, src->rects, src->count * sizeof(sraRect));
+  dst->count = src->count;
+  dst->extents = src->extents;
+  return TRUE;
+}
+
+static const sraRect *
+sraBandEnd(const sraRect *r, const sraRect *end) {
+  int y1 = r->y1;
+
+  while (r < end && r->y1 == y1)
+    r++;
+  return r;
+}
+
+static void
+sraBandAdd(sraRegion *rgn, int x1, int y1, int x2, int y2) {
+  sraRect *r = &rgn->rects[rgn->count++];
+
+  r->x1 = x1;
+  r->y1 = y1;
+  r->x2 = x2;
+  r->y2 = y2;
+}
+
+/* like sraBandAdd(), but joins what touches the band's last rectangle */
+static void
+sraBandAddOr(sraRegion *rgn, int bandStart, int x1, int y1, int x2, int y2) {
+  sraRect *last = rgn->rects + rgn->count - 1;
+
+  if (rgn->count > bandStart && last->x2 >= x1) {
+    if (last->x2 < x2)
+      last->x2 = x2;
+  } else
+    sraBandAdd(rgn, x1, y1, x2, y2);
+}
+
+/* merges the band at bandStart into the previous one if they fit, and
+   returns where the band that the next one may merge into starts */
+static int
+sraBandCoalesce(sraRegion *rgn, int prevStart, int bandStart) {
+  sraRect *prev, *band = &rgn->rects[bandStart];
+  int n = rgn->count - bandStart, i;
+
+  if (n == 0)
+    return prevStart;
+  if (prevStart < 0 || bandStart - prevStart != n)
+    return bandStart;
+  prev = &rgn->rects[prevStart];
+  if (prev->y2 != band->y1)
+    return bandStart;
+  for (i = 0; i < n; i++)
+    if (prev[i].x1 != band[i].x1 || prev[i].x2 != band[i].x2)
+      return bandStart;
+  for (i = 0; i < n; i++)
+    prev[i].y2 = band->y2;
+  rgn->count = bandStart;
+  return prevStart;
+}
+
+/* -=- Band routines */
+
+static void
+sraBandCopy(sraRegion *out, const sraRect *r, const sraRect *end, int y1, int y2) {
+  for (; r < end; r++)
+    sraBandAdd(out, r->x1, y1, r->x2, y2);
+}
+
+static void
+sraBandOr(sraRegion *out, const sraRect *r1, const sraRect *end1,
+	  const sraRect *r2, const sraRect *end2, int y1, int y2) {
+  int bandStart = out->count;
+
+  while (r1 < end1 || r2 < end2) {
+    if (r2 == end2 || (r1 < end1 && r1->x1 <= r2->x1)) {
+      sraBandAddOr(out, bandStart, r1->x1, y1, r1->x2, y2);
+      r1++;
+    } else {
+      sraBandAddOr(out, bandStart, r2->x1, y1, r2->x2, y2);
+      r2++;
+    }
+  }
+}
+
+static void
+sraBandAnd(sraRegion *out, const sraRect *r1, const sraRect *end1,
+	   const sraRect *r2, const sraRect *end2, int y1, int y2) {
+  int x1, x2;
+
+  while (r1 < end1 && r2 < end2) {
+    x1 = r1->x1 > r2->x1 ? r1->x1 : r2->x1;
+    x2 = r1->x2 < r2->x2 ? r1->x2 : r2->x2;
+    if (x1 < x2)
+      sraBandAdd(out, x1, y1, x2, y2);
+    if (r1->x2 < r2->x2)
+      r1++;
+    else if (r2->x2 < r1->x2)
+      r2++;
+    else {
+      r1++;
+      r2++;
+    }
+  }
+}
+
+static void
+sraBandSubtract(sraRegion *out, const sraRect *r1, const sraRect *end1,
+		const sraRect *r2, const sraRect *end2, int y1, int y2) {
+  int x1 = r1->x1;
+
+  while (r1 < end1 && r2 < end2) {
+    if (r2->x2 <= x1) {
+      /* - The subtracted span is left of what is left of r1 */
+      r2++;
+      continue;
+    }
+    if (r2->x1 >= r1->x2) {
+      /* - or right of it, so the rest of r1 stays */
+      sraBandAdd(out, x1, y1, r1->x2, y2);
+    } else {
+      /* - or cuts into it, which keeps what is left of the cut */
+      if (r2->x1 > x1)
+	sraBandAdd(out, x1, y1, r2->x1, y2);
+      x1 = r2->x2;
+      if (x1 < r1->x2) {
+	r2++;
+	continue;
+      }
+    }
+    if (++r1 < end1)
+      x1 = r1->x1;
+  }
+  while (r1 < end1) {
+    sraBandAdd(out, x1, y1, r1->x2, y2);
+    if (++r1 < end1)
+      x1 = r1->x1;
+  }
+}
+
+/* the first band that reaches below y */
+static const sraRect *
+sraBandsBelow(const sraRect *r, const sraRect *end, int y) {
+  const sraRect *mid;
+
+  while (r < end) {
+    mid = r + (end - r) / 2;
+    if (mid->y2 <= y)
+      r = mid + 1;
+    else
+      end = mid;
+  }
+  return r;
+}
+
+/* appends whole bands, of which only the first may start above top, and
+   only it may merge with the band before */
+static rfbBool
+sraBandsAppend(sraRegion *out, const sraRect *r, const sraRect *end, int top, int *prev) {
+  const sraRect *band;
+  int start;
+
+  if (r == end)
+    return TRUE;
+  if (!sraBandsGrow(out, end - r))
+    return FALSE;
+  band = sraBandEnd(r, end);
+  start = out->count;
+  sraBandCopy(out, r, band, r->y1 > top ? r->y1 : top, r->y2);
+  *prev = sraBandCoalesce(out, *prev, start);
+  if (band < end) {
+    memcpy(out->rects + out->count, band, (end - band) * sizeof(sraRect));
+    out->count += end - band;
+    for (start = out->count - 1; out->rects[start - 1].y1 == end[-1].y1; start--)
+      ;
+    *prev = start;
+  }
+  return TRUE;
+}
+
+/* -=- Region merge
+ *
+ * Walks the bands of both regions top to bottom. Where only one region
+ * has a band, it is kept for OR, and for SUBTRACT if it is dst's; where
+ * both have one, the overlapping rows get the merge of both bands.
+ */
+
+static rfbBool
+sraBandsOp(sraRegion *dst, const sraRegion *src, int op) {
+  const sraRect *r1 = dst->rects, *end1 = r1 + dst->count, *band1;
+  const sraRect *r2 = src->rects, *end2 = r2 + src->count, *band2;
+  sraRegion out;
+  int top, bot, ytop, ybot, prev = -1, start;
+
+  out.rects = NULL;
+  out.count = out.size = 0;
+  if (!sraBandsGrow(&out, dst->count + src->count))
+    goto nomem;
+
+  /* - The bands above all of the other region go over in one piece */
+  ybot = r1->y1 < r2->y1 ? r1->y1 : r2->y1;
+  if (r1->y1 < r2->y1) {
+    band1 = sraBandsBelow(r1, end1, r2->y1);
+    if (op != SRA_AND && !sraBandsAppend(&out, r1, band1, ybot, &prev))
+      goto nomem;
+    r1 = band1;
+  } else if (r2->y1 < r1->y1) {
+    band2 = sraBandsBelow(r2, end2, r1->y1);
+    if (op == SRA_OR && !sraBandsAppend(&out, r2, band2, ybot, &prev))
+      goto nomem;
+    r2 = band2;
+  }
+
+  while (r1 < end1 && r2 < end2) {
+    band1 = sraBandEnd(r1, end1);
+    band2 = sraBandEnd(r2, end2);
+    /* - A band of either alone, then at most one piece per edge of both */
+    if (!sraBandsGrow(&out, 2 * ((band1 - r1) + (band2 - r2))))
+      goto nomem;
+
+    /* - The rows where only one of the regions has a band */
+    start = out.count;
+    if (r1->y1 < r2->y1) {
+      top = r1->y1 > ybot ? r1->y1 : ybot;
+      bot = r1->y2 < r2->y1 ? r1->y2 : r2->y1;
+      if (top < bot && op != SRA_AND)
+	sraBandCopy(&out, r1, band1, top, bot);
+      ytop = r2->y1;
+    } else if (r2->y1 < r1->y1) {
+      top = r2->y1 > ybot ? r2->y1 : ybot;
+      bot = r2->y2 < r1->y1 ? r2->y2 : r1->y1;
+      if (top < bot && op == SRA_OR)
+	sraBandCopy(&out, r2, band2, top, bot);
+      ytop = r1->y1;
+    } else
+      ytop = r1->y1;
+    prev = sraBandCoalesce(&out, prev, start);
+
+    /* - The rows where both have one */
+    ybot = r1->y2 < r2->y2 ? r1->y2 : r2->y2;
+    if (ybot > ytop) {
+      start = out.count;
+      switch (op) {
+      case SRA_OR:
+	sraBandOr(&out, r1, band1, r2, band2, ytop, ybot);
+	break;
+      case SRA_AND:
+	sraBandAnd(&out, r1, band1, r2, band2, ytop, ybot);
+	break;
+      default:
+	sraBandSubtract(&out, r1, band1, r2, band2, ytop, ybot);
+	break;
+      }
+      prev = sraBandCoalesce(&out, prev, start);
+    }
+
+    if (r1->y2 == ybot)
+      r1 = band1;
+    if (r2->y2 == ybot)
+      r2 = band2;
+  }
+
+  /* - and so do those below it */
+  if (op != SRA_AND && !sraBandsAppend(&out, r1, end1, ybot, &prev))
+    goto nomem;
+  if (op == SRA_OR && !sraBandsAppend(&out, r2, end2, ybot, &prev))
+    goto nomem;
+
+  /* - The union's bounding box is that of both, others need a look */
+  if (op == SRA_OR) {
+    if (src->extents.x1 < dst->extents.x1)
+      dst->extents.x1 = src->extents.x1;
+    if (src->extents.y1 < dst->extents.y1)
+      dst->extents.y1 = src->extents.y1;
+    if (src->extents.x2 > dst->extents.x2)
+      dst->extents.x2 = src->extents.x2;
+    if (src->extents.y2 > dst->extents.y2)
+      dst->extents.y2 = src->extents.y2;
+    sraBandsAdopt(dst, &out);
+  } else {
+    sraBandsAdopt(dst, &out);
+    sraBandsExtents(dst);
+  }
+  return TRUE;
+
+ nomem:
+  free(out.rects);
+  rfbErr("sraRgn: out of memory for %d rectangles\n", dst->count + src->count);
+  return FALSE;
+}
+
+static rfbBool
+sraExtentsOverlap(const sraRegion *rgn1, const sraRegion *rgn2) {
+  return rgn1->count && rgn2->count &&
+    rgn1->extents.x1 < rgn2->extents.x2 && rgn2->extents.x1 < rgn1->extents.x2 &&
+    rgn1->extents.y1 < rgn2->extents.y2 && rgn2->extents.y1 < rgn1->extents.y2;
+}
+
+static rfbBool
+sraExtentsContain(const sraRect *outer, const sraRect *inner) {
+  return outer->x1 <= inner->x1 && outer->x2 >= inner->x2 &&
+    outer->y1 <= inner->y1 && outer->y2 >= inner->y2;
+}
+
+/* -=- Region routines */
+
+sraRegion *
+sraRgnCreate(void) {
+  sraRegion *rgn = (sraRegion*)malloc(sizeof(sraRegion));
+
+  if (!rgn)
+    return NULL;
+  rgn->rects = &rgn->one;
+  rgn->count = 0;
+  rgn->size = 1;
+  memset(&rgn->extents, 0, sizeof(rgn->extents));
+  return rgn;
+}
+
+sraRegion *
+sraRgnCreateRect(int x1, int y1, int x2, int y2) {
+  sraRegion *rgn = sraRgnCreate();
+
+  if (rgn && x1 < x2 && y1 < y2) {
+    sraBandAdd(rgn, x1, y1, x2, y2);
+    rgn->extents = rgn->one;
+  }
+  return rgn;
+}
+
+sraRegion *
+sraRgnCreateRgn(const sraRegion *src) {
+  sraRegion *rgn;
+
+  if (!src)
+    return NULL;
+  rgn = sraRgnCreate();
+  if (rgn && !sraBandsCopy(rgn, src)) {
+    sraRgnDestroy(rgn);
+    return NULL;
+  }
+  return rgn;
+}
+
+void
+sraRgnDestroy(sraRegion *rgn) {
+  if (!rgn)
+    return;
+  sraBandsRelease(rgn);
+  free(rgn);
+}
+
+void
+sraRgnMakeEmpty(sraRegion *rgn) {
+  sraBandsRelease(rgn);
+  memset(&rgn->extents, 0, sizeof(rgn->extents));
+}
+
+/* -=- Boolean Region ops */
+
+rfbBool
+sraRgnAnd(sraRegion *dst, const sraRegion *src) {
+  if (!sraExtentsOverlap(dst, src))
+    sraRgnMakeEmpty(dst);
+  else if (src->count != 1 || !sraExtentsContain(&src->extents, &dst->extents))
+    sraBandsOp(dst, src, SRA_AND);
+  return dst->count > 0;
+}
+
+void
+sraRgnOr(sraRegion *dst, const sraRegion *src) {
+  if (!src->count || (dst->count == 1 && sraExtentsContain(&dst->extents, &src->extents)))
+    return;
+  if (!dst->count || (src->count == 1 && sraExtentsContain(&src->extents, &dst->extents)))
+    sraBandsCopy(dst, src);
+  else
+    sraBandsOp(dst, src, SRA_OR);
+}
+
+rfbBool
+sraRgnSubtract(sraRegion *dst, const sraRegion *src) {
+  if (sraExtentsOverlap(dst, src))
+    sraBandsOp(dst, src, SRA_SUBTRACT);
+  return dst->count > 0;
+}
+
+rfbBool
+sraRgnIntersects(const sraRegion *rgn1, const sraRegion *rgn2) {
+  const sraRect *r1 = rgn1->rects, *end1 = r1 + rgn1->count, *band1, *p1;
+  const sraRect *r2 = rgn2->rects, *end2 = r2 + rgn2->count, *band2, *p2;
+
+  if (!sraExtentsOverlap(rgn1, rgn2))
+    return FALSE;
+  while (r1 < end1 && r2 < end2) {
+    band1 = sraBandEnd(r1, end1);
+    band2 = sraBandEnd(r2, end2);
+    if (r1->y1 < r2->y2 && r2->y1 < r1->y2) {
+      for (p1 = r1, p2 = r2; p1 < band1 && p2 < band2; ) {
+	if (p1->x1 < p2->x2 && p2->x1 < p1->x2)
+	  return TRUE;
+	if (p1->x2 < p2->x2)
+	  p1++;
+	else
+	  p2++;
+      }
+    }
+    if (r1->y2 < r2->y2)
+      r1 = band1;
+    else
+      r2 = band2;
+  }
+  return FALSE;
+}
+
+void
+sraRgnOffset(sraRegion *dst, int dx, int dy) {
+  sraRect *r = dst->rects, *end = r + dst->count;
+
+  for (; r < end; r++) {
+    r->x1 += dx;
+    r->x2 += dx;
+    r->y1 += dy;
+    r->y2 += dy;
+  }
+  if (dst->count) {
+    dst->extents.x1 += dx;
+    dst->extents.x2 += dx;
+    dst->extents.y1 += dy;
+    dst->extents.y2 += dy;
+  }
+}
+
+sraRegion *sraRgnBBox(const sraRegion *src) {
+  if (!src || !src->count)
+    return sraRgnCreate();
+  return sraRgnCreateRect(src->extents.x1, src->extents.y1,
+			  src->extents.x2, src->extents.y2);
+}
+
+rfbBool
+sraRgnPopRect(sraRegion *rgn, sraRect *rect, unsigned long flags) {
+  sraRect *rects = rgn->rects, *end = rects + rgn->count;
+  const sraRect *band;
+  rfbBool right2left = (flags & 2) == 2;
+  rfbBool bottom2top = (flags & 1) == 1;
+  int i;
+
+  if (!rgn->count)
+    return 0;
+
+  /* - Pick correct order: the first or last band, its first or last rectangle */
+  if (bottom2top) {
+    for (i = rgn->count - 1; i > 0 && rects[i - 1].y1 == end[-1].y1; i--)
+      ;
+    if (right2left)
+      i = rgn->count - 1;
+  } else {
+    band = sraBandEnd(rects, end);
+    i = right2left ? band - rects - 1 : 0;
+  }
+
+  *rect = rects[i];
+  memmove(&rects[i], &rects[i + 1], (rgn->count - i - 1) * sizeof(sraRect));
+  rgn->count--;
+  sraBandsExtents(rgn);
+  return 1;
+}
+
+unsigned long
+sraRgnCountRects(const sraRegion *rgn) {
+  return rgn->count;
+}
+
+rfbBool
+sraRgnEmpty(const sraRegion *rgn) {
+  return rgn->count == 0;
+}
+
+/* iterator stuff: sPtrs holds the region, ptrPos the next rectangle */
+
+/* the rectangle after r in the given order, or -1 */
+static int
+sraNextRect(const sraRegion *rgn, int r, rfbBool reverseX, rfbBool reverseY) {
+  const sraRect *rects = rgn->rects;
+  int y1 = rects[r].y1, first = r, last = r;
+
+  /* - The next one in the band */
+  if (reverseX) {
+    if (r > 0 && rects[r - 1].y1 == y1)
+      return r - 1;
+  } else if (r + 1 < rgn->count && rects[r + 1].y1 == y1)
+    return r + 1;
+
+  /* - or the first one of the next band */
+  if (reverseY) {
+    while (first > 0 && rects[first - 1].y1 == y1)
+      first--;
+    if (first == 0)
+      return -1;
+    r = first - 1;
+    if (!reverseX)
+      while (r > 0 && rects[r - 1].y1 == rects[first - 1].y1)
+	r--;
+  } else {
+    while (last + 1 < rgn->count && rects[last + 1].y1 == y1)
+      last++;
+    if (last + 1 == rgn->count)
+      return -1;
+    r = last + 1;
+    if (reverseX)
+      while (r + 1 < rgn->count && rects[r + 1].y1 == rects[last + 1].y1)
+	r++;
+  }
+  return r;
+}
+
+sraRectangleIterator *sraRgnGetIterator(sraRegion *s)
+{
+  sraRectangleIterator *i =
+    (sraRectangleIterator*)malloc(sizeof(sraRectangleIterator));
+  if(!i)
+    return NULL;
+
+  i->sPtrs = (struct sraSpan**)s;
+  i->ptrSize = 0;
+  i->ptrPos = s->count ? 0 : -1;
+  i->reverseX = 0;
+  i->reverseY = 0;
+  return i;
+}
+
+sraRectangleIterator *sraRgnGetReverseIterator(sraRegion *s,rfbBool reverseX,rfbBool reverseY)
+{
+  sraRectangleIterator *i = sraRgnGetIterator(s);
+  int r;
+
+  if(!i || !s->count)
+    return i;
+  /* start with the rectangle that would come right before the first one */
+  r = reverseY ? s->count - 1 : 0;
+  if(!reverseX == !reverseY)
+    i->ptrPos = r;
+  else if(reverseX)
+    i->ptrPos = sraBandEnd(s->rects, s->rects + s->count) - s->rects - 1;
+  else {
+    while(r > 0 && s->rects[r - 1].y1 == s->rects[s->count - 1].y1)
+      r--;
+    i->ptrPos = r;
+  }
+  i->reverseX = reverseX;
+  i->reverseY = reverseY;
+  return(i);
+}
+
+rfbBool sraRgnIteratorNext(sraRectangleIterator* i,sraRect* r)
+{
+  const sraRegion *s = (const sraRegion*)i->sPtrs;
+
+  if(i->ptrPos < 0) /* the end */
+    return(0);
+  *r = s->rects[i->ptrPos];
+  i->ptrPos = sraNextRect(s, i->ptrPos, i->reverseX, i->reverseY);
+  return(-1);
+}
+
+void sraRgnReleaseIterator(sraRectangleIterator* i)
+{
+  free(i);
+}
+
+void
+sraRgnPrint(const sraRegion *rgn) {
+  const sraRect *r = rgn->rects, *end = r + rgn->count, *band;
+
+  /* - In the format of the span lists */
+  printf("[");
+  while (r < end) {
+    band = sraBandEnd(r, end);
+    printf("(%d-%d)[", r->y1, r->y2);
+    for (; r < band; r++)
+      printf("(%d-%d)", r->x1, r->x2);
+    printf("]");
+  }
+  printf("]");
+}
@@ -369,8 +369,13 @@ rfbNewTCPOrUDPClient(rfbScreenInfoPtr rfbScreen,
 	rfbLogPerror("setsockopt failed: can't set TCP_NODELAY flag, non TCP socket?");
       }
 
-      FD_SET(sock,&(rfbScreen->allFds));
-		rfbScreen->maxFd = rfbMax(sock,rfbScreen->maxFd);
+      if(!rfbWatchSocket(rfbScreen, sock, cl)) {
+	rfbCloseSocket(sock);
+	cl->scaledScreen->scaledScreenRefCount--;
+	free(cl->host);
+	free(cl);
+	return NULL;
+      }
 #endif
 
       INIT_MUTEX(cl->outputMutex);
@@ -378,6 +383,9 @@ rfbNewTCPOrUDPClient(rfbScreenInfoPtr rfbScreen,
       INIT_MUTEX(cl->sendMutex);
       INIT_COND(cl->deleteCond);
 
+      /* without one, writes wait for the socket as they always did */
+      rfbInitOutputQueue(cl);
+
       cl->state = RFB_PROTOCOL_VERSION;
 
       cl->reverseConnection = FALSE;
@@ -401,6 +409,7 @@ rfbNewTCPOrUDPClient(rfbScreenInfoPtr rfbScreen,
       INIT_COND(cl->updateCond);
 
       cl->requestedRegion = sraRgnCreate();
+      cl->continuousRegion = sraRgnCreate();
 
       cl->format = cl->screen->serverFormat;
       cl->translateFn = rfbTranslateNone;
@@ -595,13 +604,15 @@ rfbClientConnectionGone(rfbClientPtr cl)
 #endif
 
     rfbFreeUltraData(cl);
+    rfbEncodeCacheFreeClient(cl);
+    rfbPacerFreeClient(cl);
 
     /* free buffers holding pixel data before and after encoding */
     free(cl->beforeEncBuf);
     free(cl->afterEncBuf);
 
     if(cl->sock != RFB_INVALID_SOCKET)
-       FD_CLR(cl->sock,&(cl->screen->allFds));
+       rfbUnwatchSocket(cl->screen, cl->sock);
 
     cl->clientGoneHook(cl);
 
@@ -634,6 +645,7 @@ rfbClientConnectionGone(rfbClientPtr cl)
 
     sraRgnDestroy(cl->modifiedRegion);
     sraRgnDestroy(cl->requestedRegion);
+    sraRgnDestroy(cl->continuousRegion);
     sraRgnDestroy(cl->copyRegion);
 
     free(cl->translateLookupTable);
@@ -644,6 +656,7 @@ rfbClientConnectionGone(rfbClientPtr cl)
     /* make sure outputMutex is unlocked before destroying */
     LOCK(cl->outputMutex);
     UNLOCK(cl->outputMutex);
+    rfbFreeOutputQueue(cl);
     TINI_MUTEX(cl->outputMutex);
 
     LOCK(cl->sendMutex);
@@ -1007,6 +1020,10 @@ rfbSendSupportedMessages(rfbClientPtr cl)
     rfbSetBit(msgs.server2client, rfbResizeFrameBuffer);
     rfbSetBit(msgs.server2client, rfbPalmVNCReSizeFrameBuffer);
     rfbSetBit(msgs.client2server, rfbSetDesktopSize);
+    rfbSetBit(msgs.client2server, rfbEnableContinuousUpdates);
+    rfbSetBit(msgs.server2client, rfbEndOfContinuousUpdates);
+    rfbSetBit(msgs.client2server, rfbFence);
+    rfbSetBit(msgs.server2client, rfbFence);
 
     if (cl->screen->xvpHook) {
         rfbSetBit(msgs.client2server, rfbXvp);
@@ -1064,6 +1081,8 @@ rfbSendSupportedEncodings(rfbClientPtr cl)
 	rfbEncodingSupportedMessages,
 	rfbEncodingSupportedEncodings,
 	rfbEncodingServerIdentity,
+	rfbEncodingFence,
+	rfbEncodingContinuousUpdates,
 #ifdef LIBVNCSERVER_HAVE_LIBZ
     rfbEncodingExtendedClipboard,
 #endif
@@ -1190,6 +1209,69 @@ rfbSendXvp(rfbClientPtr cl, uint8_t version, uint8_t code)
     return TRUE;
 }
 
+/*
+ * Send a fence, see rfbFenceMsg. A request is answered by the client once
+ * it has handled everything sent before.
+ */
+
+rfbBool
+rfbSendFence(rfbClientPtr cl, uint32_t flags, int length, const char *data)
+{
+    char buf[sz_rfbFenceMsg + rfbFenceMaxLength];
+    rfbFenceMsg f;
+    rfbBool result = TRUE;
+
+    if (length < 0 || length > rfbFenceMaxLength)
+        return FALSE;
+
+    f.type = rfbFence;
+    f.pad[0] = f.pad[1] = f.pad[2] = 0;
+    f.flags = Swap32IfLE(flags);
+    f.length = length;
+    memcpy(buf, (char *)&f, sz_rfbFenceMsg);
+    if (length > 0)
+        memcpy(buf + sz_rfbFenceMsg, data, length);
+
+    LOCK(cl->sendMutex);
+    if (rfbWriteExact(cl, buf, sz_rfbFenceMsg + length) < 0) {
+      rfbLogPerror("rfbSendFence: write");
+      rfbCloseClient(cl);
+      result = FALSE;
+    }
+    UNLOCK(cl->sendMutex);
+
+    rfbStatRecordMessageSent(cl, rfbFence, sz_rfbFenceMsg + length, sz_rfbFenceMsg + length);
+
+    return result;
+}
+
+/*
+ * Send EndOfContinuousUpdates, to announce the extension and whenever
+ * continuous updates stop.
+ */
+
+static rfbBool
+rfbSendEndOfContinuousUpdates(rfbClientPtr cl)
+{
+    rfbEndOfContinuousUpdatesMsg ecu;
+    rfbBool result = TRUE;
+
+    ecu.type = rfbEndOfContinuousUpdates;
+
+    LOCK(cl->sendMutex);
+    if (rfbWriteExact(cl, (char *)&ecu, sz_rfbEndOfContinuousUpdatesMsg) < 0) {
+      rfbLogPerror("rfbSendEndOfContinuousUpdates: write");
+      rfbCloseClient(cl);
+      result = FALSE;
+    }
+    UNLOCK(cl->sendMutex);
+
+    rfbStatRecordMessageSent(cl, rfbEndOfContinuousUpdates, sz_rfbEndOfContinuousUpdatesMsg,
+                             sz_rfbEndOfContinuousUpdatesMsg);
+
+    return result;
+}
+
 
 rfbBool rfbSendTextChatMessage(rfbClientPtr cl, uint32_t length, char *buffer)
 {
@@ -1552,8 +1634,6 @@ rfbBool rfbSendFileTransferChunk(rfbClientPtr cl)
     char readBuf[sz_rfbBlockSize];
     int bytesRead=0;
     int retval=0;
-    fd_set wfds;
-    struct timeval tv;
     int n;
 #ifdef LIBVNCSERVER_HAVE_LIBZ
     unsigned char compBuf[sz_rfbBlockSize + 1024];
@@ -1579,13 +1659,8 @@ rfbBool rfbSendFileTransferChunk(rfbClientPtr cl)
             errno = EBADF;
             return FALSE;
         }
-	FD_ZERO(&wfds);
-        FD_SET(cl->sock, &wfds);
-
         /* return immediately */
-	tv.tv_sec = 0; 
-	tv.tv_usec = 0;
-	n = select(cl->sock + 1, NULL, &wfds, NULL, &tv);
+	n = rfbWaitForSocket(cl->sock, TRUE, 0);
 
 	if (n<0) {
 #ifdef WIN32
@@ -1593,8 +1668,8 @@ rfbBool rfbSendFileTransferChunk(rfbClientPtr cl)
 #endif
             rfbLog("rfbSendFileTransferChunk() select failed: %s\n", strerror(errno));
 	}
-        /* We have space on the transmit queue */
-	if (n > 0)
+        /* We have space on the transmit queue, and nothing waits for it */
+	if (n > 0 && cl->outputQueued == 0)
 	{
             bytesRead = read(cl->fileTransfer.fd, readBuf, sz_rfbBlockSize);
             switch (bytesRead) {
@@ -2228,6 +2303,8 @@ rfbProcessClientNormalMessage(rfbClientPtr cl)
     rfbExtDesktopScreen *extDesktopScreens;
     rfbClientIteratorPtr iterator;
     rfbClientPtr clp;
+    rfbBool hadFence, hadContinuousUpdates;
+    char fenceData[rfbFenceMaxLength];
 #ifdef LIBVNCSERVER_HAVE_LIBZ
     rfbBool isExtendedCutText = FALSE;
     uint32_t extClipboardFlags;
@@ -2317,6 +2394,9 @@ rfbProcessClientNormalMessage(rfbClientPtr cl)
         if (cl->preferredEncoding!=-1)
             lastPreferredEncoding = cl->preferredEncoding;
 
+        hadFence = cl->enableFence;
+        hadContinuousUpdates = cl->enableFence && cl->enableContinuousUpdates;
+
         /* Reset all flags to defaults (allows us to switch between PointerPos and Server Drawn Cursors) */
         cl->preferredEncoding=-1;
         cl->useCopyRect              = FALSE;
@@ -2331,6 +2411,8 @@ rfbProcessClientNormalMessage(rfbClientPtr cl)
         cl->enableSupportedMessages  = FALSE;
         cl->enableSupportedEncodings = FALSE;
         cl->enableServerIdentity     = FALSE;
+        cl->enableFence              = FALSE;
+        cl->enableContinuousUpdates  = FALSE;
 #if defined(LIBVNCSERVER_HAVE_LIBZ) || defined(LIBVNCSERVER_HAVE_LIBPNG)
         cl->tightQualityLevel        = -1;
 #ifdef LIBVNCSERVER_HAVE_LIBJPEG
@@ -2458,6 +2540,18 @@ rfbProcessClientNormalMessage(rfbClientPtr cl)
                   cl->enableServerIdentity = TRUE;
                 }
                 break;
+            case rfbEncodingFence:
+                if (!hadFence)
+                  rfbLog("Enabling Fence protocol extension for client "
+                          "%s\n", cl->host);
+                cl->enableFence = TRUE;
+                break;
+            case rfbEncodingContinuousUpdates:
+                if (!hadContinuousUpdates)
+                  rfbLog("Enabling ContinuousUpdates protocol extension for client "
+                          "%s\n", cl->host);
+                cl->enableContinuousUpdates = TRUE;
+                break;
             case rfbEncodingXvp:
                 if (cl->screen->xvpHook) {
                   rfbLog("Enabling Xvp protocol extension for client "
@@ -2594,6 +2688,113 @@ rfbProcessClientNormalMessage(rfbClientPtr cl)
 	  cl->enableCursorPosUpdates = FALSE;
 	}
 
+        /* confirm the extensions new to us; continuous updates are only
+           for clients that can answer the fences pacing them */
+        if (cl->enableFence && !hadFence &&
+            !rfbSendFence(cl, rfbFenceFlagRequest, 0, NULL))
+            return;
+        if (cl->enableFence && cl->enableContinuousUpdates && !hadContinuousUpdates &&
+            !rfbSendEndOfContinuousUpdates(cl))
+            return;
+        if (cl->continuousUpdates && !(cl->enableFence && cl->enableContinuousUpdates)) {
+            LOCK(cl->updateMutex);
+            cl->continuousUpdates = FALSE;
+            UNLOCK(cl->updateMutex);
+        }
+
+        return;
+    }
+
+
+    case rfbEnableContinuousUpdates:
+    {
+        sraRegionPtr tmpRegion;
+
+        if ((n = rfbReadExact(cl, ((char *)&msg) + 1,
+                           sz_rfbEnableContinuousUpdatesMsg-1)) <= 0) {
+            if (n != 0)
+                rfbLogPerror("rfbProcessClientNormalMessage: read");
+            rfbCloseClient(cl);
+            return;
+        }
+
+        rfbStatRecordMessageRcvd(cl, msg.type, sz_rfbEnableContinuousUpdatesMsg,
+                                 sz_rfbEnableContinuousUpdatesMsg);
+
+        if (!cl->enableFence || !cl->enableContinuousUpdates) {
+            rfbLog("Warning, ignoring rfbEnableContinuousUpdates from client %s "
+                   "without Fence and ContinuousUpdates encodings\n", cl->host);
+            return;
+        }
+
+        if (!msg.ecu.enable) {
+            LOCK(cl->updateMutex);
+            cl->continuousUpdates = FALSE;
+            sraRgnMakeEmpty(cl->continuousRegion);
+            UNLOCK(cl->updateMutex);
+            rfbSendEndOfContinuousUpdates(cl);
+            return;
+        }
+
+        if(!rectSwapIfLEAndClip(&msg.ecu.x,&msg.ecu.y,&msg.ecu.w,&msg.ecu.h,cl))
+        {
+            rfbLog("Warning, ignoring rfbEnableContinuousUpdates: %dXx%dY-%dWx%dH\n",msg.ecu.x, msg.ecu.y, msg.ecu.w, msg.ecu.h);
+            return;
+        }
+
+        tmpRegion = sraRgnCreateRect(msg.ecu.x, msg.ecu.y,
+                                     msg.ecu.x + msg.ecu.w, msg.ecu.y + msg.ecu.h);
+
+        LOCK(cl->updateMutex);
+        sraRgnMakeEmpty(cl->continuousRegion);
+        sraRgnOr(cl->continuousRegion, tmpRegion);
+        sraRgnOr(cl->requestedRegion, tmpRegion);
+        cl->continuousUpdates = TRUE;
+        TSIGNAL(cl->updateCond);
+        UNLOCK(cl->updateMutex);
+
+        sraRgnDestroy(tmpRegion);
+        return;
+    }
+
+
+    case rfbFence:
+    {
+        if ((n = rfbReadExact(cl, ((char *)&msg) + 1,
+                           sz_rfbFenceMsg-1)) <= 0) {
+            if (n != 0)
+                rfbLogPerror("rfbProcessClientNormalMessage: read");
+            rfbCloseClient(cl);
+            return;
+        }
+
+        if (msg.f.length > rfbFenceMaxLength) {
+            rfbLog("rfbProcessClientNormalMessage: fence payload of %d bytes is too long\n",
+                   msg.f.length);
+            rfbCloseClient(cl);
+            return;
+        }
+
+        if (msg.f.length > 0 &&
+            (n = rfbReadExact(cl, fenceData, msg.f.length)) <= 0) {
+            if (n != 0)
+                rfbLogPerror("rfbProcessClientNormalMessage: read");
+            rfbCloseClient(cl);
+            return;
+        }
+
+        rfbStatRecordMessageRcvd(cl, msg.type, sz_rfbFenceMsg + msg.f.length,
+                                 sz_rfbFenceMsg + msg.f.length);
+
+        msg.f.flags = Swap32IfLE(msg.f.flags);
+        if (msg.f.flags & rfbFenceFlagRequest) {
+            /* everything before it has been handled, and nothing after it
+               will be until it is answered. SyncNext is not honoured. */
+            rfbSendFence(cl, msg.f.flags & (rfbFenceFlagBlockBefore | rfbFenceFlagBlockAfter),
+                         msg.f.length, fenceData);
+        } else {
+            rfbPacerPong(cl, fenceData, msg.f.length);
+        }
         return;
     }
 
@@ -3133,11 +3334,14 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
     rfbBool sendSupportedEncodings = FALSE;
     rfbBool sendServerIdentity = FALSE;
     rfbBool result = TRUE;
+    rfbBool parallel;
     
 
     if(cl->screen->displayHook)
       cl->screen->displayHook(cl);
 
+    cl->lastUpdateTime = rfbPacerClock();
+
     /*
      * If framebuffer size was changed and the client supports NewFBSize
      * encoding, just send NewFBSize marker and return.
@@ -3297,11 +3501,12 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
      */
 
     updateCopyRegion = sraRgnCreateRgn(cl->copyRegion);
-    sraRgnAnd(updateCopyRegion,cl->requestedRegion);
-    tmpRegion = sraRgnCreateRgn(cl->requestedRegion);
-    sraRgnOffset(tmpRegion,cl->copyDX,cl->copyDY);
-    sraRgnAnd(updateCopyRegion,tmpRegion);
-    sraRgnDestroy(tmpRegion);
+    if(sraRgnAnd(updateCopyRegion,cl->requestedRegion)) {
+      tmpRegion = sraRgnCreateRgn(cl->requestedRegion);
+      sraRgnOffset(tmpRegion,cl->copyDX,cl->copyDY);
+      sraRgnAnd(updateCopyRegion,tmpRegion);
+      sraRgnDestroy(tmpRegion);
+    }
     dx = cl->copyDX;
     dy = cl->copyDY;
 
@@ -3325,6 +3530,8 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
      sraRgnSubtract(cl->modifiedRegion,updateCopyRegion);
 
      sraRgnMakeEmpty(cl->requestedRegion);
+     if (cl->continuousUpdates)
+         sraRgnOr(cl->requestedRegion,cl->continuousRegion);
      sraRgnMakeEmpty(cl->copyRegion);
      cl->copyDX = 0;
      cl->copyDY = 0;
@@ -3348,7 +3555,12 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
      */
     
     rfbStatRecordMessageSent(cl, rfbFramebufferUpdate, 0, 0);
-    if (cl->preferredEncoding == rfbEncodingCoRRE) {
+    /* how many rects the encoding threads make of it is only known
+       afterwards, so a LastRect marker ends the update */
+    parallel = rfbEncodeThreadsWanted(cl, updateRegion);
+    if (parallel) {
+        nUpdateRegionRects = 0xFFFF;
+    } else if (cl->preferredEncoding == rfbEncodingCoRRE) {
         nUpdateRegionRects = 0;
 
         for(i = sraRgnGetIterator(updateRegion); sraRgnIteratorNext(i,&rect);){
@@ -3512,61 +3724,14 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
 	        goto updateFailed;
     }
 
-    for(i = sraRgnGetIterator(updateRegion); sraRgnIteratorNext(i,&rect);){
-        int x = rect.x1;
-        int y = rect.y1;
-        int w = rect.x2 - x;
-        int h = rect.y2 - y;
-
-        /* We need to count the number of rects in the scaled screen */
-        if (cl->screen!=cl->scaledScreen)
-            rfbScaledCorrection(cl->screen, cl->scaledScreen, &x, &y, &w, &h, "rfbSendFramebufferUpdate");
-
-        switch (cl->preferredEncoding) {
-	case -1:
-        case rfbEncodingRaw:
-            if (!rfbSendRectEncodingRaw(cl, x, y, w, h))
-	        goto updateFailed;
-            break;
-        case rfbEncodingRRE:
-            if (!rfbSendRectEncodingRRE(cl, x, y, w, h))
-	        goto updateFailed;
-            break;
-        case rfbEncodingCoRRE:
-            if (!rfbSendRectEncodingCoRRE(cl, x, y, w, h))
-	        goto updateFailed;
-	    break;
-        case rfbEncodingHextile:
-            if (!rfbSendRectEncodingHextile(cl, x, y, w, h))
-	        goto updateFailed;
-            break;
-        case rfbEncodingUltra:
-            if (!rfbSendRectEncodingUltra(cl, x, y, w, h))
+    if (parallel) {
+        if (!rfbEncodeThreadsSend(cl, updateRegion))
+            goto updateFailed;
+    } else {
+        for(i = sraRgnGetIterator(updateRegion); sraRgnIteratorNext(i,&rect);){
+            if (!rfbSendUpdateRect(cl, rect.x1, rect.y1,
+                                   rect.x2 - rect.x1, rect.y2 - rect.y1))
                 goto updateFailed;
-            break;
-#ifdef LIBVNCSERVER_HAVE_LIBZ
-	case rfbEncodingZlib:
-	    if (!rfbSendRectEncodingZlib(cl, x, y, w, h))
-	        goto updateFailed;
-	    break;
-       case rfbEncodingZRLE:
-       case rfbEncodingZYWRLE:
-           if (!rfbSendRectEncodingZRLE(cl, x, y, w, h))
-	       goto updateFailed;
-           break;
-#endif
-#if defined(LIBVNCSERVER_HAVE_LIBJPEG) && (defined(LIBVNCSERVER_HAVE_LIBZ) || defined(LIBVNCSERVER_HAVE_LIBPNG))
-	case rfbEncodingTight:
-	    if (!rfbSendRectEncodingTight(cl, x, y, w, h))
-	        goto updateFailed;
-	    break;
-#ifdef LIBVNCSERVER_HAVE_LIBPNG
-	case rfbEncodingTightPng:
-	    if (!rfbSendRectEncodingTightPng(cl, x, y, w, h))
-	        goto updateFailed;
-	    break;
-#endif
-#endif
         }
     }
     if (i) {
@@ -3578,6 +3743,11 @@ rfbSendFramebufferUpdate(rfbClientPtr cl,
 	 !rfbSendLastRectMarker(cl) )
 	    goto updateFailed;
 
+    /* nobody asks for the next continuous update, the fence's answer
+       tells when it may go */
+    if (cl->continuousUpdates && cl->enableFence && !rfbPacerPing(cl))
+        goto updateFailed;
+
     if (!rfbSendUpdateBuf(cl)) {
 updateFailed:
 	result = FALSE;
@@ -3598,6 +3768,81 @@ updateFailed:
 }
 
 
+/*
+ * Send a rectangle of the screen in the client's preferred encoding, or
+ * what another client's encoding of it left in the encode cache.
+ */
+
+rfbBool
+rfbSendUpdateRect(rfbClientPtr cl,
+                  int x,
+                  int y,
+                  int w,
+                  int h)
+{
+    /* We need the rect in the scaled screen */
+    if (cl->screen!=cl->scaledScreen)
+        rfbScaledCorrection(cl->screen, cl->scaledScreen, &x, &y, &w, &h, "rfbSendUpdateRect");
+
+    /* another client may have encoded this rect already */
+    switch (rfbEncodeCacheBegin(cl, x, y, w, h)) {
+    case 1:
+        return TRUE;
+    case -1:
+        return FALSE;
+    }
+
+    switch (cl->preferredEncoding) {
+    case -1:
+    case rfbEncodingRaw:
+        if (!rfbSendRectEncodingRaw(cl, x, y, w, h))
+            return FALSE;
+        break;
+    case rfbEncodingRRE:
+        if (!rfbSendRectEncodingRRE(cl, x, y, w, h))
+            return FALSE;
+        break;
+    case rfbEncodingCoRRE:
+        if (!rfbSendRectEncodingCoRRE(cl, x, y, w, h))
+            return FALSE;
+        break;
+    case rfbEncodingHextile:
+        if (!rfbSendRectEncodingHextile(cl, x, y, w, h))
+            return FALSE;
+        break;
+    case rfbEncodingUltra:
+        if (!rfbSendRectEncodingUltra(cl, x, y, w, h))
+            return FALSE;
+        break;
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    case rfbEncodingZlib:
+        if (!rfbSendRectEncodingZlib(cl, x, y, w, h))
+            return FALSE;
+        break;
+    case rfbEncodingZRLE:
+    case rfbEncodingZYWRLE:
+        if (!rfbSendRectEncodingZRLE(cl, x, y, w, h))
+            return FALSE;
+        break;
+#endif
+#if defined(LIBVNCSERVER_HAVE_LIBJPEG) && (defined(LIBVNCSERVER_HAVE_LIBZ) || defined(LIBVNCSERVER_HAVE_LIBPNG))
+    case rfbEncodingTight:
+        if (!rfbSendRectEncodingTight(cl, x, y, w, h))
+            return FALSE;
+        break;
+#ifdef LIBVNCSERVER_HAVE_LIBPNG
+    case rfbEncodingTightPng:
+        if (!rfbSendRectEncodingTightPng(cl, x, y, w, h))
+            return FALSE;
+        break;
+#endif
+#endif
+    }
+    rfbEncodeCacheEnd(cl);
+    return TRUE;
+}
+
+
 /*
  * Send the copy region as a string of CopyRect encoded rectangles.
  * The only slightly tricky thing is that we should send the messages in
@@ -3906,9 +4151,15 @@ rfbSendExtDesktopSize(rfbClientPtr cl,
 rfbBool
 rfbSendUpdateBuf(rfbClientPtr cl)
 {
+    /* a copy of the client encoding part of an update on another thread */
+    if (cl->encodeStrip)
+        return rfbEncodeThreadsCapture(cl);
+
     if(cl->sock<0)
       return FALSE;
 
+    rfbEncodeCacheCapture(cl);
+
     if (rfbWriteExact(cl, cl->updateBuf, cl->ublen) < 0) {
         rfbLogPerror("rfbSendUpdateBuf: write");
         rfbCloseClient(cl);
@@ -32,11 +32,16 @@
 #include <rfb/rfb.h>
 #include <rfb/rfbregion.h>
 #include "private.h"
+#include "simd.h"
 
 #ifdef LIBVNCSERVER_HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
 
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+#include <unistd.h>
+#endif
+
 
 #ifdef DEBUGPROTO
 #undef DEBUGPROTO
@@ -132,127 +137,583 @@ void rfbScaledCorrection(rfbScreenInfoPtr from, rfbScreenInfoPtr to, int *x, int
     if (*y+*h > to->height) *h=to->height - *y;
 }
 
+/*
+ * The scaled copies are kept up to date by averaging the area of the
+ * source each of their pixels covers. Along an axis with S source and D
+ * destination pixels, destination pixel X covers [X * S/D, (X+1) * S/D).
+ * Counted in (D/g)ths of a source pixel, g the greatest common divisor of
+ * S and D, each source pixel in there gets an integer weight and the
+ * weights add up to S/g. Where D divides S all weights are 1, which is the
+ * box filter this scaler always had for such sizes; scaling up, every
+ * destination pixel takes one source pixel.
+ *
+ * The filter is separable: a destination row first sums its source rows
+ * into four accumulators per source pixel with simd_accumulate_u8(),
+ * straight from 32 bit pixels with 8 bit channels in whole bytes and
+ * otherwise from their channels taken apart into bytes, with
+ * simd_unpack16() for 16 bit pixels. Each destination pixel then adds up
+ * the accumulators of its source pixels and divides by the total weight
+ * with a fixed point reciprocal, all in simd_average_u32() for the box
+ * filter.
+ *
+ * With rfbScreenInfo::scaleThreads, the rows of a large rectangle are
+ * shared out in bands between the calling thread and helpers, as in
+ * damage.c. All clients scaled to one size share its copy, which is
+ * updated once per change, however many of them use it.
+ */
+
+#define MAX_SCALE_THREADS 64
+/* smaller rectangles, in source pixels, are not worth waking the helpers */
+#define MIN_PARALLEL_AREA (512 * 256)
+#define BAND_ROWS 8
+/* below this total weight and with channels of 8 bits at most, a
+   multiplication and a shift by RECIPROCAL_SHIFT divide exactly */
+#define RECIPROCAL_LIMIT (1 << 23)
+#define RECIPROCAL_SHIFT 55
+/* with a shift of 31 + log2(total), the factor fits 32 bits and below this
+   total still divides exactly */
+#define BOX_LIMIT (1 << 20)
+
+typedef struct {
+    int first, count;   /* the source pixels a destination pixel covers */
+    int weights;        /* where their weights start in ScaleAxis::weights */
+} ScaleSpan;
+
+typedef struct {
+    ScaleSpan *spans;
+    uint32_t *weights;  /* NULL if they are all 1 */
+    uint32_t total;     /* the sum of the weights of each span */
+} ScaleAxis;
+
+typedef struct {
+    rfbScreenInfoPtr from, to;
+    int x, y, w, h;             /* the rectangle of to to update */
+    ScaleAxis cols, rows;
+    int srcX, srcW, srcH;       /* the source columns and rows it takes */
+    int bytesPerPixel;
+    rfbBool blend;              /* FALSE to take one pixel of each area */
+    rfbBool bytes;              /* the channels are whole bytes */
+    rfbBool narrow;             /* none of them is wider than 8 bits */
+    unsigned char mask[4];      /* the bytes of a pixel that are colour */
+    int shift[3];
+    unsigned long max[3];
+    uint64_t total, reciprocal; /* reciprocal 0 to divide by total */
+    uint32_t boxFactor;         /* for simd_average_u32(), if not 0 */
+    int boxShift;
+    /* per thread, srcW * 4 accumulators, w * 4 bytes of averages and
+       srcW * 4 bytes of unpacked source pixels */
+    uint32_t *scratch;
+} ScaleJob;
+
+static uint32_t
+gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+
+    while (b != 0) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* spans of the n destination pixels from first on, FALSE if out of memory */
+static rfbBool
+buildAxis(ScaleAxis *axis, int from, int to, int first, int n)
+{
+    uint32_t g = gcd(from, to), s = from / g, d = to / g;
+    uint64_t lo, hi, a, b;
+    ScaleSpan *span;
+    int i, j, k = 0;
+
+    axis->total = s;
+    axis->spans = malloc(n * sizeof(ScaleSpan));
+    axis->weights = d > 1 ? malloc(n * (s / d + 2) * sizeof(uint32_t)) : NULL;
+    if (axis->spans == NULL || (d > 1 && axis->weights == NULL))
+        return FALSE;
+    for (i = 0; i < n; i++) {
+        span = &axis->spans[i];
+        lo = (uint64_t)(first + i) * s;
+        hi = lo + s;
+        span->first = (int)(lo / d);
+        span->count = (int)((hi - 1) / d) - span->first + 1;
+        span->weights = k;
+        if (axis->weights != NULL)
+            for (j = 0; j < span->count; j++) {
+                a = (uint64_t)(span->first + j) * d;
+                b = a + d;
+                axis->weights[k++] = (uint32_t)((b < hi ? b : hi) - (a > lo ? a : lo));
+            }
+    }
+    return TRUE;
+}
+
+/* how to blend the pixels of job->from */
+static void
+setFormat(ScaleJob *job)
+{
+    const rfbPixelFormat *f = &job->from->serverFormat;
+    unsigned long maxChannel = 0;
+    uint32_t mask;
+    int c;
+
+    job->shift[0] = f->redShift;
+    job->shift[1] = f->greenShift;
+    job->shift[2] = f->blueShift;
+    job->max[0] = f->redMax;
+    job->max[1] = f->greenMax;
+    job->max[2] = f->blueMax;
+    if (!f->trueColour)
+        return;
+
+    job->blend = TRUE;
+    for (c = 0; c < 3; c++) {
+        if (job->max[c] > maxChannel)
+            maxChannel = job->max[c];
+        /* the sum of a column of source pixels has to fit 32 bits */
+        if ((uint64_t)job->max[c] * job->rows.total > 0xffffffff)
+            job->blend = FALSE;
+    }
+    if (job->bytesPerPixel == 4 && maxChannel == 255) {
+        job->bytes = TRUE;
+        mask = 0;
+        for (c = 0; c < 3; c++) {
+            if (job->max[c] != 255 || job->shift[c] % 8 != 0)
+                job->bytes = FALSE;
+            else
+                mask |= (uint32_t)255 << job->shift[c];
+        }
+        memcpy(job->mask, &mask, 4);
+    }
+
+    job->narrow = maxChannel <= 255;
+    job->total = (uint64_t)job->cols.total * job->rows.total;
+    if (job->narrow && job->total < RECIPROCAL_LIMIT)
+        job->reciprocal = ((uint64_t)1 << RECIPROCAL_SHIFT) / job->total + 1;
+
+    /* and one that fits 32 bits for the box filter */
+    if (job->reciprocal != 0 && job->cols.weights == NULL && job->total < BOX_LIMIT) {
+        for (job->boxShift = 31; ((uint64_t)2 << (job->boxShift - 31)) <= job->total; job->boxShift++)
+            ;
+        job->boxFactor = (uint32_t)(((uint64_t)1 << job->boxShift) / job->total + 1);
+    }
+}
+
+static InlineX unsigned long
+loadPixel(const unsigned char *src, int bytesPerPixel)
+{
+    unsigned long p = 0;
+    int z;
+
+    switch (bytesPerPixel) {
+    case 4: p = *((const uint32_t *)src); break;
+    case 2: p = *((const uint16_t *)src); break;
+    case 1: p = *src; break;
+    default:
+        /* fixme: endianness problem? */
+        for (z = 0; z < bytesPerPixel; z++)
+            p += ((unsigned long)src[z] << (8 * z));
+        break;
+    }
+    return p;
+}
+
+/* takes a row of source pixels apart into a byte per channel, four per
+   pixel, for channels of 8 bits at most */
+static void
+unpackRow(const ScaleJob *job, unsigned char *dst, const unsigned char *src)
+{
+    unsigned long p;
+    int i, shift[3], max[3];
+
+    if (job->bytesPerPixel == 2) {
+        for (i = 0; i < 3; i++) {
+            shift[i] = job->shift[i];
+            max[i] = (int)job->max[i];
+        }
+        simd_unpack16(dst, src, job->srcW, shift, max);
+        return;
+    }
+
+    for (i = 0; i < job->srcW; i++, dst += 4, src += job->bytesPerPixel) {
+        p = loadPixel(src, job->bytesPerPixel);
+        dst[0] = (unsigned char)((p >> job->shift[0]) & job->max[0]);
+        dst[1] = (unsigned char)((p >> job->shift[1]) & job->max[1]);
+        dst[2] = (unsigned char)((p >> job->shift[2]) & job->max[2]);
+        dst[3] = 0;
+    }
+}
+
+/* adds a row of source pixels, weighted, to the accumulators per channel */
+static void
+sumChannels(const ScaleJob *job, uint32_t *acc, const unsigned char *src, uint32_t weight)
+{
+    unsigned long p;
+    int i;
+
+    for (i = 0; i < job->srcW; i++, acc += 4, src += job->bytesPerPixel) {
+        p = loadPixel(src, job->bytesPerPixel);
+        acc[0] += ((p >> job->shift[0]) & job->max[0]) * weight;
+        acc[1] += ((p >> job->shift[1]) & job->max[1]) * weight;
+        acc[2] += ((p >> job->shift[2]) & job->max[2]) * weight;
+    }
+}
+
+/* sums the source rows of destination row y, by way of unpacked */
+static void
+sumRows(const ScaleJob *job, uint32_t *acc, unsigned char *unpacked, int y)
+{
+    const ScaleSpan *span = &job->rows.spans[y];
+    const unsigned char *src;
+    uint32_t weight = 1;
+    int i;
+
+    memset(acc, 0, job->srcW * 4 * sizeof(uint32_t));
+    for (i = 0; i < span->count; i++) {
+        if (job->rows.weights != NULL)
+            weight = job->rows.weights[span->weights + i];
+        src = (const unsigned char *)job->from->frameBuffer +
+              (size_t)(span->first + i) * job->from->paddedWidthInBytes +
+              job->srcX * job->bytesPerPixel;
+        if (job->bytes) {
+            simd_accumulate_u8(acc, src, job->srcW * 4, weight);
+        } else if (job->narrow) {
+            unpackRow(job, unpacked, src);
+            simd_accumulate_u8(acc, unpacked, job->srcW * 4, weight);
+        } else
+            sumChannels(job, acc, src, weight);
+    }
+}
+
+static InlineX void
+storePixel(const ScaleJob *job, unsigned char *dst, const uint32_t *v)
+{
+    unsigned long p;
+    int z;
+
+    if (job->bytes) {
+        dst[0] = (unsigned char)v[0] & job->mask[0];
+        dst[1] = (unsigned char)v[1] & job->mask[1];
+        dst[2] = (unsigned char)v[2] & job->mask[2];
+        dst[3] = (unsigned char)v[3] & job->mask[3];
+        return;
+    }
+    p = ((unsigned long)v[0] << job->shift[0]) |
+        ((unsigned long)v[1] << job->shift[1]) |
+        ((unsigned long)v[2] << job->shift[2]);
+    switch (job->bytesPerPixel) {
+    case 4: *((uint32_t *)dst) = (uint32_t)p; break;
+    case 2: *((uint16_t *)dst) = (uint16_t)p; break;
+    case 1: *dst = (unsigned char)p; break;
+    default:
+        /* fixme: endianness problem? */
+        for (z = 0; z < job->bytesPerPixel; z++)
+            dst[z] = (p >> (8 * z)) & 0xff;
+        break;
+    }
+}
+
+/* averages the accumulators into destination row y, by way of row */
+static void
+averageRow(const ScaleJob *job, const uint32_t *acc, unsigned char *row, int y)
+{
+    static const uint8_t all[4] = { 0xff, 0xff, 0xff, 0xff };
+    const ScaleSpan *span = job->cols.spans;
+    const uint32_t *weights = job->cols.weights, *a;
+    unsigned char *dst = (unsigned char *)job->to->frameBuffer +
+                         (size_t)(job->y + y) * job->to->paddedWidthInBytes +
+                         job->x * job->bytesPerPixel;
+    uint64_t sum[4], reciprocal = job->reciprocal;
+    uint32_t v[4], weight;
+    int x, i, c;
+
+    /* the box filter */
+    if (job->boxFactor != 0) {
+        simd_average_u32(job->bytes ? dst : row, acc, job->w, span->count,
+                         job->boxFactor, job->boxShift, job->bytes ? job->mask : all);
+        if (!job->bytes)
+            for (x = 0; x < job->w; x++, row += 4, dst += job->bytesPerPixel) {
+                v[0] = row[0];
+                v[1] = row[1];
+                v[2] = row[2];
+                v[3] = row[3];
+                storePixel(job, dst, v);
+            }
+        return;
+    }
+
+    for (x = 0; x < job->w; x++, span++, dst += job->bytesPerPixel) {
+        a = acc + 4 * (span->first - job->srcX);
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+        for (i = 0; i < span->count; i++, a += 4) {
+            weight = weights != NULL ? weights[span->weights + i] : 1;
+            for (c = 0; c < 4; c++)
+                sum[c] += (uint64_t)a[c] * weight;
+        }
+        for (c = 0; c < 4; c++)
+            v[c] = (uint32_t)(reciprocal != 0 ? (sum[c] * reciprocal) >> RECIPROCAL_SHIFT
+                                              : sum[c] / job->total);
+        storePixel(job, dst, v);
+    }
+}
+
+/* scales rows from to to with thread's part of job->scratch */
+static void
+scaleRows(const ScaleJob *job, int thread, int from, int to)
+{
+    uint32_t *acc = job->scratch + (size_t)thread * (job->srcW * 5 + job->w);
+    int y;
+
+    for (y = from; y < to; y++) {
+        sumRows(job, acc, (unsigned char *)(acc + job->srcW * 4 + job->w), y);
+        averageRow(job, acc, (unsigned char *)(acc + job->srcW * 4), y);
+    }
+}
+
+/* Not truecolour, so we can't blend. Just use the top-left pixel instead */
+static void
+samplePixels(const ScaleJob *job)
+{
+    const char *src;
+    char *dst;
+    int x, y;
+
+    for (y = 0; y < job->h; y++) {
+        src = job->from->frameBuffer +
+              (size_t)job->rows.spans[y].first * job->from->paddedWidthInBytes;
+        dst = job->to->frameBuffer + (size_t)(job->y + y) * job->to->paddedWidthInBytes +
+              job->x * job->bytesPerPixel;
+        for (x = 0; x < job->w; x++, dst += job->bytesPerPixel)
+            memcpy(dst, src + job->cols.spans[x].first * job->bytesPerPixel,
+                   job->bytesPerPixel);
+    }
+}
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+
+typedef struct {
+    int nThreads;
+    pthread_t threads[MAX_SCALE_THREADS];
+
+    MUTEX(mutex);
+    COND(jobPosted);
+    COND(jobDone);
+    rfbBool busy;
+    unsigned long jobs;
+    rfbBool quit;
+
+    const ScaleJob *job;
+    int nextBand, nBands, bandsDone;
+} ScaleThreads;
+
+/* takes bands until there are none left; t->mutex is held */
+static void
+runBands(ScaleThreads *t, int thread)
+{
+    const ScaleJob *job;
+    int y;
+
+    while (t->nextBand < t->nBands) {
+        job = t->job;
+        y = BAND_ROWS * t->nextBand++;
+        UNLOCK(t->mutex);
+        scaleRows(job, thread, y, y + BAND_ROWS < job->h ? y + BAND_ROWS : job->h);
+        LOCK(t->mutex);
+        if (++t->bandsDone == t->nBands)
+            TSIGNAL(t->jobDone);
+    }
+}
+
+static THREAD_ROUTINE_RETURN_TYPE
+helperRun(void *data)
+{
+    ScaleThreads *t = (ScaleThreads *)data;
+    unsigned long jobs = 0;
+    int i;
+
+    LOCK(t->mutex);
+    for (i = 0; !pthread_equal(t->threads[i], pthread_self()); i++)
+        ;
+    for (;;) {
+        while (t->jobs == jobs && !t->quit)
+            WAIT(t->jobPosted, t->mutex);
+        if (t->quit)
+            break;
+        jobs = t->jobs;
+        runBands(t, i + 1);
+    }
+    UNLOCK(t->mutex);
+    return THREAD_ROUTINE_RETURN_VALUE;
+}
+
+/* how many threads job->scratch is for */
+static int
+threadsFor(rfbScreenInfoPtr screen, const ScaleJob *job)
+{
+    ScaleThreads *t = (ScaleThreads *)screen->scaleThreadPool;
+
+    if (t == NULL || (size_t)job->srcW * job->srcH < MIN_PARALLEL_AREA ||
+        job->h < 2 * BAND_ROWS)
+        return 1;
+    return t->nThreads + 1;
+}
+
+/* FALSE if the helpers are busy with another rectangle */
+static rfbBool
+shareRows(rfbScreenInfoPtr screen, const ScaleJob *job)
+{
+    ScaleThreads *t = (ScaleThreads *)screen->scaleThreadPool;
+
+    LOCK(t->mutex);
+    if (t->busy) {
+        UNLOCK(t->mutex);
+        return FALSE;
+    }
+    t->busy = TRUE;
+    t->job = job;
+    t->nextBand = t->bandsDone = 0;
+    t->nBands = (job->h + BAND_ROWS - 1) / BAND_ROWS;
+    t->jobs++;
+    pthread_cond_broadcast(&t->jobPosted);
+    runBands(t, 0);
+    while (t->bandsDone < t->nBands)
+        WAIT(t->jobDone, t->mutex);
+    t->busy = FALSE;
+    UNLOCK(t->mutex);
+    return TRUE;
+}
+
+void
+rfbScaleThreadsInit(rfbScreenInfoPtr screen)
+{
+    ScaleThreads *t;
+    int n = screen->scaleThreads, i;
+
+    if (screen->scaleThreadPool)
+        return;
+    if (n < 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > MAX_SCALE_THREADS)
+        n = MAX_SCALE_THREADS;
+    if (n < 2)
+        return;
+
+    t = calloc(1, sizeof(ScaleThreads));
+    if (t == NULL)
+        return;
+    INIT_MUTEX(t->mutex);
+    INIT_COND(t->jobPosted);
+    INIT_COND(t->jobDone);
+
+    /* the helpers look for their place in t->threads */
+    LOCK(t->mutex);
+    for (i = 0; i < n - 1; i++)
+        if (pthread_create(&t->threads[i], NULL, helperRun, t) != 0)
+            break;
+    t->nThreads = i;
+    UNLOCK(t->mutex);
+    screen->scaleThreadPool = t;
+}
+
+void
+rfbScaleThreadsFree(rfbScreenInfoPtr screen)
+{
+    ScaleThreads *t = (ScaleThreads *)screen->scaleThreadPool;
+    int i;
+
+    if (t == NULL)
+        return;
+    LOCK(t->mutex);
+    t->quit = TRUE;
+    pthread_cond_broadcast(&t->jobPosted);
+    UNLOCK(t->mutex);
+    for (i = 0; i < t->nThreads; i++)
+        THREAD_JOIN(t->threads[i]);
+    TINI_COND(t->jobPosted);
+    TINI_COND(t->jobDone);
+    TINI_MUTEX(t->mutex);
+    free(t);
+    screen->scaleThreadPool = NULL;
+}
+
+#else
+
+static int
+threadsFor(rfbScreenInfoPtr screen, const ScaleJob *job)
+{
+    return 1;
+}
+
+static rfbBool
+shareRows(rfbScreenInfoPtr screen, const ScaleJob *job)
+{
+    return FALSE;
+}
+
+void
+rfbScaleThreadsInit(rfbScreenInfoPtr screen)
+{
+}
+
+void
+rfbScaleThreadsFree(rfbScreenInfoPtr screen)
+{
+}
+
+#endif
+
 void rfbScaledScreenUpdateRect(rfbScreenInfoPtr screen, rfbScreenInfoPtr ptr, int x0, int y0, int w0, int h0)
 {
-    int x,y,w,v,z;
-    int x1, y1, w1, h1;
-    int bitsPerPixel, bytesPerPixel, bytesPerLine, areaX, areaY, area2;
-    unsigned char *srcptr, *dstptr;
+    ScaleJob job;
+    int threads;
 
     /* Nothing to do!!! */
     if (screen==ptr) return;
 
-    x1 = x0;
-    y1 = y0;
-    w1 = w0;
-    h1 = h0;
-
-    rfbScaledCorrection(screen, ptr, &x1, &y1, &w1, &h1, "rfbScaledScreenUpdateRect");
-    x0 = ScaleX(ptr, screen, x1);
-    y0 = ScaleY(ptr, screen, y1);
-    w0 = ScaleX(ptr, screen, w1);
-    h0 = ScaleY(ptr, screen, h1);
-
-    bitsPerPixel = screen->bitsPerPixel;
-    bytesPerPixel = bitsPerPixel / 8;
-    bytesPerLine = w1 * bytesPerPixel;
-    srcptr = (unsigned char *)(screen->frameBuffer +
-     (y0 * screen->paddedWidthInBytes + x0 * bytesPerPixel));
-    dstptr = (unsigned char *)(ptr->frameBuffer +
-     ( y1 * ptr->paddedWidthInBytes + x1 * bytesPerPixel));
-    /* The area of the source framebuffer for each destination pixel */
-    areaX = ScaleX(ptr,screen,1);
-    areaY = ScaleY(ptr,screen,1);
-    area2 = areaX*areaY;
-
-
-    /* Ensure that we do not go out of bounds */
-    if ((x1+w1) > (ptr->width))
-    {
-      if (x1==0) w1=ptr->width; else x1 = ptr->width - w1;
+    rfbScaledCorrection(screen, ptr, &x0, &y0, &w0, &h0, "rfbScaledScreenUpdateRect");
+    if (x0 < 0 || y0 < 0 || w0 <= 0 || h0 <= 0)
+        return;
+
+    memset(&job, 0, sizeof(job));
+    job.from = screen;
+    job.to = ptr;
+    job.x = x0;
+    job.y = y0;
+    job.w = w0;
+    job.h = h0;
+    job.bytesPerPixel = screen->bitsPerPixel / 8;
+    if (!buildAxis(&job.cols, screen->width, ptr->width, x0, w0) ||
+        !buildAxis(&job.rows, screen->height, ptr->height, y0, h0)) {
+        rfbErr("rfbScaledScreenUpdateRect: out of memory\n");
+        goto done;
     }
-    if ((y1+h1) > (ptr->height))
-    {
-      if (y1==0) h1=ptr->height; else y1 = ptr->height - h1;
+    job.srcX = job.cols.spans[0].first;
+    job.srcW = job.cols.spans[w0 - 1].first + job.cols.spans[w0 - 1].count - job.srcX;
+    job.srcH = job.rows.spans[h0 - 1].first + job.rows.spans[h0 - 1].count -
+               job.rows.spans[0].first;
+    setFormat(&job);
+
+    if (!job.blend) {
+        samplePixels(&job);
+        goto done;
     }
-    /*
-     * rfbLog("rfbScaledScreenUpdateRect(%dXx%dY-%dWx%dH  ->  %dXx%dY-%dWx%dH <%dx%d>) {%dWx%dH -> %dWx%dH} 0x%p\n",
-     *    x0, y0, w0, h0, x1, y1, w1, h1, areaX, areaY,
-     *    screen->width, screen->height, ptr->width, ptr->height, ptr->frameBuffer);
-     */
 
-    if (screen->serverFormat.trueColour) { /* Blend neighbouring pixels together */
-      unsigned char *srcptr2;
-      unsigned long pixel_value, red, green, blue;
-      unsigned int redShift = screen->serverFormat.redShift;
-      unsigned int greenShift = screen->serverFormat.greenShift;
-      unsigned int blueShift = screen->serverFormat.blueShift;
-      unsigned long redMax = screen->serverFormat.redMax;
-      unsigned long greenMax = screen->serverFormat.greenMax;
-      unsigned long blueMax = screen->serverFormat.blueMax;
-
-     /* for each *destination* pixel... */
-     for (y = 0; y < h1; y++) {
-       for (x = 0; x < w1; x++) {
-         red = green = blue = 0;
-         /* Get the totals for rgb from the source grid... */
-         for (w = 0; w < areaX; w++) {
-           for (v = 0; v < areaY; v++) {
-             srcptr2 = &srcptr[(((x * areaX) + w) * bytesPerPixel) +
-                               (v * screen->paddedWidthInBytes)];
-             pixel_value = 0;
-
-
-             switch (bytesPerPixel) {
-             case 4: pixel_value = *((unsigned int *)srcptr2);   break;
-             case 2: pixel_value = *((unsigned short *)srcptr2); break;
-             case 1: pixel_value = *((unsigned char *)srcptr2);  break;
-             default:
-               /* fixme: endianness problem? */
-               for (z = 0; z < bytesPerPixel; z++)
-                 pixel_value += ((unsigned long)srcptr2[z] << (8 * z));
-                break;
-              }
-              /*
-              srcptr2 += bytesPerPixel;
-              */
-
-            red += ((pixel_value >> redShift) & redMax);
-            green += ((pixel_value >> greenShift) & greenMax);
-            blue += ((pixel_value >> blueShift) & blueMax);
-
-           }
-         }
-         /* We now have a total for all of the colors, find the average! */
-         red /= area2;
-         green /= area2;
-         blue /= area2;
-          /* Stuff the new value back into memory */
-         pixel_value = ((red & redMax) << redShift) | ((green & greenMax) << greenShift) | ((blue & blueMax) << blueShift);
-
-         switch (bytesPerPixel) {
-         case 4: *((unsigned int *)dstptr)   = (unsigned int)   pixel_value; break;
-         case 2: *((unsigned short *)dstptr) = (unsigned short) pixel_value; break;
-         case 1: *((unsigned char *)dstptr)  = (unsigned char)  pixel_value; break;
-         default:
-           /* fixme: endianness problem? */
-           for (z = 0; z < bytesPerPixel; z++)
-             dstptr[z]=(pixel_value >> (8 * z)) & 0xff;
-            break;
-          }
-          dstptr += bytesPerPixel;
-       }
-       srcptr += (screen->paddedWidthInBytes * areaY);
-       dstptr += (ptr->paddedWidthInBytes - bytesPerLine);
-     }
-   } else
-   { /* Not truecolour, so we can't blend. Just use the top-left pixel instead */
-     for (y = y1; y < (y1+h1); y++) {
-       for (x = x1; x < (x1+w1); x++)
-         memcpy (&ptr->frameBuffer[(y *ptr->paddedWidthInBytes) + (x * bytesPerPixel)],
-                 &screen->frameBuffer[(y * areaY * screen->paddedWidthInBytes) + (x *areaX * bytesPerPixel)], bytesPerPixel);
-     }
-  }
+    threads = threadsFor(screen, &job);
+    job.scratch = malloc((size_t)threads * (job.srcW * 5 + job.w) * sizeof(uint32_t));
+    if (job.scratch == NULL) {
+        rfbErr("rfbScaledScreenUpdateRect: out of memory\n");
+        goto done;
+    }
+    if (threads == 1 || !shareRows(screen, &job))
+        scaleRows(&job, 0, 0, job.h);
+
+done:
+    free(job.cols.spans);
+    free(job.cols.weights);
+    free(job.rows.spans);
+    free(job.rows.weights);
+    free(job.scratch);
 }
 
 void rfbScaledScreenUpdate(rfbScreenInfoPtr screen, int x1, int y1, int x2, int y2)
@@ -275,6 +736,30 @@ void rfbScaledScreenUpdate(rfbScreenInfoPtr screen, int x1, int y1, int x2, int
     }
 }
 
+void rfbScaledScreenUpdateRegion(rfbScreenInfoPtr screen, sraRegionPtr region)
+{
+    rfbScreenInfoPtr ptr;
+    sraRectangleIterator *i;
+    sraRect rect;
+
+    for (ptr=screen->scaledScreenNext;ptr!=NULL;ptr=ptr->scaledScreenNext)
+        if (ptr->scaledScreenRefCount>0)
+            break;
+    if (ptr==NULL)
+        return;
+
+    i = sraRgnGetIterator(region);
+    while (sraRgnIteratorNext(i, &rect)) {
+        if (rect.x1 < 0) rect.x1 = 0;
+        if (rect.y1 < 0) rect.y1 = 0;
+        if (rect.x2 > screen->width) rect.x2 = screen->width;
+        if (rect.y2 > screen->height) rect.y2 = screen->height;
+        if (rect.x1 < rect.x2 && rect.y1 < rect.y2)
+            rfbScaledScreenUpdate(screen, rect.x1, rect.y1, rect.x2, rect.y2);
+    }
+    sraRgnReleaseIterator(i);
+}
+
 /* Create a new scaled version of the framebuffer */
 rfbScreenInfoPtr rfbScaledScreenAllocate(rfbClientPtr cl, int width, int height)
 {
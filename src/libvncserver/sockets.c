@@ -89,6 +89,15 @@ struct timeval
 
 #include <errno.h>
 
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#ifndef WIN32
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
 #ifdef USE_LIBWRAP
 #include <syslog.h>
 #include <tcpd.h>
@@ -97,10 +106,192 @@ int deny_severity=LOG_WARNING;
 #endif
 
 #include "sockets.h"
+#include "private.h"
 
 int rfbMaxClientWait = 20000;   /* time (ms) after which we decide client has
                                    gone away - needed to stop us hanging */
 
+static int flushOutput(rfbClientPtr cl);
+
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+/* ready sockets taken from one epoll_wait(), the rest wait for the next */
+#define POLL_EVENTS 256
+
+typedef struct {
+    int fd;
+    struct epoll_event events[POLL_EVENTS];
+} rfbPollSet;
+#endif
+
+/*
+ * TRUE if rfbCheckFds waits on the epoll set rather than on allFds. The
+ * threads of rfbRunEventLoop() select() on the sockets themselves, unless
+ * there is a worker pool, whose dispatcher calls rfbCheckFds.
+ */
+
+static rfbBool
+rfbPollSetActive(rfbScreenInfoPtr rfbScreen)
+{
+    return rfbScreen->pollSet != NULL
+	&& (!rfbScreen->backgroundLoop || rfbScreen->workerPool != NULL);
+}
+
+/*
+ * rfbWatchSocket makes rfbCheckFds wait for input on sock. data is what
+ * it dispatches on: the client, or the address of the rfbScreenInfo
+ * member holding a listening or HTTP socket. With data NULL the socket
+ * only goes into allFds. Returns FALSE if the socket cannot be watched,
+ * which with select() is the case from FD_SETSIZE on. With a worker pool
+ * a socket reports one event, then has to be watched again.
+ */
+
+rfbBool
+rfbWatchSocket(rfbScreenInfoPtr rfbScreen, rfbSocket sock, void *data)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    rfbPollSet *ps = rfbScreen->pollSet;
+    struct epoll_event event;
+
+    if (ps && data) {
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	if (rfbScreen->workerPool)
+	    event.events |= EPOLLONESHOT;
+	event.data.ptr = data;
+	/* the inetd socket and rfbConnect()ed ones come back as clients */
+	if (epoll_ctl(ps->fd, EPOLL_CTL_ADD, sock, &event) < 0
+	    && (errno != EEXIST || epoll_ctl(ps->fd, EPOLL_CTL_MOD, sock, &event) < 0)) {
+	    rfbLogPerror("rfbWatchSocket: epoll_ctl");
+	    return FALSE;
+	}
+    }
+
+    /* nobody reads allFds then, but the pool's threads would race on it */
+    if (rfbScreen->workerPool)
+	return TRUE;
+#endif
+
+#ifndef WIN32
+    if (sock >= FD_SETSIZE) {
+	if (data == NULL || rfbPollSetActive(rfbScreen))
+	    return TRUE;
+	rfbErr("rfbWatchSocket: socket %d is beyond what select() can watch\n", sock);
+	rfbUnwatchSocket(rfbScreen, sock);
+	return FALSE;
+    }
+#endif
+
+    FD_SET(sock, &rfbScreen->allFds);
+    rfbScreen->maxFd = rfbMax(sock, rfbScreen->maxFd);
+    return TRUE;
+}
+
+/*
+ * rfbUnwatchSocket undoes rfbWatchSocket. Call it before closing the
+ * socket: epoll keeps watching a socket that a forked child still holds.
+ */
+
+void
+rfbUnwatchSocket(rfbScreenInfoPtr rfbScreen, rfbSocket sock)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    rfbPollSet *ps = rfbScreen->pollSet;
+
+    /* fails for sockets watched with data NULL, which is fine */
+    if (ps)
+	epoll_ctl(ps->fd, EPOLL_CTL_DEL, sock, NULL);
+    if (rfbScreen->workerPool)
+	return;
+#endif
+
+#ifndef WIN32
+    if (sock >= FD_SETSIZE)
+	return;
+#endif
+
+    FD_CLR(sock, &rfbScreen->allFds);
+    if (sock == rfbScreen->maxFd)
+	while (rfbScreen->maxFd > 0
+	       && !FD_ISSET(rfbScreen->maxFd, &rfbScreen->allFds))
+	    rfbScreen->maxFd--;
+}
+
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+/*
+ * Arms a client's socket in the epoll set for input and, while output is
+ * queued, for the socket taking more. outputMutex is held.
+ */
+
+static void
+armClient(rfbClientPtr cl)
+{
+    rfbPollSet *ps = cl->screen->pollSet;
+    struct epoll_event event;
+
+    if (ps == NULL || cl->sock == RFB_INVALID_SOCKET)
+	return;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    if (cl->outputQueued > 0)
+	event.events |= EPOLLOUT;
+    if (cl->screen->workerPool)
+	event.events |= EPOLLONESHOT;
+    event.data.ptr = cl;
+    if (epoll_ctl(ps->fd, EPOLL_CTL_MOD, cl->sock, &event) < 0
+	&& (errno != ENOENT || epoll_ctl(ps->fd, EPOLL_CTL_ADD, cl->sock, &event) < 0))
+	rfbLogPerror("rfbWatchClient: epoll_ctl");
+}
+#endif
+
+/*
+ * rfbWatchClient is rfbWatchSocket for a client's socket, which with
+ * epoll is also watched for output while some is queued.
+ */
+
+rfbBool
+rfbWatchClient(rfbClientPtr cl)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (cl->screen->workerPool && cl->outputQueue) {
+	LOCK(cl->outputMutex);
+	armClient(cl);
+	UNLOCK(cl->outputMutex);
+	return TRUE;
+    }
+#endif
+    return rfbWatchSocket(cl->screen, cl->sock, cl);
+}
+
+/*
+ * rfbWaitForSocket waits up to timeout ms for sock to become readable, or
+ * writable with forWriting TRUE, and returns what select() would. It uses
+ * poll() where there is one, which takes sockets beyond FD_SETSIZE too.
+ */
+
+int
+rfbWaitForSocket(rfbSocket sock, rfbBool forWriting, int timeout)
+{
+#ifdef WIN32
+    fd_set fds;
+    struct timeval tv;
+
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    if (forWriting)
+	return select(sock+1, NULL, &fds, NULL, &tv);
+    return select(sock+1, &fds, NULL, &fds, &tv);
+#else
+    struct pollfd pfd;
+
+    pfd.fd = sock;
+    pfd.events = forWriting ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout);
+#endif
+}
+
 static rfbBool
 rfbNewConnectionFromSock(rfbScreenInfoPtr rfbScreen, rfbSocket sock)
 {
@@ -177,6 +368,19 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 
     rfbScreen->socketState = RFB_SOCKET_READY;
 
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (!rfbScreen->useSelect && !rfbScreen->pollSet) {
+	rfbPollSet *ps = malloc(sizeof(rfbPollSet));
+
+	if (ps && (ps->fd = epoll_create1(EPOLL_CLOEXEC)) >= 0) {
+	    rfbScreen->pollSet = ps;
+	} else {
+	    rfbLogPerror("rfbInitSockets: epoll_create1, using select() instead");
+	    free(ps);
+	}
+    }
+#endif
+
 #ifdef LIBVNCSERVER_WITH_SYSTEMD
     if (sd_listen_fds(0) == 1)
     {
@@ -203,8 +407,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 	}
 
     	FD_ZERO(&(rfbScreen->allFds));
-    	FD_SET(rfbScreen->inetdSock, &(rfbScreen->allFds));
-    	rfbScreen->maxFd = rfbScreen->inetdSock;
+    	rfbWatchSocket(rfbScreen, rfbScreen->inetdSock, NULL);
 	return;
     }
 
@@ -226,8 +429,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
         }
 
         rfbLog("Autoprobing selected TCP port %d\n", rfbScreen->port);
-        FD_SET(rfbScreen->listenSock, &(rfbScreen->allFds));
-        rfbScreen->maxFd = rfbScreen->listenSock;
+        rfbWatchSocket(rfbScreen, rfbScreen->listenSock, &rfbScreen->listenSock);
     }
 
 #ifdef LIBVNCSERVER_IPv6
@@ -247,8 +449,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
         }
 
         rfbLog("Autoprobing selected TCP6 port %d\n", rfbScreen->ipv6port);
-	FD_SET(rfbScreen->listen6Sock, &(rfbScreen->allFds));
-	rfbScreen->maxFd = rfbMax((int)rfbScreen->listen6Sock,rfbScreen->maxFd);
+	rfbWatchSocket(rfbScreen, rfbScreen->listen6Sock, &rfbScreen->listen6Sock);
     }
 #endif
 
@@ -261,8 +462,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
       }
       rfbLog("Listening for VNC connections on TCP port %d\n", rfbScreen->port);  
   
-      FD_SET(rfbScreen->listenSock, &(rfbScreen->allFds));
-      rfbScreen->maxFd = rfbScreen->listenSock;
+      rfbWatchSocket(rfbScreen, rfbScreen->listenSock, &rfbScreen->listenSock);
 	    }
 
 #ifdef LIBVNCSERVER_IPv6
@@ -273,8 +473,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
       }
       rfbLog("Listening for VNC connections on TCP6 port %d\n", rfbScreen->ipv6port);  
 	
-      FD_SET(rfbScreen->listen6Sock, &(rfbScreen->allFds));
-      rfbScreen->maxFd = rfbMax((int)rfbScreen->listen6Sock,rfbScreen->maxFd);
+      rfbWatchSocket(rfbScreen, rfbScreen->listen6Sock, &rfbScreen->listen6Sock);
 	    }
 #endif
 
@@ -289,8 +488,7 @@ rfbInitSockets(rfbScreenInfoPtr rfbScreen)
 	}
 	rfbLog("Listening for VNC connections on TCP port %d\n", rfbScreen->port);  
 
-	FD_SET(rfbScreen->udpSock, &(rfbScreen->allFds));
-	rfbScreen->maxFd = rfbMax((int)rfbScreen->udpSock,rfbScreen->maxFd);
+	rfbWatchSocket(rfbScreen, rfbScreen->udpSock, &rfbScreen->udpSock);
     }
 }
 
@@ -302,29 +500,37 @@ void rfbShutdownSockets(rfbScreenInfoPtr rfbScreen)
     rfbScreen->socketState = RFB_SOCKET_SHUTDOWN;
 
     if(rfbScreen->inetdSock!=RFB_INVALID_SOCKET) {
-	FD_CLR(rfbScreen->inetdSock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->inetdSock);
 	rfbCloseSocket(rfbScreen->inetdSock);
 	rfbScreen->inetdSock=RFB_INVALID_SOCKET;
     }
 
     if(rfbScreen->listenSock!=RFB_INVALID_SOCKET) {
-	FD_CLR(rfbScreen->listenSock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->listenSock);
 	rfbCloseSocket(rfbScreen->listenSock);
 	rfbScreen->listenSock=RFB_INVALID_SOCKET;
     }
 
     if(rfbScreen->listen6Sock!=RFB_INVALID_SOCKET) {
-	FD_CLR(rfbScreen->listen6Sock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->listen6Sock);
 	rfbCloseSocket(rfbScreen->listen6Sock);
 	rfbScreen->listen6Sock=RFB_INVALID_SOCKET;
     }
 
     if(rfbScreen->udpSock!=RFB_INVALID_SOCKET) {
-	FD_CLR(rfbScreen->udpSock,&rfbScreen->allFds);
+	rfbUnwatchSocket(rfbScreen, rfbScreen->udpSock);
 	rfbCloseSocket(rfbScreen->udpSock);
 	rfbScreen->udpSock=RFB_INVALID_SOCKET;
     }
 
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (rfbScreen->pollSet) {
+	close(((rfbPollSet *)rfbScreen->pollSet)->fd);
+	free(rfbScreen->pollSet);
+	rfbScreen->pollSet = NULL;
+    }
+#endif
+
 #ifdef WIN32
     if(WSACleanup() != 0) {
 	errno=WSAGetLastError();
@@ -333,6 +539,156 @@ void rfbShutdownSockets(rfbScreenInfoPtr rfbScreen)
 #endif
 }
 
+/*
+ * rfbProcessUDPSocket is called when the UDP socket is readable. It takes
+ * the sender as the UDP client if it is a new one. Returns FALSE if the socket
+ * could not be connected to the sender.
+ */
+
+static rfbBool
+rfbProcessUDPSocket(rfbScreenInfoPtr rfbScreen)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    char buf[6];
+
+    if(!rfbScreen->udpClient)
+	rfbNewUDPClient(rfbScreen);
+    if (recvfrom(rfbScreen->udpSock, buf, 1, MSG_PEEK,
+		(struct sockaddr *)&addr, &addrlen) < 0) {
+	rfbLogPerror("rfbCheckFds: UDP: recvfrom");
+	rfbDisconnectUDPSock(rfbScreen);
+	rfbScreen->udpSockConnected = FALSE;
+    } else {
+	if (!rfbScreen->udpSockConnected ||
+		(memcmp(&addr, &rfbScreen->udpRemoteAddr, addrlen) != 0))
+	{
+	    /* new remote end */
+	    rfbLog("rfbCheckFds: UDP: got connection\n");
+
+	    memcpy(&rfbScreen->udpRemoteAddr, &addr, addrlen);
+	    rfbScreen->udpSockConnected = TRUE;
+
+	    if (connect(rfbScreen->udpSock,
+			(struct sockaddr *)&addr, addrlen) < 0) {
+		rfbLogPerror("rfbCheckFds: UDP: connect");
+		rfbDisconnectUDPSock(rfbScreen);
+		return FALSE;
+	    }
+
+	    rfbNewUDPConnection(rfbScreen,rfbScreen->udpSock);
+	}
+
+	rfbProcessUDPInput(rfbScreen);
+    }
+    return TRUE;
+}
+
+void
+rfbProcessClientSocket(rfbClientPtr cl)
+{
+#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+    do {
+	rfbProcessClientMessage(cl);
+    } while (cl->sock != RFB_INVALID_SOCKET && webSocketsHasDataInBuffer(cl));
+#else
+    rfbProcessClientMessage(cl);
+#endif
+}
+
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+/*
+ * The epoll flavour of rfbCheckFds: only the sockets that are ready come
+ * back, so an event costs the same however many clients sit idle.
+ */
+
+static int
+rfbCheckPollSet(rfbScreenInfoPtr rfbScreen,long usec)
+{
+    rfbPollSet *ps = rfbScreen->pollSet;
+    rfbClientIteratorPtr i;
+    rfbClientPtr cl;
+    void *data;
+    uint32_t events;
+    int n, nfds;
+    int result = 0;
+
+    do {
+	/* epoll_wait() counts in ms, round up rather than spin */
+	nfds = epoll_wait(ps->fd, ps->events, POLL_EVENTS,
+			  usec > 0 ? (int)((usec + 999) / 1000) : 0);
+	if (nfds < 0) {
+	    if (errno != EINTR)
+		rfbLogPerror("rfbCheckFds: epoll_wait");
+	    return -1;
+	}
+
+	result += nfds;
+
+	for (n = 0; n < nfds; n++) {
+	    data = ps->events[n].data.ptr;
+
+#ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+	    if (data == rfbScreen->pipe_notify_listener_thread) {
+		/* a worker pool's wakeup call, see rfbStopWorkerPool() */
+		char buf;
+		while (read(rfbScreen->pipe_notify_listener_thread[0], &buf, sizeof(buf)) == sizeof(buf));
+	    } else
+#endif
+	    if (data == &rfbScreen->listenSock || data == &rfbScreen->listen6Sock) {
+		if (!rfbProcessNewConnection(rfbScreen))
+		    return -1;
+	    } else if (data == &rfbScreen->udpSock) {
+		if (!rfbProcessUDPSocket(rfbScreen))
+		    return -1;
+	    } else if (data == &rfbScreen->httpListenSock
+		       || data == &rfbScreen->httpListen6Sock
+		       || data == &rfbScreen->httpSock) {
+		rfbHttpProcessFds(rfbScreen, data == &rfbScreen->httpListenSock,
+				  data == &rfbScreen->httpListen6Sock,
+				  data == &rfbScreen->httpSock);
+	    } else {
+		/* closed by an earlier event of this round, maybe */
+		cl = (rfbClientPtr)data;
+		events = ps->events[n].events;
+		if (rfbScreen->workerPool) {
+		    if (events & EPOLLOUT)
+			rfbWorkerPoolWritable(cl);
+		    if (events & ~EPOLLOUT)
+			rfbWorkerPoolInput(cl);
+		} else if (cl->sock != RFB_INVALID_SOCKET) {
+		    if ((events & EPOLLOUT) && !rfbFlushOutput(cl))
+			rfbCloseClient(cl);
+		    else if ((events & ~EPOLLOUT) && !cl->onHold)
+			rfbProcessClientSocket(cl);
+		}
+		data = NULL;
+	    }
+
+	    /* a callback shut the server down */
+	    if (rfbScreen->pollSet != ps)
+		return result;
+
+	    /* the worker re-arms a client's socket, these are the screen's own */
+	    if (rfbScreen->workerPool && data && *(rfbSocket *)data != RFB_INVALID_SOCKET)
+		rfbWatchSocket(rfbScreen, *(rfbSocket *)data, data);
+	}
+
+	/* only a file transfer needs every client visited, workers see to it */
+	if (rfbScreen->permitFileTransfer && !rfbScreen->workerPool) {
+	    i = rfbGetClientIterator(rfbScreen);
+	    while((cl = rfbClientIteratorNext(i))) {
+		if (!cl->onHold && cl->sock != RFB_INVALID_SOCKET
+		    && cl->sock != rfbScreen->udpSock)
+		    rfbSendFileTransferChunk(cl);
+	    }
+	    rfbReleaseClientIterator(i);
+	}
+    } while(nfds > 0 && rfbScreen->handleEventsEagerly);
+    return result;
+}
+#endif
+
 /*
  * rfbCheckFds is called from ProcessInputEvents to check for input on the RFB
  * socket(s).  If there is input to process, the appropriate function in the
@@ -343,14 +699,12 @@ void rfbShutdownSockets(rfbScreenInfoPtr rfbScreen)
 int
 rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 {
-    int nfds;
-    fd_set fds;
+    int nfds, maxFd;
+    fd_set fds, wfds;
     struct timeval tv;
-    struct sockaddr_in addr;
-    socklen_t addrlen = sizeof(addr);
-    char buf[6];
     rfbClientIteratorPtr i;
     rfbClientPtr cl;
+    rfbBool httpListenReady, httpListen6Ready, httpReady;
     int result = 0;
 
     if (!rfbScreen->inetdInitDone && rfbScreen->inetdSock != RFB_INVALID_SOCKET) {
@@ -358,11 +712,28 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 	rfbScreen->inetdInitDone = TRUE;
     }
 
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (rfbPollSetActive(rfbScreen))
+	return rfbCheckPollSet(rfbScreen, usec);
+#endif
+
     do {
 	memcpy((char *)&fds, (char *)&(rfbScreen->allFds), sizeof(fd_set));
+	/* and the clients with output queued for the socket taking more */
+	FD_ZERO(&wfds);
+	maxFd = rfbScreen->maxFd;
+	i = rfbGetClientIterator(rfbScreen);
+	while((cl = rfbClientIteratorNext(i))) {
+	    if (cl->outputQueued > 0 && cl->sock != RFB_INVALID_SOCKET
+		&& FD_ISSET(cl->sock, &(rfbScreen->allFds))) {
+		FD_SET(cl->sock, &wfds);
+		maxFd = rfbMax(maxFd, cl->sock);
+	    }
+	}
+	rfbReleaseClientIterator(i);
 	tv.tv_sec = 0;
 	tv.tv_usec = usec;
-	nfds = select(rfbScreen->maxFd + 1, &fds, NULL, NULL /* &fds */, &tv);
+	nfds = select(maxFd + 1, &fds, &wfds, NULL /* &fds */, &tv);
 	if (nfds == 0) {
 	    /* timed out, check for async events */
             i = rfbGetClientIterator(rfbScreen);
@@ -408,41 +779,25 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 	}
 
 	if ((rfbScreen->udpSock != RFB_INVALID_SOCKET) && FD_ISSET(rfbScreen->udpSock, &fds)) {
-	    if(!rfbScreen->udpClient)
-		rfbNewUDPClient(rfbScreen);
-	    if (recvfrom(rfbScreen->udpSock, buf, 1, MSG_PEEK,
-			(struct sockaddr *)&addr, &addrlen) < 0) {
-		rfbLogPerror("rfbCheckFds: UDP: recvfrom");
-		rfbDisconnectUDPSock(rfbScreen);
-		rfbScreen->udpSockConnected = FALSE;
-	    } else {
-		if (!rfbScreen->udpSockConnected ||
-			(memcmp(&addr, &rfbScreen->udpRemoteAddr, addrlen) != 0))
-		{
-		    /* new remote end */
-		    rfbLog("rfbCheckFds: UDP: got connection\n");
-
-		    memcpy(&rfbScreen->udpRemoteAddr, &addr, addrlen);
-		    rfbScreen->udpSockConnected = TRUE;
-
-		    if (connect(rfbScreen->udpSock,
-				(struct sockaddr *)&addr, addrlen) < 0) {
-			rfbLogPerror("rfbCheckFds: UDP: connect");
-			rfbDisconnectUDPSock(rfbScreen);
-			return -1;
-		    }
-
-		    rfbNewUDPConnection(rfbScreen,rfbScreen->udpSock);
-		}
-
-		rfbProcessUDPInput(rfbScreen);
-	    }
+	    if (!rfbProcessUDPSocket(rfbScreen))
+		return -1;
 
 	    FD_CLR(rfbScreen->udpSock, &fds);
 	    if (--nfds == 0)
 		return result;
 	}
 
+	httpListenReady = rfbScreen->httpListenSock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpListenSock, &fds);
+	httpListen6Ready = rfbScreen->httpListen6Sock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpListen6Sock, &fds);
+	httpReady = rfbScreen->httpSock != RFB_INVALID_SOCKET && FD_ISSET(rfbScreen->httpSock, &fds);
+	if (httpListenReady || httpListen6Ready || httpReady) {
+	    rfbHttpProcessFds(rfbScreen, httpListenReady, httpListen6Ready, httpReady);
+
+	    nfds -= httpListenReady + httpListen6Ready + httpReady;
+	    if (nfds == 0)
+		return result;
+	}
+
 	i = rfbGetClientIterator(rfbScreen);
 	while((cl = rfbClientIteratorNext(i))) {
 
@@ -451,16 +806,10 @@ rfbCheckFds(rfbScreenInfoPtr rfbScreen,long usec)
 
             if (FD_ISSET(cl->sock, &(rfbScreen->allFds)))
             {
-                if (FD_ISSET(cl->sock, &fds))
-                {
-#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
-                    do {
-                        rfbProcessClientMessage(cl);
-                    } while (cl->sock != RFB_INVALID_SOCKET && webSocketsHasDataInBuffer(cl));
-#else
-                    rfbProcessClientMessage(cl);
-#endif
-                }
+                if (FD_ISSET(cl->sock, &wfds) && !rfbFlushOutput(cl))
+                    rfbCloseClient(cl);
+                else if (FD_ISSET(cl->sock, &fds))
+                    rfbProcessClientSocket(cl);
                 else
                     rfbSendFileTransferChunk(cl);
             }
@@ -488,7 +837,7 @@ rfbProcessNewConnection(rfbScreenInfoPtr rfbScreen)
       FD_SET(rfbScreen->listenSock, &listen_fds);
     if(rfbScreen->listen6Sock != RFB_INVALID_SOCKET)
       FD_SET(rfbScreen->listen6Sock, &listen_fds);
-    if (select(rfbScreen->maxFd+1, &listen_fds, NULL, NULL, NULL) == -1) {
+    if (select(rfbMax(rfbScreen->listenSock, rfbScreen->listen6Sock)+1, &listen_fds, NULL, NULL, NULL) == -1) {
       rfbLogPerror("rfbProcessNewConnection: error in select");
       return FALSE;
     }
@@ -556,17 +905,22 @@ rfbCloseClient(rfbClientPtr cl)
 	    extension->data = NULL;
 	}
 
+    /* what is still queued goes as far as the socket takes it, the reason
+       for closing maybe */
+    if (cl->outputQueue) {
+	LOCK(cl->outputMutex);
+	if (cl->outputQueued > 0 && cl->sock != RFB_INVALID_SOCKET)
+	    flushOutput(cl);
+	UNLOCK(cl->outputMutex);
+    }
+
     LOCK(cl->updateMutex);
 #if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) || defined(LIBVNCSERVER_HAVE_WIN32THREADS)
     if (cl->sock != RFB_INVALID_SOCKET)
 #endif
       {
 	/* Remove client sock from allFds and adapt maxFd */
-	FD_CLR(cl->sock,&(cl->screen->allFds));
-	if(cl->sock==cl->screen->maxFd)
-	  while(cl->screen->maxFd>0
-		&& !FD_ISSET(cl->screen->maxFd,&(cl->screen->allFds)))
-	    cl->screen->maxFd--;
+	rfbUnwatchSocket(cl->screen, cl->sock);
 #ifdef LIBVNCSERVER_WITH_WEBSOCKETS
 	/* Has to happen before socket close as the SSL implementation might send a goodbye */
 	if (cl->sslctx)
@@ -585,6 +939,11 @@ rfbCloseClient(rfbClientPtr cl)
 	/* Indicate to client-to-server thread that it should not go on */
 	cl->state = RFB_SHUTDOWN;
 #ifdef LIBVNCSERVER_HAVE_LIBPTHREAD
+	/* With a worker pool, a worker closes the socket and frees the client. */
+	if (cl->screen->workerPool) {
+	    rfbWorkerPoolClose(cl);
+	    return;
+	}
 	/*
 	  Notify the thread. This simply writes a NULL byte to the notify pipe in order to get past the select()
 	  in clientInput(), the loop in there will then break because the client state has been set to
@@ -637,8 +996,7 @@ rfbConnect(rfbScreenInfoPtr rfbScreen,
     }
 
     /* AddEnabledDevice(sock); */
-    FD_SET(sock, &rfbScreen->allFds);
-    rfbScreen->maxFd = rfbMax(sock,rfbScreen->maxFd);
+    rfbWatchSocket(rfbScreen, sock, NULL);
 
     return sock;
 }
@@ -668,8 +1026,6 @@ rfbReadExactTimeout(rfbClientPtr cl, char* buf, int len, int timeout)
 #endif
     rfbSocket sock = cl->sock;
     int n;
-    fd_set fds;
-    struct timeval tv;
 
     while (len > 0) {
         if(sock == RFB_INVALID_SOCKET) {
@@ -717,11 +1073,7 @@ rfbReadExactTimeout(rfbClientPtr cl, char* buf, int len, int timeout)
 		    continue;
 	    }
 #endif
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            tv.tv_sec = timeout / 1000;
-            tv.tv_usec = (timeout % 1000) * 1000;
-            n = select(sock+1, &fds, NULL, &fds, &tv);
+            n = rfbWaitForSocket(sock, FALSE, timeout);
             if (n < 0) {
                 rfbLogPerror("ReadExact: select");
                 return n;
@@ -772,8 +1124,6 @@ rfbPeekExactTimeout(rfbClientPtr cl, char* buf, int len, int timeout)
 #endif
     rfbSocket sock = cl->sock;
     int n;
-    fd_set fds;
-    struct timeval tv;
 
     while (len > 0) {
         if(sock == RFB_INVALID_SOCKET) {
@@ -815,11 +1165,7 @@ rfbPeekExactTimeout(rfbClientPtr cl, char* buf, int len, int timeout)
 		    continue;
 	    }
 #endif
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            tv.tv_sec = timeout / 1000;
-            tv.tv_usec = (timeout % 1000) * 1000;
-            n = select(sock+1, &fds, NULL, &fds, &tv);
+            n = rfbWaitForSocket(sock, FALSE, timeout);
             if (n < 0) {
                 rfbLogPerror("PeekExact: select");
                 return n;
@@ -841,10 +1187,331 @@ rfbPeekExactTimeout(rfbClientPtr cl, char* buf, int len, int timeout)
     return 1;
 }
 
+/*
+ * The output queue holds what a client's socket did not take at once, in
+ * the order it was written. Small writes fill up the last chunk, so the
+ * queue goes out with few writev() calls however it was written.
+ */
+
+#define OUTPUT_CHUNK_SIZE UPDATE_BUF_SIZE
+/* chunks handed to one writev() */
+#define OUTPUT_IOVECS 64
+
+typedef struct rfbOutputChunk {
+    struct rfbOutputChunk *next;
+    size_t start, end, size;
+    char data[1];
+} rfbOutputChunk;
+
+typedef struct {
+    rfbOutputChunk *head, *tail;
+    rfbOutputChunk *spare;	/* a drained chunk kept for the next one */
+    unsigned long stalledSince;	/* when the socket last took something */
+} rfbOutputQueue;
+
+rfbBool
+rfbInitOutputQueue(rfbClientPtr cl)
+{
+    cl->outputQueue = calloc(1, sizeof(rfbOutputQueue));
+    cl->outputQueued = 0;
+    return cl->outputQueue != NULL;
+}
+
+void
+rfbFreeOutputQueue(rfbClientPtr cl)
+{
+    rfbOutputQueue *q = cl->outputQueue;
+    rfbOutputChunk *c;
+
+    if (q == NULL)
+	return;
+    while ((c = q->head) != NULL) {
+	q->head = c->next;
+	free(c);
+    }
+    free(q->spare);
+    free(q);
+    cl->outputQueue = NULL;
+    cl->outputQueued = 0;
+}
+
+/* TRUE if no update should be encoded for the client for now */
+rfbBool
+rfbOutputFull(rfbClientPtr cl)
+{
+    return cl->screen->outputHighWater > 0
+	&& cl->outputQueued > (unsigned long)cl->screen->outputHighWater;
+}
+
+/*
+ * Has the event loop tell when the client's socket takes more, or no
+ * longer. outputMutex is held. The epoll set is told directly, a client
+ * thread is woken to select() for writing and rfbCheckFds() selects for
+ * writing on whoever has output queued anyway.
+ */
+
+static void
+rfbWatchOutput(rfbClientPtr cl)
+{
+#ifdef LIBVNCSERVER_HAVE_SYS_EPOLL_H
+    if (rfbPollSetActive(cl->screen)) {
+	armClient(cl);
+	return;
+    }
+#endif
+#if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) && !defined(WIN32)
+    if (cl->screen->backgroundLoop && cl->outputQueued > 0
+	&& cl->pipe_notify_client_thread[1] != -1)
+	write(cl->pipe_notify_client_thread[1], "\x00", 1);
+#endif
+}
+
+/* appends to the queue; outputMutex is held */
+static rfbBool
+queueOutput(rfbClientPtr cl, const char *buf, size_t len)
+{
+    rfbOutputQueue *q = cl->outputQueue;
+    rfbOutputChunk *c = q->tail;
+    size_t n;
+
+    if (q->head == NULL)
+	q->stalledSince = rfbPacerClock();
+    cl->outputQueued += len;
+
+    if (c && c->end < c->size) {
+	n = len < c->size - c->end ? len : c->size - c->end;
+	memcpy(c->data + c->end, buf, n);
+	c->end += n;
+	buf += n;
+	len -= n;
+    }
+    if (len == 0)
+	return TRUE;
+
+    if (q->spare && len <= q->spare->size) {
+	c = q->spare;
+	q->spare = NULL;
+    } else {
+	n = len > OUTPUT_CHUNK_SIZE ? len : OUTPUT_CHUNK_SIZE;
+	c = malloc(sizeof(rfbOutputChunk) + n);
+	if (c == NULL) {
+	    cl->outputQueued -= len;
+	    return FALSE;
+	}
+	c->size = n;
+    }
+    memcpy(c->data, buf, len);
+    c->start = 0;
+    c->end = len;
+    c->next = NULL;
+    if (q->tail)
+	q->tail->next = c;
+    else
+	q->head = c;
+    q->tail = c;
+    return TRUE;
+}
+
+/*
+ * Writes as much of the queue as the socket takes without waiting.
+ * outputMutex is held. Returns -1 if the socket failed, or took nothing
+ * for maxClientWait.
+ */
+
+static int
+flushOutput(rfbClientPtr cl)
+{
+    rfbOutputQueue *q = cl->outputQueue;
+    rfbOutputChunk *c;
+#ifndef WIN32
+    struct iovec iov[OUTPUT_IOVECS];
+    int count;
+#endif
+    const int timeout = (cl->screen && cl->screen->maxClientWait) ? cl->screen->maxClientWait : rfbMaxClientWait;
+    ssize_t n;
+    size_t left;
+
+    while (q->head) {
+	if (cl->sock == RFB_INVALID_SOCKET) {
+	    errno = EBADF;
+	    return -1;
+	}
+#ifdef WIN32
+	n = send(cl->sock, q->head->data + q->head->start,
+		 (int)(q->head->end - q->head->start), 0);
+	if (n < 0)
+	    errno = WSAGetLastError();
+#else
+	for (count = 0, c = q->head; c && count < OUTPUT_IOVECS; c = c->next, count++) {
+	    iov[count].iov_base = c->data + c->start;
+	    iov[count].iov_len = c->end - c->start;
+	}
+	n = writev(cl->sock, iov, count);
+#endif
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno != EWOULDBLOCK && errno != EAGAIN)
+		return -1;
+	    break;
+	}
+	if (n == 0)
+	    break;
+
+	q->stalledSince = rfbPacerClock();
+	cl->outputQueued -= n;
+	for (left = n; left > 0; ) {
+	    c = q->head;
+	    if (left < c->end - c->start) {
+		c->start += left;
+		break;
+	    }
+	    left -= c->end - c->start;
+	    q->head = c->next;
+	    if (q->head == NULL)
+		q->tail = NULL;
+	    if (q->spare == NULL && c->size == OUTPUT_CHUNK_SIZE)
+		q->spare = c;
+	    else
+		free(c);
+	}
+    }
+
+    if (q->head && (long)(rfbPacerClock() - q->stalledSince) >= timeout) {
+	errno = ETIMEDOUT;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes out what the client's socket takes now, called as it becomes
+ * writable. Returns FALSE if the socket failed; the caller closes the
+ * client. Wakes a client thread waiting for the queue to shrink.
+ */
+
+rfbBool
+rfbFlushOutput(rfbClientPtr cl)
+{
+    rfbBool wasFull, full;
+    int n = 0;
+
+    if (cl->outputQueue == NULL)
+	return TRUE;
+
+    LOCK(cl->outputMutex);
+    wasFull = rfbOutputFull(cl);
+    if (cl->outputQueued > 0) {
+	n = flushOutput(cl);
+	if (n == 0 && cl->outputQueued == 0)
+	    rfbWatchOutput(cl);
+    }
+    full = rfbOutputFull(cl);
+    UNLOCK(cl->outputMutex);
+
+    if (n < 0) {
+	rfbLogPerror("rfbFlushOutput: write");
+	return FALSE;
+    }
+    if (wasFull && !full) {
+	LOCK(cl->updateMutex);
+	TSIGNAL(cl->updateCond);
+	UNLOCK(cl->updateMutex);
+    }
+    return TRUE;
+}
+
+/*
+ * Writes what the socket takes of head and then buf without waiting,
+ * with one writev() if there is a head, and moves both past what it
+ * wrote. head is a WebSockets frame header, never set on Windows.
+ */
+
+static int
+writeFramed(rfbSocket sock, const char **head, int *headLen, const char **buf, int *len)
+{
+    int n, m;
+#ifndef WIN32
+    struct iovec iov[2];
+
+    if (*headLen > 0) {
+	iov[0].iov_base = (void *)*head;
+	iov[0].iov_len = *headLen;
+	iov[1].iov_base = (void *)*buf;
+	iov[1].iov_len = *len;
+	n = writev(sock, iov, *len > 0 ? 2 : 1);
+    } else
+#endif
+	n = write(sock, *buf, *len);
+
+    if (n > 0) {
+	m = n < *headLen ? n : *headLen;
+	*head += m;
+	*headLen -= m;
+	*buf += n - m;
+	*len -= n - m;
+    }
+    return n;
+}
+
+/*
+ * rfbWriteExact() for a client with an output queue: writes what the
+ * socket takes right away and queues the rest, or all of it behind what
+ * is queued already. outputMutex is held.
+ */
+
+static int
+writeQueued(rfbClientPtr cl, const char *head, int headLen, const char *buf, int len)
+{
+    rfbOutputQueue *q = cl->outputQueue;
+    rfbBool wasEmpty;
+    int n;
+
+    if (cl->sock == RFB_INVALID_SOCKET) {
+	errno = EBADF;
+	return -1;
+    }
+    cl->bytesWritten += headLen + len;
+
+    while (q->head == NULL && headLen + len > 0) {
+	n = writeFramed(cl->sock, &head, &headLen, &buf, &len);
+	if (n > 0)
+	    continue;
+#ifdef WIN32
+	errno = WSAGetLastError();
+#endif
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+	    return -1;
+	break;
+    }
+    if (headLen + len == 0)
+	return 1;
+
+    wasEmpty = q->head == NULL;
+    if ((headLen > 0 && !queueOutput(cl, head, headLen))
+	|| (len > 0 && !queueOutput(cl, buf, len))) {
+	rfbErr("WriteExact: out of memory queueing %d bytes\n", headLen + len);
+	errno = ENOMEM;
+	return -1;
+    }
+    if (wasEmpty) {
+	rfbWatchOutput(cl);
+	return 1;
+    }
+    if (flushOutput(cl) < 0)
+	return -1;
+    if (cl->outputQueued == 0)
+	rfbWatchOutput(cl);
+    return 1;
+}
+
 /*
  * WriteExact writes an exact number of bytes to a client.  Returns 1 if
  * those bytes have been written, or -1 if an error occurred (errno is set to
- * ETIMEDOUT if it timed out).
+ * ETIMEDOUT if it timed out). For a client with an output queue "written"
+ * means queued, and the call never waits for the socket.
  */
 
 int
@@ -857,10 +1524,13 @@ rfbWriteExact(rfbClientPtr cl,
 #endif
     rfbSocket sock = cl->sock;
     int n;
-    fd_set fds;
-    struct timeval tv;
     int totalTimeWaited = 0;
     const int timeout = (cl->screen && cl->screen->maxClientWait) ? cl->screen->maxClientWait : rfbMaxClientWait;
+    const char *head = NULL;
+    int headLen = 0;
+#ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+    char header[WS_FRAME_HEADER_MAX];
+#endif
 
 #undef DEBUG_WRITE_EXACT
 #ifdef DEBUG_WRITE_EXACT
@@ -871,6 +1541,13 @@ rfbWriteExact(rfbClientPtr cl,
 #endif
 
 #ifdef LIBVNCSERVER_WITH_WEBSOCKETS
+#ifndef WIN32
+    /* binary frames: the header goes out in front of buf, however long */
+    if (cl->wsctx && cl->sslctx == NULL
+	&& (headLen = webSocketsFrameHeader(cl, len, header)) > 0) {
+        head = header;
+    } else
+#endif
     if (cl->wsctx) {
         char *tmp = NULL;
 
@@ -895,22 +1572,30 @@ rfbWriteExact(rfbClientPtr cl,
 #endif
 
     LOCK(cl->outputMutex);
-    while (len > 0) {
+    if (cl->outputQueue && cl->sslctx == NULL) {
+        n = writeQueued(cl, head, headLen, buf, len);
+        UNLOCK(cl->outputMutex);
+        return n;
+    }
+    while (headLen + len > 0) {
         if(sock == RFB_INVALID_SOCKET) {
             errno = EBADF;
             return -1;
         }
 #ifdef LIBVNCSERVER_WITH_WEBSOCKETS
-        if (cl->sslctx)
+        if (cl->sslctx) {
 	    n = rfbssl_write(cl, buf, len);
-	else
+	    if (n > 0) {
+	        buf += n;
+	        len -= n;
+	    }
+	} else
 #endif
-	    n = write(sock, buf, len);
+	    n = writeFramed(sock, &head, &headLen, &buf, &len);
 
         if (n > 0) {
 
-            buf += n;
-            len -= n;
+            cl->bytesWritten += n;
 
         } else if (n == 0) {
 
@@ -934,11 +1619,7 @@ rfbWriteExact(rfbClientPtr cl,
                need to do this because select doesn't necessarily return
                immediately when the other end has gone away */
 
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            tv.tv_sec = 5;
-            tv.tv_usec = 0;
-            n = select(sock+1, NULL, &fds, NULL /* &fds */, &tv);
+            n = rfbWaitForSocket(sock, TRUE, 5000);
 	    if (n < 0) {
 #ifdef WIN32
                 errno=WSAGetLastError();
@@ -55,6 +55,8 @@ char *messageNameServer2Client(uint32_t type, char *buf, int len) {
     case rfbTextChat:                 snprintf(buf, len, "TextChat"); break;
     case rfbPalmVNCReSizeFrameBuffer: snprintf(buf, len, "PalmVNCReSize"); break;
     case rfbXvp:                      snprintf(buf, len, "XvpServerMessage"); break;
+    case rfbEndOfContinuousUpdates:   snprintf(buf, len, "EndOfContinuousUpdates"); break;
+    case rfbFence:                    snprintf(buf, len, "Fence"); break;
     default:
         snprintf(buf, len, "svr2cli-0x%08X", 0xFF);
     }
@@ -79,6 +81,8 @@ char *messageNameClient2Server(uint32_t type, char *buf, int len) {
     case rfbPalmVNCSetScaleFactor:    snprintf(buf, len, "PalmVNCSetScale"); break;
     case rfbXvp:                      snprintf(buf, len, "XvpClientMessage"); break;
     case rfbSetDesktopSize:           snprintf(buf, len, "SetDesktopSize"); break;
+    case rfbEnableContinuousUpdates:  snprintf(buf, len, "EnableContinuousUpdates"); break;
+    case rfbFence:                    snprintf(buf, len, "Fence"); break;
     default:
         snprintf(buf, len, "cli2svr-0x%08X", type);
 
@@ -128,6 +132,8 @@ char *encodingName(uint32_t type, char *buf, int len) {
     case rfbEncodingSupportedMessages:  snprintf(buf, len, "SupportedMessage");  break;
     case rfbEncodingSupportedEncodings: snprintf(buf, len, "SupportedEncoding"); break;
     case rfbEncodingServerIdentity:     snprintf(buf, len, "ServerIdentify");    break;
+    case rfbEncodingFence:              snprintf(buf, len, "Fence");       break;
+    case rfbEncodingContinuousUpdates:  snprintf(buf, len, "ContinuousUpdates"); break;
 
     /* The following lookups do not report in stats */
     case rfbEncodingCompressLevel0: snprintf(buf, len, "CompressLevel0");  break;
@@ -431,6 +437,16 @@ void rfbPrintStats(rfbClientPtr cl)
         savings = 100.0 - ((totalBytes/totalBytesIfRaw)*100.0);
     rfbLog(" %-20.20s: %6d | %9.0f/%9.0f (%5.1f%%)\n",
             "TOTALS", totalRects, totalBytes,totalBytesIfRaw, savings);
+    if (cl->sendRate>0 || cl->queuedBytes>0)
+        rfbLog(" %-20.20s: %9u bytes/s, %u bytes queued\n",
+                "Send rate", cl->sendRate, cl->queuedBytes);
+    if (cl->outputQueued>0)
+        rfbLog(" %-20.20s: %lu bytes\n", "Output queue", cl->outputQueued);
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+    if (rfbStatGetEncodingCountSent(cl, rfbEncodingZRLE)>0)
+        rfbLog(" %-20.20s: %d%s\n", "ZRLE zlib level", cl->zrleZlibLevel,
+                cl->screen->adaptiveZlibLevel ? " (adaptive)" : "");
+#endif
 
     totalRects=0.0;
     totalBytes=0.0;
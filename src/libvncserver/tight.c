@@ -156,6 +156,7 @@ static rfbBool SendMonoRect      (rfbClientPtr cl, int x, int y, int w, int h, u
 static rfbBool SendIndexedRect   (palettePtr palette, rfbClientPtr cl, int x, int y, int w, int h);
 static rfbBool SendFullColorRect (rfbClientPtr cl, int x, int y, int w, int h);
 
+static int StreamResetBits (rfbClientPtr cl, int streamId);
 static rfbBool CompressData (rfbClientPtr cl, int streamId, int dataLen,
                              int zlibLevel, int zlibStrategy);
 
@@ -825,7 +826,8 @@ SendMonoRect(rfbClientPtr cl,
         cl->updateBuf[cl->ublen++] =
             (char)((rfbTightNoZlib | rfbTightExplicitFilter) << 4);
     else
-        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4;
+        cl->updateBuf[cl->ublen++] = (char)((streamId | rfbTightExplicitFilter) << 4 |
+                                            StreamResetBits(cl, streamId));
     cl->updateBuf[cl->ublen++] = rfbTightFilterPalette;
     cl->updateBuf[cl->ublen++] = 1;
 
@@ -902,7 +904,8 @@ SendIndexedRect(palettePtr palette,
         cl->updateBuf[cl->ublen++] =
             (char)((rfbTightNoZlib | rfbTightExplicitFilter) << 4);
     else
-        cl->updateBuf[cl->ublen++] = (streamId | rfbTightExplicitFilter) << 4;
+        cl->updateBuf[cl->ublen++] = (char)((streamId | rfbTightExplicitFilter) << 4 |
+                                            StreamResetBits(cl, streamId));
     cl->updateBuf[cl->ublen++] = rfbTightFilterPalette;
     cl->updateBuf[cl->ublen++] = (char)(palette->numColors - 1);
 
@@ -977,7 +980,8 @@ SendFullColorRect(rfbClientPtr cl,
         cl->tightEncoding != rfbEncodingTightPng)
         cl->updateBuf[cl->ublen++] = (char)(rfbTightNoZlib << 4);
     else
-        cl->updateBuf[cl->ublen++] = 0x00;  /* stream id = 0, no flushing, no filter */
+        /* stream id = 0, no filter */
+        cl->updateBuf[cl->ublen++] = (char)StreamResetBits(cl, streamId);
     rfbStatRecordEncodingSentAdd(cl, cl->tightEncoding, 1);
 
     if (cl->tightUsePixelFormat24) {
@@ -991,6 +995,24 @@ SendFullColorRect(rfbClientPtr cl,
                         Z_DEFAULT_STRATEGY);
 }
 
+/* Restarts a zlib stream that is due for it, see
+   rfbClientRec::tightStreamsToReset, and returns the bit of the compression
+   control byte that has the client restart its inflater as well. */
+static int
+StreamResetBits(rfbClientPtr cl, int streamId)
+{
+    int bit = 1 << streamId;
+
+    if (!(cl->tightStreamsToReset & bit))
+        return 0;
+    cl->tightStreamsToReset &= ~bit;
+    if (cl->zsActive[streamId])
+        deflateReset(&cl->zsStruct[streamId]);
+    /* the reset would hit other clients' streams too */
+    rfbEncodeCacheUnshareable(cl);
+    return bit;
+}
+
 static rfbBool
 CompressData(rfbClientPtr cl,
              int streamId,
@@ -1011,6 +1033,8 @@ CompressData(rfbClientPtr cl,
     if (zlibLevel == 0)
         return rfbSendCompressedDataTight(cl, cl->beforeEncBuf, dataLen);
 
+    /* the data only decodes against this client's dictionary */
+    rfbEncodeCacheUnshareable(cl);
     pz = &cl->zsStruct[streamId];
 
     /* Initialize compression stream if needed. */
@@ -25,6 +25,7 @@
 
 #include <rfb/rfb.h>
 #include <rfb/rfbregion.h>
+#include "simd.h"
 
 static void PrintPixelFormat(rfbPixelFormat *pf);
 static rfbBool rfbSetClientColourMapBGR233(rfbClientPtr cl);
@@ -237,6 +238,129 @@ rfbTranslateNone(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
 }
 
 
+/*
+ * With 8 bits for each of red, green and blue in a 32 bit server format,
+ * a 32 bit client of 8 bit channels only needs the bytes of each pixel
+ * rearranged, and a 16 bit one its channels scaled and packed. Neither
+ * needs a table: cl->translateLookupTable holds the byte map for
+ * simd_shuffle32() or the simd_pack_format for simd_pack32to16() instead.
+ */
+
+static void
+rfbTranslateShuffle32(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                      char *iptr, char *optr, int bytesBetweenInputLines,
+                      int width, int height)
+{
+    simd_shuffle32((uint8_t *)optr, width * 4, (const uint8_t *)iptr,
+                   bytesBetweenInputLines, width, height, (const uint8_t *)table);
+}
+
+static void
+rfbTranslatePack32to16(char *table, rfbPixelFormat *in, rfbPixelFormat *out,
+                       char *iptr, char *optr, int bytesBetweenInputLines,
+                       int width, int height)
+{
+    simd_pack32to16((uint8_t *)optr, width * 2, (const uint8_t *)iptr,
+                    bytesBetweenInputLines, width, height,
+                    (const simd_pack_format *)table);
+}
+
+/* 32 bit true colour, red, green and blue each a byte of its own */
+static rfbBool
+rfbHasByteChannels(const rfbPixelFormat *pf)
+{
+    return pf->bitsPerPixel == 32 && pf->trueColour &&
+        pf->redMax == 255 && pf->greenMax == 255 && pf->blueMax == 255 &&
+        pf->redShift % 8 == 0 && pf->redShift <= 24 &&
+        pf->greenShift % 8 == 0 && pf->greenShift <= 24 &&
+        pf->blueShift % 8 == 0 && pf->blueShift <= 24 &&
+        pf->redShift != pf->greenShift && pf->greenShift != pf->blueShift &&
+        pf->blueShift != pf->redShift;
+}
+
+/* a channel of up to 8 bits, within 16 */
+static rfbBool
+rfbFitsIn16(int max, int shift)
+{
+    return max > 0 && max <= 255 && (max & (max + 1)) == 0 &&
+        shift >= 0 && (max << shift) <= 0xffff;
+}
+
+/*
+ * Picks one of the translations above where the formats allow and the CPU
+ * has the instructions that make it worth it. The tables do the rest.
+ */
+
+static rfbBool
+rfbSetVectorTranslateFunction(rfbClientPtr cl)
+{
+    rfbPixelFormat *in = &cl->screen->serverFormat;
+    rfbPixelFormat *out = &cl->format;
+    rfbBool swap = (out->bigEndian != in->bigEndian);
+    int features = simd_features();
+    int inShift[3], outShift[3], outMax[3];
+    int c, inByte, outByte;
+    uint8_t *map;
+    simd_pack_format *fmt;
+
+    if (!rfbHasByteChannels(in))
+        return FALSE;
+
+    inShift[0] = in->redShift;
+    inShift[1] = in->greenShift;
+    inShift[2] = in->blueShift;
+    outShift[0] = out->redShift;
+    outShift[1] = out->greenShift;
+    outShift[2] = out->blueShift;
+    outMax[0] = out->redMax;
+    outMax[1] = out->greenMax;
+    outMax[2] = out->blueMax;
+
+    if (rfbHasByteChannels(out) && (features & (SIMD_SSSE3 | SIMD_NEON))) {
+        map = (uint8_t *)malloc(4);
+        if (map == NULL)
+            return FALSE;
+        memset(map, 0x80, 4);
+        for (c = 0; c < 3; c++) {
+            /* shifts count from the least significant byte */
+            inByte = inShift[c] / 8;
+            outByte = swap ? 3 - outShift[c] / 8 : outShift[c] / 8;
+            if (!rfbEndianTest) {
+                inByte = 3 - inByte;
+                outByte = 3 - outByte;
+            }
+            map[outByte] = (uint8_t)inByte;
+        }
+        free(cl->translateLookupTable);
+        cl->translateLookupTable = (char *)map;
+        cl->translateFn = rfbTranslateShuffle32;
+        return TRUE;
+    }
+
+    if (out->bitsPerPixel == 16 && out->trueColour &&
+        rfbFitsIn16(out->redMax, out->redShift) &&
+        rfbFitsIn16(out->greenMax, out->greenShift) &&
+        rfbFitsIn16(out->blueMax, out->blueShift) &&
+        (features & (SIMD_SSE2 | SIMD_NEON))) {
+        fmt = (simd_pack_format *)malloc(sizeof(simd_pack_format));
+        if (fmt == NULL)
+            return FALSE;
+        for (c = 0; c < 3; c++) {
+            fmt->in_shift[c] = inShift[c];
+            fmt->max[c] = outMax[c];
+            fmt->out_shift[c] = outShift[c];
+        }
+        fmt->swap = swap;
+        free(cl->translateLookupTable);
+        cl->translateLookupTable = (char *)fmt;
+        cl->translateFn = rfbTranslatePack32to16;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
 /*
  * rfbSetTranslateFunction sets the translation function.
  */
@@ -315,6 +439,9 @@ rfbSetTranslateFunction(rfbClientPtr cl)
         return TRUE;
     }
 
+    if (rfbSetVectorTranslateFunction(cl))
+        return TRUE;
+
     if ((cl->screen->serverFormat.bitsPerPixel < 16) ||
         ((!cl->screen->serverFormat.trueColour || !rfbEconomicTranslate) &&
 	   (cl->screen->serverFormat.bitsPerPixel == 16))) {
@@ -47,6 +47,7 @@
 #include "crypto.h"
 #include "ws_decode.h"
 #include "base64.h"
+#include "private.h"
 
 #if 0
 #include <sys/syscall.h>
@@ -355,6 +356,47 @@ ws_read(void *ctxPtr, char *buf, size_t len)
     return n;
 }
 
+/* writes the header of an unmasked, final frame; returns its length */
+static int
+hybiEncodeHeader(ws_header_t *header, unsigned char opcode, uint64_t blen)
+{
+    header->b0 = 0x80 | (opcode & 0x0f);
+    if (blen <= 125) {
+      header->b1 = (uint8_t)blen;
+      return 2;
+    } else if (blen <= 65535) {
+      header->b1 = 0x7e;
+      header->u.s16.l16 = WS_HTON16((uint16_t)blen);
+      return 4;
+    } else {
+      header->b1 = 0x7f;
+      header->u.s64.l64 = WS_HTON64(blen);
+      return 10;
+    }
+}
+
+/*
+ * For binary frames, whose payload is the data as it is: writes the
+ * header of a frame carrying len bytes to header, which has room for
+ * WS_FRAME_HEADER_MAX, and returns its length. The caller sends the data
+ * right after it, so nothing is copied and the frame can be of any size.
+ * Returns 0 if the data has to go through webSocketsEncode() instead.
+ */
+int
+webSocketsFrameHeader(rfbClientPtr cl, int len, char *header)
+{
+    ws_ctx_t *wsctx = (ws_ctx_t *)cl->wsctx;
+    ws_header_t frame;
+    int sz;
+
+    if (wsctx->base64 || len <= 0)
+        return 0;
+
+    sz = hybiEncodeHeader(&frame, WS_OPCODE_BINARY_FRAME, (uint64_t)len);
+    memcpy(header, &frame, sz);
+    return sz;
+}
+
 static int
 webSocketsEncodeHybi(rfbClientPtr cl, const char *src, int len, char **dst)
 {
@@ -392,19 +434,7 @@ webSocketsEncodeHybi(rfbClientPtr cl, const char *src, int len, char **dst)
         blen = len;
     }
 
-    header->b0 = 0x80 | (opcode & 0x0f);
-    if (blen <= 125) {
-      header->b1 = (uint8_t)blen;
-      sz = 2;
-    } else if (blen <= 65536) {
-      header->b1 = 0x7e;
-      header->u.s16.l16 = WS_HTON16((uint16_t)blen);
-      sz = 4;
-    } else {
-      header->b1 = 0x7f;
-      header->u.s64.l64 = WS_HTON64(blen);
-      sz = 10;
-    }
+    sz = hybiEncodeHeader(header, opcode, blen);
 
     if (wsctx->base64) {
         if (-1 == (ret = rfbBase64NtoP((unsigned char *)src, len, wsctx->codeBufEncode + sz, sizeof(wsctx->codeBufEncode) - sz))) {
@@ -0,0 +1,757 @@
+/*
+ * workerpool.c - serves the clients of a background event loop from a
+ * fixed set of threads.
+ *
+ * Instead of an input and an output thread per client, one dispatcher
+ * thread waits on the epoll set and a pool of rfbScreenInfo::workerThreads
+ * workers does the rest. Listening, UDP and HTTP sockets are handled by
+ * the dispatcher itself, as listenerRun() does. A readable client socket
+ * is queued as a task for that client; all sockets are watched with
+ * EPOLLONESHOT and only re-armed once the worker is through, so a client
+ * never has its messages read by two threads at once.
+ *
+ * A client with output queued is watched for its socket taking more as
+ * well, and its worker writes what it takes. No update is encoded for it
+ * while its queue is over rfbScreenInfo::outputHighWater, so a slow client
+ * never holds up a worker.
+ *
+ * Each client has one task, which is either idle, queued or being run by
+ * exactly one worker. Whatever comes up for it meanwhile (more input, an
+ * update to send, a close) is added to the task's work and the worker runs
+ * it again when done, so input and updates for one client keep their
+ * order and never overlap, while different clients are served in
+ * parallel.
+ *
+ * Deferred updates, deferred pointer events and file transfer chunks are
+ * driven by a timer wheel with one millisecond ticks, which the dispatcher
+ * advances between epoll waits, instead of sleeping in a thread per
+ * client.
+ *
+ * A client whose worker finds it closed is freed by the dispatcher, once
+ * through the events it has collected, which may still name the client.
+ */
+
+/*
+ *  This is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ *  USA.
+ */
+
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+#include "private.h"
+
+#if defined(LIBVNCSERVER_HAVE_LIBPTHREAD) && defined(LIBVNCSERVER_HAVE_SYS_EPOLL_H)
+
+#include <unistd.h>
+
+#define MAX_WORKER_THREADS 64
+/* the wheel turns once every WHEEL_SLOTS ms, later timers take more turns */
+#define WHEEL_SLOTS 256
+/* file transfer chunks sent per tick, at most */
+#define TRANSFER_CHUNKS 16
+
+/* what a task has to do the next time it runs */
+#define POOL_INPUT  1
+#define POOL_OUTPUT 2
+#define POOL_TIMER  4
+#define POOL_CLOSE  8
+#define POOL_WRITABLE 16
+
+typedef struct rfbPoolTask {
+    rfbClientPtr cl;
+    int work;
+    rfbBool queued;             /* on the run queue or being run */
+    rfbBool dead;               /* being finished off */
+    struct rfbPoolTask *next;   /* on the run queue */
+    /* in a wheel slot while due is not 0 */
+    struct rfbPoolTask *timerNext, *timerPrev;
+    int slot;
+    unsigned long due;
+    /* when to send the deferred update etc., 0 for never */
+    unsigned long updateDue, pointerDue, transferDue;
+} rfbPoolTask;
+
+typedef struct {
+    rfbScreenInfoPtr screen;
+    int nThreads;
+    pthread_t threads[MAX_WORKER_THREADS];
+    MUTEX(mutex);
+    COND(workAvailable);
+    COND(idle);
+    rfbPoolTask *head, *tail;
+    int busy;
+    rfbBool stopping, quit;
+    /* set when the pool was stopped from one of its threads, which frees it */
+    rfbBool orphaned;
+    rfbPoolTask *wheel[WHEEL_SLOTS];
+    int timers;
+    unsigned long tick;
+    /* finished clients for the dispatcher to free, while it runs */
+    rfbPoolTask *gone;
+    rfbBool reaping;
+} rfbWorkerPool;
+
+/* pool->mutex is held for all of the task and timer functions */
+
+static rfbPoolTask *
+getTask(rfbClientPtr cl)
+{
+    rfbPoolTask *task = cl->poolTask;
+
+    if (task == NULL) {
+	task = calloc(1, sizeof(rfbPoolTask));
+	if (task == NULL)
+	    return NULL;
+	task->cl = cl;
+	cl->poolTask = task;
+    }
+    return task->dead ? NULL : task;
+}
+
+static void
+schedule(rfbWorkerPool *pool, rfbPoolTask *task, int work)
+{
+    task->work |= work;
+    if (task->queued)
+	return;
+    task->queued = TRUE;
+    task->next = NULL;
+    if (pool->tail)
+	pool->tail->next = task;
+    else
+	pool->head = task;
+    pool->tail = task;
+    TSIGNAL(pool->workAvailable);
+}
+
+static void
+unlinkTimer(rfbWorkerPool *pool, rfbPoolTask *task)
+{
+    if (task->timerPrev)
+	task->timerPrev->timerNext = task->timerNext;
+    else
+	pool->wheel[task->slot] = task->timerNext;
+    if (task->timerNext)
+	task->timerNext->timerPrev = task->timerPrev;
+    task->due = 0;
+    pool->timers--;
+}
+
+/* puts the task on the wheel for the earliest of its due times */
+static void
+setTimer(rfbWorkerPool *pool, rfbPoolTask *task)
+{
+    unsigned long due = task->updateDue;
+
+    if (task->pointerDue && (!due || task->pointerDue < due))
+	due = task->pointerDue;
+    if (task->transferDue && (!due || task->transferDue < due))
+	due = task->transferDue;
+    if (task->dead)
+	due = 0;
+    if (due == task->due)
+	return;
+
+    if (task->due)
+	unlinkTimer(pool, task);
+    if (!due)
+	return;
+
+    /* one that is already due goes into the next slot to be looked at */
+    task->due = due;
+    task->slot = (due > pool->tick ? due : pool->tick + 1) % WHEEL_SLOTS;
+    task->timerPrev = NULL;
+    task->timerNext = pool->wheel[task->slot];
+    if (task->timerNext)
+	task->timerNext->timerPrev = task;
+    pool->wheel[task->slot] = task;
+
+    /* the dispatcher only ticks while there are timers */
+    if (pool->timers++ == 0 && !pool->stopping)
+	write(pool->screen->pipe_notify_listener_thread[1], "\x00", 1);
+}
+
+/* called by the dispatcher: queues the tasks whose time has come */
+static void
+runTimers(rfbWorkerPool *pool)
+{
+    unsigned long now = rfbPacerClock(), ticks, t;
+    rfbPoolTask *task, *next;
+
+    LOCK(pool->mutex);
+    ticks = now - pool->tick;
+    if (ticks > WHEEL_SLOTS)
+	ticks = WHEEL_SLOTS;
+    for (t = 1; t <= ticks && pool->timers; t++) {
+	for (task = pool->wheel[(pool->tick + t) % WHEEL_SLOTS]; task; task = next) {
+	    next = task->timerNext;
+	    /* the due times stay for the worker to look at */
+	    if (task->due <= now) {
+		unlinkTimer(pool, task);
+		schedule(pool, task, POOL_TIMER);
+	    }
+	}
+    }
+    pool->tick = now;
+    UNLOCK(pool->mutex);
+}
+
+/* TRUE if the client asked for an update and there is something to send */
+static rfbBool
+updatePending(rfbClientPtr cl)
+{
+    rfbBool pending = FALSE;
+
+    if (cl->state != RFB_NORMAL || cl->onHold || rfbOutputFull(cl))
+	return FALSE;
+
+    LOCK(cl->updateMutex);
+    /* always require a FB Update Request (otherwise can crash.) */
+    if (!sraRgnEmpty(cl->requestedRegion)) {
+	pending = FB_UPDATE_PENDING(cl);
+	if (!pending)
+	    pending = sraRgnIntersects(cl->modifiedRegion, cl->requestedRegion);
+    }
+    UNLOCK(cl->updateMutex);
+    return pending;
+}
+
+/* what clientOutput() does once it has waited for an update */
+static void
+sendUpdate(rfbClientPtr cl)
+{
+    sraRegion *region;
+
+    if (!updatePending(cl))
+	return;
+
+    LOCK(cl->updateMutex);
+    region = sraRgnCreateRgn(cl->modifiedRegion);
+    UNLOCK(cl->updateMutex);
+
+    LOCK(cl->sendMutex);
+    rfbSendFramebufferUpdate(cl, region);
+    UNLOCK(cl->sendMutex);
+
+    sraRgnDestroy(region);
+}
+
+/* frees a finished client, and its task with it */
+static void
+freeClient(rfbPoolTask *task)
+{
+    rfbClientConnectionGone(task->cl);
+    free(task);
+}
+
+/* called by the dispatcher between epoll waits, and as it stops */
+static void
+reapClients(rfbWorkerPool *pool, rfbBool stop)
+{
+    rfbPoolTask *task, *next;
+
+    LOCK(pool->mutex);
+    task = pool->gone;
+    pool->gone = NULL;
+    if (stop)
+	pool->reaping = FALSE;
+    UNLOCK(pool->mutex);
+
+    for (; task; task = next) {
+	next = task->next;
+	freeClient(task);
+    }
+}
+
+/*
+ * What the end of clientInput() does. The socket is out of the epoll set
+ * from here on, but the dispatcher may have an event for it already and
+ * pass the client to scheduleClient(), so it frees the client itself.
+ */
+static void
+finishClient(rfbWorkerPool *pool, rfbPoolTask *task)
+{
+    rfbClientPtr cl = task->cl;
+    rfbBool deferred;
+
+    LOCK(pool->mutex);
+    task->dead = TRUE;
+    setTimer(pool, task);
+    UNLOCK(pool->mutex);
+
+    if (cl->sock != RFB_INVALID_SOCKET) {
+	rfbUnwatchSocket(cl->screen, cl->sock);
+	rfbCloseSocket(cl->sock);
+	cl->sock = RFB_INVALID_SOCKET;
+    }
+
+    /* dead tasks are left alone by getTask() until then */
+    LOCK(pool->mutex);
+    deferred = pool->reaping;
+    if (deferred) {
+	task->next = pool->gone;
+	pool->gone = task;
+    }
+    UNLOCK(pool->mutex);
+
+    if (deferred)
+	write(pool->screen->pipe_notify_listener_thread[1], "\x00", 1);
+    else
+	freeClient(task);
+}
+
+static rfbBool
+clientClosed(rfbClientPtr cl)
+{
+    return cl->state == RFB_SHUTDOWN || cl->sock == RFB_INVALID_SOCKET;
+}
+
+/*
+ * Runs a task on a worker. Returns TRUE if the client is gone, and the
+ * task with it.
+ */
+
+static rfbBool
+serveClient(rfbWorkerPool *pool, rfbPoolTask *task, int work)
+{
+    rfbClientPtr cl = task->cl;
+    rfbScreenInfoPtr screen = cl->screen;
+    rfbBool update = FALSE, armed, pointer = FALSE, transfer = FALSE;
+    unsigned long now;
+    int n, delay = -1;
+
+    if ((work & POOL_WRITABLE) && !clientClosed(cl) && !rfbFlushOutput(cl))
+	rfbCloseClient(cl);
+
+    /* the socket may have been armed for output before the input was read,
+       and the event come twice; only a readable one blocks no worker */
+    if ((work & POOL_INPUT) && !cl->onHold && !clientClosed(cl)
+	&& rfbWaitForSocket(cl->sock, FALSE, 0) > 0)
+	rfbProcessClientSocket(cl);
+
+    /* a client on hold stays unarmed until rfbStartOnHoldClient() */
+    if ((work & (POOL_INPUT | POOL_WRITABLE)) && !cl->onHold && !clientClosed(cl))
+	rfbWatchClient(cl);
+
+    if (clientClosed(cl)) {
+	finishClient(pool, task);
+	return TRUE;
+    }
+
+    now = rfbPacerClock();
+    LOCK(pool->mutex);
+    if (task->updateDue && task->updateDue <= now) {
+	task->updateDue = 0;
+	update = TRUE;
+    }
+    armed = task->updateDue != 0;
+    if (task->pointerDue && task->pointerDue <= now) {
+	task->pointerDue = 0;
+	pointer = TRUE;
+    }
+    if (task->transferDue && task->transferDue <= now) {
+	task->transferDue = 0;
+	transfer = TRUE;
+    }
+    UNLOCK(pool->mutex);
+
+    if (pointer && !cl->viewOnly && cl->lastPtrX >= 0) {
+	screen->ptrAddEvent(cl->lastPtrButtons, cl->lastPtrX, cl->lastPtrY, cl);
+	cl->lastPtrX = -1;
+    }
+
+    /* whatever the input asked for may go out now, if the pacer says so */
+    if (!update && !armed && updatePending(cl))
+	update = (delay = rfbUpdateDelay(cl)) <= 0;
+    if (update) {
+	sendUpdate(cl);
+	delay = -1;
+    }
+
+    for (n = 0; transfer && n < TRANSFER_CHUNKS && !clientClosed(cl)
+	     && cl->fileTransfer.fd != -1 && cl->fileTransfer.sending; n++)
+	rfbSendFileTransferChunk(cl);
+
+    if (clientClosed(cl)) {
+	finishClient(pool, task);
+	return TRUE;
+    }
+
+    /* and see when to come back */
+    update = updatePending(cl);
+    if (update && delay < 0) {
+	delay = rfbUpdateDelay(cl);
+	now = rfbPacerClock();
+    }
+    LOCK(pool->mutex);
+    if (update && !task->updateDue)
+	task->updateDue = now + (delay > 0 ? delay : 0);
+    if (!cl->viewOnly && cl->lastPtrX >= 0 && !task->pointerDue)
+	task->pointerDue = now + (screen->deferPtrUpdateTime > 0 ? screen->deferPtrUpdateTime : 0);
+    if (cl->fileTransfer.fd != -1 && cl->fileTransfer.sending)
+	task->transferDue = now + 1;
+    setTimer(pool, task);
+    UNLOCK(pool->mutex);
+    return FALSE;
+}
+
+/* runs the first task on the queue; pool->mutex is held */
+static void
+runNext(rfbWorkerPool *pool)
+{
+    rfbPoolTask *task = pool->head;
+    rfbBool finished;
+    int work;
+
+    pool->head = task->next;
+    if (pool->head == NULL)
+	pool->tail = NULL;
+    work = task->work;
+    task->work = 0;
+    pool->busy++;
+    UNLOCK(pool->mutex);
+
+    finished = serveClient(pool, task, work);
+
+    LOCK(pool->mutex);
+    pool->busy--;
+    if (!finished) {
+	task->queued = FALSE;
+	if (task->work)
+	    schedule(pool, task, 0);
+    }
+    /* rfbStopWorkerPool() may run on a worker, which then counts as busy */
+    if (pool->head == NULL && pool->busy <= 1)
+	TSIGNAL(pool->idle);
+}
+
+static void
+freePool(rfbWorkerPool *pool)
+{
+    TINI_COND(pool->workAvailable);
+    TINI_COND(pool->idle);
+    TINI_MUTEX(pool->mutex);
+    free(pool);
+}
+
+static THREAD_ROUTINE_RETURN_TYPE
+workerRun(void *data)
+{
+    rfbWorkerPool *pool = (rfbWorkerPool *)data;
+
+    LOCK(pool->mutex);
+    for (;;) {
+	while (pool->head == NULL && !pool->quit)
+	    WAIT(pool->workAvailable, pool->mutex);
+	if (pool->head == NULL)
+	    break;
+	runNext(pool);
+    }
+    UNLOCK(pool->mutex);
+    /* pass the wakeup on to the next worker */
+    TSIGNAL(pool->workAvailable);
+
+    if (pool->orphaned)
+	freePool(pool);
+    return THREAD_ROUTINE_RETURN_VALUE;
+}
+
+static THREAD_ROUTINE_RETURN_TYPE
+dispatcherRun(void *data)
+{
+    rfbWorkerPool *pool = (rfbWorkerPool *)data;
+    rfbScreenInfoPtr screen = pool->screen;
+    rfbBool stopping;
+    long usec;
+
+    for (;;) {
+	LOCK(pool->mutex);
+	stopping = pool->stopping;
+	usec = pool->timers ? 1000 : screen->select_timeout_usec;
+	UNLOCK(pool->mutex);
+	if (stopping)
+	    break;
+
+	rfbCheckFds(screen, usec);
+	runTimers(pool);
+	reapClients(pool, FALSE);
+    }
+
+    /* no events left to look at, whoever finishes a client frees it now */
+    reapClients(pool, TRUE);
+
+    if (pool->orphaned)
+	freePool(pool);
+    return THREAD_ROUTINE_RETURN_VALUE;
+}
+
+static void
+stopWorkers(rfbWorkerPool *pool, int self)
+{
+    int i;
+
+    LOCK(pool->mutex);
+    pool->quit = TRUE;
+    UNLOCK(pool->mutex);
+    TSIGNAL(pool->workAvailable);
+    for (i = 0; i < pool->nThreads; i++)
+	if (i != self)
+	    THREAD_JOIN(pool->threads[i]);
+}
+
+/* (re)arms a socket of the screen, data is the member holding it */
+#define WATCH(sock) \
+    if (screen->sock != RFB_INVALID_SOCKET) \
+	rfbWatchSocket(screen, screen->sock, &screen->sock)
+
+/*
+ * Called by rfbRunEventLoop() in place of starting listenerRun(). Returns
+ * FALSE if there is to be no pool, with the pipe to the listener thread
+ * left for the caller.
+ */
+
+rfbBool
+rfbStartWorkerPool(rfbScreenInfoPtr screen)
+{
+    rfbClientIteratorPtr i;
+    rfbClientPtr cl;
+    rfbWorkerPool *pool;
+    int n = screen->workerThreads;
+
+    if (n == 0)
+	return FALSE;
+    if (screen->pollSet == NULL || screen->pipe_notify_listener_thread[0] == -1) {
+	rfbLog("rfbRunEventLoop: no epoll, using a thread per client instead of a pool\n");
+	return FALSE;
+    }
+    if (n < 0)
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+	n = 1;
+    if (n > MAX_WORKER_THREADS)
+	n = MAX_WORKER_THREADS;
+
+    pool = calloc(1, sizeof(rfbWorkerPool));
+    if (pool == NULL)
+	return FALSE;
+    pool->screen = screen;
+    pool->tick = rfbPacerClock();
+    INIT_MUTEX(pool->mutex);
+    INIT_COND(pool->workAvailable);
+    INIT_COND(pool->idle);
+
+    for (pool->nThreads = 0; pool->nThreads < n; pool->nThreads++)
+	if (pthread_create(&pool->threads[pool->nThreads], NULL, workerRun, pool) != 0)
+	    break;
+    if (pool->nThreads == 0) {
+	rfbErr("rfbRunEventLoop: could not start worker threads\n");
+	freePool(pool);
+	return FALSE;
+    }
+
+    /* from now on every socket wakes the dispatcher once, then until re-armed */
+    screen->workerPool = pool;
+    pool->reaping = TRUE;
+    WATCH(listenSock);
+    WATCH(listen6Sock);
+    WATCH(udpSock);
+    WATCH(httpListenSock);
+    WATCH(httpListen6Sock);
+    WATCH(httpSock);
+    rfbWatchSocket(screen, screen->pipe_notify_listener_thread[0],
+		   screen->pipe_notify_listener_thread);
+    i = rfbGetClientIterator(screen);
+    while ((cl = rfbClientIteratorNext(i)))
+	if (!cl->onHold)
+	    rfbWatchClient(cl);
+    rfbReleaseClientIterator(i);
+
+    if (pthread_create(&screen->listener_thread, NULL, dispatcherRun, pool) != 0) {
+	rfbErr("rfbRunEventLoop: could not start the dispatcher thread\n");
+	rfbUnwatchSocket(screen, screen->pipe_notify_listener_thread[0]);
+	screen->workerPool = NULL;
+	pool->reaping = FALSE;
+	stopWorkers(pool, -1);
+	freePool(pool);
+	return FALSE;
+    }
+
+    rfbLog("rfbRunEventLoop: serving clients from %d worker threads\n", pool->nThreads);
+    return TRUE;
+}
+
+/*
+ * Stops the dispatcher, closes the clients that are left and waits for the
+ * workers to finish them off. This may be called from a callback, that is
+ * on one of the pool's own threads, which then frees the pool on its way
+ * out.
+ */
+
+void
+rfbStopWorkerPool(rfbScreenInfoPtr screen)
+{
+    rfbWorkerPool *pool = screen->workerPool;
+    rfbClientIteratorPtr i;
+    rfbClientPtr cl;
+    rfbBool dispatcher;
+    int self = -1, n;
+
+    if (pool == NULL)
+	return;
+
+    LOCK(pool->mutex);
+    if (pool->stopping) {
+	UNLOCK(pool->mutex);
+	return;
+    }
+    pool->stopping = TRUE;
+    UNLOCK(pool->mutex);
+
+    for (n = 0; n < pool->nThreads; n++)
+	if (pthread_equal(pthread_self(), pool->threads[n]))
+	    self = n;
+    dispatcher = pthread_equal(pthread_self(), screen->listener_thread);
+
+    if (dispatcher) {
+	pthread_detach(screen->listener_thread);
+    } else {
+	write(screen->pipe_notify_listener_thread[1], "\x00", 1);
+	THREAD_JOIN(screen->listener_thread);
+    }
+    rfbUnwatchSocket(screen, screen->pipe_notify_listener_thread[0]);
+
+    i = rfbGetClientIterator(screen);
+    while ((cl = rfbClientIteratorNext(i)))
+	if (cl->state != RFB_SHUTDOWN)
+	    rfbCloseClient(cl);
+    rfbReleaseClientIterator(i);
+
+    /* a worker calling this helps out, the queue might wait for it else */
+    LOCK(pool->mutex);
+    while (pool->head || pool->busy > (self >= 0)) {
+	if (pool->head && self >= 0)
+	    runNext(pool);
+	else
+	    WAIT(pool->idle, pool->mutex);
+    }
+    UNLOCK(pool->mutex);
+
+    stopWorkers(pool, self);
+    screen->workerPool = NULL;
+
+    if (self >= 0 || dispatcher) {
+	if (self >= 0)
+	    pthread_detach(pool->threads[self]);
+	pool->orphaned = TRUE;
+    } else {
+	freePool(pool);
+    }
+}
+
+static void
+scheduleClient(rfbClientPtr cl, int work)
+{
+    rfbWorkerPool *pool = cl->screen->workerPool;
+    rfbPoolTask *task;
+
+    if (pool == NULL)
+	return;
+    LOCK(pool->mutex);
+    if ((task = getTask(cl)) != NULL)
+	schedule(pool, task, work);
+    UNLOCK(pool->mutex);
+}
+
+/* the dispatcher found the client's socket readable */
+void
+rfbWorkerPoolInput(rfbClientPtr cl)
+{
+    scheduleClient(cl, POOL_INPUT);
+}
+
+/* the dispatcher found the client's socket taking more of its output */
+void
+rfbWorkerPoolWritable(rfbClientPtr cl)
+{
+    scheduleClient(cl, POOL_WRITABLE);
+}
+
+/* called by rfbCloseClient(), a worker closes the socket and frees the client */
+void
+rfbWorkerPoolClose(rfbClientPtr cl)
+{
+    scheduleClient(cl, POOL_CLOSE);
+}
+
+/*
+ * The client's modifiedRegion grew, send it after deferUpdateTime. A
+ * paced client is up to its worker, which knows when it last sent.
+ */
+void
+rfbWorkerPoolUpdate(rfbClientPtr cl)
+{
+    rfbWorkerPool *pool = cl->screen->workerPool;
+    rfbPoolTask *task;
+
+    if (pool == NULL)
+	return;
+    if (cl->screen->deferUpdateTime <= 0 || cl->screen->maxFrameRate > 0) {
+	scheduleClient(cl, POOL_OUTPUT);
+	return;
+    }
+    LOCK(pool->mutex);
+    if ((task = getTask(cl)) != NULL && !task->updateDue) {
+	task->updateDue = rfbPacerClock() + cl->screen->deferUpdateTime;
+	setTimer(pool, task);
+    }
+    UNLOCK(pool->mutex);
+}
+
+#else
+
+rfbBool
+rfbStartWorkerPool(rfbScreenInfoPtr screen)
+{
+    if (screen->workerThreads != 0)
+	rfbLog("rfbRunEventLoop: no epoll, using a thread per client instead of a pool\n");
+    return FALSE;
+}
+
+void
+rfbStopWorkerPool(rfbScreenInfoPtr screen)
+{
+}
+
+void
+rfbWorkerPoolInput(rfbClientPtr cl)
+{
+}
+
+void
+rfbWorkerPoolWritable(rfbClientPtr cl)
+{
+}
+
+void
+rfbWorkerPoolClose(rfbClientPtr cl)
+{
+}
+
+void
+rfbWorkerPoolUpdate(rfbClientPtr cl)
+{
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "ws_decode.h"
 #include "base64.h"
+#include "simd.h"
 
 #include <string.h>
 #include <errno.h>
@@ -407,23 +408,14 @@ hybiReadAndDecode(ws_ctx_t *wsctx, char *dst, int len, int *sockRet, int nInBuf)
    * the whole frame is received and carry over any remaining bytes in the carry buf*/
   data = (unsigned char *)(wsctx->writePos - toDecode);
 
-  for (i = 0; i < (toDecode >> 2); i++) {
-    uint32_t tmp;
-    memcpy(&tmp, data + i * sizeof(tmp), sizeof(tmp));
-    tmp ^= wsctx->header.mask.u;
-    memcpy(data + i * sizeof(tmp), &tmp, sizeof(tmp));
-  }
-  ws_dbg("mask decoding; i=%d toDecode=%d\n", i, toDecode);
-
+  /* data starts at a multiple of 4 into the payload, so the mask lines up */
+  i = toDecode >> 2;
   if (wsctx->hybiDecodeState == WS_HYBI_STATE_FRAME_COMPLETE) {
-    /* process the remaining bytes (if any) */
-    for (i*=4; i < toDecode; i++) {
-      data[i] ^= wsctx->header.mask.c[i % 4];
-    }
-
-    /* all data is here, no carrying */
+    /* all data is here, unmask the remaining bytes (if any) too, no carrying */
+    simd_xor_mask(data, toDecode, (const uint8_t *)wsctx->header.mask.c);
     wsctx->carrylen = 0;
   } else {
+    simd_xor_mask(data, i * 4, (const uint8_t *)wsctx->header.mask.c);
     /* carry over remaining, non-multiple-of-four bytes */
     wsctx->carrylen = toDecode - (i * 4);
     if (wsctx->carrylen < 0 || wsctx->carrylen > ARRAYSIZE(wsctx->carryBuf)) {
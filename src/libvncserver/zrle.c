@@ -28,6 +28,16 @@
 #include "private.h"
 #include "zrleoutstream.h"
 
+/*
+ * With rfbScreenInfo::adaptiveZlibLevel the zlib level moves by one each
+ * time ADAPT_SAMPLE us were spent encoding: up while deflate makes bytes
+ * more than twice as fast as the connection takes them, down once it
+ * makes them slower than that.
+ */
+#define ADAPT_SAMPLE 50000
+#define ADAPT_MIN_LEVEL 1
+#define ADAPT_MAX_LEVEL 9
+
 
 #define GET_IMAGE_INTO_BUF(tx,ty,tw,th,buf)                                \
 {  char *fbptr = (cl->scaledScreen->frameBuffer                                   \
@@ -89,6 +99,41 @@
 #undef BPP
 
 
+/*
+ * zrleAdaptLevel - the level the next rect is compressed at.  Where the
+ * system doesn't tell how fast the connection is, data left waiting in
+ * the client's output queue says that it is the slower one.
+ */
+
+static int zrleAdaptLevel(rfbClientPtr cl, zrleOutStream *zos)
+{
+  int level = cl->zrleZlibLevel;
+  double rate;
+  rfbBool linkBound, cpuBound;
+
+  if (zos->usecs < ADAPT_SAMPLE)
+    return level;
+
+  rfbPacerMeasure(cl);
+  rate = (double)zos->bytes * 1000000 / zos->usecs;
+  if (cl->sendRate > 0) {
+    linkBound = rate > 2.0 * cl->sendRate;
+    cpuBound = rate < cl->sendRate;
+  } else {
+    linkBound = cl->outputQueued > 0;
+    cpuBound = !linkBound;
+  }
+  zos->usecs = 0;
+  zos->bytes = 0;
+
+  if (linkBound && level < ADAPT_MAX_LEVEL)
+    level = level < ADAPT_MIN_LEVEL ? ADAPT_MIN_LEVEL : level + 1;
+  else if (cpuBound && level > ADAPT_MIN_LEVEL)
+    level--;
+  return level;
+}
+
+
 /*
  * zrleBeforeBuf contains pixel data in the client's format.  It must be at
  * least one pixel bigger than the largest tile of pixel data, since the
@@ -106,7 +151,8 @@ rfbBool rfbSendRectEncodingZRLE(rfbClientPtr cl, int x, int y, int w, int h)
   zrleOutStream* zos;
   rfbFramebufferUpdateRectHeader rect;
   rfbZRLEHeader hdr;
-  int i;
+  int i, level;
+  unsigned long long start = 0;
   char *zrleBeforeBuf;
 
   if (cl->zrleBeforeBuf == NULL) {
@@ -127,12 +173,26 @@ rfbBool rfbSendRectEncodingZRLE(rfbClientPtr cl, int x, int y, int w, int h)
   } else
 	  cl->zywrleLevel = 0;
 
-  if (!cl->zrleData)
-    cl->zrleData = zrleOutStreamNew();
+  if (!cl->zrleData) {
+    cl->zrleZlibLevel = cl->zlibCompressLevel;
+    cl->zrleData = zrleOutStreamNew(cl->zrleZlibLevel);
+    if (!cl->zrleData)
+      return FALSE;
+  }
   zos = cl->zrleData;
   zos->in.ptr = zos->in.start;
   zos->out.ptr = zos->out.start;
 
+  level = cl->screen->adaptiveZlibLevel ? zrleAdaptLevel(cl, zos)
+                                        : (int)cl->zlibCompressLevel;
+  if (level != cl->zrleZlibLevel) {
+    if (!zrleOutStreamSetLevel(zos, level))
+      return FALSE;
+    cl->zrleZlibLevel = level;
+  }
+  if (cl->screen->adaptiveZlibLevel)
+    start = rfbClockUsecs();
+
   switch (cl->format.bitsPerPixel) {
 
   case 8:
@@ -187,6 +247,11 @@ rfbBool rfbSendRectEncodingZRLE(rfbClientPtr cl, int x, int y, int w, int h)
     break;
   }
 
+  if (cl->screen->adaptiveZlibLevel) {
+    zos->usecs += (unsigned long)(rfbClockUsecs() - start);
+    zos->bytes += ZRLE_BUFFER_LENGTH(&zos->out);
+  }
+
   rfbStatRecordEncodingSent(cl, rfbEncodingZRLE, sz_rfbFramebufferUpdateRectHeader + sz_rfbZRLEHeader + ZRLE_BUFFER_LENGTH(&zos->out),
       + w * (cl->format.bitsPerPixel / 8) * h);
 
@@ -65,7 +65,7 @@ static rfbBool zrleBufferGrow(zrleBuffer *buffer, int size)
   return TRUE;
 }
 
-zrleOutStream *zrleOutStreamNew(void)
+zrleOutStream *zrleOutStreamNew(int level)
 {
   zrleOutStream *os;
 
@@ -87,15 +87,46 @@ zrleOutStream *zrleOutStreamNew(void)
   os->zs.zalloc = Z_NULL;
   os->zs.zfree  = Z_NULL;
   os->zs.opaque = Z_NULL;
-  if (deflateInit(&os->zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+  if (deflateInit(&os->zs, level) != Z_OK) {
     zrleBufferFree(&os->in);
+    zrleBufferFree(&os->out);
     free(os);
     return NULL;
   }
 
+  os->usecs = 0;
+  os->bytes = 0;
+
   return os;
 }
 
+/* Call between rects only: whatever deflate still holds is written to
+   the output buffer first, at the old level. */
+rfbBool zrleOutStreamSetLevel(zrleOutStream *os, int level)
+{
+  int ret;
+
+  if (os->out.ptr >= os->out.end &&
+      !zrleBufferGrow(&os->out, os->out.end - os->out.start)) {
+    rfbLog("zrleOutStreamSetLevel: failed to grow output buffer\n");
+    return FALSE;
+  }
+
+  os->zs.next_in = os->in.start;
+  os->zs.avail_in = 0;
+  os->zs.next_out = os->out.ptr;
+  os->zs.avail_out = os->out.end - os->out.ptr;
+
+  if ((ret = deflateParams(&os->zs, level, Z_DEFAULT_STRATEGY)) != Z_OK) {
+    rfbLog("zrleOutStreamSetLevel: deflateParams failed with error code %d\n", ret);
+    return FALSE;
+  }
+
+  os->out.ptr = os->zs.next_out;
+
+  return TRUE;
+}
+
 void zrleOutStreamFree (zrleOutStream *os)
 {
   deflateEnd(&os->zs);
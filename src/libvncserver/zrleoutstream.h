@@ -36,12 +36,19 @@ typedef struct {
   zrleBuffer out;
 
   z_stream   zs;
+
+  /* for rfbScreenInfo::adaptiveZlibLevel: time spent encoding in us,
+     and the bytes it made, since the level last moved */
+  unsigned long usecs;
+  unsigned long bytes;
 } zrleOutStream;
 
 #define ZRLE_BUFFER_LENGTH(b) ((b)->ptr - (b)->start)
 
-zrleOutStream *zrleOutStreamNew           (void);
+zrleOutStream *zrleOutStreamNew           (int level);
 void           zrleOutStreamFree          (zrleOutStream *os);
+rfbBool        zrleOutStreamSetLevel      (zrleOutStream *os,
+					   int            level);
 rfbBool        zrleOutStreamFlush         (zrleOutStream *os);
 void           zrleOutStreamWriteBytes    (zrleOutStream *os,
 					   const zrle_U8 *data,
@@ -0,0 +1,252 @@
+/*
+ * bench_client_decode.c - replays sessions recorded with
+ * examples/client/vncrecord (or the -record option of any libvncclient
+ * program) through the decoders as fast as they go, and reports input
+ * MB/s, output Mpx/s, the time spent per encoding and heap allocations
+ * per frame. Streams have to be recorded with the default 32 bpp pixel
+ * format.
+ *
+ * Usage: bench_client_decode [-check] [-repeat n] [-threads n] file...
+ *
+ * Every file is replayed n times (default 3) and the fastest run is
+ * reported. The exit status is non-zero if a file could not be replayed
+ * to its end, so a corpus can be run as a regression check. -check
+ * replays every file once and also fails unless each ends on the same
+ * frame as the first; test/vncrec holds such a corpus, one small static
+ * screen recorded in several lossless encodings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <rfb/rfbclient.h>
+
+#ifdef __GLIBC__
+/* count every allocation the library makes, by interposing on malloc */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(ptr, size);
+}
+#define ALLOCATIONS allocations
+#else
+#define ALLOCATIONS 0
+#endif
+
+typedef struct {
+	int frames;
+	double pixels;
+	double seconds;
+	unsigned long allocations;
+} result_t;
+
+static int frames, rects;
+static double pixels;
+static rfbBool check;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void countPixels(rfbClient *client, int x, int y, int w, int h)
+{
+	pixels += (double)w * h;
+	rects++;
+}
+
+/* updates with nothing but pseudo-encodings in them are not frames */
+static void countFrame(rfbClient *client)
+{
+	if (rects > 0)
+		frames++;
+	rects = 0;
+}
+
+static const char *encodingName(int32_t encoding)
+{
+	switch (encoding) {
+	case rfbEncodingRaw: return "raw";
+	case rfbEncodingCopyRect: return "copyRect";
+	case rfbEncodingRRE: return "RRE";
+	case rfbEncodingCoRRE: return "CoRRE";
+	case rfbEncodingHextile: return "hextile";
+	case rfbEncodingZlib: return "zlib";
+	case rfbEncodingTight: return "tight";
+	case rfbEncodingZlibHex: return "zlibhex";
+	case rfbEncodingUltra: return "ultra";
+	case rfbEncodingUltraZip: return "ultraZip";
+	case rfbEncodingTRLE: return "TRLE";
+	case rfbEncodingZRLE: return "ZRLE";
+	case rfbEncodingZYWRLE: return "ZYWRLE";
+	case rfbEncodingXCursor: return "Xcursor";
+	case rfbEncodingRichCursor: return "RichCursor";
+	case rfbEncodingPointerPos: return "PointerPos";
+	default: return "other";
+	}
+}
+
+/* with -check, compares the colours of the client's last frame with the
+   first file's; what decoders leave in the padding byte doesn't count */
+static rfbBool sameFrame(const char *file, rfbClient *client)
+{
+	static const char *firstFile;
+	static uint32_t *first;
+	static int size;
+	uint32_t *fb = (uint32_t *)client->frameBuffer, mask;
+	int n = client->width * client->height, i;
+
+	if (frames == 0) {
+		fprintf(stderr, "%s: no frames\n", file);
+		return FALSE;
+	}
+	mask = client->format.redMax << client->format.redShift |
+		client->format.greenMax << client->format.greenShift |
+		client->format.blueMax << client->format.blueShift;
+	if (first == NULL) {
+		first = malloc(n * sizeof(uint32_t));
+		if (first == NULL)
+			return FALSE;
+		for (i = 0; i < n; i++)
+			first[i] = fb[i] & mask;
+		size = n;
+		firstFile = file;
+		return TRUE;
+	}
+	for (i = 0; i < n && n == size; i++)
+		if ((fb[i] & mask) != first[i])
+			break;
+	if (n != size || i < n) {
+		fprintf(stderr, "%s: the last frame differs from %s's\n", file, firstFile);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* replays file once; prints the per-encoding times if verbose */
+static rfbBool replay(const char *file, int threads, rfbBool verbose, result_t *result)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	rfbClientDecodeStats *stats;
+	unsigned long allocated;
+	struct stat st;
+	rfbBool complete;
+	double t;
+
+	client->serverHost = strdup(file);
+	client->serverPort = -1;
+	client->decodeThreads = threads;
+	client->GotFrameBufferUpdate = countPixels;
+	client->FinishedFrameBufferUpdate = countFrame;
+	if (!rfbInitClient(client, NULL, NULL)) {
+		fprintf(stderr, "%s: could not start the replay\n", file);
+		return FALSE;
+	}
+	client->vncRec->doNotSleep = TRUE;
+
+	frames = rects = 0;
+	pixels = 0;
+	allocated = ALLOCATIONS;
+	t = now();
+	while (HandleRFBServerMessage(client))
+		;
+	result->seconds = now() - t;
+	result->allocations = ALLOCATIONS - allocated;
+	result->frames = frames;
+	result->pixels = pixels;
+
+	/* a decoder that gives up leaves the rest of the file unread */
+	complete = stat(file, &st) == 0 && ftell(client->vncRec->file) == st.st_size;
+	if (!complete)
+		fprintf(stderr, "%s: replay stopped at byte %ld of %ld\n", file,
+			ftell(client->vncRec->file), (long)st.st_size);
+	else if (check)
+		complete = sameFrame(file, client);
+
+	if (verbose) {
+		for (stats = client->decodeStats; stats; stats = stats->next)
+			printf("  %-12s %8u rects %10.1f Mpx %10.1f ms %5.1f%%\n",
+				encodingName(stats->encoding), stats->rects, stats->pixels / 1e6,
+				stats->seconds * 1000, 100 * stats->seconds / result->seconds);
+	}
+
+	rfbClientCleanup(client);
+	return complete;
+}
+
+int main(int argc, char **argv)
+{
+	int repeat = 3, threads = 0, failed = 0;
+	int i, r;
+
+	rfbEnableClientLogging = FALSE;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-check") == 0)
+			check = TRUE;
+		else if (i + 1 < argc && strcmp(argv[i], "-repeat") == 0)
+			repeat = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			threads = atoi(argv[++i]);
+		else
+			break;
+	}
+	if (i == argc || repeat < 1) {
+		fprintf(stderr, "Usage: %s [-check] [-repeat n] [-threads n] file...\n", argv[0]);
+		return 1;
+	}
+	if (check)
+		repeat = 1;
+
+	for (; i < argc; i++) {
+		result_t best = { 0, 0, -1, 0 }, result;
+		struct stat st;
+
+		if (stat(argv[i], &st) != 0) {
+			perror(argv[i]);
+			failed++;
+			continue;
+		}
+
+		printf("%s:\n", argv[i]);
+		for (r = 0; r < repeat; r++) {
+			if (!replay(argv[i], threads, r == repeat - 1, &result)) {
+				failed++;
+				break;
+			}
+			if (best.seconds < 0 || result.seconds < best.seconds)
+				best = result;
+		}
+		if (best.seconds <= 0)
+			continue;
+
+		printf("  %d frames, %.1f MB/s in, %.1f Mpx/s out, %.1f fps, %.1f allocations/frame\n",
+			best.frames, st.st_size / best.seconds / (1024 * 1024),
+			best.pixels / best.seconds / 1e6, best.frames / best.seconds,
+			best.frames ? (double)best.allocations / best.frames : 0.0);
+	}
+
+	return failed ? 1 : 0;
+}
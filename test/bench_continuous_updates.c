@@ -0,0 +1,349 @@
+/*
+ * bench_continuous_updates.c - compares asking for each update with
+ * continuous updates over a link with a round trip time. A libvncclient
+ * viewer forked off the server connects through a proxy thread that holds
+ * back everything for half the round trip in each direction, and may
+ * limit the bandwidth. The viewer reports each update it finishes through
+ * a pipe.
+ *
+ * Usage: bench_continuous_updates [-rtt ms] [-kbps n] [-seconds n] [-check]
+ *
+ * "flood" redraws a 320x320 window every 2 ms and counts the updates per
+ * second the viewer gets. "echo" then makes a small change while the
+ * flood goes on and takes the median ms until the viewer has it, which
+ * shows what the updates queued up on the link cost. The round trip and
+ * bandwidth the viewer measured with its fences are printed along.
+ * Defaults are a 100 ms round trip and no bandwidth limit. The exit status
+ * is non-zero if a change never arrives, continuous updates were not
+ * used when asked for or the fences measured less than half the round
+ * trip; -check is a 20 ms round trip and a 1 second flood.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "benchutil.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FLOOD_X 200
+#define FLOOD_Y 100
+#define FLOOD_SIZE 320
+#define ECHO_X 1000
+#define ECHO_Y 600
+#define ECHOES 20
+
+static int rtt = 100, kbps = 0, seconds = 3;
+
+/*
+ * The proxy: one thread per direction, holding each chunk read until half
+ * the round trip has passed, and then writing it no faster than kbps.
+ */
+
+typedef struct Chunk {
+	struct Chunk *next;
+	double due;
+	int len;
+	char data[16384];
+} Chunk;
+
+typedef struct {
+	int from, to;
+	Chunk *head, *tail;
+} Direction;
+
+static void *forward(void *arg)
+{
+	Direction *d = arg;
+	struct pollfd pfd;
+	double sent = 0;
+	Chunk *c;
+	int timeout, n;
+
+	pfd.fd = d->from;
+	pfd.events = POLLIN;
+	for (;;) {
+		timeout = -1;
+		if (d->head) {
+			timeout = (int)((d->head->due - benchNow()) * 1000);
+			if (timeout < 0)
+				timeout = 0;
+		}
+		if (pfd.fd >= 0 && poll(&pfd, 1, timeout) == 1) {
+			c = malloc(sizeof(Chunk));
+			n = read(d->from, c->data, sizeof(c->data));
+			if (n <= 0) {
+				free(c);
+				pfd.fd = -1;
+				if (d->head == NULL)
+					break;
+				continue;
+			}
+			c->len = n;
+			c->due = benchNow() + rtt / 2000.0;
+			c->next = NULL;
+			if (d->tail)
+				d->tail->next = c;
+			else
+				d->head = c;
+			d->tail = c;
+		} else if (pfd.fd < 0 && d->head == NULL) {
+			break;
+		} else if (pfd.fd < 0) {
+			usleep(1000);
+		}
+
+		while ((c = d->head) && c->due <= benchNow()) {
+			if (kbps > 0) {
+				/* the link takes this long for the chunk */
+				double start = sent > benchNow() ? sent : benchNow();
+				sent = start + c->len * 8.0 / (kbps * 1000.0);
+				if (sent > benchNow())
+					usleep((useconds_t)((sent - benchNow()) * 1000000));
+			}
+			if (write(d->to, c->data, c->len) != c->len)
+				pfd.fd = -1;
+			d->head = c->next;
+			if (d->head == NULL)
+				d->tail = NULL;
+			free(c);
+		}
+		if (pfd.fd < 0 && d->head == NULL)
+			break;
+	}
+	shutdown(d->to, SHUT_WR);
+	return NULL;
+}
+
+/* listens on a port of its own and relays one connection to the server */
+static void *proxy(void *arg)
+{
+	int *fds = arg, client, server;
+	struct sockaddr_in addr;
+	Direction up, down;
+	pthread_t t1, t2;
+
+	client = accept(fds[0], NULL, NULL);
+	close(fds[0]);
+	if (client < 0)
+		return NULL;
+	server = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(fds[1]);
+	if (connect(server, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(client);
+		close(server);
+		return NULL;
+	}
+
+	memset(&up, 0, sizeof(up));
+	memset(&down, 0, sizeof(down));
+	up.from = client;
+	up.to = server;
+	down.from = server;
+	down.to = client;
+	pthread_create(&t1, NULL, forward, &up);
+	pthread_create(&t2, NULL, forward, &down);
+	pthread_join(t1, NULL);
+	pthread_join(t2, NULL);
+	close(client);
+	close(server);
+	return NULL;
+}
+
+static int listenOnLoopback(int *port)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(sock, 1) < 0 || getsockname(sock, (struct sockaddr *)&addr, &len) < 0)
+		return -1;
+	*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+/*
+ * The viewer.
+ */
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port, rfbBool continuous, int reportFd, int statsFd)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	int stats[2];
+
+	client->appData.encodingsString = "zlib";
+	client->appData.compressLevel = 1;
+	client->continuousUpdates = continuous;
+	benchReportUpdates(client, reportFd, ECHO_X, ECHO_Y);
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+	stats[0] = client->latency;
+	stats[1] = (int)client->bandwidth;
+	write(statsFd, stats, sizeof(stats));
+	_exit(!client->continuousUpdatesActive == !continuous ? 0 : 3);
+}
+
+/* redraws the flood window, returns the frame number after it */
+static int flood(rfbScreenInfoPtr screen, int frame)
+{
+	benchNoise((uint32_t *)screen->frameBuffer, WIDTH, FLOOD_X, FLOOD_Y, FLOOD_SIZE, frame);
+	rfbMarkRectAsModified(screen, FLOOD_X, FLOOD_Y, FLOOD_X + FLOOD_SIZE, FLOOD_Y + FLOOD_SIZE);
+	usleep(2000);
+	return frame + 1;
+}
+
+/*
+ * Fills in the updates per second, the echo time under the flood and the
+ * viewer's measurements. Returns FALSE on failure.
+ */
+static rfbBool run(rfbBool continuous, double *fps, double *echo, int *latency, int *bandwidth)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	double times[ECHOES], t, end;
+	int reportFds[2], statsFds[2], proxyFds[2], proxyPort, i, status, updates, frame = 0, seen;
+	int stats[2] = { -1, -1 };
+	rfbBool ok = TRUE;
+	pthread_t proxyThread;
+	pid_t pid;
+
+	rfbInitServer(screen);
+
+	proxyFds[0] = listenOnLoopback(&proxyPort);
+	proxyFds[1] = screen->port;
+	if (proxyFds[0] < 0 || pipe(reportFds) < 0 || pipe(statsFds) < 0)
+		return FALSE;
+	pthread_create(&proxyThread, NULL, proxy, proxyFds);
+
+	pid = benchForkViewer(screen);
+	if (pid == 0) {
+		close(reportFds[0]);
+		close(statsFds[0]);
+		close(proxyFds[0]);
+		viewer(proxyPort, continuous, reportFds[1], statsFds[1]);
+	}
+	close(reportFds[1]);
+	close(statsFds[1]);
+
+	rfbRunEventLoop(screen, -1, TRUE);
+
+	if (!benchWaitForUpdate(reportFds[0])) {
+		fprintf(stderr, "the viewer did not connect\n");
+		ok = FALSE;
+	}
+
+	/* faster than anybody can take them */
+	fcntl(reportFds[0], F_SETFL, O_NONBLOCK);
+	usleep(rtt * 2000);
+	benchCountUpdates(reportFds[0], &seen);
+	updates = 0;
+	t = benchNow();
+	end = t + seconds;
+	while (ok && benchNow() < end) {
+		frame = flood(screen, frame);
+		updates += benchCountUpdates(reportFds[0], &seen);
+	}
+	t = benchNow() - t;
+	*fps = updates / t;
+
+	/* a key press in another window meanwhile */
+	for (i = 0; i < ECHOES && ok; i++) {
+		memset(screen->frameBuffer + (ECHO_Y * WIDTH + ECHO_X) * 4, i + 1, 4);
+		seen = 0;
+		t = benchNow();
+		rfbMarkRectAsModified(screen, ECHO_X, ECHO_Y, ECHO_X + 1, ECHO_Y + 1);
+		while (!seen && benchNow() - t < 10) {
+			frame = flood(screen, frame);
+			benchCountUpdates(reportFds[0], &seen);
+		}
+		if (!seen) {
+			fprintf(stderr, "change %d did not arrive\n", i);
+			ok = FALSE;
+		}
+		times[i] = (benchNow() - t) * 1000;
+	}
+
+	rfbShutdownServer(screen, TRUE);
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "continuous updates were%s used\n", continuous ? " not" : "");
+		ok = FALSE;
+	}
+	if (read(statsFds[0], stats, sizeof(stats)) != sizeof(stats))
+		stats[0] = stats[1] = -1;
+	pthread_join(proxyThread, NULL);
+	close(reportFds[0]);
+	close(statsFds[0]);
+	benchScreenFree(screen);
+
+	*latency = stats[0];
+	*bandwidth = stats[1];
+	if (ok)
+		*echo = benchMedian(times, ECHOES);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int i, failed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-rtt") == 0)
+			rtt = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-kbps") == 0)
+			kbps = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-seconds") == 0)
+			seconds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0) {
+			rtt = 20;
+			seconds = 1;
+		} else {
+			fprintf(stderr, "Usage: %s [-rtt ms] [-kbps n] [-seconds n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rtt < 0 || kbps < 0 || seconds < 1) {
+		fprintf(stderr, "need a round trip, a bandwidth and at least one second\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%dx%d, zlib, %d ms round trip, %s\n", WIDTH, HEIGHT, rtt,
+	       kbps ? "limited bandwidth" : "unlimited bandwidth");
+	printf("  %-12s %10s %8s %14s %12s\n", "", "flood fps", "echo ms", "viewer rtt ms", "viewer KB/s");
+	for (i = 0; i < 2; i++) {
+		double fps = -1, echo = -1;
+		int latency = -1, bandwidth = -1;
+
+		if (!run(i == 1, &fps, &echo, &latency, &bandwidth))
+			failed++;
+		else if (latency < rtt / 2) {
+			fprintf(stderr, "the fences measured a %d ms round trip\n", latency);
+			failed++;
+		}
+		printf("  %-12s %10.1f %8.1f %14d %12d\n", i ? "continuous" : "requests",
+		       fps, echo, latency, bandwidth / 1024);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * bench_damage.c - measures how long finding the changed parts of a
+ * polled 1080p and 4K framebuffer takes, with rfbCopyDamage() and
+ * rfbFindDamage() on one and on several threads, against the row by row
+ * per-pixel memcmp() the X11 example server used before.
+ *
+ * Usage: bench_damage [-frames n] [-threads n] [-check]
+ *
+ * Each frame flips the source between two pictures that differ as a
+ * desktop does from one grab to the next: not at all, in a few glyphs
+ * and a blinking cursor, in a window a ninth the size of the screen, or
+ * everywhere but in flat areas. Reported are ms per frame and the share of the screen that
+ * was marked as modified. Every copy is checked to leave the framebuffer
+ * equal to the source, and the exit status is non-zero if one did not.
+ * -check times nothing and instead has a client on a socket pair check
+ * that what was marked covers every changed pixel, on a screen whose
+ * size is no multiple of the tile size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+
+enum { IDLE, TYPING, WINDOW, VIDEO, SCENES };
+static const char *sceneNames[SCENES] = { "idle", "typing", "window", "video" };
+
+static int frames = 60, threads = 4, failures = 0;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* a desktop with flat window areas and some busy ones */
+static uint32_t pixel(int x, int y, int seed)
+{
+	if ((x / 160 + y / 120) % 3 == 0)
+		return 0xc0c0c0;
+	return ((x + seed * 4) & 0xff) | ((y * 2 + seed) & 0xff) << 8 | (((x ^ y) >> 3) * 8 & 0xff) << 16;
+}
+
+static void fill(uint32_t *p, int width, int x0, int y0, int w, int h, int seed)
+{
+	int x, y;
+
+	for (y = y0; y < y0 + h; y++)
+		for (x = x0; x < x0 + w; x++)
+			p[y * width + x] = pixel(x, y, seed);
+}
+
+/* draws the second picture of a scene over a copy of the first */
+static void change(uint32_t *p, int width, int height, int scene)
+{
+	int i;
+
+	switch (scene) {
+	case TYPING:
+		for (i = 0; i < 20; i++)
+			fill(p, width, width / 4 + i * 9, height / 2, 8, 16, 1);
+		fill(p, width, width / 4 + 20 * 9, height / 2, 2, 16, 2);
+		break;
+	case WINDOW:
+		fill(p, width, width / 3, height / 3, width / 3, height / 3, 1);
+		break;
+	case VIDEO:
+		fill(p, width, 0, 0, width, height, 1);
+		break;
+	}
+}
+
+/* the X11 example's dirty_copy(): compares pixel by pixel, marks rows */
+static int copyRows(rfbScreenInfoPtr screen, const char *data)
+{
+	int width = screen->width, x, y, rows = 0;
+	rfbBool dirty;
+
+	for (y = 0; y < screen->height; y++) {
+		dirty = FALSE;
+		for (x = 0; x < width; x++)
+			if (memcmp(&screen->frameBuffer[(y * width + x) * 4], &data[(y * width + x) * 4], 4) != 0) {
+				dirty = TRUE;
+				break;
+			}
+		if (dirty) {
+			memcpy(&screen->frameBuffer[y * width * 4], &data[y * width * 4], width * 4);
+			rfbMarkRectAsModified(screen, 0, y, width, y + 1);
+			rows++;
+		}
+	}
+	return rows;
+}
+
+enum { ROWS, COPY, COPY_THREADS, HASH, HASH_THREADS, METHODS };
+
+/* ms per frame for a method and scene, and the share that was marked */
+static double run(rfbScreenInfoPtr screen, char **pictures, int method, double *marked)
+{
+	rfbDamageDetectorPtr d = NULL;
+	size_t size = (size_t)screen->width * screen->height * 4;
+	double t, spent = 0, area = 0;
+	int i, n;
+
+	if (method != ROWS)
+		d = rfbNewDamageDetector(screen, method == COPY_THREADS || method == HASH_THREADS ? threads : 1);
+	memcpy(screen->frameBuffer, pictures[0], size);
+	if (method == HASH || method == HASH_THREADS)
+		rfbFindDamage(d);
+
+	for (i = 1; i <= frames; i++) {
+		const char *picture = pictures[i % 2];
+
+		if (method == HASH || method == HASH_THREADS)
+			memcpy(screen->frameBuffer, picture, size);
+		t = now();
+		switch (method) {
+		case ROWS:
+			n = copyRows(screen, picture);
+			area += (double)n * screen->width;
+			break;
+		case COPY:
+		case COPY_THREADS:
+			n = rfbCopyDamage(d, picture, screen->width * 4);
+			area += n * 32.0 * 32.0;
+			break;
+		default:
+			n = rfbFindDamage(d);
+			area += n * 32.0 * 32.0;
+			break;
+		}
+		spent += now() - t;
+		if (memcmp(screen->frameBuffer, picture, size) != 0)
+			failures++;
+	}
+
+	if (d)
+		rfbFreeDamageDetector(d);
+	*marked = area / frames / screen->width / screen->height * 100;
+	if (*marked > 100)
+		*marked = 100;
+	return spent / frames * 1000;
+}
+
+/* TRUE if the client's modified region covers every pixel that differs */
+static rfbBool covered(rfbClientPtr cl, const uint32_t *before, const uint32_t *after)
+{
+	int width = cl->screen->width, height = cl->screen->height, x, y;
+	char *marked = calloc(width, height);
+	sraRectangleIterator *i = sraRgnGetIterator(cl->modifiedRegion);
+	rfbBool ok = TRUE;
+	sraRect r;
+
+	while (sraRgnIteratorNext(i, &r))
+		for (y = r.y1; y < r.y2; y++)
+			memset(marked + y * width + r.x1, 1, r.x2 - r.x1);
+	sraRgnReleaseIterator(i);
+
+	for (y = 0; y < height && ok; y++)
+		for (x = 0; x < width && ok; x++)
+			if (before[y * width + x] != after[y * width + x] && !marked[y * width + x])
+				ok = FALSE;
+	free(marked);
+	return ok;
+}
+
+static int check(void)
+{
+	static const char *methodNames[METHODS] = { "", "copy", "copy threads", "hash", "hash threads" };
+	int width = 1003, height = 601, scene, method, fds[2], failed = 0;
+	size_t size = (size_t)width * height * 4;
+	rfbScreenInfoPtr screen = rfbGetScreen(NULL, NULL, width, height, 8, 3, 4);
+	char *pictures[2];
+	rfbDamageDetectorPtr d;
+	rfbClientPtr cl;
+
+	screen->frameBuffer = malloc(size);
+	pictures[0] = malloc(size);
+	pictures[1] = malloc(size);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 || (cl = rfbNewClient(screen, fds[0])) == NULL) {
+		fprintf(stderr, "could not make a client\n");
+		return 1;
+	}
+
+	for (scene = 0; scene < SCENES; scene++) {
+		fill((uint32_t *)pictures[0], width, 0, 0, width, height, 0);
+		memcpy(pictures[1], pictures[0], size);
+		change((uint32_t *)pictures[1], width, height, scene);
+
+		for (method = COPY; method < METHODS; method++) {
+			rfbBool ok;
+
+			d = rfbNewDamageDetector(screen, method == COPY_THREADS || method == HASH_THREADS ? threads : 1);
+			memcpy(screen->frameBuffer, pictures[0], size);
+			if (method == HASH || method == HASH_THREADS) {
+				rfbFindDamage(d);
+				sraRgnMakeEmpty(cl->modifiedRegion);
+				memcpy(screen->frameBuffer, pictures[1], size);
+				rfbFindDamage(d);
+			} else {
+				sraRgnMakeEmpty(cl->modifiedRegion);
+				rfbCopyDamage(d, pictures[1], width * 4);
+			}
+			rfbFreeDamageDetector(d);
+
+			ok = memcmp(screen->frameBuffer, pictures[1], size) == 0 &&
+				covered(cl, (uint32_t *)pictures[0], (uint32_t *)pictures[1]) &&
+				(scene != IDLE || sraRgnEmpty(cl->modifiedRegion));
+			if (!ok)
+				failed++;
+			printf("%s, %s: %s\n", sceneNames[scene], methodNames[method], ok ? "ok" : "FAILED");
+		}
+	}
+
+	close(fds[1]);
+	free(pictures[0]);
+	free(pictures[1]);
+	free(screen->frameBuffer);
+	rfbScreenCleanup(screen);
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	static const char *methodNames[METHODS] = { "rows", "copy", "copy", "hash", "hash" };
+	rfbScreenInfoPtr screen;
+	char *pictures[2];
+	double ms, marked;
+	int i, s, scene, method;
+	rfbBool checking = FALSE;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			frames = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0)
+			checking = TRUE;
+		else {
+			fprintf(stderr, "Usage: %s [-frames n] [-threads n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 1)
+		frames = 1;
+
+	rfbLogEnable(0);
+	if (checking)
+		return check();
+
+	for (s = 0; s < 2; s++) {
+		int width = sizes[s][0], height = sizes[s][1];
+		size_t size = (size_t)width * height * 4;
+
+		screen = rfbGetScreen(NULL, NULL, width, height, 8, 3, 4);
+		screen->frameBuffer = malloc(size);
+		pictures[0] = malloc(size);
+		pictures[1] = malloc(size);
+
+		printf("%dx%d, ms per frame (%% of the screen marked)\n", width, height);
+		printf("  %-8s", "");
+		for (method = 0; method < METHODS; method++) {
+			char name[32];
+
+			if (method == COPY_THREADS || method == HASH_THREADS)
+				snprintf(name, sizeof(name), "%s x%d", methodNames[method], threads);
+			else
+				snprintf(name, sizeof(name), "%s", methodNames[method]);
+			printf(" %18s", name);
+		}
+		printf("\n");
+
+		for (scene = 0; scene < SCENES; scene++) {
+			fill((uint32_t *)pictures[0], width, 0, 0, width, height, 0);
+			memcpy(pictures[1], pictures[0], size);
+			change((uint32_t *)pictures[1], width, height, scene);
+
+			printf("  %-8s", sceneNames[scene]);
+			for (method = 0; method < METHODS; method++) {
+				ms = run(screen, pictures, method, &marked);
+				printf(" %8.2f (%6.2f%%)", ms, marked);
+				fflush(stdout);
+			}
+			printf("\n");
+		}
+
+		free(pictures[0]);
+		free(pictures[1]);
+		free(screen->frameBuffer);
+		rfbScreenCleanup(screen);
+	}
+
+	if (failures)
+		fprintf(stderr, "%d frames were not copied right\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * bench_encode_cache.c - measures the CPU time the server spends sending
+ * an update to 1, 2, 4, ... identical viewers, with and without
+ * rfbScreenInfo::encodeCache. The viewers are libvncclient processes
+ * forked off the server, so only the server's own time is counted; the
+ * framebuffer is redrawn and marked as modified before every frame, which
+ * is not counted either.
+ *
+ * Usage: bench_encode_cache [-frames n] [-viewers n] [-encoding name]
+ *                           [-quality n] [-cache kbytes] [-check]
+ *
+ * The defaults are 30 frames, up to 16 viewers, hextile and a 32 MB cache.
+ * Without a -quality and other than with ZYWRLE every viewer checks that
+ * it ended up with the last frame, and the exit status is non-zero if one
+ * did not. Tight only shares what it sends as JPEG or solid fills, so
+ * give it a -quality. -check times nothing and only has two viewers that
+ * share the cache check three frames of hextile, ZRLE and Tight each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "benchutil.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define MAX_VIEWERS 64
+
+static int frames = 30, quality = -1;
+static const char *encoding = "hextile";
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+
+	client->appData.encodingsString = encoding;
+	client->appData.qualityLevel = quality < 0 ? 5 : quality;
+	client->appData.enableJPEG = quality >= 0;
+	client->appData.useRemoteCursor = TRUE;
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+
+	if (benchLossless(encoding, quality) &&
+	    !benchShowsFrame(client, benchDesktopPixel, frames))
+		_exit(1);
+	_exit(0);
+}
+
+/* returns the server CPU time per frame in ms, or -1 on failure */
+static double run(int viewers, int cacheSize)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	pid_t pids[MAX_VIEWERS];
+	double cpu = 0, t;
+	int i, f, status, failed = 0;
+
+	screen->deferUpdateTime = 0;
+	screen->encodeCacheSize = cacheSize;
+	benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, 0, benchDesktopPixel);
+	rfbInitServer(screen);
+
+	for (i = 0; i < viewers; i++) {
+		pids[i] = benchForkViewer(screen);
+		if (pids[i] == 0)
+			viewer(screen->port);
+	}
+
+	if (!benchProcessUntilSent(screen, viewers)) {
+		fprintf(stderr, "viewers did not connect\n");
+		failed = 1;
+	}
+
+	for (f = 1; f <= frames && !failed; f++) {
+		benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, f, benchDesktopPixel);
+		rfbMarkRectAsModified(screen, 0, 0, WIDTH, HEIGHT);
+		t = benchCpuTime();
+		if (!benchProcessUntilSent(screen, viewers)) {
+			fprintf(stderr, "frame %d was not sent\n", f);
+			failed = 1;
+		}
+		cpu += benchCpuTime() - t;
+	}
+
+	rfbShutdownServer(screen, TRUE);
+	for (i = 0; i < viewers; i++) {
+		if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "viewer %d did not end up with the last frame\n", i);
+			failed = 1;
+		}
+	}
+	benchScreenFree(screen);
+
+	return failed ? -1 : 1000 * cpu / frames;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *checked[] = { "hextile", "zrle", "tight" };
+	int maxViewers = 16, cacheSize = 32 * 1024 * 1024;
+	int i, failed = 0;
+	rfbBool check = FALSE;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			frames = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-viewers") == 0)
+			maxViewers = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-encoding") == 0)
+			encoding = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-quality") == 0)
+			quality = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-cache") == 0)
+			cacheSize = atoi(argv[++i]) * 1024;
+		else if (strcmp(argv[i], "-check") == 0)
+			check = TRUE;
+		else {
+			fprintf(stderr, "Usage: %s [-frames n] [-viewers n] [-encoding name] [-quality n] [-cache kbytes] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 1 || maxViewers < 1 || maxViewers > MAX_VIEWERS) {
+		fprintf(stderr, "need at least one frame and 1 to %d viewers\n", MAX_VIEWERS);
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	if (check) {
+		frames = 3;
+		quality = -1;
+		for (i = 0; i < (int)(sizeof(checked) / sizeof(checked[0])); i++) {
+			rfbBool ok;
+
+			encoding = checked[i];
+			ok = run(2, cacheSize) >= 0;
+			if (!ok)
+				failed++;
+			printf("%s with the cache: %s\n", encoding, ok ? "ok" : "FAILED");
+		}
+		return failed ? 1 : 0;
+	}
+
+	printf("%s, %dx%d, %d frames, server CPU ms/frame\n", encoding, WIDTH, HEIGHT, frames);
+	printf("  viewers   no cache      cache\n");
+	for (i = 1; i <= maxViewers; i *= 2) {
+		double off = run(i, 0), on = run(i, cacheSize);
+
+		if (off < 0 || on < 0)
+			failed++;
+		printf("  %7d %10.2f %10.2f\n", i, off, on);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * bench_frame_pacing.c - compares deferring every update by
+ * rfbScreenInfo::deferUpdateTime with pacing them by rfbScreenInfo::
+ * maxFrameRate, with the server's event loop running in the background.
+ * A libvncclient viewer forked off the server reports each update it
+ * finishes through a pipe.
+ *
+ * Usage: bench_frame_pacing [-echoes n] [-seconds n] [-maxfps n] [-check]
+ *
+ * Two things are measured per setting: "echo" is the median ms from a
+ * small change, like a typed character, until the viewer has it, over 50
+ * changes by default. "flood" redraws a 320x320 window every 2 ms for 2
+ * seconds and counts the updates per second the viewer gets, along with
+ * the process' CPU ms per update, drawing included. The pacer is run at
+ * 60 frames per second unless told otherwise. The exit status is non-zero
+ * if a change never arrives, or the pacer lets through half as many
+ * updates again as it should. -check runs 5 echoes and a 1 second flood
+ * with the pacer at 20 frames per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "benchutil.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FLOOD_X 200
+#define FLOOD_Y 100
+#define FLOOD_SIZE 320
+
+static int echoes = 50, seconds = 2, maxfps = 60;
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port, int reportFd)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+
+	client->appData.encodingsString = "zlib";
+	client->appData.compressLevel = 1;
+	benchReportUpdates(client, reportFd, -1, -1);
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+	_exit(0);
+}
+
+/*
+ * Fills in the echo time, the updates per second and the CPU ms per update
+ * with the given pacing. Returns FALSE on failure.
+ */
+static rfbBool run(int deferUpdateTime, int maxFrameRate, double *echo, double *fps, double *cpu)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	double *times = malloc(echoes * sizeof(double)), t, end;
+	int pipeFds[2], i, status, updates, frame;
+	rfbBool ok = TRUE;
+	pid_t pid;
+
+	screen->deferUpdateTime = deferUpdateTime;
+	screen->maxFrameRate = maxFrameRate;
+	rfbInitServer(screen);
+
+	if (pipe(pipeFds) < 0)
+		return FALSE;
+	pid = benchForkViewer(screen);
+	if (pid == 0) {
+		close(pipeFds[0]);
+		viewer(screen->port, pipeFds[1]);
+	}
+	close(pipeFds[1]);
+
+	rfbRunEventLoop(screen, -1, TRUE);
+
+	if (!benchWaitForUpdate(pipeFds[0])) {
+		fprintf(stderr, "the viewer did not connect\n");
+		ok = FALSE;
+	}
+
+	/* one change at a time, each after the last one arrived */
+	for (i = 0; i < echoes && ok; i++) {
+		int x = i * 16 % (WIDTH - 16), y = i * 8 % (HEIGHT - 16);
+
+		usleep(20000);
+		memset(screen->frameBuffer + (y * WIDTH + x) * 4, i + 1, 8 * 4);
+		t = benchNow();
+		rfbMarkRectAsModified(screen, x, y, x + 8, y + 1);
+		if (!benchWaitForUpdate(pipeFds[0])) {
+			fprintf(stderr, "change %d did not arrive\n", i);
+			ok = FALSE;
+		}
+		times[i] = (benchNow() - t) * 1000;
+	}
+
+	/* and faster than anybody can take them */
+	fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+	benchCountUpdates(pipeFds[0], NULL);
+	updates = 0;
+	*cpu = benchCpuTime();
+	t = benchNow();
+	end = t + seconds;
+	for (frame = 0; ok && benchNow() < end; frame++) {
+		benchNoise((uint32_t *)screen->frameBuffer, WIDTH, FLOOD_X, FLOOD_Y, FLOOD_SIZE, frame);
+		rfbMarkRectAsModified(screen, FLOOD_X, FLOOD_Y, FLOOD_X + FLOOD_SIZE, FLOOD_Y + FLOOD_SIZE);
+		usleep(2000);
+		updates += benchCountUpdates(pipeFds[0], NULL);
+	}
+	t = benchNow() - t;
+	updates += benchCountUpdates(pipeFds[0], NULL);
+	*cpu = updates ? 1000 * (benchCpuTime() - *cpu) / updates : -1;
+	*fps = updates / t;
+
+	rfbShutdownServer(screen, TRUE);
+	waitpid(pid, &status, 0);
+	close(pipeFds[0]);
+	benchScreenFree(screen);
+
+	if (ok)
+		*echo = benchMedian(times, echoes);
+	free(times);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		int deferUpdateTime, maxFrameRate;
+	} settings[] = {
+		{ "defer 5 ms", 5, 0 },
+		{ "defer 40 ms", 40, 0 },
+		{ "no defer", 0, 0 },
+		{ "paced", 5, -1 }
+	};
+	int i, failed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-echoes") == 0)
+			echoes = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-seconds") == 0)
+			seconds = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-maxfps") == 0)
+			maxfps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0) {
+			echoes = 5;
+			seconds = 1;
+			maxfps = 20;
+		} else {
+			fprintf(stderr, "Usage: %s [-echoes n] [-seconds n] [-maxfps n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (echoes < 1 || seconds < 1 || maxfps < 1) {
+		fprintf(stderr, "need at least one echo, second and frame per second\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%dx%d, zlib, echo: median ms for a small change, flood: updates/s and server CPU ms/update\n",
+	       WIDTH, HEIGHT);
+	printf("  %-16s %8s %10s %8s\n", "", "echo ms", "flood fps", "cpu ms");
+	for (i = 0; i < (int)(sizeof(settings) / sizeof(settings[0])); i++) {
+		double echo = -1, fps = -1, cpu = -1;
+		char name[32];
+		int rate = settings[i].maxFrameRate < 0 ? maxfps : settings[i].maxFrameRate;
+
+		if (!run(settings[i].deferUpdateTime, rate, &echo, &fps, &cpu))
+			failed++;
+		else if (rate > 0 && fps > rate * 1.5) {
+			fprintf(stderr, "%d updates per second at %d frames per second\n", (int)fps, rate);
+			failed++;
+		}
+		if (rate > 0)
+			snprintf(name, sizeof(name), "%s %d fps", settings[i].name, rate);
+		else
+			snprintf(name, sizeof(name), "%s", settings[i].name);
+		printf("  %-16s %8.2f %10.1f %8.2f\n", name, echo, fps, cpu);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
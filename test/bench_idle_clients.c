@@ -0,0 +1,278 @@
+/*
+ * bench_idle_clients.c - measures how long the server takes to act on one
+ * client's key press while more and more other clients sit idle, with
+ * rfbCheckFds() waiting on select() and on epoll. The idle clients are
+ * plain sockets in a forked process that get through the handshake and
+ * then send nothing.
+ *
+ * Usage: bench_idle_clients [-clients n] [-events n] [-check]
+ *
+ * The defaults are up to 4000 idle clients and 200 key presses. Two times
+ * are printed per run, in microseconds, as the median over the key
+ * presses: "dispatch" is rfbCheckFds() alone, "loop" is rfbProcessEvents(),
+ * which also walks all clients for pending updates. select() cannot watch
+ * sockets from FD_SETSIZE on, so it sits out the bigger runs. Every key
+ * press has to be handled exactly once within 10 s, or the exit status is
+ * non-zero; -check stops at 250 idle clients and 20 key presses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <rfb/rfb.h>
+
+static int events = 200;
+static volatile int keys;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void gotKey(rfbBool down, rfbKeySym key, rfbClientPtr cl)
+{
+	keys++;
+}
+
+static int connectTo(int port)
+{
+	struct sockaddr_in addr;
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*
+ * Reads len bytes from sock. If screen is not NULL the server runs in this
+ * process and gets to handle events while we wait.
+ */
+static rfbBool readAll(rfbScreenInfoPtr screen, int sock, char *buf, int len)
+{
+	int n, tries = 0;
+
+	while (len > 0) {
+		if (screen)
+			rfbProcessEvents(screen, 1000);
+		n = recv(sock, buf, len, screen ? MSG_DONTWAIT : 0);
+		if (n > 0) {
+			buf += n;
+			len -= n;
+		} else if (n == 0 || (errno != EAGAIN && errno != EINTR) || ++tries > 10000) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * RFB 3.8 without authentication up to the ServerInit message. The version
+ * goes out before the server's arrives, or a server built with WebSockets
+ * support waits for a while in case an HTTP request comes instead.
+ */
+static rfbBool handshake(rfbScreenInfoPtr screen, int sock)
+{
+	char buf[256];
+	uint32_t nameLength;
+
+	if (write(sock, "RFB 003.008\n", sz_rfbProtocolVersionMsg) != sz_rfbProtocolVersionMsg ||
+	    !readAll(screen, sock, buf, sz_rfbProtocolVersionMsg) ||
+	    !readAll(screen, sock, buf, 2) || buf[0] != 1 || buf[1] != rfbNoAuth ||
+	    write(sock, "\1", 1) != 1 || !readAll(screen, sock, buf, 4) ||
+	    write(sock, "\1", 1) != 1 || !readAll(screen, sock, buf, sz_rfbServerInitMsg))
+		return FALSE;
+	memcpy(&nameLength, buf + sz_rfbServerInitMsg - 4, 4);
+	nameLength = ntohl(nameLength);
+	return nameLength < sizeof(buf) && readAll(screen, sock, buf, nameLength);
+}
+
+/* runs in a child process: connects n clients, reports, waits for the end */
+static void idleClients(int port, int n, int pipeFd)
+{
+	char result = 1;
+	int i, sock;
+
+	for (i = 0; i < n; i++) {
+		sock = connectTo(port);
+		if (sock < 0 || !handshake(NULL, sock)) {
+			result = 0;
+			break;
+		}
+	}
+	write(pipeFd, &result, 1);
+	/* the parent closes its end when it is done */
+	read(pipeFd, &result, 1);
+	_exit(0);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return d < 0 ? -1 : d > 0;
+}
+
+/* median time in us from sending a key press to the server handling it */
+static double measure(rfbScreenInfoPtr screen, int sock, rfbBool loop)
+{
+	rfbKeyEventMsg ke;
+	double *times = malloc(events * sizeof(double)), t, median;
+	int i, k;
+
+	memset(&ke, 0, sizeof(ke));
+	ke.type = rfbKeyEvent;
+	ke.down = 1;
+	ke.key = htonl(0x61);
+	for (i = 0; i < events; i++) {
+		k = keys;
+		if (write(sock, &ke, sz_rfbKeyEventMsg) != sz_rfbKeyEventMsg)
+			break;
+		t = now();
+		while (keys == k && now() - t < 10) {
+			if (loop)
+				rfbProcessEvents(screen, 100000);
+			else
+				rfbCheckFds(screen, 100000);
+		}
+		if (keys != k + 1)
+			break;
+		times[i] = (now() - t) * 1000000;
+	}
+	if (i < events) {
+		free(times);
+		return -1;
+	}
+	qsort(times, events, sizeof(double), compareDoubles);
+	median = times[events / 2];
+	free(times);
+	return median;
+}
+
+/* fills in the two times for n idle clients, returns FALSE on failure */
+static rfbBool run(int n, rfbBool useSelect, double *dispatch, double *loop)
+{
+	rfbScreenInfoPtr screen = rfbGetScreen(NULL, NULL, 64, 64, 8, 3, 4);
+	int pipeFds[2], sock, status;
+	rfbBool ok = FALSE;
+	char ready = 0;
+	pid_t pid;
+
+	screen->frameBuffer = calloc(64 * 64, 4);
+	screen->autoPort = TRUE;
+	screen->ipv6port = 0;
+	screen->alwaysShared = TRUE;
+	screen->useSelect = useSelect;
+	screen->fdQuota = 0.9;
+	screen->kbdAddEvent = gotKey;
+	rfbInitServer(screen);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pipeFds) < 0)
+		return FALSE;
+	pid = fork();
+	if (pid == 0) {
+		close(pipeFds[0]);
+		close(screen->listenSock);
+		idleClients(screen->port, n, pipeFds[1]);
+	}
+	close(pipeFds[1]);
+
+	/* serve the handshakes until the child says it is through */
+	while (recv(pipeFds[0], &ready, 1, MSG_DONTWAIT) != 1)
+		rfbProcessEvents(screen, 1000);
+
+	if (ready && (sock = connectTo(screen->port)) >= 0) {
+		if (handshake(screen, sock)) {
+			*dispatch = measure(screen, sock, FALSE);
+			*loop = measure(screen, sock, TRUE);
+			ok = *dispatch >= 0 && *loop >= 0;
+		}
+		close(sock);
+	}
+
+	rfbShutdownServer(screen, TRUE);
+	close(pipeFds[0]);
+	waitpid(pid, &status, 0);
+	free(screen->frameBuffer);
+	rfbScreenCleanup(screen);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int maxClients = 4000, failed = 0;
+	struct rlimit rlim;
+	int i, n;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-clients") == 0)
+			maxClients = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-events") == 0)
+			events = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0) {
+			maxClients = 250;
+			events = 20;
+		} else {
+			fprintf(stderr, "Usage: %s [-clients n] [-events n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (maxClients < 0 || events < 1) {
+		fprintf(stderr, "need at least one event\n");
+		return 1;
+	}
+
+	/*
+	 * The server keeps one socket per client, so does the child. Don't go
+	 * much higher: the server scans the whole limit on every connection.
+	 */
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+		rlim.rlim_cur = (rlim_t)maxClients * 5 / 4 + 64;
+		if (rlim.rlim_max != RLIM_INFINITY && rlim.rlim_cur > rlim.rlim_max)
+			rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	rfbLogEnable(FALSE);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("us from key press to kbdAddEvent, median of %d\n", events);
+	printf("  clients  select dispatch  select loop  epoll dispatch  epoll loop\n");
+	for (n = 0; n <= maxClients; n = n ? n * 2 : 250) {
+		double selectDispatch = -1, selectLoop = -1, epollDispatch, epollLoop;
+
+		if (n + 16 < FD_SETSIZE && !run(n, TRUE, &selectDispatch, &selectLoop))
+			failed++;
+		if (!run(n, FALSE, &epollDispatch, &epollLoop)) {
+			failed++;
+			epollDispatch = epollLoop = -1;
+		}
+
+		printf("  %7d", n);
+		if (selectDispatch >= 0)
+			printf(" %16.1f %12.1f", selectDispatch, selectLoop);
+		else
+			printf(" %16s %12s", "-", "-");
+		printf(" %15.1f %11.1f\n", epollDispatch, epollLoop);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * bench_parallel_encode.c - measures how long the server takes to send a
+ * full-screen 3840x2160 update with rfbScreenInfo::encodeThreads at 1, 2,
+ * 4, ... threads. The viewer is a libvncclient process forked off the
+ * server, which answers every update with the next request; the time
+ * counted is from marking the screen as modified until the whole update
+ * has been written, not redrawing the framebuffer.
+ *
+ * Usage: bench_parallel_encode [-frames n] [-threads n] [-encoding name]
+ *                              [-quality n] [-check]
+ *
+ * The defaults are 10 frames, up to 8 threads and Tight without JPEG.
+ * With lossless encodings the viewer checks that it ended up with the
+ * last frame, and the exit status is non-zero if it did not. The times
+ * only go down with the thread count if there are cores for the threads
+ * besides the one the viewer decodes on. -check times nothing and only
+ * has the viewer check two frames of Tight, hextile and RRE sent on 4
+ * threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "benchutil.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+
+static int frames = 10, quality = -1;
+static const char *encoding = "tight";
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	char encodings[64];
+
+	/* Tight after the encoding under test has the viewer ask for
+	   LastRect markers, which updates on several threads need */
+	snprintf(encodings, sizeof(encodings), "%s tight", encoding);
+	client->appData.encodingsString = encodings;
+	client->appData.qualityLevel = quality < 0 ? 5 : quality;
+	client->appData.enableJPEG = quality >= 0;
+	client->appData.useRemoteCursor = TRUE;
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+
+	if (benchLossless(encoding, quality) &&
+	    !benchShowsFrame(client, benchDesktopPixel, frames))
+		_exit(1);
+	_exit(0);
+}
+
+/* returns the time per frame in ms, or -1 on failure */
+static double run(int threads)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	double time = 0, t;
+	pid_t pid;
+	int f, status, failed = 0;
+
+	screen->deferUpdateTime = 0;
+	screen->encodeThreads = threads;
+	benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, 0, benchDesktopPixel);
+	rfbInitServer(screen);
+
+	pid = benchForkViewer(screen);
+	if (pid == 0)
+		viewer(screen->port);
+
+	if (!benchProcessUntilSent(screen, 1)) {
+		fprintf(stderr, "viewer did not connect\n");
+		failed = 1;
+	}
+
+	for (f = 1; f <= frames && !failed; f++) {
+		benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, f, benchDesktopPixel);
+		rfbMarkRectAsModified(screen, 0, 0, WIDTH, HEIGHT);
+		t = benchNow();
+		if (!benchProcessUntilSent(screen, 1)) {
+			fprintf(stderr, "frame %d was not sent\n", f);
+			failed = 1;
+		}
+		time += benchNow() - t;
+	}
+
+	rfbShutdownServer(screen, TRUE);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "the viewer did not end up with the last frame\n");
+		failed = 1;
+	}
+	benchScreenFree(screen);
+
+	return failed ? -1 : 1000 * time / frames;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *checked[] = { "tight", "hextile", "rre" };
+	int maxThreads = 8;
+	int i, failed = 0;
+	double one = 0, ms;
+	rfbBool check = FALSE;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			frames = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			maxThreads = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-encoding") == 0)
+			encoding = argv[++i];
+		else if (i + 1 < argc && strcmp(argv[i], "-quality") == 0)
+			quality = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0)
+			check = TRUE;
+		else {
+			fprintf(stderr, "Usage: %s [-frames n] [-threads n] [-encoding name] [-quality n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 1 || maxThreads < 1) {
+		fprintf(stderr, "need at least one frame and one thread\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	if (check) {
+		frames = 2;
+		quality = -1;
+		for (i = 0; i < (int)(sizeof(checked) / sizeof(checked[0])); i++) {
+			rfbBool ok;
+
+			encoding = checked[i];
+			ok = run(4) >= 0;
+			if (!ok)
+				failed++;
+			printf("%s on 4 threads: %s\n", encoding, ok ? "ok" : "FAILED");
+		}
+		return failed ? 1 : 0;
+	}
+
+	printf("%s, %dx%d, %d frames, %ld cores, ms per full-screen update\n",
+	       encoding, WIDTH, HEIGHT, frames, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("  threads         ms    speedup\n");
+	for (i = 1; i <= maxThreads; i *= 2) {
+		ms = run(i);
+		if (ms < 0)
+			failed++;
+		if (i == 1)
+			one = ms;
+		printf("  %7d %10.2f %10.2f\n", i, ms, ms > 0 ? one / ms : 0);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * bench_pool_clients.c - runs the server with rfbRunEventLoop() in the
+ * background, once with a thread pair per client and once with a pool of
+ * rfbScreenInfo::workerThreads, and measures how long 1, 2, 4, ...
+ * viewers take to get a small change to the framebuffer, along with the
+ * threads and CPU time the server uses. The viewers are libvncclient
+ * processes forked off the server; each reports every update it finishes
+ * through a pipe, so the time is until the last viewer has the change.
+ *
+ * Usage: bench_pool_clients [-frames n] [-viewers n] [-workers n] [-check]
+ *
+ * The defaults are 50 frames, up to 64 viewers and a worker per core.
+ * Updates are deferred by the default 5 ms, which in the pool is the
+ * timer wheel's job. Every viewer checks that it ends up with the last
+ * frame, and the exit status is non-zero if one does not or a frame
+ * never arrives; -check stops at 5 frames and 8 viewers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "benchutil.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+#define MAX_VIEWERS 256
+
+static int frames = 50, workers = -1;
+
+/* the Threads: line of /proc/self/status */
+static int threads(void)
+{
+	char line[256];
+	int n = -1;
+	FILE *f = fopen("/proc/self/status", "r");
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "Threads: %d", &n) == 1)
+			break;
+	fclose(f);
+	return n;
+}
+
+/* frame f draws a 64 pixel line in grey level f, and returns where */
+static void drawFrame(char *fb, int f, int *x, int *y)
+{
+	*x = f * 32 % (WIDTH - 64);
+	*y = f * 16 % (HEIGHT - 64);
+	memset(fb + (*y * WIDTH + *x) * 4, f, 64 * 4);
+}
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port, int reportFd)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	uint32_t *fb, *expected = calloc(WIDTH * HEIGHT, 4);
+	int f, x, y;
+
+	client->appData.encodingsString = "hextile";
+	client->appData.useRemoteCursor = TRUE;
+	benchReportUpdates(client, reportFd, -1, -1);
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+
+	for (f = 0; f < frames; f++)
+		drawFrame((char *)expected, f, &x, &y);
+	fb = (uint32_t *)client->frameBuffer;
+	for (y = 0; y < HEIGHT; y++)
+		for (x = 0; x < WIDTH; x++)
+			if (((fb[y * WIDTH + x] ^ expected[y * WIDTH + x]) & 0xffffff) != 0)
+				_exit(1);
+	_exit(0);
+}
+
+/* waits for n updates to be reported, FALSE after 10 s without one */
+static rfbBool waitForUpdates(int fd, int n)
+{
+	while (n-- > 0)
+		if (!benchWaitForUpdate(fd))
+			return FALSE;
+	return TRUE;
+}
+
+/*
+ * Fills in the median ms per frame, the server's CPU ms per frame and its
+ * threads while serving n viewers. Returns FALSE on failure.
+ */
+static rfbBool run(int n, int workerThreads, double *ms, double *cpu, int *nThreads)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	pid_t pids[MAX_VIEWERS];
+	double *times = malloc(frames * sizeof(double)), t;
+	int pipeFds[2], i, f, status;
+	rfbBool ok = TRUE;
+
+	screen->alwaysShared = TRUE;
+	screen->workerThreads = workerThreads;
+	rfbInitServer(screen);
+
+	if (pipe(pipeFds) < 0)
+		return FALSE;
+	for (i = 0; i < n; i++) {
+		pids[i] = benchForkViewer(screen);
+		if (pids[i] == 0) {
+			close(pipeFds[0]);
+			viewer(screen->port, pipeFds[1]);
+		}
+	}
+	close(pipeFds[1]);
+
+	rfbRunEventLoop(screen, -1, TRUE);
+
+	/* everybody gets the whole screen first */
+	if (!waitForUpdates(pipeFds[0], n)) {
+		fprintf(stderr, "viewers did not connect\n");
+		ok = FALSE;
+	}
+	*nThreads = threads();
+
+	*cpu = benchCpuTime();
+	for (f = 0; f < frames && ok; f++) {
+		int x, y;
+
+		drawFrame(screen->frameBuffer, f, &x, &y);
+		t = benchNow();
+		rfbMarkRectAsModified(screen, x, y, x + 64, y + 1);
+		if (!waitForUpdates(pipeFds[0], n)) {
+			fprintf(stderr, "frame %d did not arrive\n", f);
+			ok = FALSE;
+		}
+		times[f] = (benchNow() - t) * 1000;
+	}
+	*cpu = 1000 * (benchCpuTime() - *cpu) / frames;
+
+	rfbShutdownServer(screen, TRUE);
+	for (i = 0; i < n; i++)
+		if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "viewer %d did not end up with the last frame\n", i);
+			ok = FALSE;
+		}
+	close(pipeFds[0]);
+	benchScreenFree(screen);
+
+	if (ok)
+		*ms = benchMedian(times, frames);
+	free(times);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int maxViewers = 64, failed = 0;
+	int i, n;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			frames = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-viewers") == 0)
+			maxViewers = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-workers") == 0)
+			workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0) {
+			frames = 5;
+			maxViewers = 8;
+		} else {
+			fprintf(stderr, "Usage: %s [-frames n] [-viewers n] [-workers n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 1 || maxViewers < 1 || maxViewers > MAX_VIEWERS || workers == 0) {
+		fprintf(stderr, "need at least one frame, 1 to %d viewers and workers\n", MAX_VIEWERS);
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%dx%d, %d frames, median ms until all viewers have a frame, server CPU ms/frame\n",
+	       WIDTH, HEIGHT, frames);
+	printf("  viewers  threads   ms/frame   cpu ms    pool threads   ms/frame   cpu ms\n");
+	for (n = 1; n <= maxViewers; n *= 2) {
+		double ms[2] = { -1, -1 }, cpu[2] = { -1, -1 };
+		int nThreads[2] = { -1, -1 };
+
+		if (!run(n, 0, &ms[0], &cpu[0], &nThreads[0]))
+			failed++;
+		if (!run(n, workers, &ms[1], &cpu[1], &nThreads[1]))
+			failed++;
+		printf("  %7d %8d %10.2f %8.2f %14d %10.2f %8.2f\n", n,
+		       nThreads[0], ms[0], cpu[0], nThreads[1], ms[1], cpu[1]);
+		fflush(stdout);
+	}
+
+	return failed ? 1 : 0;
+}
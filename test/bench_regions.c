@@ -0,0 +1,187 @@
+/*
+ * bench_regions.c - measures the sraRgn operations an update goes
+ * through, on the fragmented damage of many small rectangles a busy
+ * desktop produces: building it rectangle by rectangle, copying it, and
+ * ANDing, subtracting, counting and iterating the copy, as
+ * rfbSendFramebufferUpdate() and the event loops do.
+ *
+ * Usage: bench_regions [-rounds n]
+ *
+ * Reported are microseconds and heap allocations per operation, for
+ * 100, 1000 and 4000 random rectangles of 4x4 to 64x32 pixels on a
+ * 1920x1080 screen. Allocations are counted by wrapping malloc(), which
+ * needs glibc; elsewhere they show as "-". The results of "intersects"
+ * and of AND, which it stands in for, are checked to agree, and the exit
+ * status is non-zero if they did not. Configure with
+ * -DWITH_BANDED_REGIONS=ON to measure the banded rectangle regions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static int rounds = 20, failures = 0;
+static unsigned long allocations;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+
+/* counts what the library allocates too, as the executable's malloc wins */
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+#define COUNTING 1
+#endif
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+enum { BUILD, COPY, AND, SUBTRACT, INTERSECTS, COPY_AND, COUNT, ITERATE, OPS };
+static const char *opNames[OPS] = {
+	"build, per rect", "copy", "and screen", "subtract window",
+	"intersects", "copy and and", "count rects", "iterate"
+};
+
+static sraRegion *build(int rects, unsigned int seed)
+{
+	sraRegion *region = sraRgnCreate(), *rect;
+	int i, x, y;
+
+	srand(seed);
+	for (i = 0; i < rects; i++) {
+		x = rand() % (WIDTH - 64);
+		y = rand() % (HEIGHT - 32);
+		rect = sraRgnCreateRect(x, y, x + 4 + rand() % 60, y + 4 + rand() % 28);
+		sraRgnOr(region, rect);
+		sraRgnDestroy(rect);
+	}
+	return region;
+}
+
+/* runs an operation rounds times, returns us and allocations per round */
+static double run(int op, int rects, double *allocs)
+{
+	sraRegion *damage = build(rects, 1), *screen = sraRgnCreateRect(0, 0, WIDTH, HEIGHT);
+	sraRegion *window = sraRgnCreateRect(600, 300, 1400, 900);
+	sraRegion *elsewhere = sraRgnCreateRect(WIDTH, 0, WIDTH + 100, 100);
+	sraRegion *copy, *other = build(rects, 2);
+	sraRectangleIterator *i;
+	sraRect r;
+	unsigned long before = 0, sum = 0;
+	double t, spent = 0;
+	int n;
+
+	/* the first round is not counted, it fills the span pool or sizes the arrays */
+	for (n = -1; n < rounds; n++) {
+		if (n == 0) {
+			before = allocations;
+			spent = 0;
+			sum = 0;
+		}
+		t = now();
+		switch (op) {
+		case BUILD:
+			sraRgnDestroy(build(rects, 3 + n));
+			break;
+		case COPY:
+			sraRgnDestroy(sraRgnCreateRgn(damage));
+			break;
+		case AND:
+			copy = sraRgnCreateRgn(damage);
+			sraRgnAnd(copy, screen);
+			sraRgnDestroy(copy);
+			break;
+		case SUBTRACT:
+			copy = sraRgnCreateRgn(damage);
+			sraRgnSubtract(copy, window);
+			sraRgnDestroy(copy);
+			break;
+		case INTERSECTS:
+			sum += sraRgnIntersects(damage, other) != 0;
+			sum += sraRgnIntersects(damage, elsewhere) != 0;
+			break;
+		case COPY_AND:
+			copy = sraRgnCreateRgn(damage);
+			sum += sraRgnAnd(copy, other) != 0;
+			sraRgnDestroy(copy);
+			copy = sraRgnCreateRgn(damage);
+			sum += sraRgnAnd(copy, elsewhere) != 0;
+			sraRgnDestroy(copy);
+			break;
+		case COUNT:
+			sum += sraRgnCountRects(damage);
+			break;
+		case ITERATE:
+			i = sraRgnGetIterator(damage);
+			while (sraRgnIteratorNext(i, &r))
+				sum += r.x2 - r.x1;
+			sraRgnReleaseIterator(i);
+			break;
+		}
+		spent += now() - t;
+	}
+	*allocs = (double)(allocations - before) / rounds;
+
+	/* both ways of asking must give one hit of two per round */
+	if ((op == INTERSECTS || op == COPY_AND) && sum != (unsigned long)rounds)
+		failures++;
+
+	sraRgnDestroy(damage);
+	sraRgnDestroy(other);
+	sraRgnDestroy(screen);
+	sraRgnDestroy(window);
+	sraRgnDestroy(elsewhere);
+	if (op == BUILD) {
+		spent /= rects;
+		*allocs /= rects;
+	}
+	return spent / rounds * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 100, 1000, 4000 };
+	double us, allocs;
+	int i, op, s;
+
+	for (i = 1; i + 1 < argc; i += 2)
+		if (strcmp(argv[i], "-rounds") == 0)
+			rounds = atoi(argv[i + 1]);
+	if (rounds < 1)
+		rounds = 1;
+
+	printf("1920x1080, us (allocations) per operation\n");
+	printf("  %-16s", "rects");
+	for (s = 0; s < 3; s++)
+		printf(" %19d", sizes[s]);
+	printf("\n");
+	for (op = 0; op < OPS; op++) {
+		printf("  %-16s", opNames[op]);
+		for (s = 0; s < 3; s++) {
+			us = run(op, sizes[s], &allocs);
+#ifdef COUNTING
+			printf(" %9.2f (%7.1f)", us, allocs);
+#else
+			printf(" %9.2f (%7s)", us, "-");
+#endif
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	if (failures)
+		fprintf(stderr, "sraRgnIntersects() and sraRgnAnd() disagreed %d times\n", failures);
+	return failures ? 1 : 0;
+}
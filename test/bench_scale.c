@@ -0,0 +1,210 @@
+/*
+ * bench_scale.c - measures how fast libvncserver keeps a scaled copy of a
+ * 1920x1080 framebuffer up to date, as for a client that asked for
+ * SetScale, at 32 and 16 bits per pixel and for sizes the source width
+ * and height divide and sizes they don't. The whole screen is scaled
+ * with rfbScaledScreenUpdateRect(), once with the scaler libvncserver
+ * had before, kept here as the reference, and once with the library's,
+ * with each instruction set it can use on this CPU.
+ *
+ * Usage: bench_scale [-rounds n] [-threads n]
+ *
+ * Reported are source Mpx/s, the best of n rounds, 10 by default, on
+ * rfbScreenInfo::scaleThreads threads, 1 by default. Where the reference
+ * averages the right pixels, that is for sizes the source divides, every
+ * result is compared with it and the exit status is non-zero if one
+ * differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <rfb/rfb.h>
+#include "simd.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+/* from scale.c */
+void rfbScaledScreenUpdateRect(rfbScreenInfoPtr screen, rfbScreenInfoPtr ptr, int x0, int y0, int w0, int h0);
+void rfbScaleThreadsInit(rfbScreenInfoPtr screen);
+
+static int rounds = 10, failures = 0;
+
+static const struct { int width, height; } sizes[] = {
+	{ 960, 540 }, { 640, 360 }, { 480, 270 }, { 1280, 720 }, { 1366, 768 }
+};
+
+static const struct { int mask; const char *name; } levels[] = {
+	{ 0, "C" },
+	{ SIMD_SSE2, "SSE2" },
+	{ SIMD_SSE2 | SIMD_SSSE3 | SIMD_AVX2, "AVX2" },
+	{ SIMD_NEON, "NEON" }
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* the box filter scale.c had, for the whole screen and sizes it divides */
+static void reference(rfbScreenInfoPtr screen, rfbScreenInfoPtr ptr)
+{
+	const rfbPixelFormat *f = &screen->serverFormat;
+	int bytesPerPixel = screen->bitsPerPixel / 8;
+	int areaX = screen->width / ptr->width, areaY = screen->height / ptr->height;
+	unsigned long pixel_value, red, green, blue;
+	unsigned char *srcptr, *srcptr2, *dstptr;
+	int x, y, w, v;
+
+	for (y = 0; y < ptr->height; y++) {
+		srcptr = (unsigned char *)screen->frameBuffer + y * areaY * screen->paddedWidthInBytes;
+		dstptr = (unsigned char *)ptr->frameBuffer + y * ptr->paddedWidthInBytes;
+		for (x = 0; x < ptr->width; x++) {
+			red = green = blue = 0;
+			for (w = 0; w < areaX; w++) {
+				for (v = 0; v < areaY; v++) {
+					srcptr2 = &srcptr[((x * areaX) + w) * bytesPerPixel +
+							v * screen->paddedWidthInBytes];
+					if (bytesPerPixel == 4)
+						pixel_value = *((unsigned int *)srcptr2);
+					else
+						pixel_value = *((unsigned short *)srcptr2);
+					red += (pixel_value >> f->redShift) & f->redMax;
+					green += (pixel_value >> f->greenShift) & f->greenMax;
+					blue += (pixel_value >> f->blueShift) & f->blueMax;
+				}
+			}
+			red /= areaX * areaY;
+			green /= areaX * areaY;
+			blue /= areaX * areaY;
+			pixel_value = (red & f->redMax) << f->redShift |
+				(green & f->greenMax) << f->greenShift |
+				(blue & f->blueMax) << f->blueShift;
+			if (bytesPerPixel == 4)
+				*((unsigned int *)dstptr) = (unsigned int)pixel_value;
+			else
+				*((unsigned short *)dstptr) = (unsigned short)pixel_value;
+			dstptr += bytesPerPixel;
+		}
+	}
+}
+
+static rfbScreenInfoPtr newScaled(rfbScreenInfoPtr screen, int width, int height)
+{
+	int bytesPerPixel = screen->bitsPerPixel / 8;
+	rfbScreenInfoPtr ptr = rfbGetScreen(NULL, NULL, width, height, 8, 3, bytesPerPixel);
+
+	ptr->serverFormat = screen->serverFormat;
+	ptr->frameBuffer = calloc((size_t)ptr->paddedWidthInBytes, height);
+	return ptr;
+}
+
+/* returns source Mpx/s; level -1 is the reference */
+static double scale(rfbScreenInfoPtr screen, rfbScreenInfoPtr ptr, int level)
+{
+	double t, best = 1e9;
+	int r;
+
+	if (level >= 0)
+		simd_set_features(levels[level].mask);
+	for (r = 0; r < rounds; r++) {
+		t = now();
+		if (level < 0)
+			reference(screen, ptr);
+		else
+			rfbScaledScreenUpdateRect(screen, ptr, 0, 0, WIDTH, HEIGHT);
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	return (double)WIDTH * HEIGHT / best / 1e6;
+}
+
+static void run(int bpp, int threads)
+{
+	rfbScreenInfoPtr screen, ptr, expected;
+	int detected = simd_features(), s, i;
+	size_t size;
+	double mpx;
+
+	screen = rfbGetScreen(NULL, NULL, WIDTH, HEIGHT, 8, 3, bpp / 8);
+	if (bpp == 16) {
+		screen->serverFormat.redMax = 31;
+		screen->serverFormat.greenMax = 63;
+		screen->serverFormat.blueMax = 31;
+		screen->serverFormat.redShift = 11;
+		screen->serverFormat.greenShift = 5;
+		screen->serverFormat.blueShift = 0;
+	}
+	screen->scaleThreads = threads;
+	rfbScaleThreadsInit(screen);
+	screen->frameBuffer = malloc((size_t)screen->paddedWidthInBytes * HEIGHT);
+	srand(1);
+	for (i = 0; i < screen->paddedWidthInBytes * HEIGHT; i++)
+		screen->frameBuffer[i] = rand();
+
+	printf("%d bpp, %dx%d to, in source Mpx/s:\n", bpp, WIDTH, HEIGHT);
+	for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+		ptr = newScaled(screen, sizes[s].width, sizes[s].height);
+		expected = newScaled(screen, sizes[s].width, sizes[s].height);
+		size = (size_t)ptr->paddedWidthInBytes * ptr->height;
+		printf("  %4dx%-4d", sizes[s].width, sizes[s].height);
+		if (WIDTH % sizes[s].width == 0 && HEIGHT % sizes[s].height == 0)
+			printf(" reference %7.1f", scale(screen, expected, -1));
+		else
+			printf(" reference    -   ");
+		for (i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++) {
+			if ((levels[i].mask & detected) != levels[i].mask)
+				continue;
+			mpx = scale(screen, ptr, i);
+			if (WIDTH % sizes[s].width == 0 && HEIGHT % sizes[s].height == 0 &&
+			    memcmp(expected->frameBuffer, ptr->frameBuffer, size) != 0) {
+				fprintf(stderr, "%d bpp to %dx%d: %s differs from the reference\n",
+						bpp, sizes[s].width, sizes[s].height, levels[i].name);
+				failures++;
+			}
+			printf(" %s %7.1f", levels[i].name, mpx);
+		}
+		printf("\n");
+		free(ptr->frameBuffer);
+		free(expected->frameBuffer);
+		rfbScreenCleanup(ptr);
+		rfbScreenCleanup(expected);
+	}
+
+	free(screen->frameBuffer);
+	rfbScreenCleanup(screen);
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 1, i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-rounds") == 0)
+			rounds = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-threads") == 0)
+			threads = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "Usage: %s [-rounds n] [-threads n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rounds < 1) {
+		fprintf(stderr, "need at least one round\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	run(32, threads);
+	run(16, threads);
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	return failures ? 1 : 0;
+}
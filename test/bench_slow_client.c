@@ -0,0 +1,247 @@
+/*
+ * bench_slow_client.c - measures how much a viewer that stopped reading
+ * holds up another one, in each of the server's event loops. Both
+ * viewers are libvncclient processes forked off the server; the stalled
+ * one keeps asking for raw full screen updates and never reads them,
+ * the other reports each update it finishes through a pipe.
+ *
+ * Usage: bench_slow_client [-echoes n] [-seconds n] [-check]
+ *
+ * Per event loop the healthy viewer's "flood" updates per second while a
+ * 320x320 window is redrawn every 2 ms for 2 seconds and its "echo", the
+ * median ms from a small change until it has it over 20 changes, are
+ * measured alone and next to the stalled viewer. Next to it, "gap ms"
+ * is how long the healthy viewer waited for its first update after
+ * connecting and "queued" the most the stalled viewer's output queue held
+ * meanwhile, in KB. The exit status is non-zero if a change never reaches
+ * the healthy viewer, or the stalled one has more queued than the
+ * default rfbScreenInfo::outputHighWater and one more update allow.
+ * -check runs 3 echoes and a 1 second flood.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "benchutil.h"
+
+#define WIDTH 1280
+#define HEIGHT 720
+#define FLOOD_X 200
+#define FLOOD_Y 100
+#define FLOOD_SIZE 320
+#define ECHO_X 1000
+#define ECHO_Y 600
+/* the default outputHighWater, a raw full screen update and some slack */
+#define MAX_QUEUED ((1 << 20) + WIDTH * HEIGHT * 4 + 4096)
+
+enum { LOOP_SELECT, LOOP_EPOLL, THREADS, POOL, LOOPS };
+static const char *loopNames[LOOPS] = { "select loop", "epoll loop", "threads", "pool" };
+
+static int echoes = 20, seconds = 2;
+
+/* runs in a child process until the server hangs up */
+static void viewer(int port, int reportFd)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+
+	client->appData.encodingsString = "zlib";
+	client->appData.compressLevel = 1;
+	benchReportUpdates(client, reportFd, -1, -1);
+	benchConnect(client, port);
+	benchReadUntilHangup(client);
+	_exit(0);
+}
+
+/* asks for the whole screen over and over and reads nothing, until killed */
+static void stalledViewer(int port)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	int size = 4096;
+
+	client->appData.encodingsString = "raw";
+	benchConnect(client, port);
+	setsockopt(client->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	for (;;) {
+		SendFramebufferUpdateRequest(client, 0, 0, WIDTH, HEIGHT, FALSE);
+		usleep(50000);
+	}
+}
+
+/* lets a foreground loop serve its clients, or the background ones run */
+static void serve(rfbScreenInfoPtr screen, int loop, long usec)
+{
+	if (loop == LOOP_SELECT || loop == LOOP_EPOLL)
+		rfbProcessEvents(screen, usec);
+	else
+		usleep(usec);
+}
+
+/* the most any client has queued */
+static unsigned long mostQueued(rfbScreenInfoPtr screen)
+{
+	rfbClientIteratorPtr i = rfbGetClientIterator(screen);
+	unsigned long most = 0;
+	rfbClientPtr cl;
+
+	while ((cl = rfbClientIteratorNext(i)))
+		if (cl->outputQueued > most)
+			most = cl->outputQueued;
+	rfbReleaseClientIterator(i);
+	return most;
+}
+
+/*
+ * Fills in the healthy viewer's updates per second, echo ms and longest
+ * ms between two updates in the given event loop, next to a stalled
+ * viewer if asked to, and the most that was queued. Returns FALSE on
+ * failure.
+ */
+static rfbBool run(int loop, rfbBool stalled, double *fps, double *echo, double *gap, unsigned long *queued)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	double *times = malloc(echoes * sizeof(double)), t, last, end;
+	int pipeFds[2], i, status, got, updates = 0, frame = 0;
+	pid_t pid, stalledPid = -1;
+	rfbBool ok = TRUE;
+
+	*fps = *gap = 0;
+	*queued = 0;
+	screen->useSelect = loop == LOOP_SELECT;
+	screen->workerThreads = loop == POOL ? 2 : 0;
+	rfbInitServer(screen);
+	if (loop == THREADS || loop == POOL)
+		rfbRunEventLoop(screen, -1, TRUE);
+
+	if (pipe(pipeFds) < 0)
+		return FALSE;
+	pid = benchForkViewer(screen);
+	if (pid == 0) {
+		close(pipeFds[0]);
+		viewer(screen->port, pipeFds[1]);
+	}
+	close(pipeFds[1]);
+	fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+
+	/* the first update */
+	for (t = benchNow(); benchCountUpdates(pipeFds[0], NULL) == 0; serve(screen, loop, 10000))
+		if (benchNow() - t > 10) {
+			fprintf(stderr, "the viewer got no first update\n");
+			ok = FALSE;
+			break;
+		}
+
+	if (stalled) {
+		stalledPid = benchForkViewer(screen);
+		if (stalledPid == 0) {
+			close(pipeFds[0]);
+			stalledViewer(screen->port);
+		}
+	}
+
+	t = last = benchNow();
+	end = t + seconds;
+	while (ok && benchNow() < end) {
+		benchNoise((uint32_t *)screen->frameBuffer, WIDTH, FLOOD_X, FLOOD_Y, FLOOD_SIZE, frame++);
+		rfbMarkRectAsModified(screen, FLOOD_X, FLOOD_Y, FLOOD_X + FLOOD_SIZE, FLOOD_Y + FLOOD_SIZE);
+		serve(screen, loop, 2000);
+		if ((got = benchCountUpdates(pipeFds[0], NULL)) > 0) {
+			updates += got;
+			if ((benchNow() - last) * 1000 > *gap)
+				*gap = (benchNow() - last) * 1000;
+			last = benchNow();
+		}
+		if (mostQueued(screen) > *queued)
+			*queued = mostQueued(screen);
+	}
+	if ((benchNow() - last) * 1000 > *gap)
+		*gap = (benchNow() - last) * 1000;
+	*fps = updates / (benchNow() - t);
+
+	for (i = 0; i < echoes && ok; i++) {
+		while (benchCountUpdates(pipeFds[0], NULL) > 0)
+			;
+		memset(screen->frameBuffer + (ECHO_Y * WIDTH + ECHO_X) * 4, i + 1, 4);
+		t = benchNow();
+		rfbMarkRectAsModified(screen, ECHO_X, ECHO_Y, ECHO_X + 1, ECHO_Y + 1);
+		while (benchCountUpdates(pipeFds[0], NULL) == 0) {
+			if (benchNow() - t > 10) {
+				ok = FALSE;
+				break;
+			}
+			serve(screen, loop, 1000);
+		}
+		times[i] = (benchNow() - t) * 1000;
+	}
+
+	if (stalledPid > 0) {
+		kill(stalledPid, SIGKILL);
+		waitpid(stalledPid, &status, 0);
+	}
+	rfbShutdownServer(screen, TRUE);
+	waitpid(pid, &status, 0);
+	close(pipeFds[0]);
+	benchScreenFree(screen);
+
+	if (ok)
+		*echo = benchMedian(times, echoes);
+	free(times);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	double fps, echo, gap;
+	unsigned long queued;
+	int i, loop, failed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-echoes") == 0)
+			echoes = atoi(argv[++i]);
+		else if (i + 1 < argc && strcmp(argv[i], "-seconds") == 0)
+			seconds = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0) {
+			echoes = 3;
+			seconds = 1;
+		} else {
+			fprintf(stderr, "Usage: %s [-echoes n] [-seconds n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (echoes < 1)
+		echoes = 1;
+
+	rfbLogEnable(0);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("1280x720, zlib, a healthy viewer alone and next to a stalled one\n");
+	printf("%-14s %10s %9s %10s %9s %9s %9s\n", "", "alone fps", "echo ms", "stalled fps", "echo ms", "gap ms", "queued KB");
+	for (loop = 0; loop < LOOPS; loop++) {
+		printf("  %-12s", loopNames[loop]);
+		fflush(stdout);
+		if (run(loop, FALSE, &fps, &echo, &gap, &queued))
+			printf(" %10.1f %9.1f", fps, echo);
+		else {
+			printf(" %10s %9s", "-", "-");
+			failed++;
+		}
+		fflush(stdout);
+		if (run(loop, TRUE, &fps, &echo, &gap, &queued))
+			printf(" %11.1f %9.1f %9.0f %9lu\n", fps, echo, gap, queued / 1024);
+		else {
+			printf(" %11.1f %9s %9.0f %9lu\n", fps, "-", gap, queued / 1024);
+			failed++;
+		}
+		if (queued > MAX_QUEUED) {
+			fprintf(stderr, "%lu bytes were queued for the stalled viewer\n", queued);
+			failed++;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * bench_translate.c - measures how fast libvncserver translates a
+ * 1920x1080 framebuffer of 32 bit pixels into the formats clients
+ * commonly ask for, with the lookup tables and with each instruction set
+ * the vectorised translations in translate.c can use on this CPU. The
+ * translation is picked by rfbSetTranslateFunction(), as for a real
+ * client, so formats it has no vectorised translation for show the
+ * tables on every line.
+ *
+ * Usage: bench_translate [-rounds n]
+ *
+ * Reported are million pixels per second, the best of n rounds, 10 by
+ * default. Every result is compared with the tables' and the exit
+ * status is non-zero if one differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <rfb/rfb.h>
+#include "simd.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static int rounds = 10, failures = 0;
+
+typedef struct {
+	const char *name;
+	rfbPixelFormat format;
+} Format;
+
+/* bpp, depth, bigEndian, trueColour, max r g b, shift r g b */
+static const Format formats[] = {
+	{ "32 bpp, swapped red and blue", { 32, 24, 0, 1, 255, 255, 255, 0, 8, 16, 0, 0 } },
+	{ "32 bpp, big endian", { 32, 24, 1, 1, 255, 255, 255, 16, 8, 0, 0, 0 } },
+	{ "16 bpp, RGB565", { 16, 16, 0, 1, 31, 63, 31, 11, 5, 0, 0, 0 } },
+	{ "16 bpp, RGB555", { 16, 15, 0, 1, 31, 31, 31, 10, 5, 0, 0, 0 } },
+	{ "16 bpp, RGB565 big endian", { 16, 16, 1, 1, 31, 63, 31, 11, 5, 0, 0, 0 } },
+	{ "8 bpp, BGR233", { 8, 8, 0, 1, 7, 7, 3, 0, 3, 6, 0, 0 } }
+};
+
+static const struct { int mask; const char *name; } levels[] = {
+	{ 0, "tables" },
+	{ SIMD_SSE2, "SSE2" },
+	{ SIMD_SSE2 | SIMD_SSSE3, "SSSE3" },
+	{ SIMD_SSE2 | SIMD_SSSE3 | SIMD_AVX2, "AVX2" },
+	{ SIMD_NEON, "NEON" }
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* returns Mpx/s, translating into out */
+static double translate(rfbScreenInfoPtr screen, const rfbPixelFormat *format,
+		int features, char *out)
+{
+	rfbClientRec cl;
+	double t, best = 1e9;
+	int r;
+
+	memset(&cl, 0, sizeof(cl));
+	cl.screen = screen;
+	cl.host = "bench";
+	cl.format = *format;
+	simd_set_features(features);
+	if (!rfbSetTranslateFunction(&cl)) {
+		failures++;
+		return 0;
+	}
+
+	for (r = 0; r < rounds; r++) {
+		t = now();
+		cl.translateFn(cl.translateLookupTable, &screen->serverFormat, &cl.format,
+				screen->frameBuffer, out, screen->paddedWidthInBytes,
+				WIDTH, HEIGHT);
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	free(cl.translateLookupTable);
+	return (double)WIDTH * HEIGHT / best / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	rfbScreenInfoPtr screen;
+	char *reference, *out;
+	int detected, i, f, n;
+	size_t size;
+	double mpx;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-rounds") == 0)
+			rounds = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "Usage: %s [-rounds n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rounds < 1) {
+		fprintf(stderr, "need at least one round\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	detected = simd_features();
+
+	/* the server in the format X11 usually has */
+	screen = rfbGetScreen(NULL, NULL, WIDTH, HEIGHT, 8, 3, 4);
+	screen->serverFormat.redShift = 16;
+	screen->serverFormat.greenShift = 8;
+	screen->serverFormat.blueShift = 0;
+	screen->frameBuffer = malloc(WIDTH * HEIGHT * 4);
+	srand(1);
+	for (n = 0; n < WIDTH * HEIGHT * 4; n++)
+		screen->frameBuffer[n] = rand();
+
+	reference = malloc(WIDTH * HEIGHT * 4);
+	out = malloc(WIDTH * HEIGHT * 4);
+
+	printf("%dx%d, 32 bpp xRGB to, in Mpx/s:\n", WIDTH, HEIGHT);
+	for (f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++) {
+		size = (size_t)WIDTH * HEIGHT * formats[f].format.bitsPerPixel / 8;
+		printf("  %-28s", formats[f].name);
+		for (i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++) {
+			if ((levels[i].mask & detected) != levels[i].mask)
+				continue;
+			mpx = translate(screen, &formats[f].format, levels[i].mask,
+					i == 0 ? reference : out);
+			if (i > 0 && memcmp(reference, out, size) != 0) {
+				fprintf(stderr, "%s: %s differs from the tables\n",
+						formats[f].name, levels[i].name);
+				failures++;
+			}
+			printf(" %s %7.1f", levels[i].name, mpx);
+		}
+		printf("\n");
+	}
+
+	free(reference);
+	free(out);
+	free(screen->frameBuffer);
+	rfbScreenCleanup(screen);
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	return failures ? 1 : 0;
+}
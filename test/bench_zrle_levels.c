@@ -0,0 +1,163 @@
+/*
+ * bench_zrle_levels.c - what each zlib level costs ZRLE: the time the
+ * server takes to send a 1920x1080 update and the bytes it sends, at
+ * the levels 0 to 9 a viewer can ask for with the CompressLevel
+ * pseudo-encoding, and with rfbScreenInfo::adaptiveZlibLevel starting
+ * from the default. The viewer is a libvncclient process forked off the
+ * server; the time counted is from marking the screen as modified until
+ * the whole update has been written, and so includes none of the
+ * viewer's work.
+ *
+ * Usage: bench_zrle_levels [-frames n] [-check]
+ *
+ * The default is 20 frames. The viewer hangs up once it shows the last
+ * frame, and the exit status is non-zero if it never does. Over the
+ * loopback the connection is never the slower side, so the adaptive
+ * level is expected to end up low. -check only runs two frames at levels
+ * 0, 1 and 9 and adaptively, for the viewer to check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "benchutil.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static int frames = 20;
+
+/* text-like runs on flat backgrounds, with a gradient here and there */
+static uint32_t pixel(int x, int y, int frame)
+{
+	int cell = (x / 8 + y / 16 * 7 + frame) % 11;
+
+	if ((x / 480 + y / 270) % 4 == 3)
+		return ((x + frame) & 0xff) | (y & 0xff) << 8 | ((x + y) & 0xff) << 16;
+	if (cell < 4 && (x % 8 < 2 || y % 16 < 2))
+		return 0x202020 * (cell + 1);
+	return 0xf0f0f0;
+}
+
+/* runs in a child process until it has the last frame */
+static void viewer(int port, int level)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+
+	client->appData.encodingsString = "zrle";
+	client->appData.compressLevel = level;
+	client->appData.useRemoteCursor = TRUE;
+	benchConnect(client, port);
+
+	while (WaitForMessage(client, 10000000) > 0 && HandleRFBServerMessage(client))
+		if (benchShowsFrame(client, pixel, frames))
+			_exit(0);
+	_exit(1);
+}
+
+/* level -1 is adaptive; returns FALSE on failure */
+static rfbBool run(int level)
+{
+	rfbScreenInfoPtr screen = benchScreen(WIDTH, HEIGHT);
+	rfbClientPtr cl;
+	double time = 0, t;
+	int bytes = 0, f, status, used = 0;
+	rfbBool failed = FALSE;
+	pid_t pid;
+
+	screen->deferUpdateTime = 0;
+	screen->adaptiveZlibLevel = level < 0;
+	benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, 0, pixel);
+	rfbInitServer(screen);
+
+	pid = benchForkViewer(screen);
+	if (pid == 0)
+		viewer(screen->port, level < 0 ? 5 : level);
+
+	if ((cl = benchProcessUntilSent(screen, 1)) == NULL) {
+		fprintf(stderr, "viewer did not connect\n");
+		failed = TRUE;
+	}
+
+	for (f = 1; f <= frames && !failed; f++) {
+		benchDraw((uint32_t *)screen->frameBuffer, WIDTH, HEIGHT, f, pixel);
+		bytes -= rfbStatGetSentBytes(cl);
+		rfbMarkRectAsModified(screen, 0, 0, WIDTH, HEIGHT);
+		t = benchNow();
+		if ((cl = benchProcessUntilSent(screen, 1)) == NULL) {
+			fprintf(stderr, "frame %d was not sent\n", f);
+			failed = TRUE;
+			break;
+		}
+		time += benchNow() - t;
+		bytes += rfbStatGetSentBytes(cl);
+		used = cl->zrleZlibLevel;
+	}
+
+	/* hanging up on it could lose what the viewer has yet to read */
+	for (f = 0; !failed && screen->clientHead != NULL && f < 100000; f++)
+		rfbProcessEvents(screen, 1000);
+	rfbShutdownServer(screen, TRUE);
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "the viewer did not end up with the last frame\n");
+		failed = TRUE;
+	}
+	benchScreenFree(screen);
+
+	if (level < 0)
+		printf("  adaptive (ends at %d)", used);
+	else
+		printf("  %-21d", level);
+	printf(" %10.2f %12d\n", failed ? -1 : 1000 * time / frames,
+	       failed ? -1 : bytes / frames);
+	fflush(stdout);
+	return !failed;
+}
+
+int main(int argc, char **argv)
+{
+	static const int checked[] = { 0, 1, 9, -1 };
+	int i, failed = 0;
+	rfbBool check = FALSE;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "-frames") == 0)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-check") == 0)
+			check = TRUE;
+		else {
+			fprintf(stderr, "Usage: %s [-frames n] [-check]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 1) {
+		fprintf(stderr, "need at least one frame\n");
+		return 1;
+	}
+
+	rfbLogEnable(FALSE);
+	rfbEnableClientLogging = FALSE;
+	signal(SIGPIPE, SIG_IGN);
+
+	if (check)
+		frames = 2;
+	printf("ZRLE, %dx%d, %d frames, per full-screen update\n", WIDTH, HEIGHT, frames);
+	printf("  level                         ms        bytes\n");
+	if (check) {
+		for (i = 0; i < (int)(sizeof(checked) / sizeof(checked[0])); i++)
+			if (!run(checked[i]))
+				failed++;
+		return failed ? 1 : 0;
+	}
+	for (i = 0; i <= 9; i++)
+		if (!run(i))
+			failed++;
+	if (!run(-1))
+		failed++;
+
+	return failed ? 1 : 0;
+}
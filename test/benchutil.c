@@ -0,0 +1,210 @@
+/*
+ * benchutil.c - the harness the bench_* programs share, see benchutil.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "benchutil.h"
+#include <rfb/rfbregion.h>
+
+double benchNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+double benchCpuTime(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+uint32_t benchDesktopPixel(int x, int y, int frame)
+{
+	uint32_t r = (x + frame * 4) & 0xff;
+	uint32_t g = (y * 2 + frame) & 0xff;
+	uint32_t b = ((x ^ y) >> 3) * 8 & 0xff;
+
+	/* and some flat areas, like windows on a desktop */
+	if ((x / 160 + y / 120) % 3 == 0)
+		r = g = b = 0xc0;
+	return r | g << 8 | b << 16;
+}
+
+void benchDraw(uint32_t *fb, int width, int height, int frame, benchPixelProc pixel)
+{
+	int x, y;
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++)
+			fb[y * width + x] = pixel(x, y, frame);
+}
+
+rfbBool benchShowsFrame(rfbClient *client, benchPixelProc pixel, int frame)
+{
+	uint32_t *fb = (uint32_t *)client->frameBuffer;
+	int x, y;
+
+	for (y = 0; y < client->height; y++)
+		for (x = 0; x < client->width; x++)
+			if ((fb[y * client->width + x] & 0xffffff) != pixel(x, y, frame))
+				return FALSE;
+	return TRUE;
+}
+
+rfbBool benchLossless(const char *encoding, int quality)
+{
+	return quality < 0 && strcmp(encoding, "zywrle") != 0;
+}
+
+rfbScreenInfoPtr benchScreen(int width, int height)
+{
+	rfbScreenInfoPtr screen = rfbGetScreen(NULL, NULL, width, height, 8, 3, 4);
+
+	screen->frameBuffer = calloc(width * height, 4);
+	screen->autoPort = TRUE;
+	screen->ipv6port = 0;
+	return screen;
+}
+
+void benchScreenFree(rfbScreenInfoPtr screen)
+{
+	free(screen->frameBuffer);
+	rfbScreenCleanup(screen);
+}
+
+pid_t benchForkViewer(rfbScreenInfoPtr screen)
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		close(screen->listenSock);
+		if (screen->listen6Sock != RFB_INVALID_SOCKET)
+			close(screen->listen6Sock);
+	}
+	return pid;
+}
+
+void benchConnect(rfbClient *client, int port)
+{
+	client->serverHost = strdup("127.0.0.1");
+	client->serverPort = port;
+	if (!rfbInitClient(client, NULL, NULL))
+		_exit(2);
+}
+
+void benchReadUntilHangup(rfbClient *client)
+{
+	while (WaitForMessage(client, 10000000) > 0 && HandleRFBServerMessage(client))
+		;
+}
+
+static int reportFd = -1, reportX, reportY, rects, watchedRects;
+
+static void gotPixels(rfbClient *client, int x, int y, int w, int h)
+{
+	if (x <= reportX && x + w > reportX && y <= reportY && y + h > reportY)
+		watchedRects++;
+	rects++;
+}
+
+/* updates with nothing but a cursor shape in them don't count */
+static void reportUpdate(rfbClient *client)
+{
+	if (rects > 0)
+		write(reportFd, watchedRects ? "w" : "u", 1);
+	rects = watchedRects = 0;
+}
+
+void benchReportUpdates(rfbClient *client, int fd, int watchX, int watchY)
+{
+	reportFd = fd;
+	reportX = watchX;
+	reportY = watchY;
+	client->GotFrameBufferUpdate = gotPixels;
+	client->FinishedFrameBufferUpdate = reportUpdate;
+}
+
+char benchWaitForUpdate(int fd)
+{
+	struct pollfd pfd;
+	char c;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 10000) == 1 && read(fd, &c, 1) == 1 ? c : 0;
+}
+
+int benchCountUpdates(int fd, int *watched)
+{
+	char buf[256];
+	int n = 0, got, i;
+
+	while ((got = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; watched != NULL && i < got; i++)
+			if (buf[i] == 'w')
+				*watched = 1;
+		n += got;
+	}
+	return n;
+}
+
+void benchNoise(uint32_t *fb, int width, int x0, int y0, int size, int frame)
+{
+	int x, y;
+
+	for (y = y0; y < y0 + size; y++)
+		for (x = x0; x < x0 + size; x++)
+			fb[y * width + x] = ((y * width + x) * 2654435761u) >> (frame & 7) ^ frame;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return d < 0 ? -1 : d > 0;
+}
+
+double benchMedian(double *values, int n)
+{
+	qsort(values, n, sizeof(double), compareDoubles);
+	return values[n / 2];
+}
+
+/* the number of clients with nothing left to send that asked for more */
+static int sent(rfbScreenInfoPtr screen, rfbClientPtr *last)
+{
+	rfbClientIteratorPtr i = rfbGetClientIterator(screen);
+	rfbClientPtr cl;
+	int n = 0;
+
+	while ((cl = rfbClientIteratorNext(i)) != NULL)
+		if (cl->state == RFB_NORMAL && sraRgnEmpty(cl->modifiedRegion) &&
+		    cl->outputQueued == 0 && !sraRgnEmpty(cl->requestedRegion)) {
+			*last = cl;
+			n++;
+		}
+	rfbReleaseClientIterator(i);
+	return n;
+}
+
+rfbClientPtr benchProcessUntilSent(rfbScreenInfoPtr screen, int viewers)
+{
+	rfbClientPtr cl = NULL;
+	int n;
+
+	for (n = 0; sent(screen, &cl) < viewers; n++) {
+		if (n == 100000)
+			return NULL;
+		rfbProcessEvents(screen, 1000);
+	}
+	return cl;
+}
@@ -0,0 +1,62 @@
+/*
+ * benchutil.h - what the bench_* programs that serve libvncclient viewers
+ * have in common: a screen on an automatic port, viewers forked off it
+ * that may report each update through a pipe, test pictures they can
+ * check their framebuffer against, clocks and a median.
+ *
+ * The viewers are child processes that leave with _exit(), so nothing
+ * here frees what a viewer allocated.
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <rfb/rfb.h>
+#include <rfb/rfbclient.h>
+
+typedef uint32_t (*benchPixelProc)(int x, int y, int frame);
+
+/* wall clock and the process' CPU time, both in seconds */
+double benchNow(void);
+double benchCpuTime(void);
+
+/* a busy, many-coloured picture that moves a little every frame */
+uint32_t benchDesktopPixel(int x, int y, int frame);
+void benchDraw(uint32_t *fb, int width, int height, int frame, benchPixelProc pixel);
+/* TRUE if a 32 bit client's framebuffer shows the given frame */
+rfbBool benchShowsFrame(rfbClient *client, benchPixelProc pixel, int frame);
+/* TRUE if a viewer asking for encoding at quality (-1 for none) gets exact pixels */
+rfbBool benchLossless(const char *encoding, int quality);
+
+/* a 32 bit screen with a cleared framebuffer on an automatic IPv4 port,
+   still to be initialised with rfbInitServer() */
+rfbScreenInfoPtr benchScreen(int width, int height);
+void benchScreenFree(rfbScreenInfoPtr screen);
+
+/* fork(), with the screen's listening sockets closed in the child */
+pid_t benchForkViewer(rfbScreenInfoPtr screen);
+/* connects a client set up by the caller, _exit(2)s if it can't */
+void benchConnect(rfbClient *client, int port);
+/* handles server messages until the server hangs up or is quiet for 10 s */
+void benchReadUntilHangup(rfbClient *client);
+
+/* has a viewer write a byte to fd for every update with pixels in it,
+   'w' if the update covered the pixel at (watchX, watchY), 'u' if not */
+void benchReportUpdates(rfbClient *client, int fd, int watchX, int watchY);
+/* waits for a reported update and returns its byte, or 0 after 10 s */
+char benchWaitForUpdate(int fd);
+/* the updates reported so far on a non-blocking fd; sets *watched if one
+   covered the watched pixel, unless watched is NULL */
+int benchCountUpdates(int fd, int *watched);
+
+/* something like a video playing in a size x size window at (x, y) */
+void benchNoise(uint32_t *fb, int width, int x, int y, int size, int frame);
+/* sorts n values and returns the middle one */
+double benchMedian(double *values, int n);
+
+/* runs a foreground server until viewers clients have been sent all of
+   their changes and asked for more, and returns one of them, or NULL if
+   that takes more than 100000 rounds */
+rfbClientPtr benchProcessUntilSent(rfbScreenInfoPtr screen, int viewers);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * inputbatchtest.c - checks what SendPointerEvent() queues between
+ * rfbClientBeginInputBatch() and rfbClientFlushInputBatch(): motion is
+ * merged, presses and releases stay where they happened.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <rfb/rfbclient.h>
+
+static const struct {
+	int x, y, buttons;
+} sent[] = {
+	{ 1, 1, 0 }, { 2, 2, 0 },
+	{ 10, 10, 1 }, { 20, 20, 1 }, { 30, 30, 1 },
+	{ 40, 40, 0 }
+}, expected[] = {
+	{ 2, 2, 0 },
+	{ 10, 10, 1 }, { 30, 30, 1 },
+	{ 40, 40, 0 }
+};
+
+#define N(a) (int)(sizeof(a) / sizeof((a)[0]))
+
+int main(int argc, char **argv)
+{
+	rfbClient *client = rfbGetClient(8, 3, 4);
+	rfbPointerEventMsg pe[N(sent) + 1];
+	int sv[2], n, i, ret = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	client->sock = sv[0];
+	client->supportedMessages.client2server[rfbPointerEvent / 8] |= 1 << (rfbPointerEvent % 8);
+
+	if (!rfbClientBeginInputBatch(client)) {
+		fprintf(stderr, "could not start a batch\n");
+		return 1;
+	}
+	for (i = 0; i < N(sent); i++)
+		SendPointerEvent(client, sent[i].x, sent[i].y, sent[i].buttons);
+	if (!rfbClientFlushInputBatch(client)) {
+		fprintf(stderr, "could not send the batch\n");
+		return 1;
+	}
+
+	n = read(sv[1], pe, sizeof(pe));
+	if (n != N(expected) * sz_rfbPointerEventMsg) {
+		fprintf(stderr, "%d bytes sent (should be %d)\n", n, N(expected) * sz_rfbPointerEventMsg);
+		return 1;
+	}
+	for (i = 0; i < N(expected); i++) {
+		int x = rfbClientSwap16IfLE(pe[i].x), y = rfbClientSwap16IfLE(pe[i].y);
+
+		if (pe[i].type != rfbPointerEvent || x != expected[i].x || y != expected[i].y ||
+		    pe[i].buttonMask != expected[i].buttons) {
+			fprintf(stderr, "event %d is %d,%d buttons %d (should be %d,%d buttons %d)\n",
+				i, x, y, pe[i].buttonMask, expected[i].x, expected[i].y, expected[i].buttons);
+			ret = 1;
+		}
+	}
+
+	close(sv[1]);
+	rfbClientCleanup(client);
+	return ret;
+}
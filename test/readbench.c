@@ -0,0 +1,474 @@
+/*
+ * readbench.c - measures how fast libvncclient pulls Raw and Zlib
+ * framebuffer updates off a socket, with the default 8 KB receive buffer
+ * and the old staged copy versus a large receive buffer read in place,
+ * and how Tight JPEG and ZRLE decoding scale with decode threads.
+ */
+
+#ifdef __STRICT_ANSI__
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <rfb/rfbclient.h>
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+#include <zlib.h>
+#endif
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+#include "turbojpeg.h"
+#define JPEG_TILE_W 240
+#define JPEG_TILE_H 270
+#define JPEG_QUALITY 80
+#endif
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define BPP 4
+#define FRAMES 100
+#define BIG_BUFFER (256*1024)
+
+typedef struct {
+	int fd;
+	char **frames;
+	size_t *frameLen;
+	int nFrames;
+	int repeat;
+} writer_t;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void *writeFrames(void *arg)
+{
+	writer_t *w = arg;
+	int i;
+
+	for (i = 0; i < w->nFrames * w->repeat; i++) {
+		const char *p = w->frames[i % w->nFrames];
+		size_t left = w->frameLen[i % w->nFrames];
+		while (left > 0) {
+			ssize_t n = write(w->fd, p, left);
+			if (n <= 0)
+				goto out;
+			p += n;
+			left -= n;
+		}
+	}
+out:
+	shutdown(w->fd, SHUT_WR);
+	return NULL;
+}
+
+static char *makeHeader(char *p, uint32_t encoding)
+{
+	rfbFramebufferUpdateMsg fu;
+	rfbFramebufferUpdateRectHeader rect;
+
+	memset(&fu, 0, sizeof(fu));
+	fu.type = rfbFramebufferUpdate;
+	fu.nRects = htons(1);
+	memcpy(p, &fu, sz_rfbFramebufferUpdateMsg);
+	p += sz_rfbFramebufferUpdateMsg;
+
+	rect.r.x = rect.r.y = 0;
+	rect.r.w = htons(WIDTH);
+	rect.r.h = htons(HEIGHT);
+	rect.encoding = htonl(encoding);
+	memcpy(p, &rect, sz_rfbFramebufferUpdateRectHeader);
+	return p + sz_rfbFramebufferUpdateRectHeader;
+}
+
+static void fillPixels(uint32_t *pixels, int frame)
+{
+	int x, y;
+	for (y = 0; y < HEIGHT; y++)
+		for (x = 0; x < WIDTH; x++)
+			pixels[y * WIDTH + x] = ((x + frame) & 0xf0) << 16 | ((y * 3) & 0xff) << 8 | ((x ^ y) & 0x3f);
+}
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+/* a desktop-like mix: flat areas, two-colour text and a busy strip */
+static void fillDesktop(uint32_t *pixels, int frame)
+{
+	int x, y;
+	for (y = 0; y < HEIGHT; y++)
+		for (x = 0; x < WIDTH; x++) {
+			uint32_t *p = &pixels[y * WIDTH + x];
+			if (x < WIDTH / 3)
+				*p = ((x / 128 ^ y / 96) & 3) * 0x303030;
+			else if (x < WIDTH * 2 / 3)
+				*p = (x * 7 + y * 13 + frame) % 5 == 0 ? 0x101010 : 0xf0f0f0;
+			else
+				*p = ((x + frame) & 0xf0) << 16 | ((y * 3) & 0xff) << 8 | ((x ^ y) & 0x3f);
+		}
+}
+
+static uint8_t *putCPixel(uint8_t *p, uint32_t c)
+{
+	*p++ = c;
+	*p++ = c >> 8;
+	*p++ = c >> 16;
+	return p;
+}
+
+/* encodes one tile as a ZRLE server would, with 3 byte CPIXELs */
+static uint8_t *zrleTile(uint8_t *p, const uint32_t *src, int w, int h)
+{
+	uint8_t *start = p;
+	uint32_t palette[16];
+	int nColours = 0, i, j, k;
+
+	for (j = 0; j < h && nColours <= 16; j++)
+		for (i = 0; i < w && nColours <= 16; i++) {
+			uint32_t c = src[j * WIDTH + i];
+			for (k = 0; k < nColours && k < 16 && palette[k] != c; k++)
+				;
+			if (k == nColours) {
+				if (nColours < 16)
+					palette[nColours] = c;
+				nColours++;
+			}
+		}
+
+	if (nColours == 1) {
+		*p++ = 1;
+		return putCPixel(p, palette[0]);
+	}
+
+	if (nColours <= 16) {
+		int bits = nColours > 4 ? 4 : nColours > 2 ? 2 : 1;
+		*p++ = nColours;
+		for (k = 0; k < nColours; k++)
+			p = putCPixel(p, palette[k]);
+		for (j = 0; j < h; j++) {
+			int shift = 8 - bits;
+			uint8_t byte = 0;
+			for (i = 0; i < w; i++) {
+				for (k = 0; palette[k] != src[j * WIDTH + i]; k++)
+					;
+				byte |= k << shift;
+				shift -= bits;
+				if (shift < 0) {
+					*p++ = byte;
+					byte = 0;
+					shift = 8 - bits;
+				}
+			}
+			if (shift < 8 - bits)
+				*p++ = byte;
+		}
+		return p;
+	}
+
+	*p++ = 128;
+	for (k = 0; k < w * h; ) {
+		uint32_t c = src[k / w * WIDTH + k % w];
+		int len = 1, n;
+		while (k + len < w * h && src[(k + len) / w * WIDTH + (k + len) % w] == c)
+			len++;
+		p = putCPixel(p, c);
+		for (n = len - 1; n >= 255; n -= 255)
+			*p++ = 255;
+		*p++ = n;
+		k += len;
+	}
+	if (p - start <= 1 + w * h * 3)
+		return p;
+
+	p = start;
+	*p++ = 0;
+	for (j = 0; j < h; j++)
+		for (i = 0; i < w; i++)
+			p = putCPixel(p, src[j * WIDTH + i]);
+	return p;
+}
+#endif
+
+/* mimics the pre-peek Raw path, which staged every row in a bounce buffer */
+static void stagedGotBitmap(rfbClient *client, const uint8_t *buffer, int x, int y, int w, int h)
+{
+	int j;
+	for (j = 0; j < h; j++)
+		memcpy(client->frameBuffer + ((y + j) * client->width + x) * BPP, buffer + j * w * BPP, w * BPP);
+}
+
+/* returns the final framebuffer contents */
+static char *run(const char *name, char **frames, size_t *frameLen, int nFrames,
+		unsigned int readBufferSize, rfbBool staged, int decodeThreads)
+{
+	char *frameBuffer;
+	rfbClient *client;
+	writer_t w;
+	pthread_t thread;
+	int sv[2], i;
+	double t;
+	double bytes = 0;
+
+	for (i = 0; i < nFrames; i++)
+		bytes += frameLen[i];
+	bytes *= FRAMES / nFrames;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+
+	client = rfbGetClient(8, 3, BPP);
+	client->sock = sv[0];
+	client->width = WIDTH;
+	client->height = HEIGHT;
+	client->frameBuffer = malloc(WIDTH * HEIGHT * BPP);
+	client->readBufferSize = readBufferSize;
+	client->decodeThreads = decodeThreads;
+	if (staged)
+		client->GotBitmap = stagedGotBitmap;
+
+	w.fd = sv[1];
+	w.frames = frames;
+	w.frameLen = frameLen;
+	w.nFrames = nFrames;
+	w.repeat = FRAMES / nFrames;
+	pthread_create(&thread, NULL, writeFrames, &w);
+
+	t = now();
+	for (i = 0; i < FRAMES; i++)
+		if (!HandleRFBServerMessage(client)) {
+			fprintf(stderr, "%s: frame %d failed\n", name, i);
+			break;
+		}
+	t = now() - t;
+
+	pthread_join(thread, NULL);
+	printf("%-32s %8.1f MB/s %8.1f fps\n", name, bytes / t / (1024 * 1024), i / t);
+
+	frameBuffer = (char *)client->frameBuffer;
+	close(sv[1]);
+	rfbClientCleanup(client);
+	return frameBuffer;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t *pixels = malloc(WIDTH * HEIGHT * BPP);
+	char *raw = malloc(WIDTH * HEIGHT * BPP + 64);
+	size_t rawLen;
+
+	rfbEnableClientLogging = FALSE;
+
+	fillPixels(pixels, 0);
+	rawLen = makeHeader(raw, rfbEncodingRaw) - raw;
+	memcpy(raw + rawLen, pixels, WIDTH * HEIGHT * BPP);
+	rawLen += WIDTH * HEIGHT * BPP;
+
+	free(run("raw, 8 KB buffer, staged", &raw, &rawLen, 1, 0, TRUE, 0));
+	free(run("raw, 256 KB buffer, in place", &raw, &rawLen, 1, BIG_BUFFER, FALSE, 0));
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+	{
+		/* one continuous deflate stream, so frames can't be replayed */
+		const int nFrames = FRAMES;
+		char *zframes[FRAMES];
+		size_t zlen[FRAMES];
+		z_stream zs;
+		uLong bound;
+		char *tmp;
+		int i;
+
+		memset(&zs, 0, sizeof(zs));
+		deflateInit(&zs, 1);
+		bound = deflateBound(&zs, WIDTH * HEIGHT * BPP) + 64;
+		tmp = malloc(bound);
+		for (i = 0; i < nFrames; i++) {
+			rfbZlibHeader hdr;
+			char *p;
+
+			fillPixels(pixels, i);
+			p = makeHeader(tmp, rfbEncodingZlib);
+			zs.next_in = (Bytef *)pixels;
+			zs.avail_in = WIDTH * HEIGHT * BPP;
+			zs.next_out = (Bytef *)p + sz_rfbZlibHeader;
+			zs.avail_out = bound - (p - tmp) - sz_rfbZlibHeader;
+			deflate(&zs, Z_SYNC_FLUSH);
+			hdr.nBytes = htonl((uint32_t)((char *)zs.next_out - p - sz_rfbZlibHeader));
+			memcpy(p, &hdr, sz_rfbZlibHeader);
+			zlen[i] = (char *)zs.next_out - tmp;
+			zframes[i] = malloc(zlen[i]);
+			memcpy(zframes[i], tmp, zlen[i]);
+		}
+		deflateEnd(&zs);
+		free(tmp);
+
+		free(run("zlib, 8 KB buffer", zframes, zlen, nFrames, 0, FALSE, 0));
+		free(run("zlib, 256 KB buffer", zframes, zlen, nFrames, BIG_BUFFER, FALSE, 0));
+
+		for (i = 0; i < nFrames; i++)
+			free(zframes[i]);
+	}
+#endif
+
+#ifdef LIBVNCSERVER_HAVE_LIBZ
+	{
+		/* ZRLE keeps one deflate stream too; tiles in row-major order */
+		const int nFrames = FRAMES;
+		static const int threads[] = { 0, 2, 4 };
+		char *zframes[FRAMES];
+		size_t zlen[FRAMES];
+		char *serial = NULL;
+		z_stream zs;
+		uLong bound;
+		uint8_t *tiles = malloc(WIDTH * HEIGHT * 4 + (WIDTH / 64 + 1) * (HEIGHT / 64 + 1));
+		char *tmp;
+		int i, x, y;
+
+		memset(&zs, 0, sizeof(zs));
+		deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+		bound = deflateBound(&zs, WIDTH * HEIGHT * 4 + (WIDTH / 64 + 1) * (HEIGHT / 64 + 1)) + 64;
+		tmp = malloc(bound);
+		for (i = 0; i < nFrames; i++) {
+			rfbZRLEHeader hdr;
+			uint8_t *t = tiles;
+			char *p;
+
+			fillDesktop(pixels, i);
+			for (y = 0; y < HEIGHT; y += 64)
+				for (x = 0; x < WIDTH; x += 64)
+					t = zrleTile(t, pixels + y * WIDTH + x,
+							x + 64 > WIDTH ? WIDTH - x : 64,
+							y + 64 > HEIGHT ? HEIGHT - y : 64);
+
+			p = makeHeader(tmp, rfbEncodingZRLE);
+			zs.next_in = tiles;
+			zs.avail_in = t - tiles;
+			zs.next_out = (Bytef *)p + sz_rfbZRLEHeader;
+			zs.avail_out = bound - (p - tmp) - sz_rfbZRLEHeader;
+			deflate(&zs, Z_SYNC_FLUSH);
+			hdr.length = htonl((uint32_t)((char *)zs.next_out - p - sz_rfbZRLEHeader));
+			memcpy(p, &hdr, sz_rfbZRLEHeader);
+			zlen[i] = (char *)zs.next_out - tmp;
+			zframes[i] = malloc(zlen[i]);
+			memcpy(zframes[i], tmp, zlen[i]);
+		}
+		deflateEnd(&zs);
+		free(tmp);
+		free(tiles);
+
+		for (i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); i++) {
+			char name[64];
+			char *fb;
+
+			snprintf(name, sizeof(name), "zrle, %d decode threads", threads[i]);
+			fb = run(name, zframes, zlen, nFrames, BIG_BUFFER, FALSE, threads[i]);
+			if (serial == NULL)
+				serial = fb;
+			else {
+				if (memcmp(serial, fb, WIDTH * HEIGHT * BPP) != 0)
+					fprintf(stderr, "%s: framebuffer differs from serial decode\n", name);
+				free(fb);
+			}
+		}
+
+		/* 24 bit CPIXELs are read as whole words, so only the low bytes count */
+		fillDesktop(pixels, nFrames - 1);
+		for (x = 0; x < WIDTH * HEIGHT; x++)
+			if ((((uint32_t *)serial)[x] ^ pixels[x]) & 0xffffff) {
+				fprintf(stderr, "zrle: framebuffer differs from the encoded frame\n");
+				break;
+			}
+
+		free(serial);
+		for (i = 0; i < nFrames; i++)
+			free(zframes[i]);
+	}
+#endif
+
+#if defined(LIBVNCSERVER_HAVE_LIBZ) && defined(LIBVNCSERVER_HAVE_LIBJPEG)
+	{
+		/* JPEG rects are independent, so a few frames can be replayed */
+		const int nFrames = 4;
+		const int nRects = (WIDTH / JPEG_TILE_W) * (HEIGHT / JPEG_TILE_H);
+		static const int threads[] = { 0, 2, 4 };
+		char *jframes[4];
+		size_t jlen[4];
+		char *serial = NULL;
+		tjhandle tj = tjInitCompress();
+		unsigned long bound = tjBufSize(JPEG_TILE_W, JPEG_TILE_H, TJSAMP_420);
+		int i, x, y;
+
+		for (i = 0; i < nFrames; i++) {
+			rfbFramebufferUpdateMsg fu;
+			char *p;
+
+			fillPixels(pixels, i * 8);
+			jframes[i] = p = malloc(sz_rfbFramebufferUpdateMsg +
+					nRects * (sz_rfbFramebufferUpdateRectHeader + 4 + bound));
+			memset(&fu, 0, sizeof(fu));
+			fu.type = rfbFramebufferUpdate;
+			fu.nRects = htons(nRects);
+			memcpy(p, &fu, sz_rfbFramebufferUpdateMsg);
+			p += sz_rfbFramebufferUpdateMsg;
+
+			for (y = 0; y + JPEG_TILE_H <= HEIGHT; y += JPEG_TILE_H)
+				for (x = 0; x + JPEG_TILE_W <= WIDTH; x += JPEG_TILE_W) {
+					rfbFramebufferUpdateRectHeader rect;
+					unsigned long size = bound;
+					unsigned char *jpeg = (unsigned char *)p + sz_rfbFramebufferUpdateRectHeader + 4;
+
+					rect.r.x = htons(x);
+					rect.r.y = htons(y);
+					rect.r.w = htons(JPEG_TILE_W);
+					rect.r.h = htons(JPEG_TILE_H);
+					rect.encoding = htonl(rfbEncodingTight);
+					memcpy(p, &rect, sz_rfbFramebufferUpdateRectHeader);
+					p += sz_rfbFramebufferUpdateRectHeader;
+
+					tjCompress2(tj, (unsigned char *)(pixels + y * WIDTH + x), JPEG_TILE_W,
+							WIDTH * BPP, JPEG_TILE_H, TJPF_RGBX, &jpeg, &size,
+							TJSAMP_420, JPEG_QUALITY, 0);
+
+					/* compression control, then the compact length */
+					*p++ = rfbTightJpeg << 4;
+					*p++ = (size & 0x7f) | 0x80;
+					*p++ = ((size >> 7) & 0x7f) | 0x80;
+					*p++ = size >> 14;
+					memmove(p, jpeg, size);
+					p += size;
+				}
+			jlen[i] = p - jframes[i];
+		}
+		tjDestroy(tj);
+
+		for (i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); i++) {
+			char name[64];
+			char *fb;
+
+			snprintf(name, sizeof(name), "tight jpeg, %d decode threads", threads[i]);
+			fb = run(name, jframes, jlen, nFrames, BIG_BUFFER, FALSE, threads[i]);
+			if (serial == NULL)
+				serial = fb;
+			else {
+				if (memcmp(serial, fb, WIDTH * HEIGHT * BPP) != 0)
+					fprintf(stderr, "%s: framebuffer differs from serial decode\n", name);
+				free(fb);
+			}
+		}
+
+		free(serial);
+		for (i = 0; i < nFrames; i++)
+			free(jframes[i]);
+	}
+#endif
+
+	free(raw);
+	free(pixels);
+	return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * regionstest.c - runs random sequences of region operations on the span
+ * lists of rfbregion.c and the banded rectangles of rfbregion_bands.c
+ * side by side. After every step both must cover exactly the pixels a
+ * plain bitmap says they should, give the same answers as the bitmap,
+ * and hand out disjoint rectangles, as many as they count, in the order
+ * each kind of reverse iterator promises.
+ *
+ * Usage: regionstest [-seed n] [-steps n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "regionstest.h"
+
+#define GRID 64
+#define SLOTS 4
+#define SCATTER_RECTS 64
+
+enum { SET_RECT, OR_RECT, SCATTER, OR, AND_RECT, AND, SUBTRACT_RECT, SUBTRACT, OFFSET,
+       COPY, MAKE_EMPTY, BBOX, POP, OPS };
+static const char *opNames[OPS] = {
+	"set rect", "or rect", "scatter", "or", "and rect", "and", "subtract rect",
+	"subtract", "offset", "copy", "make empty", "bbox", "pop"
+};
+
+static const RegionEngine *engines[2] = { &spanEngine, &bandEngine };
+
+typedef unsigned char Bitmap[GRID][GRID];
+
+typedef struct Slot {
+	struct sraRegion *rgn[2];
+	Bitmap bits;
+} Slot;
+
+static Slot slots[SLOTS];
+static int step, failures = 0;
+
+static void fail(const RegionEngine *e, int op, const char *what)
+{
+	if (failures++ < 10)
+		fprintf(stderr, "step %d, %s: %s %s\n", step, opNames[op], e->name, what);
+}
+
+static void randomRect(sraRect *r, int size)
+{
+	int w = 1 + rand() % size, h = 1 + rand() % size;
+
+	r->x1 = rand() % GRID;
+	r->y1 = rand() % GRID;
+	r->x2 = r->x1 + w > GRID ? GRID : r->x1 + w;
+	r->y2 = r->y1 + h > GRID ? GRID : r->y1 + h;
+}
+
+static void fillBits(Bitmap bits, const sraRect *r, int value)
+{
+	int x, y;
+
+	for (y = r->y1; y < r->y2; y++)
+		for (x = r->x1; x < r->x2; x++)
+			bits[y][x] = value;
+}
+
+static int emptyBits(Bitmap bits)
+{
+	int x, y;
+
+	for (y = 0; y < GRID; y++)
+		for (x = 0; x < GRID; x++)
+			if (bits[y][x])
+				return 0;
+	return 1;
+}
+
+/* whether b may follow a when iterating with reverseX and reverseY */
+static int inOrder(const sraRect *a, const sraRect *b, int reverseX, int reverseY)
+{
+	if (a->y1 == b->y1)
+		return a->y2 == b->y2 && (reverseX ? b->x2 <= a->x1 : b->x1 >= a->x2);
+	return reverseY ? b->y2 <= a->y1 : b->y1 >= a->y2;
+}
+
+/* whether rectangles in top-left order are as few as they can be: none
+   touch in a band, and touching bands differ */
+static int minimal(const sraRect *rects, int n)
+{
+	int i, band = 0, prevBand = -1, k;
+
+	for (i = 1; i <= n; i++) {
+		if (i < n && rects[i].y1 == rects[band].y1) {
+			if (rects[i].x1 <= rects[i - 1].x2)
+				return 0;
+			continue;
+		}
+		if (prevBand >= 0 && i - band == band - prevBand && rects[prevBand].y2 == rects[band].y1) {
+			for (k = 0; k < i - band; k++)
+				if (rects[prevBand + k].x1 != rects[band + k].x1 || rects[prevBand + k].x2 != rects[band + k].x2)
+					break;
+			if (k == i - band)
+				return 0;
+		}
+		prevBand = band;
+		band = i;
+	}
+	return 1;
+}
+
+/* compares what an engine's region covers with the slot's bitmap */
+static void check(const RegionEngine *e, struct sraRegion *rgn, Bitmap bits, int op)
+{
+	static Bitmap hits;
+	static sraRect rects[GRID * GRID];
+	sraRectangleIterator *i;
+	sraRect r, prev = { 0, 0, 0, 0 };
+	unsigned long n;
+	int order, x, y;
+
+	for (order = 0; order < 4; order++) {
+		if (order == 0)
+			memset(hits, 0, sizeof(hits));
+		i = e->getReverseIterator(rgn, order & 1, order >> 1);
+		for (n = 0; e->iteratorNext(i, &r); n++) {
+			if (r.x1 < 0 || r.y1 < 0 || r.x2 > GRID || r.y2 > GRID || r.x1 >= r.x2 || r.y1 >= r.y2) {
+				fail(e, op, "returned a rectangle off the grid");
+				break;
+			}
+			if (n > 0 && !inOrder(&prev, &r, order & 1, order >> 1))
+				fail(e, op, "returned rectangles out of order");
+			if (order == 0) {
+				for (y = r.y1; y < r.y2; y++)
+					for (x = r.x1; x < r.x2; x++)
+						hits[y][x]++;
+				if (n < GRID * GRID)
+					rects[n] = r;
+			}
+			prev = r;
+		}
+		e->releaseIterator(i);
+		if (n != e->countRects(rgn))
+			fail(e, op, "counted other rectangles than it returned");
+		/* the span lists do not always merge what they could */
+		if (e == &bandEngine && order == 0 && n <= GRID * GRID && !minimal(rects, n))
+			fail(e, op, "left rectangles that could be merged");
+	}
+
+	if (memcmp(hits, bits, sizeof(hits)) != 0)
+		fail(e, op, "covers other pixels than it should");
+	if (!e->empty(rgn) != !emptyBits(bits))
+		fail(e, op, "is wrong about being empty");
+}
+
+/* pops every rectangle off a copy, which must cover the region once */
+static void checkPop(const RegionEngine *e, struct sraRegion *rgn, Bitmap bits, unsigned long flags)
+{
+	static Bitmap hits;
+	struct sraRegion *copy = e->createRgn(rgn);
+	sraRect r;
+	int x, y;
+
+	memset(hits, 0, sizeof(hits));
+	while (e->popRect(copy, &r, flags))
+		for (y = r.y1; y < r.y2; y++)
+			for (x = r.x1; x < r.x2; x++)
+				hits[y][x]++;
+	if (!e->empty(copy) || e->countRects(copy) != 0)
+		fail(e, POP, "is not empty after popping everything");
+	if (memcmp(hits, bits, sizeof(hits)) != 0)
+		fail(e, POP, "popped other pixels than it covers");
+	e->destroy(copy);
+}
+
+static void runStep(void)
+{
+	Slot *a = &slots[rand() % SLOTS], *b = a;
+	int op = rand() % OPS, k, i, x, y, dx = 0, dy = 0, any, answer[2];
+	sraRect r, box, dots[SCATTER_RECTS];
+	Bitmap bits;
+
+	while (b == a)
+		b = &slots[rand() % SLOTS];
+	randomRect(&r, rand() % 4 ? 12 : GRID);
+	for (i = 0; i < SCATTER_RECTS; i++)
+		randomRect(&dots[i], 3);
+	if (op == OFFSET) {
+		dx = rand() % 9 - 4;
+		dy = rand() % 9 - 4;
+	}
+
+	/* - What the bitmap says */
+	memcpy(bits, a->bits, sizeof(bits));
+	switch (op) {
+	case SET_RECT:
+		memset(bits, 0, sizeof(bits));
+		/* fall through */
+	case OR_RECT:
+		fillBits(bits, &r, 1);
+		break;
+	case SCATTER:
+		for (i = 0; i < SCATTER_RECTS; i++)
+			fillBits(bits, &dots[i], 1);
+		break;
+	case AND_RECT:
+		for (y = 0; y < GRID; y++)
+			for (x = 0; x < GRID; x++)
+				bits[y][x] &= x >= r.x1 && x < r.x2 && y >= r.y1 && y < r.y2;
+		break;
+	case SUBTRACT_RECT:
+		fillBits(bits, &r, 0);
+		break;
+	case OR:
+	case AND:
+	case SUBTRACT:
+		for (y = 0; y < GRID; y++)
+			for (x = 0; x < GRID; x++)
+				if (op == OR)
+					bits[y][x] |= b->bits[y][x];
+				else if (op == AND)
+					bits[y][x] &= b->bits[y][x];
+				else
+					bits[y][x] &= !b->bits[y][x];
+		break;
+	case OFFSET:
+		memset(bits, 0, sizeof(bits));
+		for (y = 0; y < GRID; y++)
+			for (x = 0; x < GRID; x++)
+				if (x + dx >= 0 && x + dx < GRID && y + dy >= 0 && y + dy < GRID)
+					bits[y + dy][x + dx] = a->bits[y][x];
+		break;
+	case COPY:
+		memcpy(bits, b->bits, sizeof(bits));
+		break;
+	case MAKE_EMPTY:
+		memset(bits, 0, sizeof(bits));
+		break;
+	case BBOX:
+		box.x1 = box.y1 = GRID;
+		box.x2 = box.y2 = 0;
+		for (y = 0; y < GRID; y++)
+			for (x = 0; x < GRID; x++)
+				if (bits[y][x]) {
+					if (x < box.x1) box.x1 = x;
+					if (y < box.y1) box.y1 = y;
+					if (x >= box.x2) box.x2 = x + 1;
+					if (y >= box.y2) box.y2 = y + 1;
+				}
+		if (box.x1 < box.x2)
+			fillBits(bits, &box, 1);
+		break;
+	}
+	any = !emptyBits(bits);
+
+	/* - What the engines do */
+	for (k = 0; k < 2; k++) {
+		const RegionEngine *e = engines[k];
+		struct sraRegion *rgn = a->rgn[k], *other = b->rgn[k], *tmp = e->createRect(r.x1, r.y1, r.x2, r.y2);
+
+		answer[k] = -1;
+		switch (op) {
+		case SET_RECT:
+			e->destroy(rgn);
+			rgn = e->createRect(r.x1, r.y1, r.x2, r.y2);
+			break;
+		case OR_RECT:
+			e->or(rgn, tmp);
+			break;
+		case SCATTER:
+			/* - many small rectangles, as damage comes */
+			for (i = 0; i < SCATTER_RECTS; i++) {
+				e->destroy(tmp);
+				tmp = e->createRect(dots[i].x1, dots[i].y1, dots[i].x2, dots[i].y2);
+				e->or(rgn, tmp);
+			}
+			break;
+		case OR:
+			e->or(rgn, other);
+			break;
+		case AND_RECT:
+			answer[k] = !e->and(rgn, tmp);
+			break;
+		case AND:
+			answer[k] = !e->and(rgn, other);
+			break;
+		case SUBTRACT_RECT:
+			answer[k] = !e->subtract(rgn, tmp);
+			break;
+		case SUBTRACT:
+			answer[k] = !e->subtract(rgn, other);
+			break;
+		case OFFSET:
+			e->destroy(tmp);
+			tmp = e->createRect(0, 0, GRID, GRID);
+			e->offset(rgn, dx, dy);
+			e->and(rgn, tmp);
+			break;
+		case COPY:
+			e->destroy(rgn);
+			rgn = e->createRgn(other);
+			break;
+		case MAKE_EMPTY:
+			e->makeEmpty(rgn);
+			break;
+		case BBOX:
+			e->destroy(tmp);
+			tmp = rgn;
+			rgn = e->bbox(tmp);
+			break;
+		case POP:
+			checkPop(e, rgn, bits, rand() % 4);
+			break;
+		}
+		e->destroy(tmp);
+		a->rgn[k] = rgn;
+
+		if (answer[k] != -1 && answer[k] != !any)
+			fail(e, op, "returned the wrong emptiness");
+		check(e, rgn, bits, op);
+
+		/* - and whether they see the same overlap as the bitmap */
+		answer[k] = !e->intersects(rgn, other);
+	}
+	memcpy(a->bits, bits, sizeof(bits));
+
+	any = 0;
+	for (y = 0; y < GRID; y++)
+		for (x = 0; x < GRID; x++)
+			any |= a->bits[y][x] & b->bits[y][x];
+	for (k = 0; k < 2; k++)
+		if (answer[k] != !any)
+			fail(engines[k], op, "is wrong about intersecting");
+}
+
+int main(int argc, char **argv)
+{
+	int i, k, steps = 20000;
+	unsigned int seed = 1;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-seed") == 0)
+			seed = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-steps") == 0)
+			steps = atoi(argv[i + 1]);
+	}
+	srand(seed);
+
+	for (i = 0; i < SLOTS; i++)
+		for (k = 0; k < 2; k++)
+			slots[i].rgn[k] = engines[k]->create();
+
+	for (step = 0; step < steps && failures < 10; step++)
+		runStep();
+
+	for (i = 0; i < SLOTS; i++)
+		for (k = 0; k < 2; k++)
+			engines[k]->destroy(slots[i].rgn[k]);
+
+	if (failures)
+		fprintf(stderr, "%d failures with seed %u\n", failures, seed);
+	else
+		printf("%d steps with seed %u agree\n", steps, seed);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * regionstest.h - both region engines of libvncserver, side by side.
+ *
+ * regionstest_spans.c and regionstest_bands.c each build one engine from
+ * its source with every global renamed to the prefix in SRA_ENGINE, so
+ * both link into one program next to the library's own, and hand its
+ * functions to regionstest.c in a RegionEngine.
+ */
+
+#ifndef REGIONSTEST_H
+#define REGIONSTEST_H
+
+#ifdef SRA_ENGINE
+#define SRA_NAME(name) SRA_NAME2(SRA_ENGINE, name)
+#define SRA_NAME2(engine, name) SRA_NAME3(engine, name)
+#define SRA_NAME3(engine, name) engine##name
+
+#define sraRgnCreate SRA_NAME(RgnCreate)
+#define sraRgnCreateRect SRA_NAME(RgnCreateRect)
+#define sraRgnCreateRgn SRA_NAME(RgnCreateRgn)
+#define sraRgnDestroy SRA_NAME(RgnDestroy)
+#define sraRgnMakeEmpty SRA_NAME(RgnMakeEmpty)
+#define sraRgnAnd SRA_NAME(RgnAnd)
+#define sraRgnOr SRA_NAME(RgnOr)
+#define sraRgnSubtract SRA_NAME(RgnSubtract)
+#define sraRgnIntersects SRA_NAME(RgnIntersects)
+#define sraRgnOffset SRA_NAME(RgnOffset)
+#define sraRgnPopRect SRA_NAME(RgnPopRect)
+#define sraRgnCountRects SRA_NAME(RgnCountRects)
+#define sraRgnEmpty SRA_NAME(RgnEmpty)
+#define sraRgnBBox SRA_NAME(RgnBBox)
+#define sraRgnGetIterator SRA_NAME(RgnGetIterator)
+#define sraRgnGetReverseIterator SRA_NAME(RgnGetReverseIterator)
+#define sraRgnIteratorNext SRA_NAME(RgnIteratorNext)
+#define sraRgnReleaseIterator SRA_NAME(RgnReleaseIterator)
+#define sraRgnPrint SRA_NAME(RgnPrint)
+#define sraClipRect SRA_NAME(ClipRect)
+#define sraClipRect2 SRA_NAME(ClipRect2)
+#define sraSpanListDup SRA_NAME(SpanListDup)
+#define sraSpanListDestroy SRA_NAME(SpanListDestroy)
+#endif
+
+#include <rfb/rfb.h>
+#include <rfb/rfbregion.h>
+
+typedef struct RegionEngine {
+	const char *name;
+	struct sraRegion *(*create)(void);
+	struct sraRegion *(*createRect)(int x1, int y1, int x2, int y2);
+	struct sraRegion *(*createRgn)(const struct sraRegion *src);
+	void (*destroy)(struct sraRegion *rgn);
+	void (*makeEmpty)(struct sraRegion *rgn);
+	rfbBool (*and)(struct sraRegion *dst, const struct sraRegion *src);
+	void (*or)(struct sraRegion *dst, const struct sraRegion *src);
+	rfbBool (*subtract)(struct sraRegion *dst, const struct sraRegion *src);
+	rfbBool (*intersects)(const struct sraRegion *rgn1, const struct sraRegion *rgn2);
+	void (*offset)(struct sraRegion *dst, int dx, int dy);
+	rfbBool (*popRect)(struct sraRegion *region, sraRect *rect, unsigned long flags);
+	unsigned long (*countRects)(const struct sraRegion *rgn);
+	rfbBool (*empty)(const struct sraRegion *rgn);
+	struct sraRegion *(*bbox)(const struct sraRegion *src);
+	sraRectangleIterator *(*getReverseIterator)(struct sraRegion *s, rfbBool reverseX, rfbBool reverseY);
+	rfbBool (*iteratorNext)(sraRectangleIterator *i, sraRect *r);
+	void (*releaseIterator)(sraRectangleIterator *i);
+} RegionEngine;
+
+extern const RegionEngine spanEngine, bandEngine;
+
+#ifdef SRA_ENGINE
+#define SRA_ENGINE_TABLE(engine) \
+const RegionEngine engine##Engine = { \
+	#engine, sraRgnCreate, sraRgnCreateRect, sraRgnCreateRgn, \
+	sraRgnDestroy, sraRgnMakeEmpty, sraRgnAnd, sraRgnOr, sraRgnSubtract, \
+	sraRgnIntersects, sraRgnOffset, sraRgnPopRect, sraRgnCountRects, \
+	sraRgnEmpty, sraRgnBBox, sraRgnGetReverseIterator, sraRgnIteratorNext, \
+	sraRgnReleaseIterator \
+}
+#endif
+
+#endif
@@ -0,0 +1,8 @@
+/* regionstest_bands.c - the banded engine from rfbregion_bands.c, renamed */
+
+#define SRA_ENGINE band
+#include "regionstest.h"
+
+#include "../src/libvncserver/rfbregion_bands.c"
+
+SRA_ENGINE_TABLE(band);
@@ -0,0 +1,9 @@
+/* regionstest_spans.c - the span list engine from rfbregion.c, renamed */
+
+#define SRA_ENGINE span
+#include "regionstest.h"
+
+#undef LIBVNCSERVER_BANDED_REGIONS
+#include "../src/libvncserver/rfbregion.c"
+
+SRA_ENGINE_TABLE(span);
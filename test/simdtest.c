@@ -0,0 +1,456 @@
+/*
+ * simdtest.c - checks the vectorised fill and rectangle move kernels
+ * against the plain per-pixel loops libvncclient used before, the
+ * difference search libvncserver's damage detection uses against a byte
+ * loop, and the pixel translation kernels against per-pixel ones, for
+ * every instruction set this CPU supports. Run with -b to also time scrolling
+ * and tile fills on a 4K framebuffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "simd.h"
+
+#define WIDTH 3840
+#define HEIGHT 2160
+#define ROUNDS 1000
+
+static int failures = 0;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* the FILL_RECT loop formerly in vncviewer.c */
+static void refFill(uint8_t *fb, int width, int bpp, int x, int y, int w, int h, uint32_t colour)
+{
+	int i, j;
+
+	for (j = y * width; j < (y + h) * width; j += width)
+		for (i = x; i < x + w; i++)
+			switch (bpp) {
+			case 8: ((uint8_t *)fb)[j + i] = colour; break;
+			case 16: ((uint16_t *)fb)[j + i] = colour; break;
+			case 32: ((uint32_t *)fb)[j + i] = colour; break;
+			}
+}
+
+/* the COPY_RECT_FROM_RECT loop formerly in vncviewer.c, for one pixel size */
+#define REF_MOVE(BPP)                                                         \
+static void refMove##BPP(uint8_t *fb, int width, int src_x, int src_y,         \
+		int w, int h, int dest_x, int dest_y)                          \
+{                                                                             \
+	uint##BPP##_t *f = (uint##BPP##_t *)fb;                                \
+	uint##BPP##_t *b = f + (src_y - dest_y) * width + src_x - dest_x;      \
+	int i, j;                                                              \
+	if (dest_y < src_y) {                                                  \
+		for (j = dest_y * width; j < (dest_y + h) * width; j += width) \
+			if (dest_x < src_x)                                    \
+				for (i = dest_x; i < dest_x + w; i++)          \
+					f[j + i] = b[j + i];                   \
+			else                                                   \
+				for (i = dest_x + w - 1; i >= dest_x; i--)     \
+					f[j + i] = b[j + i];                   \
+	} else {                                                               \
+		for (j = (dest_y + h - 1) * width; j >= dest_y * width; j -= width) \
+			if (dest_x < src_x)                                    \
+				for (i = dest_x; i < dest_x + w; i++)          \
+					f[j + i] = b[j + i];                   \
+			else                                                   \
+				for (i = dest_x + w - 1; i >= dest_x; i--)     \
+					f[j + i] = b[j + i];                   \
+	}                                                                      \
+}
+REF_MOVE(8)
+REF_MOVE(16)
+REF_MOVE(32)
+
+static void refMove(uint8_t *fb, int width, int bpp, int src_x, int src_y,
+		int w, int h, int dest_x, int dest_y)
+{
+	switch (bpp) {
+	case 8: refMove8(fb, width, src_x, src_y, w, h, dest_x, dest_y); break;
+	case 16: refMove16(fb, width, src_x, src_y, w, h, dest_x, dest_y); break;
+	case 32: refMove32(fb, width, src_x, src_y, w, h, dest_x, dest_y); break;
+	}
+}
+
+static void simdMove(uint8_t *fb, int width, int bpp, int src_x, int src_y,
+		int w, int h, int dest_x, int dest_y)
+{
+	int stride = width * bpp / 8;
+	simd_move_rect(fb + dest_y * stride + dest_x * bpp / 8,
+			fb + src_y * stride + src_x * bpp / 8, stride, w * bpp / 8, h);
+}
+
+/* what simd_shuffle32() does, a byte at a time */
+static void refShuffle(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+		int w, int h, const uint8_t map[4])
+{
+	int i, j, k;
+
+	for (j = 0; j < h; j++)
+		for (i = 0; i < w; i++)
+			for (k = 0; k < 4; k++)
+				dst[j * dst_stride + i * 4 + k] =
+					map[k] < 4 ? src[j * src_stride + i * 4 + map[k]] : 0;
+}
+
+/* what libvncserver's RGB tables make of a 32 bit pixel for a 16 bit client */
+static void refPack(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride,
+		int w, int h, const simd_pack_format *fmt)
+{
+	uint32_t p;
+	uint16_t v;
+	int i, j, c;
+
+	for (j = 0; j < h; j++)
+		for (i = 0; i < w; i++) {
+			memcpy(&p, src + j * src_stride + i * 4, 4);
+			v = 0;
+			for (c = 0; c < 3; c++)
+				v |= ((((p >> fmt->in_shift[c]) & 0xff) * fmt->max[c] + 255 / 2) / 255)
+					<< fmt->out_shift[c];
+			if (fmt->swap)
+				v = v << 8 | v >> 8;
+			memcpy(dst + j * dst_stride + i * 2, &v, 2);
+		}
+}
+
+static void check(const char *what, int features, int bpp, const uint8_t *a,
+		const uint8_t *b, size_t size, int x, int y, int w, int h)
+{
+	if (memcmp(a, b, size) != 0) {
+		fprintf(stderr, "%s mismatch: features 0x%x, %d bpp, %dx%d at %d,%d\n",
+				what, features, bpp, w, h, x, y);
+		failures++;
+	}
+}
+
+/* small odd-sized framebuffer so that edges, tails and overlaps get hit */
+static void testKernels(int features)
+{
+	const int width = 211, height = 67;
+	static const int bpps[] = { 8, 16, 32 };
+	uint8_t *a = malloc(width * height * 4), *b = malloc(width * height * 4);
+	uint8_t *noise = malloc(width * height * 4);
+	int k, n;
+
+	simd_set_features(features);
+	for (n = 0; n < width * height * 4; n++)
+		noise[n] = rand();
+
+	for (k = 0; k < 3; k++) {
+		int bpp = bpps[k];
+		size_t size = (size_t)width * height * bpp / 8;
+
+		for (n = 0; n < ROUNDS; n++) {
+			int w = 1 + rand() % width, h = 1 + rand() % height;
+			int x = rand() % (width - w + 1), y = rand() % (height - h + 1);
+			uint32_t colour = (uint32_t)rand() << 16 ^ rand();
+
+			memcpy(a, noise, size);
+			memcpy(b, noise, size);
+			refFill(a, width, bpp, x, y, w, h, colour);
+			simd_fill_rect(b + (y * width + x) * bpp / 8, width * bpp / 8, bpp, w, h, colour);
+			check("fill", features, bpp, a, b, size, x, y, w, h);
+		}
+
+		for (n = 0; n < ROUNDS; n++) {
+			int w = 1 + rand() % width, h = 1 + rand() % height;
+			int sx = rand() % (width - w + 1), sy = rand() % (height - h + 1);
+			int dx = rand() % (width - w + 1), dy = rand() % (height - h + 1);
+
+			/* mostly short moves, like scrolling, so rects overlap */
+			if (n % 4 != 0) {
+				dx = sx + rand() % 9 - 4;
+				dy = sy + rand() % 9 - 4;
+				if (dx < 0 || dx + w > width)
+					dx = sx;
+				if (dy < 0 || dy + h > height)
+					dy = sy;
+			}
+			if (n % 16 == 1) {
+				sx = dx = 0;
+				w = width;
+			}
+
+			memcpy(a, noise, size);
+			memcpy(b, noise, size);
+			refMove(a, width, bpp, sx, sy, w, h, dx, dy);
+			simdMove(b, width, bpp, sx, sy, w, h, dx, dy);
+			check("move", features, bpp, a, b, size, dx, dy, w, h);
+		}
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		size_t len = rand() % 1000, start = rand() % 64, i, expected;
+
+		memcpy(a, noise, start + len);
+		memcpy(b, noise, start + len);
+		/* no difference, one, or one with more after it */
+		expected = len;
+		if (len > 0 && n % 3 != 0) {
+			expected = rand() % len;
+			b[start + expected] ^= 1 << (rand() % 8);
+			if (n % 3 == 2 && expected + 1 < len)
+				b[start + expected + 1 + rand() % (len - expected - 1)] ^= 0x80;
+		}
+		for (i = 0; i < len && a[start + i] == b[start + i]; i++)
+			;
+		if (i != expected || simd_find_difference(a + start, b + start, len) != expected) {
+			fprintf(stderr, "find difference mismatch: features 0x%x, %d bytes at %d\n",
+					features, (int)len, (int)start);
+			failures++;
+		}
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		static const int maxes[] = { 1, 7, 15, 31, 63, 255 };
+		int w = 1 + rand() % width, h = 1 + rand() % height, c, k, bits;
+		size_t size = (size_t)width * height * 4;
+		simd_pack_format fmt;
+		uint8_t map[4];
+
+		/* now and then whole rows, which go in one */
+		if (n % 8 == 0)
+			w = width;
+
+		for (k = 0; k < 4; k++)
+			map[k] = rand() % 5 == 0 ? 0x80 : rand() % 4;
+		memcpy(a, noise, size);
+		memcpy(b, noise, size);
+		refShuffle(a, w * 4, noise, width * 4, w, h, map);
+		simd_shuffle32(b, w * 4, noise, width * 4, w, h, map);
+		check("shuffle", features, 32, a, b, size, 0, 0, w, h);
+
+		for (c = 0; c < 3; c++) {
+			fmt.in_shift[c] = 8 * (rand() % 4);
+			fmt.max[c] = maxes[rand() % 6];
+			for (bits = 0; fmt.max[c] >> bits; bits++)
+				;
+			fmt.out_shift[c] = rand() % (17 - bits);
+		}
+		fmt.swap = rand() % 2;
+		memcpy(a, noise, size);
+		memcpy(b, noise, size);
+		refPack(a, w * 2, noise, width * 4, w, h, &fmt);
+		simd_pack32to16(b, w * 2, noise, width * 4, w, h, &fmt);
+		check("pack", features, 16, a, b, size, 0, 0, w, h);
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		size_t len = rand() % (width * 4), start = rand() % 64, i;
+		uint32_t weight = n % 4 == 0 ? 1 : rand() % 65536;
+		uint32_t *sa = (uint32_t *)a, *sb = (uint32_t *)b;
+
+		/* sums near where 32 bits run out */
+		for (i = 0; i < len; i++)
+			sa[i] = sb[i] = (uint32_t)rand() << 8 ^ rand();
+		for (i = 0; i < len; i++)
+			sa[i] += noise[start + i] * weight;
+		simd_accumulate_u8(sb, noise + start, len, weight);
+		check("accumulate", features, 8, a, b, len * 4, (int)start, 0, (int)len, 1);
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		static const int maxes[] = { 1, 7, 15, 31, 63, 255 };
+		int w = rand() % width, shift[3], max[3], c, i;
+		uint16_t p;
+
+		for (c = 0; c < 3; c++) {
+			max[c] = maxes[rand() % 6];
+			shift[c] = rand() % 16;
+		}
+		memset(a, 0xaa, w * 4);
+		memset(b, 0x55, w * 4);
+		for (i = 0; i < w; i++) {
+			memcpy(&p, noise + 2 * i, 2);
+			for (c = 0; c < 3; c++)
+				a[4 * i + c] = (p >> shift[c]) & max[c];
+			a[4 * i + 3] = 0;
+		}
+		simd_unpack16(b, noise, w, shift, max);
+		check("unpack16", features, 16, a, b, w * 4, 0, 0, w, 1);
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		int w = rand() % 200, count = 1 + rand() % 8, shift, i, j, k;
+		uint32_t *sums = malloc(w * count * 4 * sizeof(uint32_t)), sum, m;
+		uint8_t mask[4];
+
+		/* what scale.c divides a sum of count * count bytes by */
+		for (shift = 31; (2 << (shift - 31)) <= count * count; shift++)
+			;
+		m = (uint32_t)(((uint64_t)1 << shift) / (count * count) + 1);
+		for (k = 0; k < 4; k++)
+			mask[k] = rand() % 3 == 0 ? 0 : 0xff;
+		for (i = 0; i < w * count * 4; i++)
+			sums[i] = rand() % (255 * count + 1);
+		memset(a, 0xaa, w * 4);
+		memset(b, 0x55, w * 4);
+		for (i = 0; i < w; i++)
+			for (k = 0; k < 4; k++) {
+				for (sum = 0, j = 0; j < count; j++)
+					sum += sums[4 * (i * count + j) + k];
+				a[4 * i + k] = sum / (count * count) & mask[k];
+			}
+		simd_average_u32(b, sums, w, count, m, shift, mask);
+		check("average", features, 32, a, b, w * 4, 0, 0, w, count);
+		free(sums);
+	}
+
+	for (n = 0; n < ROUNDS; n++) {
+		size_t len = rand() % 1000, start = rand() % 64, i;
+		uint8_t mask[4];
+		int k;
+
+		for (k = 0; k < 4; k++)
+			mask[k] = rand();
+		memcpy(a, noise, start + len);
+		memcpy(b, noise, start + len);
+		for (i = 0; i < len; i++)
+			a[start + i] ^= mask[i % 4];
+		simd_xor_mask(b + start, len, mask);
+		check("xor mask", features, 8, a, b, start + len, (int)start, 0, (int)len, 1);
+	}
+
+	free(a);
+	free(b);
+	free(noise);
+}
+
+static void fill(uint8_t *fb, int reference, int x, int y, int size, uint32_t colour)
+{
+	if (reference)
+		refFill(fb, WIDTH, 32, x, y, size, size, colour);
+	else
+		simd_fill_rect(fb + (y * WIDTH + x) * 4, WIDTH * 4, 32, size, size, colour);
+}
+
+static void move(uint8_t *fb, int reference, int src_x, int src_y, int w, int h, int dest_x, int dest_y)
+{
+	if (reference)
+		refMove(fb, WIDTH, 32, src_x, src_y, w, h, dest_x, dest_y);
+	else
+		simdMove(fb, WIDTH, 32, src_x, src_y, w, h, dest_x, dest_y);
+}
+
+/* the byte loop, or the kernel */
+static size_t findDifference(const uint8_t *a, const uint8_t *b, int reference, size_t n)
+{
+	size_t i;
+
+	if (!reference)
+		return simd_find_difference(a, b, n);
+	for (i = 0; i < n && a[i] == b[i]; i++)
+		;
+	return i;
+}
+
+/* best of a few runs, this is meant to be run on a busy desktop */
+static void benchmark(int reference)
+{
+	uint8_t *fb = calloc(WIDTH * HEIGHT, 4);
+	const int frames = 10;
+	uint8_t *copy = calloc(WIDTH * HEIGHT, 4);
+	double t, best[5] = { 1e9, 1e9, 1e9, 1e9, 1e9 };
+	int r, i, x, y;
+
+	for (r = 0; r < 5; r++) {
+		/* fill the whole screen in 16x16 tiles, as hextile and RRE do */
+		t = now();
+		for (i = 0; i < frames; i++)
+			for (y = 0; y < HEIGHT; y += 16)
+				for (x = 0; x < WIDTH; x += 16)
+					fill(fb, reference, x, y, 16, x ^ y ^ i);
+		t = now() - t;
+		if (t < best[0])
+			best[0] = t;
+
+		/* and in large solid areas, as tight does */
+		t = now();
+		for (i = 0; i < frames; i++)
+			for (y = 0; y + 240 <= HEIGHT; y += 240)
+				for (x = 0; x < WIDTH; x += 240)
+					fill(fb, reference, x, y, 240, x ^ y ^ i);
+		t = now() - t;
+		if (t < best[3])
+			best[3] = t;
+
+		/* scroll by one line, full width and in a window with borders */
+		t = now();
+		for (i = 0; i < frames; i++)
+			move(fb, reference, 0, 1, WIDTH, HEIGHT - 1, 0, 0);
+		t = now() - t;
+		if (t < best[1])
+			best[1] = t;
+
+		t = now();
+		for (i = 0; i < frames; i++)
+			move(fb, reference, 64, 101, WIDTH - 128, HEIGHT - 200, 64, 100);
+		t = now() - t;
+		if (t < best[2])
+			best[2] = t;
+
+		/* look for a change in an unchanged frame, as damage detection does */
+		memcpy(copy, fb, WIDTH * HEIGHT * 4);
+		t = now();
+		for (i = 0; i < frames; i++)
+			if (findDifference(fb, copy, reference, WIDTH * HEIGHT * 4) != WIDTH * HEIGHT * 4)
+				failures++;
+		t = now() - t;
+		if (t < best[4])
+			best[4] = t;
+	}
+
+	printf("  fill 16x16 tiles, 32 bpp     %8.1f Mpx/s\n", frames * (double)WIDTH * HEIGHT / best[0] / 1e6);
+	printf("  fill 240x240 rects, 32 bpp   %8.1f Mpx/s\n", frames * (double)WIDTH * HEIGHT / best[3] / 1e6);
+	printf("  scroll full width, 32 bpp    %8.1f Mpx/s\n", frames * (double)WIDTH * (HEIGHT - 1) / best[1] / 1e6);
+	printf("  scroll window, 32 bpp        %8.1f Mpx/s\n", frames * (double)(WIDTH - 128) * (HEIGHT - 200) / best[2] / 1e6);
+	printf("  compare frames, 32 bpp       %8.1f Mpx/s\n", frames * (double)WIDTH * HEIGHT / best[4] / 1e6);
+
+	free(fb);
+	free(copy);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct { int mask; const char *name; } levels[] = {
+		{ 0, "plain C" },
+		{ SIMD_SSE2, "SSE2" },
+		{ SIMD_SSE2 | SIMD_SSSE3, "SSSE3" },
+		{ SIMD_SSE2 | SIMD_SSSE3 | SIMD_AVX2, "AVX2" },
+		{ SIMD_NEON, "NEON" }
+	};
+	int detected = simd_features();
+	int bench = argc > 1 && strcmp(argv[1], "-b") == 0;
+	unsigned int i;
+
+	srand(1);
+
+	if (bench) {
+		printf("reference loops:\n");
+		benchmark(1);
+	}
+
+	for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+		if ((levels[i].mask & detected) != levels[i].mask)
+			continue;
+		testKernels(levels[i].mask);
+		if (bench) {
+			printf("%s:\n", levels[i].name);
+			simd_set_features(levels[i].mask);
+			benchmark(0);
+		}
+	}
+
+	if (failures)
+		fprintf(stderr, "%d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -32,6 +32,11 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "simd.h"
 
 /* incoming data frames should not be larger than that */
 #define TEST_BUF_SIZE B64LEN(131072) + WSHLENMAX
@@ -167,12 +172,300 @@ static uint64_t run_test(struct ws_frame_test *ft, ws_ctx_t *ctx)
 }
 
 
-int main()
+/*
+ * Throughput benchmark, run with -bench [-mb n]: what the server gets
+ * through rfbWriteExact() to a WebSockets client, binary frames and
+ * base64 ones, next to copying every write into a frame as it used to,
+ * and how fast webSocketsDecodeHybi() unmasks what a client sends, with
+ * each instruction set simd_xor_mask() can use on this CPU.
+ */
+
+static int bench_mb = 256;
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int read_all(int fd, unsigned char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = read(fd, buf, len)) <= 0)
+      return 0;
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+/*
+ * Runs in a child process: reads frames until the server hangs up and
+ * checks that the payload of the binary ones is the chunk over and over.
+ * Exits with 0 if expected payload bytes came, and they were right.
+ */
+static void frame_reader(int fd, const unsigned char *chunk, size_t chunk_len, uint64_t expected)
+{
+  unsigned char hdr[2], ext[8], *payload = malloc(1 << 20);
+  unsigned char *repeated = malloc((1 << 20) + chunk_len);
+  uint64_t len, total = 0, i, n;
+  int bad = 0;
+
+  /* so that a memcmp() checks a read wherever in the chunk it starts */
+  for (i = 0; i < (1 << 20) + chunk_len; i++)
+    repeated[i] = chunk[i % chunk_len];
+
+  while (read_all(fd, hdr, 2)) {
+    len = hdr[1] & 0x7f;
+    if (len == 126) {
+      if (!read_all(fd, ext, 2))
+        break;
+      len = (uint64_t)ext[0] << 8 | ext[1];
+    } else if (len == 127) {
+      if (!read_all(fd, ext, 8))
+        break;
+      for (len = 0, i = 0; i < 8; i++)
+        len = len << 8 | ext[i];
+    }
+    while (len > 0) {
+      n = len < (1 << 20) ? len : (1 << 20);
+      if (!read_all(fd, payload, n))
+        _exit(2);
+      if ((hdr[0] & 0x0f) == WS_OPCODE_BINARY_FRAME) {
+        bad |= memcmp(payload, repeated + total % chunk_len, n) != 0;
+        total += n;
+      } else {
+        /* base64, which comes in one read; count what it decodes to */
+        total += n / 4 * 3 - (n > 0 && payload[n - 1] == '=') - (n > 1 && payload[n - 2] == '=');
+      }
+      len -= n;
+    }
+  }
+  _exit(bad || total != expected ? 1 : 0);
+}
+
+/* frames every write as before, copied and at most UPDATE_BUF_SIZE long */
+static int write_copied(rfbClientPtr cl, const char *buf, int len)
+{
+  char *frame;
+  int n, m;
+
+  while (len > 0) {
+    n = len > UPDATE_BUF_SIZE ? UPDATE_BUF_SIZE : len;
+    if ((m = webSocketsEncode(cl, buf, n, &frame)) < 0)
+      return -1;
+    buf += n;
+    len -= n;
+    while (m > 0) {
+      ssize_t w = write(cl->sock, frame, m);
+      if (w <= 0)
+        return -1;
+      frame += w;
+      m -= w;
+    }
+  }
+  return 1;
+}
+
+/* MB/s writing bench_mb of chunk_len writes, or -1 on failure */
+static double bench_write(size_t chunk_len, int base64, int copied)
+{
+  rfbClientRec cl;
+  ws_ctx_t *wsctx = calloc(1, sizeof(ws_ctx_t));
+  unsigned char *chunk = malloc(chunk_len);
+  uint64_t total = (uint64_t)bench_mb << 20, sent;
+  int sv[2], status, failed = 0;
+  double t;
+  size_t i;
+  pid_t pid;
+
+  for (i = 0; i < chunk_len; i++)
+    chunk[i] = i * 7 % 251;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    return -1;
+
+  pid = fork();
+  if (pid == 0) {
+    close(sv[0]);
+    frame_reader(sv[1], chunk, chunk_len, total / chunk_len * chunk_len);
+  }
+  close(sv[1]);
+
+  memset(&cl, 0, sizeof(cl));
+  cl.sock = sv[0];
+  cl.wsctx = (wsCtx *)wsctx;
+  wsctx->base64 = base64;
+  INIT_MUTEX(cl.outputMutex);
+
+  t = now();
+  for (sent = 0; sent + chunk_len <= total && !failed; sent += chunk_len)
+    if ((copied ? write_copied(&cl, (char *)chunk, chunk_len)
+                : rfbWriteExact(&cl, (char *)chunk, chunk_len)) < 0)
+      failed = 1;
+  close(sv[0]);
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    failed = 1;
+  t = now() - t;
+
+  TINI_MUTEX(cl.outputMutex);
+  free(wsctx);
+  free(chunk);
+  return failed ? -1 : sent / t / (1 << 20);
+}
+
+struct bench_input {
+  const unsigned char *data;
+  size_t len, pos;
+};
+
+static int bench_read(void *ctx, char *dst, size_t len)
+{
+  struct bench_input *in = ctx;
+
+  if (len > in->len - in->pos)
+    len = in->len - in->pos;
+  memcpy(dst, in->data + in->pos, len);
+  in->pos += len;
+  return len;
+}
+
+/* MB/s decoding masked binary frames of frame_len, or -1 if the payload came out wrong */
+static double bench_decode(size_t frame_len, int features)
+{
+  const size_t total = (size_t)64 << 20;
+  size_t frames = total / frame_len, header_len = frame_len > 65535 ? 14 : frame_len > 125 ? 8 : 6;
+  unsigned char *input = malloc(frames * (header_len + frame_len)), *p = input;
+  char *out = malloc(65536);
+  ws_ctx_t *ctx = calloc(1, sizeof(ws_ctx_t));
+  struct bench_input in = { input, frames * (header_len + frame_len), 0 };
+  size_t f, i, got = 0;
+  double t, best = 1e9;
+  int r, n, bad = 0;
+
+  for (f = 0; f < frames; f++) {
+    *p++ = 0x80 | WS_OPCODE_BINARY_FRAME;
+    if (header_len == 6)
+      *p++ = 0x80 | frame_len;
+    else if (header_len == 8) {
+      *p++ = 0x80 | 126;
+      *p++ = frame_len >> 8;
+      *p++ = frame_len;
+    } else {
+      *p++ = 0x80 | 127;
+      for (i = 0; i < 8; i++)
+        *p++ = (uint64_t)frame_len >> (56 - 8 * i);
+    }
+    for (i = 0; i < 4; i++)
+      *p++ = 0x11 * (i + 1) + f;
+    for (i = 0; i < frame_len; i++)
+      p[i] = (i % 251) ^ p[i % 4 - 4];
+    p += frame_len;
+  }
+
+  simd_set_features(features);
+  hybiDecodeCleanupComplete(ctx);
+  ctx->decode = webSocketsDecodeHybi;
+  ctx->ctxInfo.readFunc = bench_read;
+  ctx->ctxInfo.ctxPtr = &in;
+
+  /* the first round checks what comes out, the others are timed */
+  for (r = 0; r < 4; r++) {
+    in.pos = 0;
+    got = 0;
+    t = now();
+    while (in.pos < in.len || ctx->readlen > 0) {
+      n = ctx->decode(ctx, out, 65536);
+      if (n < 0 && errno != EAGAIN)
+        break;
+      if (n <= 0)
+        continue;
+      /* no read goes past the end of a frame */
+      for (i = 0; r == 0 && i < (size_t)n; i++)
+        bad |= (unsigned char)out[i] != (got % frame_len + i) % 251;
+      got += n;
+    }
+    t = now() - t;
+    if (r > 0 && t < best)
+      best = t;
+  }
+  simd_set_features(-1);
+
+  free(input);
+  free(out);
+  free(ctx);
+  return bad || got != frames * frame_len ? -1 : got / best / (1 << 20);
+}
+
+static int bench(void)
+{
+  static const size_t writes[] = { 1024, 32768, 262144, 4 << 20 };
+  static const size_t frames[] = { 100, 2048, 65536, 1 << 20 };
+  static const struct { int mask; const char *name; } levels[] = {
+    { 0, "plain C" },
+    { SIMD_SSE2, "SSE2" },
+    { SIMD_SSE2 | SIMD_AVX2, "AVX2" },
+    { SIMD_NEON, "NEON" }
+  };
+  int detected = simd_features(), failed = 0;
+  unsigned int i, l;
+  double mb;
+
+  rfbLogEnable(FALSE);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("writing %d MB to a WebSockets client over a socketpair, MB/s:\n", bench_mb);
+  printf("  write size     binary   copied   base64\n");
+  for (i = 0; i < ARRAYSIZE(writes); i++) {
+    printf("  %8lu", (unsigned long)writes[i]);
+    for (l = 0; l < 3; l++) {
+      mb = bench_write(writes[i], l == 2, l == 1);
+      failed += mb < 0;
+      printf(" %8.1f", mb);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  printf("decoding masked binary frames, MB/s:\n");
+  printf("  frame size");
+  for (l = 0; l < ARRAYSIZE(levels); l++)
+    if ((levels[l].mask & detected) == levels[l].mask)
+      printf(" %8s", levels[l].name);
+  printf("\n");
+  for (i = 0; i < ARRAYSIZE(frames); i++) {
+    printf("  %10lu", (unsigned long)frames[i]);
+    for (l = 0; l < ARRAYSIZE(levels); l++) {
+      if ((levels[l].mask & detected) != levels[l].mask)
+        continue;
+      mb = bench_decode(frames[i], levels[l].mask);
+      failed += mb < 0;
+      printf(" %8.1f", mb);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  if (failed)
+    fprintf(stderr, "%d failures\n", failed);
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
 {
   ws_ctx_t ctx;
   int retall= 0;
   int i;
   srand(RND_SEED);
+
+  if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+    if (argc > 3 && strcmp(argv[2], "-mb") == 0)
+      bench_mb = atoi(argv[3]);
+    return bench();
+  }
   
   hybiDecodeCleanupComplete(&ctx);
   ctx.decode = webSocketsDecodeHybi;